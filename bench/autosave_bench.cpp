@@ -0,0 +1,143 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file autosave_bench.cpp
+ * @date 2021-12-26
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * UI thread pause of an autosave snapshot after a region of the layer has been painted,
+ * i.e. only the time spent in AutosaveService::snapshot(), not the background write.
+ * With "synced" the tiles were already read back by a history step, as after a stroke,
+ * otherwise the snapshot reads them back itself, as in the middle of a stroke.
+ *
+ * Pixels are counted as the area of the painted region.
+ */
+
+#include <algorithm>
+#include <filesystem>
+#include "paint/autosave.h"
+#include "bench_common.h"
+
+struct Resolution
+{
+    const char* name;
+    int32_t     width;
+    int32_t     height;
+};
+
+struct Change
+{
+    const char* name;
+    int32_t     size; ///< Side of the painted square, 0 for the whole layer
+};
+
+/**
+ * @brief Noisy content, so that the written tiles don't compress to nothing.
+ */
+static void fillLayer(Paint::Layer* layer)
+{
+    Sml::Rectangle<int32_t> rect(0, 0, static_cast<int32_t>(layer->getWidth()), static_cast<int32_t>(layer->getHeight()));
+    Sml::Color*             pixels = layer->lockPixels(rect);
+
+    uint32_t state = 0x12345678;
+    for (size_t i = 0; i < layer->getWidth() * layer->getHeight(); ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        pixels[i] = (state & 0xF0F0F000) | 0xFF;
+    }
+
+    layer->unlockPixels(rect, true);
+    layer->markDirty();
+}
+
+int main()
+{
+    using Clock = std::chrono::steady_clock;
+
+    Sml::Window window(64, 64, "autosave_bench");
+    Sml::Renderer::init(&window);
+
+    std::string directory = (std::filesystem::temp_directory_path() / "autosave_bench").string();
+
+    const Resolution resolutions[] = {{"1080p", 1920, 1080}, {"4k", 3840, 2160}};
+    const Change     changes[]     = {{"dab", 64}, {"stroke", 512}, {"full", 0}};
+
+    for (const auto& resolution : resolutions)
+    {
+        for (const auto& change : changes)
+        {
+            for (bool synced : {true, false})
+            {
+                Paint::Document document(resolution.width, resolution.height);
+                Paint::Layer*   layer = document.getActiveLayer();
+
+                fillLayer(layer);
+                document.applyLayersToCanvas();
+
+                std::list<Paint::Document*> documents = {&document};
+
+                Paint::AutosaveService autosave;
+                autosave.setDirectory(directory.c_str());
+
+                /* The first autosave writes the whole document, later ones only the changes */
+                autosave.snapshot(documents);
+                autosave.flush();
+
+                int32_t width  = change.size == 0 ? resolution.width  : change.size;
+                int32_t height = change.size == 0 ? resolution.height : change.size;
+
+                double maxPause     = 0;
+                double writeSeconds = 0;
+
+                Bench::Measurement measurement;
+                while (measurement.seconds < Bench::MIN_DURATION && writeSeconds < 10 * Bench::MIN_DURATION)
+                {
+                    size_t i = measurement.iterations++;
+
+                    Sml::Rectangle<int32_t> rect(static_cast<int32_t>(i * 97 % (resolution.width  - width  + 1)),
+                                                 static_cast<int32_t>(i * 61 % (resolution.height - height + 1)),
+                                                 width, height);
+
+                    Sml::Renderer::getInstance().pushSetTarget(layer->getTexture());
+                    Sml::Renderer::getInstance().setColor(static_cast<Sml::Color>(0x20406080 + i * 0x01010100) | 0xFF);
+                    Sml::renderFilledRect(rect);
+                    Sml::Renderer::getInstance().popTarget();
+
+                    layer->markDirty(rect);
+                    document.applyLayersToCanvas();
+
+                    if (synced)
+                    {
+                        layer->snapshot();
+                    }
+
+                    Clock::time_point start = Clock::now();
+                    autosave.snapshot(documents);
+                    double pause = std::chrono::duration<double>(Clock::now() - start).count();
+
+                    measurement.seconds += pause;
+                    maxPause             = std::max(maxPause, pause);
+
+                    start = Clock::now();
+                    autosave.flush();
+                    writeSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+                }
+
+                Bench::Report("autosave").param("resolution", resolution.name)
+                                         .param("change", change.name)
+                                         .param("synced", synced ? 1 : 0)
+                                         .param("max_pause_us", maxPause * 1e6)
+                                         .param("write_ms_per_iteration", writeSeconds * 1e3 / measurement.iterations)
+                                         .param("file_kb", static_cast<int64_t>(autosave.getDiskUsage() / 1024))
+                                         .print(measurement, static_cast<double>(width) * height);
+
+                autosave.removeFiles();
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file bench_common.h
+ * @date 2021-12-24
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * Shared measurement and reporting code of the benchmarks. Every measurement is printed
+ * as a single line JSON object, so that results can be collected with `make bench` and
+ * compared between revisions.
+ */
+
+#pragma once
+
+#include <sys/resource.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+namespace Bench
+{
+    static const double MIN_DURATION = 0.5; ///< Seconds per measurement
+
+    struct Measurement
+    {
+        size_t iterations = 0;
+        double seconds    = 0;
+    };
+
+    /**
+     * @brief Runs the iteration repeatedly for at least MIN_DURATION seconds.
+     */
+    inline Measurement measure(const std::function<void(size_t)>& iteration)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        Measurement measurement;
+
+        Clock::time_point start = Clock::now();
+        while (measurement.seconds < MIN_DURATION)
+        {
+            iteration(measurement.iterations++);
+            measurement.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        }
+
+        return measurement;
+    }
+
+    /**
+     * @return Peak resident set size of the process so far in kilobytes.
+     */
+    inline long getPeakRss()
+    {
+        rusage usage = {};
+        getrusage(RUSAGE_SELF, &usage);
+
+        return usage.ru_maxrss;
+    }
+
+    /**
+     * @brief Builds the JSON line of a measurement, e.g.
+     *        Report("sharpen").param("radius", 5).print(measurement, width * height);
+     */
+    class Report
+    {
+    public:
+        explicit Report(const char* bench) { m_Line = "{\"bench\": \"" + std::string(bench) + "\""; }
+
+        Report& param(const char* name, const char* value)
+        {
+            m_Line += ", \"" + std::string(name) + "\": \"" + value + "\"";
+            return *this;
+        }
+
+        Report& param(const char* name, int32_t value) { return param(name, static_cast<int64_t>(value)); }
+        Report& param(const char* name, size_t value)  { return param(name, static_cast<int64_t>(value)); }
+
+        Report& param(const char* name, int64_t value)
+        {
+            m_Line += ", \"" + std::string(name) + "\": " + std::to_string(value);
+            return *this;
+        }
+
+        Report& param(const char* name, double value)
+        {
+            char buffer[64];
+            snprintf(buffer, sizeof(buffer), "%.6g", value);
+
+            m_Line += ", \"" + std::string(name) + "\": " + buffer;
+            return *this;
+        }
+
+        /**
+         * @param pixels Pixels processed by a single iteration.
+         */
+        void print(const Measurement& measurement, double pixels)
+        {
+            double secondsPerIteration = measurement.seconds / measurement.iterations;
+
+            param("iterations", measurement.iterations);
+            param("us_per_iteration", secondsPerIteration * 1e6);
+            param("ns_per_pixel", secondsPerIteration * 1e9 / pixels);
+            param("mpix_per_s", pixels / secondsPerIteration / 1e6);
+            param("peak_rss_kb", static_cast<int64_t>(getPeakRss()));
+
+            printf("%s}\n", m_Line.c_str());
+            fflush(stdout);
+        }
+
+    private:
+        std::string m_Line;
+    };
+};
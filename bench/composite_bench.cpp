@@ -0,0 +1,143 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file composite_bench.cpp
+ * @date 2021-12-24
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * Document::applyLayersToCanvas with different numbers of layers, both recomposing the
+ * whole canvas and a small region as during a brush stroke on the middle layer. Also the
+ * throughput of the blending kernels per blend mode.
+ */
+
+#include <vector>
+#include "paint/document.h"
+#include "paint/blend.h"
+#include "bench_common.h"
+
+static const int32_t WIDTH       = 1920;
+static const int32_t HEIGHT      = 1080;
+static const int32_t REGION_SIZE = 64;
+
+/**
+ * @brief Semi-transparent shapes, so that every layer contributes to the blending.
+ */
+static void drawShapes(Paint::Layer* layer, int32_t seed)
+{
+    Sml::Renderer& renderer = Sml::Renderer::getInstance();
+    renderer.pushSetTarget(layer->getTexture());
+
+    for (int32_t i = 0; i < 32; ++i)
+    {
+        int32_t x = (seed * 131 + i * 977) % WIDTH;
+        int32_t y = (seed * 173 + i * 601) % HEIGHT;
+
+        renderer.setColor(Sml::rgbaColor((i * 37) % 256, (seed * 59) % 256, (i * 11) % 256, 128));
+        Sml::renderFilledRect(Sml::Rectangle<int32_t>(x, y, WIDTH / 4, HEIGHT / 4));
+    }
+
+    renderer.popTarget();
+    layer->markDirty();
+}
+
+/**
+ * @brief Premultiplied rows of semi-transparent gradients, blended onto each other.
+ */
+static void benchBlendModes()
+{
+    std::vector<Sml::Color> src(static_cast<size_t>(WIDTH) * HEIGHT);
+    std::vector<Sml::Color> dst(src.size());
+
+    for (size_t i = 0; i < src.size(); ++i)
+    {
+        src[i] = Sml::rgbaColor(i % 256, (i / 7) % 256, (i / 13) % 256, 64 + i % 192);
+        dst[i] = Sml::rgbaColor((i / 3) % 256, i % 256, (i / 5) % 256, 255);
+    }
+
+    Paint::premultiplyRow(src.data(), src.data(), src.size());
+    std::vector<Sml::Color> original = dst;
+
+    for (uint32_t mode = 0; mode < static_cast<uint32_t>(Paint::BlendMode::COUNT); ++mode)
+    {
+        for (uint8_t opacity : {255, 128})
+        {
+            Bench::Measurement measurement = Bench::measure([&](size_t i)
+            {
+                if (i % 16 == 0)
+                {
+                    dst = original;
+                }
+
+                for (int32_t y = 0; y < HEIGHT; ++y)
+                {
+                    Paint::blendRow(static_cast<Paint::BlendMode>(mode), src.data() + y * WIDTH, dst.data() + y * WIDTH,
+                                    WIDTH, opacity);
+                }
+            });
+
+            Bench::Report("blend").param("mode", Paint::getBlendModeName(static_cast<Paint::BlendMode>(mode)))
+                                  .param("opacity", static_cast<int32_t>(opacity))
+                                  .param("implementation", Paint::getBlendImplementationName())
+                                  .print(measurement, static_cast<double>(WIDTH) * HEIGHT);
+        }
+    }
+}
+
+int main()
+{
+    Sml::Window window(64, 64, "composite_bench");
+    Sml::Renderer::init(&window);
+
+    benchBlendModes();
+
+    const int32_t layerCounts[] = {1, 4, 16};
+
+    for (int32_t layerCount : layerCounts)
+    {
+        Paint::Document document(WIDTH, HEIGHT);
+        drawShapes(document.getActiveLayer(), 0);
+
+        std::vector<Paint::LayerHandle> layers = {document.getActiveLayerHandle()};
+
+        for (int32_t i = 1; i < layerCount; ++i)
+        {
+            Paint::Layer* layer = new Paint::Layer(WIDTH, HEIGHT, Sml::COLOR_WHITE);
+            drawShapes(layer, i);
+
+            layers.push_back(document.addLayer(layer));
+        }
+
+        /* So that there are layers both below and above the one being drawn on */
+        document.setActiveLayer(layers[layers.size() / 2]);
+        document.applyLayersToCanvas();
+
+        Bench::Measurement full = Bench::measure([&](size_t i)
+        {
+            document.getActiveLayer()->markDirty();
+            document.applyLayersToCanvas();
+        });
+
+        Bench::Report("composite").param("case", "full")
+                                  .param("layers", layerCount)
+                                  .param("width", WIDTH)
+                                  .param("height", HEIGHT)
+                                  .print(full, static_cast<double>(WIDTH) * HEIGHT);
+
+        Bench::Measurement region = Bench::measure([&](size_t i)
+        {
+            int32_t x = static_cast<int32_t>(i * 37) % (WIDTH  - REGION_SIZE);
+            int32_t y = static_cast<int32_t>(i * 53) % (HEIGHT - REGION_SIZE);
+
+            document.getActiveLayer()->markDirty(Sml::Rectangle<int32_t>(x, y, REGION_SIZE, REGION_SIZE));
+            document.applyLayersToCanvas();
+        });
+
+        Bench::Report("composite").param("case", "region")
+                                  .param("layers", layerCount)
+                                  .param("width", WIDTH)
+                                  .param("height", HEIGHT)
+                                  .print(region, REGION_SIZE * REGION_SIZE);
+    }
+
+    return 0;
+}
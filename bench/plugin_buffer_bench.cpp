@@ -0,0 +1,89 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file plugin_buffer_bench.cpp
+ * @date 2021-12-23
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * Plugin pixel access round-trips on canvases of several sizes. Runs headless with
+ * SDL_VIDEODRIVER=dummy, see bench_common.h for the output format.
+ */
+
+#include "paint/plugin/texture_impl.h"
+#include "bench_common.h"
+
+static const int32_t REGION_SIZE = 64; ///< Region a plugin touches per Action event
+
+static void measure(const char* name, int32_t width, int32_t height, double pixels,
+                    const std::function<void(int32_t)>& roundTrip)
+{
+    Bench::Measurement measurement = Bench::measure([&](size_t i) { roundTrip(static_cast<int32_t>(i)); });
+
+    Bench::Report("plugin_buffer").param("case", name)
+                                  .param("width", width)
+                                  .param("height", height)
+                                  .print(measurement, pixels);
+}
+
+int main()
+{
+    Sml::Window window(64, 64, "plugin_buffer_bench");
+    Sml::Renderer::init(&window);
+
+    const int32_t sizes[][2] = {{640, 360}, {1920, 1080}, {3840, 2160}};
+
+    for (const auto& size : sizes)
+    {
+        int32_t width  = size[0];
+        int32_t height = size[1];
+
+        Paint::Layer        layer(width, height);
+        plugin::TextureImpl texture(layer.getTexture(), &layer);
+
+        /* What ReadBuffer/LoadBuffer used to cost: a full read back and a full upload */
+        measure("copy_per_call", width, height, width * height, [&](int32_t i)
+        {
+            Sml::Color* pixels = layer.getTexture()->readPixels(nullptr);
+            pixels[(i * 7919) % (width * height)] = Sml::COLOR_BLACK;
+            layer.getTexture()->updatePixels(pixels, nullptr);
+            layer.markDirty();
+            delete[] pixels;
+        });
+
+        measure("read_load_buffer", width, height, width * height, [&](int32_t i)
+        {
+            plugin::Buffer buffer = texture.ReadBuffer();
+            buffer.pixels[(i * 7919) % (width * height)] = Sml::COLOR_BLACK;
+            texture.LoadBuffer(buffer);
+            texture.ReleaseBuffer(buffer);
+        });
+
+        measure("lock_unlock_region", width, height, REGION_SIZE * REGION_SIZE, [&](int32_t i)
+        {
+            int32_t x = (i * 37) % (width  - REGION_SIZE);
+            int32_t y = (i * 53) % (height - REGION_SIZE);
+
+            plugin::BufferRegion region = texture.LockBuffer(x, y, REGION_SIZE, REGION_SIZE);
+            for (int32_t row = 0; row < region.size_y; ++row)
+            {
+                region.pixels[row * region.stride + row] = Sml::COLOR_BLACK;
+            }
+
+            texture.UnlockBuffer(region, true);
+        });
+
+        /* A plugin reading pixels right after the editor's own tools drew on the layer */
+        measure("lock_region_after_draw", width, height, REGION_SIZE * REGION_SIZE, [&](int32_t i)
+        {
+            int32_t x = (i * 37) % (width  - REGION_SIZE);
+            int32_t y = (i * 53) % (height - REGION_SIZE);
+
+            texture.DrawLine({x, y, x + REGION_SIZE / 2, y + REGION_SIZE / 2, 3, Sml::COLOR_BLACK});
+
+            plugin::BufferRegion region = texture.LockBuffer(x, y, REGION_SIZE, REGION_SIZE);
+            texture.UnlockBuffer(region, false);
+        });
+    }
+
+    return 0;
+}
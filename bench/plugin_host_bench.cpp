@@ -0,0 +1,110 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file plugin_host_bench.cpp
+ * @date 2021-12-28
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * Cost of a stroke of a plugin tool run in the editor's process and in the PluginHost,
+ * including getting the drawn pixels to the layer. Uses bench/plugins/bench_plugin.cpp,
+ * built by `make bench`.
+ *
+ * Pixels are counted as the events of the stroke, i.e. ns_per_pixel is ns per event.
+ */
+
+#include "paint/plugin/plugin_host.h"
+#include "paint/plugin/api_impl.h"
+#include "bench_common.h"
+
+static const char* const PLUGIN_FILENAME = "bin/bench/bench_plugin.so";
+static const int32_t     STROKE_EVENTS   = 64;
+
+static Sml::Vec2i getEventPos(size_t stroke, int32_t event)
+{
+    return {static_cast<int32_t>(100 + (stroke * 53) % 1500 + event * 4),
+            static_cast<int32_t>(100 + (stroke * 97) % 800  + event * 2)};
+}
+
+static void report(const char* mode, const char* tool, const Bench::Measurement& measurement)
+{
+    Bench::Report("plugin_host").param("mode", mode)
+                                .param("tool", tool)
+                                .param("events", STROKE_EVENTS)
+                                .print(measurement, STROKE_EVENTS);
+}
+
+int main(int argc, const char* argv[])
+{
+    /* The bench itself is started as the host */
+    if (Paint::PluginHost::isServer(argc, argv))
+    {
+        return Paint::PluginHost::runServer(argc, argv);
+    }
+
+    Sml::Window window(64, 64, "plugin_host_bench");
+    Sml::Renderer::init(&window);
+
+    plugin::APIImpl      api;
+    Paint::PluginLibrary library(PLUGIN_FILENAME, &api);
+    plugin::IPlugin*     plugin = library.getPlugin();
+
+    Paint::PluginHost                  host;
+    int32_t                            remoteLibrary = -1;
+    uint32_t                           version       = 0;
+    std::vector<Paint::PluginToolInfo> tools;
+
+    if (plugin == nullptr || !host.loadLibrary(PLUGIN_FILENAME, &remoteLibrary, &version, &tools))
+    {
+        fprintf(stderr, "plugin_host_bench: couldn't load '%s'\n", PLUGIN_FILENAME);
+        return 1;
+    }
+
+    Paint::Layer layer(1920, 1080);
+
+    for (int32_t tool = 0; tool < static_cast<int32_t>(tools.size()); ++tool)
+    {
+        plugin::ITool* localTool = plugin->GetTools().tools[tool];
+
+        Bench::Measurement local = Bench::measure([&](size_t stroke)
+        {
+            plugin::TextureImpl texture(layer.getTexture(), &layer);
+
+            localTool->ActionBegin(&texture, getEventPos(stroke, 0).x, getEventPos(stroke, 0).y);
+            for (int32_t event = 1; event < STROKE_EVENTS - 1; ++event)
+            {
+                Sml::Vec2i pos = getEventPos(stroke, event);
+                localTool->Action(&texture, pos.x, pos.y, 4, 2);
+                texture.Present();
+            }
+
+            Sml::Vec2i end = getEventPos(stroke, STROKE_EVENTS - 1);
+            localTool->ActionEnd(&texture, end.x, end.y);
+        });
+
+        report("in_process", tools[tool].name.c_str(), local);
+
+        /* Not pipelined waits after every event, as if each one was drawn in its own frame */
+        for (bool pipelined : {false, true})
+        {
+            Bench::Measurement remote = Bench::measure([&](size_t stroke)
+            {
+                host.beginAction(&layer, remoteLibrary, tool, getEventPos(stroke, 0));
+                for (int32_t event = 1; event < STROKE_EVENTS - 1; ++event)
+                {
+                    host.postAction(getEventPos(stroke, event), {4, 2});
+
+                    if (!pipelined)
+                    {
+                        host.wait();
+                    }
+                }
+
+                host.endAction(getEventPos(stroke, STROKE_EVENTS - 1));
+            });
+
+            report(pipelined ? "host_pipelined" : "host", tools[tool].name.c_str(), remote);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file plugin_profiler_bench.cpp
+ * @date 2021-12-29
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * Overhead of PluginProfiler on in-process plugin strokes, timed the same way PluginTool
+ * and TextureImpl do. Uses bench/plugins/bench_plugin.cpp, built by `make bench`.
+ *
+ * Pixels are counted as the events of the stroke, i.e. ns_per_pixel is ns per event.
+ */
+
+#include "paint/plugin/plugin_manager.h"
+#include "paint/plugin/plugin_profiler.h"
+#include "paint/plugin/api_impl.h"
+#include "bench_common.h"
+
+static const char* const PLUGIN_FILENAME = "bin/bench/bench_plugin.so";
+static const int32_t     STROKE_EVENTS   = 64;
+
+int main()
+{
+    Sml::Window window(64, 64, "plugin_profiler_bench");
+    Sml::Renderer::init(&window);
+
+    plugin::APIImpl      api;
+    Paint::PluginLibrary library(PLUGIN_FILENAME, &api);
+    plugin::IPlugin*     plugin = library.getPlugin();
+
+    if (plugin == nullptr)
+    {
+        fprintf(stderr, "plugin_profiler_bench: couldn't load '%s'\n", PLUGIN_FILENAME);
+        return 1;
+    }
+
+    Paint::PluginProfiler& profiler = Paint::PluginProfiler::getInstance();
+    uint32_t               id       = profiler.registerPlugin("bench_plugin.so");
+
+    Paint::Layer  layer(1920, 1080);
+    plugin::Tools tools = plugin->GetTools();
+
+    for (uint32_t tool = 0; tool < tools.count; ++tool)
+    {
+        double disabledSeconds = 0;
+
+        for (bool enabled : {false, true})
+        {
+            profiler.setEnabled(enabled);
+
+            Bench::Measurement measurement = Bench::measure([&](size_t stroke)
+            {
+                plugin::TextureImpl texture(layer.getTexture(), &layer);
+
+                int32_t x = static_cast<int32_t>(100 + (stroke * 53) % 1500);
+                int32_t y = static_cast<int32_t>(100 + (stroke * 97) % 800);
+
+                {
+                    Paint::PluginProfiler::Scope scope(id, Paint::PluginCall::ACTION_BEGIN);
+                    tools.tools[tool]->ActionBegin(&texture, x, y);
+                }
+
+                for (int32_t event = 1; event < STROKE_EVENTS - 1; ++event)
+                {
+                    Paint::PluginProfiler::Scope scope(id, Paint::PluginCall::ACTION);
+                    tools.tools[tool]->Action(&texture, x + event * 4, y + event * 2, 4, 2);
+                    texture.Present();
+                }
+
+                Paint::PluginProfiler::Scope scope(id, Paint::PluginCall::ACTION_END);
+                tools.tools[tool]->ActionEnd(&texture, x + STROKE_EVENTS * 4, y + STROKE_EVENTS * 2);
+            });
+
+            double seconds = measurement.seconds / measurement.iterations;
+            if (!enabled)
+            {
+                disabledSeconds = seconds;
+            }
+
+            Bench::Report("plugin_profiler").param("tool", tools.tools[tool]->GetName())
+                                            .param("profiling", enabled ? 1 : 0)
+                                            .param("overhead_pct", (seconds / disabledSeconds - 1) * 100)
+                                            .print(measurement, STROKE_EVENTS);
+        }
+    }
+
+    return 0;
+}
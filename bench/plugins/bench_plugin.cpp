@@ -0,0 +1,93 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file bench_plugin.cpp
+ * @date 2021-12-28
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * Minimal plugin for plugin_host_bench, built as a shared library against the plugin API
+ * headers only. "shapes" draws with primitives, "buffer" edits pixels directly.
+ */
+
+#include <dlfcn.h>
+#include "plugin_api.h"
+#include "plugin_api_ext.h"
+
+namespace
+{
+    const int32_t BRUSH_RADIUS = 8;
+    const int32_t REGION_SIZE  = 32;
+
+    class ShapesTool : public plugin::ITool
+    {
+    public:
+        virtual void ActionBegin(plugin::ITexture* canvas, int x, int y) override
+        {
+            canvas->DrawCircle({x, y, BRUSH_RADIUS, 0, 0x204080FF, 0});
+        }
+
+        virtual void Action(plugin::ITexture* canvas, int x, int y, int dx, int dy) override
+        {
+            canvas->DrawLine({x - dx, y - dy, x, y, 2 * BRUSH_RADIUS, 0x204080FF});
+            canvas->DrawCircle({x, y, BRUSH_RADIUS, 2, 0x20408080, 0x000000FF});
+        }
+
+        virtual void ActionEnd(plugin::ITexture*, int, int) override {}
+
+        virtual const char* GetIconFileName() const override { return ""; }
+        virtual const char* GetName() const override { return "shapes"; }
+        virtual plugin::IPreferencesPanel* GetPreferencesPanel() override { return nullptr; }
+    };
+
+    class BufferTool : public plugin::ITool
+    {
+    public:
+        virtual void ActionBegin(plugin::ITexture* canvas, int x, int y) override { invert(canvas, x, y); }
+        virtual void Action(plugin::ITexture* canvas, int x, int y, int, int) override { invert(canvas, x, y); }
+        virtual void ActionEnd(plugin::ITexture*, int, int) override {}
+
+        virtual const char* GetIconFileName() const override { return ""; }
+        virtual const char* GetName() const override { return "buffer"; }
+        virtual plugin::IPreferencesPanel* GetPreferencesPanel() override { return nullptr; }
+
+    private:
+        static void invert(plugin::ITexture* canvas, int x, int y)
+        {
+            auto getExt = reinterpret_cast<plugin::GetTextureExtFunction>(dlsym(RTLD_DEFAULT, "GetTextureExt"));
+            plugin::ITextureExt* ext = getExt != nullptr ? getExt(canvas, plugin::kTextureExtVersion) : nullptr;
+
+            if (ext == nullptr)
+            {
+                return;
+            }
+
+            plugin::BufferRegion region = ext->LockBuffer(x - REGION_SIZE / 2, y - REGION_SIZE / 2, REGION_SIZE, REGION_SIZE);
+
+            for (int32_t row = 0; row < region.size_y; ++row)
+            {
+                for (int32_t column = 0; column < region.size_x; ++column)
+                {
+                    region.pixels[row * region.stride + column] ^= 0xFFFFFF00;
+                }
+            }
+
+            ext->UnlockBuffer(region, true);
+        }
+    };
+
+    class BenchPlugin : public plugin::IPlugin
+    {
+    public:
+        virtual plugin::Filters GetFilters() const override { return {nullptr, 0}; }
+        virtual plugin::Tools GetTools() const override { return {const_cast<plugin::ITool**>(m_Tools), 2}; }
+
+    private:
+        ShapesTool     m_Shapes;
+        BufferTool     m_Buffer;
+        plugin::ITool* m_Tools[2] = {&m_Shapes, &m_Buffer};
+    };
+}
+
+extern "C" plugin::IPlugin* Create(plugin::IAPI*) { return new BenchPlugin(); }
+extern "C" void Destroy(plugin::IPlugin* plugin) { delete plugin; }
+extern "C" uint32_t Version() { return plugin::kVersion; }
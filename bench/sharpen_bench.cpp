@@ -0,0 +1,73 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file sharpen_bench.cpp
+ * @date 2021-12-24
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * SharpenFilter::apply at several blur radii on a noisy layer.
+ */
+
+#include <random>
+#include <vector>
+#include "paint/basic_filters.h"
+#include "paint/thread_pool.h"
+#include "bench_common.h"
+
+static void fillWithNoise(Paint::Layer* layer)
+{
+    std::mt19937 random(42);
+    std::vector<Sml::Color> pixels(layer->getWidth() * layer->getHeight());
+
+    for (auto& pixel : pixels)
+    {
+        pixel = static_cast<Sml::Color>(random()) | 0xFF;
+    }
+
+    layer->getTexture()->updatePixels(pixels.data(), nullptr);
+    layer->markDirty();
+}
+
+int main()
+{
+    Sml::Window window(64, 64, "sharpen_bench");
+    Sml::Renderer::init(&window);
+
+    const int32_t sizes[][2] = {{1920, 1080}, {3840, 2160}};
+    const int32_t radii[]    = {1, 3, 5, 10, 25};
+
+    for (const auto& size : sizes)
+    {
+        int32_t width  = size[0];
+        int32_t height = size[1];
+
+        Paint::Layer layer(width, height);
+        fillWithNoise(&layer);
+
+        Paint::SharpenFilter filter;
+        filter.init(&layer);
+
+        for (int32_t radius : radii)
+        {
+            filter.setBlurRadius(radius);
+
+            Bench::Measurement measurement = Bench::measure([&](size_t i)
+            {
+                Sml::Renderer::getInstance().pushSetTarget(layer.getTexture());
+                filter.apply();
+                Sml::Renderer::getInstance().popTarget();
+
+                layer.markDirty();
+            });
+
+            Bench::Report("sharpen").param("radius", radius)
+                                    .param("width", width)
+                                    .param("height", height)
+                                    .param("threads", Paint::ThreadPool::getInstance().getThreadCount())
+                                    .param("simd", Paint::getBlurImplementationName())
+                                    .print(measurement, static_cast<double>(width) * height);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,216 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file stroke_bench.cpp
+ * @date 2021-12-24
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * Brush and Eraser strokes replayed from pointer paths, including the history step that
+ * the canvas records for every stroke. Besides the built-in paths, a recorded one can be
+ * passed as a file of "x y" lines: stroke_bench.out path.txt
+ *
+ * Every stroke is replayed on a full HD and a 4K document, as the history step's size
+ * grows with the number of tiles the stroke touches.
+ *
+ * Pixels are counted as the area swept by the tip, i.e. path length times diameter.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "paint/basic_tools.h"
+#include "paint/paint_editor.h"
+#include "bench_common.h"
+
+static const size_t  EVENTS_PER_FRAME = 2;    ///< 125 Hz mouse at 60 frames per second
+static const int32_t BASE_WIDTH       = 1920; ///< Size the built-in paths are laid out for
+static const int32_t BASE_HEIGHT      = 1080;
+
+struct Resolution
+{
+    int32_t width;
+    int32_t height;
+};
+
+static const Resolution RESOLUTIONS[] = {{1920, 1080}, {3840, 2160}};
+
+struct Path
+{
+    const char*             name;
+    std::vector<Sml::Vec2i> points;
+};
+
+/**
+ * @brief Looping curve drawn with varying speed, like quick sketching.
+ */
+static Path createScribble(const Resolution& resolution)
+{
+    Path path = {"scribble", {}};
+
+    float t = 0;
+    for (int32_t i = 0; i < 1000; ++i)
+    {
+        t += 0.004f + 0.003f * std::sin(i * 0.05f);
+
+        path.points.push_back({static_cast<int32_t>(resolution.width  / 2 + resolution.width  * 0.4f * std::sin(3 * t)),
+                               static_cast<int32_t>(resolution.height / 2 + resolution.height * 0.4f * std::sin(2 * t + 0.5f))});
+    }
+
+    return path;
+}
+
+/**
+ * @brief Fast back and forth strokes, far apart events.
+ */
+static Path createHatching(const Resolution& resolution)
+{
+    Path path = {"hatching", {}};
+
+    for (int32_t line = 0; line < 40; ++line)
+    {
+        for (int32_t i = 0; i <= 10; ++i)
+        {
+            int32_t x = (line % 2 == 0) ? 100 + i * 170 : 1800 - i * 170;
+            int32_t y = 100 + line * 22 + i * 2;
+
+            path.points.push_back({x * resolution.width / BASE_WIDTH, y * resolution.height / BASE_HEIGHT});
+        }
+    }
+
+    return path;
+}
+
+static bool loadPath(const char* filename, Path* path)
+{
+    FILE* file = fopen(filename, "r");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    path->name = filename;
+
+    Sml::Vec2i point = {0, 0};
+    while (fscanf(file, "%d %d", &point.x, &point.y) == 2)
+    {
+        path->points.push_back(point);
+    }
+
+    fclose(file);
+    return !path->points.empty();
+}
+
+static double computeLength(const Path& path)
+{
+    double length = 0;
+
+    for (size_t i = 1; i < path.points.size(); ++i)
+    {
+        length += std::hypot(path.points[i].x - path.points[i - 1].x, path.points[i].y - path.points[i - 1].y);
+    }
+
+    return length;
+}
+
+/**
+ * @brief Replays the path the way DocumentView does, compositing once per frame.
+ */
+static void replay(Paint::Tool* tool, const Path& path, Paint::History* history, Paint::Document* document)
+{
+    history->beginStep(document->getActiveLayer());
+
+    tool->onActionStart(path.points[0]);
+
+    for (size_t i = 1; i < path.points.size(); ++i)
+    {
+        tool->onAction(path.points[i], path.points[i] - path.points[i - 1]);
+
+        if (i % EVENTS_PER_FRAME == 0)
+        {
+            tool->onUpdate();
+            document->applyLayersToCanvas();
+        }
+    }
+
+    tool->onActionEnd(path.points.back());
+    document->applyLayersToCanvas();
+
+    history->endStep();
+}
+
+int main(int argc, const char* argv[])
+{
+    Sml::Window window(64, 64, "stroke_bench");
+    Sml::Renderer::init(&window);
+
+    Paint::Editor::init();
+    Paint::Editor& editor = Paint::Editor::getInstance();
+
+    Path recorded = {nullptr, {}};
+
+    if (argc > 1 && !loadPath(argv[1], &recorded))
+    {
+        fprintf(stderr, "Couldn't read the path from '%s'\n", argv[1]);
+        return 1;
+    }
+
+    Paint::Brush  brush;
+    Paint::Eraser eraser;
+    Paint::Tool*  tools[] = {&brush, &eraser};
+
+    const int32_t diameters[] = {4, 16, 64};
+
+    for (const Resolution& resolution : RESOLUTIONS)
+    {
+        Paint::Document* document = new Paint::Document(resolution.width, resolution.height);
+        editor.addDocument(document);
+        editor.setActiveDocument(document);
+
+        /* Something for the eraser to erase */
+        Sml::Renderer::getInstance().pushSetTarget(document->getActiveLayer()->getTexture());
+        Sml::Renderer::getInstance().setColor(Sml::COLOR_WHITE);
+        Sml::renderFilledRect(Sml::Rectangle<int32_t>(0, 0, resolution.width, resolution.height));
+        Sml::Renderer::getInstance().popTarget();
+        document->getActiveLayer()->markDirty();
+
+        std::vector<Path> paths = {createScribble(resolution), createHatching(resolution)};
+
+        if (recorded.name != nullptr)
+        {
+            paths.push_back(recorded);
+        }
+
+        for (const auto& path : paths)
+        {
+            double length = computeLength(path);
+
+            for (Paint::Tool* tool : tools)
+            {
+                for (int32_t diameter : diameters)
+                {
+                    brush.setThickness(diameter);
+                    eraser.setThickness(diameter);
+
+                    Paint::History history;
+
+                    Bench::Measurement measurement = Bench::measure([&](size_t i)
+                    {
+                        replay(tool, path, &history, document);
+                    });
+
+                    Bench::Report("stroke").param("tool", tool->getName())
+                                           .param("path", path.name)
+                                           .param("width", resolution.width)
+                                           .param("height", resolution.height)
+                                           .param("diameter", diameter)
+                                           .param("events", path.points.size())
+                                           .param("history_kb_per_step", history.getMemoryUsage() / 1024.0 /
+                                                                         std::max(history.getStepCount(), size_t(1)))
+                                           .print(measurement, std::max(length * diameter, 1.0));
+                }
+            }
+        }
+    }
+
+    return 0;
+}
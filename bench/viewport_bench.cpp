@@ -0,0 +1,133 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file viewport_bench.cpp
+ * @date 2022-01-03
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * Composing what a Canvas shows of a large document: the whole document zoomed out, both
+ * rebuilding the mip levels from scratch and after a brush stroke, and the tiles exposed
+ * by panning at full size.
+ */
+
+#include <vector>
+#include "paint/document.h"
+#include "bench_common.h"
+
+static const int32_t WIDTH       = 8192;
+static const int32_t HEIGHT      = 8192;
+static const int32_t VIEW_WIDTH  = 1280;
+static const int32_t VIEW_HEIGHT = 720;
+static const int32_t REGION_SIZE = 64;
+static const size_t  LAYER_COUNT = 2;
+
+static void drawShapes(Paint::Layer* layer, int32_t seed)
+{
+    Sml::Renderer& renderer = Sml::Renderer::getInstance();
+    renderer.pushSetTarget(layer->getTexture());
+
+    for (int32_t i = 0; i < 64; ++i)
+    {
+        int32_t x = (seed * 131 + i * 977) % WIDTH;
+        int32_t y = (seed * 173 + i * 601) % HEIGHT;
+
+        renderer.setColor(Sml::rgbaColor((i * 37) % 256, (seed * 59) % 256, (i * 11) % 256, 128));
+        Sml::renderFilledRect(Sml::Rectangle<int32_t>(x, y, WIDTH / 8, HEIGHT / 8));
+    }
+
+    renderer.popTarget();
+    layer->markDirty();
+}
+
+/**
+ * @brief The finest level the whole document fits the view at, as Canvas picks it.
+ */
+static size_t computeOverviewLevel()
+{
+    size_t level = 0;
+    while (Paint::MipPyramid::getLevelSize(WIDTH,  level) > VIEW_WIDTH ||
+           Paint::MipPyramid::getLevelSize(HEIGHT, level) > VIEW_HEIGHT)
+    {
+        ++level;
+    }
+
+    return level;
+}
+
+int main()
+{
+    Sml::Window window(64, 64, "viewport_bench");
+    Sml::Renderer::init(&window);
+
+    Paint::Document document(WIDTH, HEIGHT);
+    drawShapes(document.getActiveLayer(), 0);
+
+    for (size_t i = 1; i < LAYER_COUNT; ++i)
+    {
+        Paint::Layer* layer = new Paint::Layer(WIDTH, HEIGHT, Sml::COLOR_WHITE);
+        drawShapes(layer, static_cast<int32_t>(i));
+
+        document.addLayer(layer);
+    }
+
+    size_t                  level = computeOverviewLevel();
+    Sml::Rectangle<int32_t> overview(0, 0, static_cast<int32_t>(Paint::MipPyramid::getLevelSize(WIDTH,  level)),
+                                           static_cast<int32_t>(Paint::MipPyramid::getLevelSize(HEIGHT, level)));
+
+    std::vector<Sml::Color> pixels(static_cast<size_t>(VIEW_WIDTH) * VIEW_HEIGHT);
+
+    document.update();
+    document.compose(overview, pixels.data(), level);
+
+    Bench::Measurement rebuild = Bench::measure([&](size_t i)
+    {
+        for (size_t layer = 0; layer < document.getLayers().getSize(); ++layer)
+        {
+            document.getLayers().getLayer(layer)->markDirty();
+        }
+
+        document.update();
+        document.compose(overview, pixels.data(), level);
+    });
+
+    Bench::Report("viewport").param("case", "overview_rebuild")
+                             .param("level", level)
+                             .param("width", WIDTH)
+                             .param("height", HEIGHT)
+                             .print(rebuild, static_cast<double>(WIDTH) * HEIGHT);
+
+    Bench::Measurement stroke = Bench::measure([&](size_t i)
+    {
+        int32_t x = static_cast<int32_t>(i * 379) % (WIDTH  - REGION_SIZE);
+        int32_t y = static_cast<int32_t>(i * 571) % (HEIGHT - REGION_SIZE);
+
+        Sml::Rectangle<int32_t> region(x, y, REGION_SIZE, REGION_SIZE);
+        Sml::Rectangle<int32_t> levelRegion = Paint::MipPyramid::getLevelRect(region, level);
+
+        document.getActiveLayer()->markDirty(region);
+        document.update();
+        document.compose(levelRegion, pixels.data(), level);
+    });
+
+    Bench::Report("viewport").param("case", "overview_stroke")
+                             .param("level", level)
+                             .param("width", WIDTH)
+                             .param("height", HEIGHT)
+                             .print(stroke, REGION_SIZE * REGION_SIZE);
+
+    /* Panning right at full size exposes a column of tiles every Tile::SIZE pixels */
+    Bench::Measurement pan = Bench::measure([&](size_t i)
+    {
+        int32_t x = static_cast<int32_t>(VIEW_WIDTH + i * Paint::Tile::SIZE) % (WIDTH - Paint::Tile::SIZE);
+
+        document.compose(Sml::Rectangle<int32_t>(x, 0, Paint::Tile::SIZE, VIEW_HEIGHT), pixels.data());
+    });
+
+    Bench::Report("viewport").param("case", "pan")
+                             .param("level", static_cast<size_t>(0))
+                             .param("width", WIDTH)
+                             .param("height", HEIGHT)
+                             .print(pan, Paint::Tile::SIZE * VIEW_HEIGHT);
+
+    return 0;
+}
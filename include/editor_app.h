@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <cstring>
 #include "sml/graphics_wrapper/renderer.h"
 #include "sml/events/system_event_manager.h"
 #include "sml/app/app.h"
@@ -18,22 +19,49 @@
 #include "resource_manager.h"
 #include "inner_window.h"
 #include "paint/paint_editor.h"
+#include "paint/frame_profiler.h"
 #include "paint/basic_tools.h"
+#include "paint/plugin/plugin_manager.h"
+#include "paint/plugin/plugin_host.h"
 #include "paint/gui/tool_panel.h"
 #include "paint/gui/document_view.h"
 #include "paint/gui/preferences_panel.h"
+#include "paint/gui/plugin_stats_view.h"
 
 constexpr size_t      EDITOR_WINDOW_WIDTH            = 1280;
 constexpr size_t      EDITOR_WINDOW_HEIGHT           = 720;
 constexpr const char* EDITOR_WINDOW_TITLE            = "Simple 3d Editor";
 constexpr size_t      EDITOR_MAX_WINDOW_TITLE_LENGTH = 64;
+constexpr const char* EDITOR_PLUGINS_DIRECTORY       = "res/plugins";
+
+/* Runs plugins in a separate process, see Paint::PluginHost */
+constexpr const char* EDITOR_ISOLATE_PLUGINS_OPTION  = "--isolate-plugins";
+
+/* Writes the plugin profiler's counters to EDITOR_PLUGIN_STATS_FILENAME on quit */
+constexpr const char* EDITOR_PLUGIN_STATS_OPTION     = "--plugin-stats";
+constexpr const char* EDITOR_PLUGIN_STATS_FILENAME   = "plugin_stats.jsonl";
+
+/* View->Save frame trace writes the zones of the last seconds, see Paint::FrameProfiler */
+constexpr const char* EDITOR_TRACE_FILENAME          = "trace.json";
+constexpr double      EDITOR_TRACE_SECONDS           = 10;
+
+/* How long to block waiting for events when nothing has to be redrawn, in milliseconds */
+constexpr int32_t     EDITOR_IDLE_WAIT_TIMEOUT       = 500;
+constexpr int32_t     EDITOR_BUSY_WAIT_TIMEOUT       = 8;   ///< While background work is in progress
 
 class EditorApplication : public Sml::Application
 {
 public:
     EditorApplication(int32_t argc, const char* argv[])
         : Application(argc, argv),
-          m_Window(EDITOR_WINDOW_WIDTH, EDITOR_WINDOW_HEIGHT, EDITOR_WINDOW_TITLE) {}
+          m_Window(EDITOR_WINDOW_WIDTH, EDITOR_WINDOW_HEIGHT, EDITOR_WINDOW_TITLE)
+    {
+        for (int32_t i = 1; i < argc; ++i)
+        {
+            m_IsolatePlugins  |= strcmp(argv[i], EDITOR_ISOLATE_PLUGINS_OPTION) == 0;
+            m_DumpPluginStats |= strcmp(argv[i], EDITOR_PLUGIN_STATS_OPTION) == 0;
+        }
+    }
 
     virtual void onInit() override;
     virtual int onQuit() override;
@@ -52,6 +80,13 @@ private:
     Paint::ToolPanel*        m_ToolPanel;
 
     Paint::PreferencesPanel* m_PreferencesPanel;
+    Paint::PluginStatsView*  m_PluginStatsView;
+    InnerWindow*             m_PluginStatsWindow;
+
+    Paint::PluginManager*    m_PluginManager;
+    Paint::PluginHost*       m_PluginHost      = nullptr;
+    bool                     m_IsolatePlugins  = false;
+    bool                     m_DumpPluginStats = false;
 
     void initSystem();
 
@@ -61,10 +96,13 @@ private:
     void initView();
     void initMenuBar();
     void initToolsFiltersMenus(Sgl::Menu* toolsMenu, Sgl::Menu* filtersMenu);
+    void initViewMenu(Sgl::Menu* viewMenu);
     void initToolPanel();
     void initPreferencesPanel();
+    void recoverAutosaves();
 
-    void proccessSystemEvents();
+    void waitForEvents();
+    bool proccessSystemEvents(); ///< @return Whether any events that can change the scene arrived
     void proccessWindowEvent(Sml::WindowEvent* event);
     void proccessInputEvent(Sml::Event* event);
 
@@ -0,0 +1,158 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file async_logger.h
+ * @date 2021-12-30
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#define PAINT_LOG_LEVEL_TRACE   0
+#define PAINT_LOG_LEVEL_INFO    1
+#define PAINT_LOG_LEVEL_WARNING 2
+#define PAINT_LOG_LEVEL_ERROR   3
+#define PAINT_LOG_LEVEL_OFF     4
+
+/* Levels below it compile to nothing, arguments included */
+#ifndef PAINT_LOG_LEVEL
+#define PAINT_LOG_LEVEL PAINT_LOG_LEVEL_INFO
+#endif
+
+#define PAINT_LOG(level, ...) Paint::AsyncLogger::getInstance().log(level, __VA_ARGS__)
+
+/* At most one message per intervalMs from the call site, the suppressed ones are counted */
+#define PAINT_LOG_EVERY(intervalMs, level, ...)                                                  \
+    do                                                                                           \
+    {                                                                                            \
+        static Paint::AsyncLogger::RateLimit paintLogRateLimit(intervalMs);                      \
+        Paint::AsyncLogger::getInstance().logRateLimited(paintLogRateLimit, level, __VA_ARGS__); \
+    } while (0)
+
+#if PAINT_LOG_LEVEL <= PAINT_LOG_LEVEL_TRACE
+#define PAINT_LOG_TRACE(...)                    PAINT_LOG(Paint::LogLevel::TRACE, __VA_ARGS__)
+#define PAINT_LOG_TRACE_EVERY(intervalMs, ...)  PAINT_LOG_EVERY(intervalMs, Paint::LogLevel::TRACE, __VA_ARGS__)
+#else
+#define PAINT_LOG_TRACE(...)                    ((void)0)
+#define PAINT_LOG_TRACE_EVERY(intervalMs, ...)  ((void)0)
+#endif
+
+#if PAINT_LOG_LEVEL <= PAINT_LOG_LEVEL_INFO
+#define PAINT_LOG_INFO(...)                     PAINT_LOG(Paint::LogLevel::INFO, __VA_ARGS__)
+#define PAINT_LOG_INFO_EVERY(intervalMs, ...)   PAINT_LOG_EVERY(intervalMs, Paint::LogLevel::INFO, __VA_ARGS__)
+#else
+#define PAINT_LOG_INFO(...)                     ((void)0)
+#define PAINT_LOG_INFO_EVERY(intervalMs, ...)   ((void)0)
+#endif
+
+#if PAINT_LOG_LEVEL <= PAINT_LOG_LEVEL_WARNING
+#define PAINT_LOG_WARNING(...)                  PAINT_LOG(Paint::LogLevel::WARNING, __VA_ARGS__)
+#else
+#define PAINT_LOG_WARNING(...)                  ((void)0)
+#endif
+
+#if PAINT_LOG_LEVEL <= PAINT_LOG_LEVEL_ERROR
+#define PAINT_LOG_ERROR(...)                    PAINT_LOG(Paint::LogLevel::ERROR, __VA_ARGS__)
+#else
+#define PAINT_LOG_ERROR(...)                    ((void)0)
+#endif
+
+namespace Paint
+{
+    enum class LogLevel : uint32_t
+    {
+        TRACE   = PAINT_LOG_LEVEL_TRACE,
+        INFO    = PAINT_LOG_LEVEL_INFO,
+        WARNING = PAINT_LOG_LEVEL_WARNING,
+        ERROR   = PAINT_LOG_LEVEL_ERROR
+    };
+
+    /**
+     * @brief Logger for the editor's own messages that never blocks the calling thread on I/O.
+     *
+     * Callers format straight into a slot of a bounded lock-free ring (claimed with a single
+     * compare-and-swap), a background thread writes the ring out in batches. Messages that
+     * don't fit into a full ring are dropped and counted.
+     */
+    class AsyncLogger
+    {
+    public:
+        static const size_t   CAPACITY;       ///< Messages in the ring, a power of two
+        static const size_t   MESSAGE_LENGTH; ///< Longer messages are truncated
+        static const uint32_t WRITE_PERIOD;   ///< How long pending messages are batched, in milliseconds
+        static const uint32_t EVENT_INTERVAL; ///< Rate limit of per-event call sites, in milliseconds
+
+        class RateLimit
+        {
+        public:
+            explicit RateLimit(uint32_t intervalMs);
+
+            /**
+             * @brief Whether the message can be logged now, if so sets suppressed to the number
+             *        of messages rejected since the last one.
+             */
+            bool pass(uint64_t* suppressed);
+
+        private:
+            uint64_t              m_IntervalNs = 0;
+            std::atomic<uint64_t> m_NextNs{0};
+            std::atomic<uint64_t> m_Suppressed{0};
+        };
+
+        static AsyncLogger& getInstance();
+
+    public:
+        explicit AsyncLogger(FILE* output = stderr);
+        ~AsyncLogger(); ///< Writes out the remaining messages
+
+        AsyncLogger(const AsyncLogger& other) = delete;
+        AsyncLogger& operator=(const AsyncLogger& other) = delete;
+
+        void log(LogLevel level, const char* format, ...) __attribute__((format(printf, 3, 4)));
+        void logRateLimited(RateLimit& rateLimit, LogLevel level, const char* format, ...)
+            __attribute__((format(printf, 4, 5)));
+
+        /**
+         * @brief Blocks until everything logged so far is written.
+         */
+        void flush();
+
+    private:
+        struct Slot
+        {
+            std::atomic<uint64_t>   sequence{0}; ///< Position it's free for, position + 1 once written
+            LogLevel                level  = LogLevel::INFO;
+            uint64_t                timeNs = 0;
+            std::unique_ptr<char[]> message;     ///< MESSAGE_LENGTH + 1 chars
+        };
+
+        FILE*                   m_Output = nullptr;
+        std::unique_ptr<Slot[]> m_Slots;
+        std::atomic<uint64_t>   m_Head{0};    ///< Next position to claim
+        uint64_t                m_Tail = 0;   ///< Next position to write, owned by the writer
+        std::atomic<uint64_t>   m_Written{0}; ///< Positions below it are written out
+        std::atomic<uint64_t>   m_Dropped{0};
+        uint64_t                m_StartNs = 0;
+
+        std::mutex              m_WakeMutex;
+        std::condition_variable m_Wake;
+        std::condition_variable m_Flushed;
+        bool                    m_Stopping       = false;
+        bool                    m_FlushRequested = false;
+        std::atomic<bool>       m_WriterSleeping{false}; ///< Waiting for messages, see push()
+        std::thread             m_Writer;
+
+        void push(LogLevel level, uint64_t suppressed, const char* format, va_list args);
+        bool hasPending() const;
+        bool writePending();
+        void writerLoop();
+    };
+};
@@ -0,0 +1,151 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file autosave.h
+ * @date 2021-12-26
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "document.h"
+
+namespace Paint
+{
+    /**
+     * @brief Periodically saves the changed documents to separate files for crash recovery.
+     *
+     * On the UI thread only copy-on-write snapshots of the documents are taken, which costs
+     * time proportional to the tiles changed since the previous synchronization. Compression
+     * and writing happen on a background thread. Every document has its own autosave file,
+     * which is appended to with the tiles changed since the previous autosave.
+     */
+    class AutosaveService
+    {
+    public:
+        static const char* const DEFAULT_DIRECTORY;
+        static const double      DEFAULT_INTERVAL;    ///< In seconds
+        static const uint64_t    DEFAULT_DISK_BUDGET; ///< In bytes, for all autosave files together
+
+    public:
+        AutosaveService();
+
+        /**
+         * @brief Drops the queued writes and only waits for the one in progress, the files
+         *        keep the previous autosave of those documents.
+         */
+        ~AutosaveService();
+
+        AutosaveService(const AutosaveService& other) = delete;
+        AutosaveService& operator=(const AutosaveService& other) = delete;
+
+        const std::string& getDirectory() const;
+        void setDirectory(const char* directory);
+
+        double getInterval() const;
+        void setInterval(double seconds);
+
+        uint64_t getDiskBudget() const;
+        void setDiskBudget(uint64_t bytes);
+
+        /**
+         * @brief Collects finished writes and snapshots the changed documents once the
+         *        interval has passed. Must be called regularly from the UI thread.
+         */
+        void update(const std::list<Document*>& documents);
+
+        /**
+         * @brief Snapshots the changed documents regardless of the interval.
+         */
+        void snapshot(const std::list<Document*>& documents);
+
+        /**
+         * @brief Waits for all the queued writes to finish.
+         */
+        void flush();
+
+        /**
+         * @brief Drops the document's queued write, waits for its write in progress and deletes
+         *        its autosave file. Must be called before deleting the document.
+         */
+        void forget(Document* document);
+
+        /**
+         * @brief Waits for the queued writes and deletes the autosave files, e.g. on a clean exit.
+         */
+        void removeFiles();
+
+        /**
+         * @brief Makes removeFiles() delete the file too, e.g. a recovered autosave.
+         */
+        void adoptFile(const char* filename);
+
+        uint64_t getDiskUsage() const; ///< Size of the autosave files written so far
+
+        /**
+         * @return Autosave files left in the directory by other (e.g. crashed) sessions.
+         */
+        static std::vector<std::string> findRecoverable(const char* directory);
+
+    private:
+        struct LayerState
+        {
+            std::vector<SavedTile>              saved;
+            std::shared_ptr<const DocumentFile> source;
+        };
+
+        struct DocumentState
+        {
+            std::string                                  filename;
+            std::shared_ptr<const DocumentFile>          file;
+            uint64_t                                     revision = 0;
+            bool                                         writing  = false;
+            std::unordered_map<const Layer*, LayerState> layers;
+        };
+
+        struct Job
+        {
+            Document*                           document = nullptr;
+            uint64_t                            revision = 0;
+            std::string                         filename;
+            DocumentSnapshot                    snapshot;
+            std::shared_ptr<const DocumentFile> result;
+        };
+
+        using Clock = std::chrono::steady_clock;
+
+        /* UI thread only */
+        std::string                                  m_Directory;
+        double                                       m_Interval    = 0;
+        uint64_t                                     m_DiskBudget  = 0;
+        Clock::time_point                            m_LastSnapshot;
+        std::unordered_map<Document*, DocumentState> m_Documents;
+        size_t                                       m_FileCount   = 0;
+        bool                                         m_OverBudget  = false;
+        std::vector<std::string>                     m_AdoptedFiles;
+
+        /* Shared with the worker, guarded by m_Mutex */
+        std::mutex                                   m_Mutex;
+        std::condition_variable                      m_JobReady;
+        std::condition_variable                      m_JobDone;
+        std::deque<Job>                              m_Queue;
+        std::deque<Job>                              m_Finished;
+        size_t                                       m_Unfinished  = 0;       ///< Queued and in progress jobs
+        Document*                                    m_Writing     = nullptr; ///< Document of the job in progress
+        bool                                         m_Stopping    = false;
+
+        std::thread                                  m_Worker;             ///< Started by the first snapshot
+
+        void queue(Document* document, DocumentState* state);
+        void collect();
+        void apply(Job& job);
+
+        void workerLoop();
+    };
+};
@@ -2,45 +2,57 @@
  * @author Nikita Mochalov (github.com/tralf-strues)
  * @file basic_filters.h
  * @date 2021-12-15
- * 
+ *
  * @copyright Copyright (c) 2021
  */
 
 #pragma once
 
-#include "sml/math/blur.h"
 #include "filter.h"
+#include "filter_engine.h"
+#include "blur.h"
 
 namespace Paint
 {
+    class SharpenKernel : public TileKernel
+    {
+    public:
+        SharpenKernel(int32_t blurRadius, float amount);
+
+        virtual int32_t getHalo() const override;
+        virtual void processBand(const FilterBand& band) const override;
+
+    private:
+        BlurKernel m_BlurKernel;
+        float      m_Amount;
+    };
+
     class SharpenFilter : public Filter
     {
     public:
         SharpenFilter() = default;
-        virtual ~SharpenFilter() override;
 
         virtual const char* getName() const override;
 
         virtual Sgl::Container* getPreferencesPanel() override;
 
-        virtual void init(Sml::Texture* texture) override;
+        virtual void init(Layer* layer) override;
         virtual void apply() override;
 
+        virtual std::shared_ptr<const TileKernel> createKernel(float scale) const override;
+
         int32_t getBlurRadius() const;
         void setBlurRadius(int32_t radius);
 
         float getAmount() const;
         void setAmount(float amount);
 
-        Sml::Texture* getOriginalTexture();
-
-        bool isCanceled() const;
-        void setCanceled(bool canceled);
+        const TiledImage& getOriginal() const;
 
     private:
-        Sml::Texture* m_OriginalTexture = nullptr;
-        Sml::Kernel*  m_BlurKernel      = Sml::createGaussianBlurKernel(5);
-        float         m_Amount          = 1.5f;
-        bool          m_Canceled        = false;
+        Layer*        m_Layer      = nullptr;
+        TiledImage    m_Original;
+        int32_t       m_BlurRadius = 5;
+        float         m_Amount     = 1.5f;
     };
-};
\ No newline at end of file
+};
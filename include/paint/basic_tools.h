@@ -9,6 +9,8 @@
 #pragma once
 
 #include "tool.h"
+#include "tiled_image.h"
+#include "stroke_engine.h"
 
 namespace Paint
 {
@@ -20,13 +22,25 @@ namespace Paint
 
         virtual Sgl::Container* getPreferencesPanel() override;
 
+        virtual void onActionStart(const Sml::Vec2i& pos) override;
         virtual void onAction(const Sml::Vec2i& pos, const Sml::Vec2i& displacement) override;
+        virtual void onActionEnd(const Sml::Vec2i& pos) override;
+        virtual void onUpdate() override;
 
         int32_t getThickness() const;
         void setThickness(int32_t thickness);
 
+        float getHardness() const;
+        void setHardness(float hardness);
+
+        float getOpacity() const;
+        void setOpacity(float opacity);
+
     private:
-        int32_t m_Thickness = 10;
+        StrokeEngine m_Stroke;
+        int32_t      m_Thickness = 10;
+        float        m_Hardness  = 0.8f;
+        float        m_Opacity   = 1;
     };
 
     class Eraser : public Tool
@@ -37,13 +51,25 @@ namespace Paint
 
         virtual Sgl::Container* getPreferencesPanel() override;
 
+        virtual void onActionStart(const Sml::Vec2i& pos) override;
         virtual void onAction(const Sml::Vec2i& pos, const Sml::Vec2i& displacement) override;
+        virtual void onActionEnd(const Sml::Vec2i& pos) override;
+        virtual void onUpdate() override;
 
         int32_t getThickness() const;
         void setThickness(int32_t thickness);
 
+        float getHardness() const;
+        void setHardness(float hardness);
+
+        float getOpacity() const;
+        void setOpacity(float opacity);
+
     private:
-        int32_t m_Thickness = 10;
+        StrokeEngine m_Stroke;
+        int32_t      m_Thickness = 10;
+        float        m_Hardness  = 1;
+        float        m_Opacity   = 1;
     };
 
     class RectangleTool : public Tool
@@ -62,8 +88,10 @@ namespace Paint
         void setThickness(int32_t thickness);
 
     private:
-        Sml::Texture* m_OriginalTexture = nullptr;
-        int32_t       m_Thickness       = 1;
-        Sml::Vec2i    m_Origin          = {0, 0};
+        LazySnapshot  m_Original;
+        int32_t       m_Thickness = 1;
+        Sml::Vec2i    m_Origin    = {0, 0};
+
+        Sml::Rectangle<int32_t> m_LastBounds = {0, 0, 0, 0};
     };
 };
\ No newline at end of file
@@ -0,0 +1,53 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file blend.h
+ * @date 2021-12-31
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include "sml/sml_graphics_wrapper.h"
+
+namespace Paint
+{
+    /**
+     * @brief Separable blend modes, defined on premultiplied colors as in the W3C
+     *        compositing spec. The result's alpha is always sa + da - sa * da, except for
+     *        ADD which saturates sa + da.
+     */
+    enum class BlendMode : uint32_t
+    {
+        NORMAL,
+        MULTIPLY,
+        SCREEN,
+        OVERLAY,
+        DARKEN,
+        LIGHTEN,
+        ADD,
+        DIFFERENCE,
+
+        COUNT
+    };
+
+    const char* getBlendModeName(BlendMode mode);
+
+    /**
+     * @brief Converts straight alpha colors to premultiplied ones, dst may be the same as src.
+     */
+    void premultiplyRow(const Sml::Color* src, Sml::Color* dst, size_t count);
+    void unpremultiplyRow(const Sml::Color* src, Sml::Color* dst, size_t count);
+
+    /**
+     * @brief dst = src blended over dst, both premultiplied.
+     *
+     * @param opacity Applied to src beforehand, 255 is fully opaque.
+     */
+    void blendRow(BlendMode mode, const Sml::Color* src, Sml::Color* dst, size_t count, uint8_t opacity);
+
+    /**
+     * @brief Name of the instruction set the blending loops were dispatched to ("avx2", "sse2" or "scalar").
+     */
+    const char* getBlendImplementationName();
+};
@@ -0,0 +1,76 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file blur.h
+ * @date 2021-12-22
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <vector>
+#include "sml/sml_graphics_wrapper.h"
+
+namespace Paint
+{
+    /**
+     * @brief One-dimensional Gaussian kernel with fixed-point weights summing up to
+     *        exactly 1 << WEIGHT_BITS.
+     */
+    class BlurKernel
+    {
+    public:
+        static const int32_t WEIGHT_BITS = 14;
+
+    public:
+        explicit BlurKernel(int32_t radius);
+
+        int32_t getRadius() const;
+        int32_t getSize() const;
+        const int16_t* getWeights() const;
+
+    private:
+        int32_t              m_Radius = 0;
+        std::vector<int16_t> m_Weights;
+    };
+
+    /**
+     * @brief Buffers reused between rows, so that blurring doesn't allocate per row.
+     */
+    struct BlurScratch
+    {
+        std::vector<Sml::Color>        paddedRow;
+        std::vector<const Sml::Color*> rows;
+    };
+
+    /**
+     * @brief Horizontal pass, pixels outside of the row repeat the edge ones.
+     */
+    void blurRowHorizontally(const Sml::Color* src, Sml::Color* dst, int32_t width,
+                             const BlurKernel& kernel, BlurScratch* scratch);
+
+    /**
+     * @brief Vertical pass for one row.
+     *
+     * @param rows kernel.getSize() rows centered around the one being computed.
+     */
+    void blurRowVertically(const Sml::Color* const* rows, Sml::Color* dst, int32_t width, const BlurKernel& kernel);
+
+    /**
+     * @brief Separable blur of the whole image, O(radius) work per pixel.
+     */
+    void gaussianBlur(const Sml::Color* src, Sml::Color* dst, int32_t width, int32_t height, const BlurKernel& kernel);
+
+    /**
+     * @brief dst = original + max(original - blurred, 0) * amount, saturated per channel.
+     *
+     * The amount is applied with 1/16 precision. dst may be the same as either source.
+     */
+    void unsharpMaskRow(const Sml::Color* original, const Sml::Color* blurred, Sml::Color* dst,
+                        int32_t width, float amount);
+
+    /**
+     * @brief Name of the instruction set the pixel loops were dispatched to ("avx2", "sse2" or "scalar").
+     */
+    const char* getBlurImplementationName();
+};
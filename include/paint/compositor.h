@@ -0,0 +1,117 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file compositor.h
+ * @date 2021-12-31
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include "tiled_image.h"
+#include "thread_pool.h"
+#include "layer_stack.h"
+
+namespace Paint
+{
+    class Layer;
+
+    /**
+     * @brief Blends a document's layers on the CPU, see blend.h.
+     *
+     * Hidden layers and transparent tiles are skipped. The contents of every group are
+     * cached, so a group the active layer isn't in costs a single blend. On the way to the
+     * active layer, the layers below it are flattened into a cached image too, and so are
+     * runs of adjacent normal layers above it, so that a frame of a stroke blends three
+     * images per level of nesting whatever the number of layers. Cached tiles are
+     * recomposed only when one of their layers changes there.
+     *
+     * Zoomed out views are composed from the layers' mip levels (see MipPyramid), and
+     * every cache keeps a separate image per level it's been composed at.
+     */
+    class Compositor
+    {
+    public:
+        static const size_t MIN_CACHED_RUN; ///< Fewer adjacent layers are blended one by one
+
+    public:
+        explicit Compositor(ThreadPool& pool = ThreadPool::getInstance());
+
+        /**
+         * @brief Picks up the layer order and the layers' dirty regions, so it must be
+         *        called before they're cleared.
+         */
+        void update(const LayerStack& layers, LayerHandle activeLayer);
+
+        /**
+         * @brief Composes the rect of the layers given to the last update().
+         *
+         * @param rect   In the level's coordinates.
+         * @param pixels Tightly packed straight alpha pixels of the rect.
+         * @param level  Mip level, the layers are downscaled 2^level times.
+         */
+        void compose(const Sml::Rectangle<int32_t>& rect, Sml::Color* pixels, size_t level = 0);
+
+        size_t getCacheCount() const;
+
+    private:
+        struct Cache;
+
+        /* A layer, a cached image or a group composed right away, as the active layer is in it */
+        struct Entry
+        {
+            Layer*             layer   = nullptr;
+            Cache*             cache   = nullptr;
+            std::vector<Entry> children;
+            BlendMode          mode    = BlendMode::NORMAL;
+            uint8_t            opacity = 255;
+            const TiledImage*  image   = nullptr; ///< The layer's or cache's tiles, set by compose()
+        };
+
+        struct CacheLevel
+        {
+            TiledImage        pixels; ///< Premultiplied
+            std::vector<bool> staleTiles;
+        };
+
+        /* Adjacent nodes of the same group composed from transparency */
+        struct Cache
+        {
+            std::vector<std::pair<LayerHandle, size_t>> key;        ///< The nodes' subtrees with depths
+            std::vector<Entry>                          items;
+            size_t                                      width  = 0;
+            size_t                                      height = 0;
+            std::vector<CacheLevel>                     levels; ///< Allocated on first use
+        };
+
+        ThreadPool&                         m_Pool;
+        std::vector<Entry>                  m_Entries;
+        std::vector<std::unique_ptr<Cache>> m_Caches;
+        std::vector<std::unique_ptr<Cache>> m_UnusedCaches; ///< Caches of the previous update()
+
+        /**
+         * @param first, end Range of the group's subtree without the group itself.
+         */
+        std::vector<Entry> buildEntries(const LayerStack& layers, size_t first, size_t end, size_t activeLayer);
+        Entry buildEntry(const LayerStack& layers, size_t index);
+
+        /**
+         * @brief Reuses the cache of the previous update() with the same nodes if any.
+         */
+        Cache* takeCache(const LayerStack& layers, const std::vector<size_t>& nodes);
+
+        void prepareEntries(std::vector<Entry>& entries, const Sml::Rectangle<int32_t>& rect, size_t level);
+        CacheLevel& updateCache(Cache* cache, const Sml::Rectangle<int32_t>& rect, size_t level);
+
+        /**
+         * @brief Blends the entries over dst, which is the rect's pixels with the given stride.
+         */
+        static void composeEntries(const std::vector<Entry>& entries, const Sml::Rectangle<int32_t>& rect,
+                                   Sml::Color* dst, int32_t stride);
+        static void blendEntry(const Entry& entry, const Sml::Rectangle<int32_t>& rect,
+                               Sml::Color* dst, int32_t stride, Sml::Color* row);
+    };
+};
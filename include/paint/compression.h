@@ -0,0 +1,33 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file compression.h
+ * @date 2021-12-21
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace Paint
+{
+    /**
+     * @brief Fast LZ77 compressor in the spirit of LZ4, tuned for tiles of RGBA pixels.
+     *
+     * The stream is a sequence of (literals, match) pairs. Each pair starts with a token
+     * byte, whose high nibble is the number of literals and low nibble is the match length
+     * minus LZ_MIN_MATCH, both extended by 255-valued bytes when they don't fit. Matches
+     * are encoded as a 16-bit little-endian backward offset. The last pair has no match.
+     *
+     * @return Size of the compressed data appended to dst.
+     */
+    size_t compress(const uint8_t* src, size_t srcSize, std::vector<uint8_t>* dst);
+
+    /**
+     * @return false if the data is corrupted or doesn't decompress to exactly dstSize bytes.
+     */
+    bool decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+};
@@ -0,0 +1,57 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file dirty_region.h
+ * @date 2021-12-20
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <vector>
+#include "sml/sml_math.h"
+
+namespace Paint
+{
+    bool isRectEmpty(const Sml::Rectangle<int32_t>& rect);
+    bool doRectsOverlap(const Sml::Rectangle<int32_t>& first, const Sml::Rectangle<int32_t>& second);
+
+    Sml::Rectangle<int32_t> intersectRects(const Sml::Rectangle<int32_t>& first, const Sml::Rectangle<int32_t>& second);
+    Sml::Rectangle<int32_t> uniteRects(const Sml::Rectangle<int32_t>& first, const Sml::Rectangle<int32_t>& second);
+
+    /**
+     * @brief Appends the parts of the rectangle outside the hole, at most four rectangles.
+     */
+    void subtractRect(const Sml::Rectangle<int32_t>& rect, const Sml::Rectangle<int32_t>& hole,
+                      std::vector<Sml::Rectangle<int32_t>>* pieces);
+
+    /**
+     * @brief Bounding rectangle of a line drawn with Sml::renderLine(start, end, thickness).
+     */
+    Sml::Rectangle<int32_t> computeLineBounds(const Sml::Vec2i& start, const Sml::Vec2i& end, int32_t thickness);
+
+    /**
+     * @brief A small set of rectangles describing the modified part of an image.
+     *
+     * Overlapping rectangles are merged on insertion, and once there are more than
+     * MAX_RECTS of them the whole region collapses into its bounding rectangle, so
+     * that the per-frame cost of walking the region stays constant.
+     */
+    class DirtyRegion
+    {
+    public:
+        static const size_t MAX_RECTS;
+
+    public:
+        void add(const Sml::Rectangle<int32_t>& rect);
+        void add(const DirtyRegion& region);
+        void clear();
+
+        bool isEmpty() const;
+        Sml::Rectangle<int32_t> getBounds() const;
+        const std::vector<Sml::Rectangle<int32_t>>& getRects() const;
+
+    private:
+        std::vector<Sml::Rectangle<int32_t>> m_Rects;
+    };
+};
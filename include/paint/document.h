@@ -9,49 +9,358 @@
 #pragma once
 
 #include <string>
-#include <list>
+#include <memory>
 #include "sml/sml_graphics_wrapper.h"
+#include "dirty_region.h"
+#include "tiled_image.h"
+#include "mip_pyramid.h"
+#include "document_file.h"
+#include "layer_stack.h"
+#include "compositor.h"
 
 namespace Paint
 {
+    class History;
+
+    /**
+     * @brief Snapshot of a layer (see Layer::snapshot()) taken without loading the layer's
+     *        tiles that are still in its file, they're read from the file when asked for.
+     */
+    class LazySnapshot
+    {
+    public:
+        LazySnapshot() = default;
+
+        /**
+         * @brief Snapshot with all of its tiles in memory.
+         */
+        explicit LazySnapshot(const TiledImage& tiles);
+
+        /**
+         * @param unloaded Tiles that are only in the source, at the locations.
+         */
+        LazySnapshot(const TiledImage& tiles, const std::vector<bool>& unloaded,
+                     const std::shared_ptr<const DocumentFile>& source, std::vector<TileLocation> locations);
+
+        size_t getTileCount() const;
+        bool isUnloaded(size_t index) const;
+
+        /**
+         * @brief Decompresses the tile from the file if it's still there, without keeping it.
+         */
+        TilePtr getTile(size_t index) const;
+
+        /**
+         * @brief Reads the tiles of the rect that are still in the file.
+         *
+         * @return Image of which the rect is complete.
+         */
+        const TiledImage& read(const Sml::Rectangle<int32_t>& rect);
+
+    private:
+        TiledImage                          m_Tiles;
+        std::vector<bool>                   m_Unloaded;  ///< Empty if every tile is in memory
+        std::shared_ptr<const DocumentFile> m_Source;
+        std::vector<TileLocation>           m_Locations;
+    };
+
     class Layer
     {
     public:
-        Layer(size_t width, size_t height);
+        /**
+         * @brief Layer filled with the color. A transparent layer has no tiles allocated, the
+         *        others share a single tile until they're drawn on.
+         */
+        Layer(size_t width, size_t height, Sml::Color color = Sml::COLOR_TRANSPARENT);
+
+        /**
+         * @brief Layer initialized with the image's pixels, sharing its tiles.
+         */
+        explicit Layer(const TiledImage& image);
+
+        /**
+         * @brief Layer whose tiles stay in the file until ensureLoaded() is called for them.
+         */
+        Layer(const std::shared_ptr<const DocumentFile>& file, size_t index);
+
         ~Layer();
 
         Sml::Texture* getTexture();
 
+        size_t getWidth() const;
+        size_t getHeight() const;
+
+        bool isVisible() const;
+        void setVisible(bool visible);
+
+        uint8_t getOpacity() const;
+        void setOpacity(uint8_t opacity);
+
+        BlendMode getBlendMode() const;
+        void setBlendMode(BlendMode mode);
+
+        /**
+         * @brief Must be called by everything that draws on the layer's texture, otherwise
+         *        the change won't reach the document's canvas. The area must be loaded.
+         */
+        void markDirty(const Sml::Rectangle<int32_t>& rect);
+        void markDirty();
+
+        const DirtyRegion& getDirtyRegion() const;
+        void clearDirtyRegion();
+
+        /**
+         * @brief Brings the tiles up to date with the texture, only reading back tiles that
+         *        were marked dirty since the previous synchronization.
+         */
+        void syncTiles();
+        void syncTiles(const Sml::Rectangle<int32_t>& rect);
+
+        /**
+         * @brief Loads and synchronizes the tiles of the rect, the others may be out of date.
+         */
+        const TiledImage& readTiles(const Sml::Rectangle<int32_t>& rect);
+
+        /**
+         * @brief Like readTiles() for a downscaled level of the layer (see MipPyramid), only
+         *        recomputing the level's tiles that changed since they were last read.
+         *
+         * @param rect In the level's coordinates.
+         */
+        const TiledImage& readLevel(size_t level, const Sml::Rectangle<int32_t>& rect);
+
+        /**
+         * @brief Cheap copy-on-write copy of the layer's pixels.
+         */
+        TiledImage snapshot();
+
+        /**
+         * @brief Like snapshot(), but doesn't load the tiles that are still in the file.
+         */
+        LazySnapshot lazySnapshot();
+
+        /**
+         * @brief Uploads the snapshot's pixels back to the texture, skipping tiles that
+         *        haven't changed since the snapshot was taken.
+         */
+        void restore(const TiledImage& snapshot);
+        void restore(const TiledImage& snapshot, const Sml::Rectangle<int32_t>& rect);
+
+        /**
+         * @brief Direct access to a CPU copy of the rect, allocated per lock and read from the
+         *        tiles. Unlocking writes a modified copy to the tiles and the texture.
+         *
+         * @return Pixels of the rect clipped by the layer (stride is the clipped width), valid
+         *         until the rect is unlocked.
+         */
+        Sml::Color* lockPixels(const Sml::Rectangle<int32_t>& rect);
+        void unlockPixels(const Sml::Rectangle<int32_t>& rect, bool modified);
+
+        /**
+         * @brief Replaces all of the layer's pixels, tightly packed.
+         */
+        void loadPixels(const Sml::Color* pixels);
+
+        /**
+         * @brief Decompresses and uploads the tiles of the rect that are still in the file.
+         *        Must be called before drawing on the texture directly.
+         */
+        void ensureLoaded(const Sml::Rectangle<int32_t>& rect);
+        void ensureLoaded();
+
+        /**
+         * @brief Copies the state needed for saving without loading the unloaded tiles.
+         */
+        void fillSnapshot(DocumentSnapshot::LayerSnapshot* snapshot);
+
+        /**
+         * @param index Index of the layer in the file the snapshot was saved to.
+         */
+        void onSaved(const DocumentSnapshot::LayerSnapshot& snapshot,
+                     const std::shared_ptr<const DocumentFile>& file, size_t index);
+
     private:
-        Sml::Texture* m_Texture = nullptr;
+        struct LockedRegion
+        {
+            Sml::Rectangle<int32_t> rect;
+            std::vector<Sml::Color> pixels;
+        };
+
+        Sml::Texture*                m_Texture   = nullptr;
+        DirtyRegion                  m_DirtyRegion;
+        bool                         m_Visible   = true;
+        uint8_t                      m_Opacity   = 255;
+        BlendMode                    m_BlendMode = BlendMode::NORMAL;
+
+        TiledImage                   m_Tiles;
+        std::vector<bool>            m_StaleTiles; ///< Tiles whose texture pixels may differ from m_Tiles
+        MipPyramid                   m_Mips;
+
+        std::vector<LockedRegion>    m_LockedRegions;
+
+        std::shared_ptr<const DocumentFile> m_Source;        ///< Holds the unloaded tiles
+        std::vector<bool>                   m_UnloadedTiles;
+        size_t                              m_UnloadedCount = 0;
+        std::vector<SavedTile>              m_SavedTiles;
+
+        /**
+         * @brief The whole layer has to be recomposed, but its pixels are the same.
+         */
+        void invalidate();
+
+        void markStale(const Sml::Rectangle<int32_t>& rect);
+        void syncTile(size_t index);
+        void loadTile(size_t index);
+        void clearTexture(Sml::Color color = Sml::COLOR_TRANSPARENT);
     };
 
     class Document
     {
     public:
+        /**
+         * @brief Opens either a native document (see DocumentFile) or an image.
+         */
         Document(const char* filename);
+
+        /**
+         * @brief Document of an already opened native file, named after it.
+         */
+        explicit Document(const std::shared_ptr<const DocumentFile>& file);
         Document(size_t width, size_t height, const char* name = "untitled");
         ~Document();
 
         void setName(const std::string& name);
         const std::string& getName() const;
+
+        /**
+         * @brief Saves the document in the native format, only rewriting tiles that changed
+         *        since the last save when saving to the same file.
+         */
+        bool save(const char* filename);
+
+        DocumentSnapshot createSnapshot();
+        void onSaved(const DocumentSnapshot& snapshot, const std::shared_ptr<const DocumentFile>& file);
+
+        /**
+         * @return Native file the document was last opened from or saved to, may be nullptr.
+         */
+        const std::shared_ptr<const DocumentFile>& getFile() const;
+
+        /**
+         * @brief Makes the next save write a new file instead of appending to the current
+         *        one, e.g. for documents recovered from an autosave.
+         */
+        void detachFile();
+
+        /**
+         * @brief Full resolution composite, created by the first applyLayersToCanvas().
+         */
         Sml::Texture* getCanvas();
 
         size_t getWidth() const;
         size_t getHeight() const;
 
+        /**
+         * @brief Picks up the changes of the layers without composing anything, so that views
+         *        can then compose just what they show with compose().
+         */
+        void update();
+
+        /**
+         * @brief Composes a rect of the document as of the last update(), see Compositor.
+         *
+         * @param rect   In the coordinates of the mip level.
+         * @param pixels Tightly packed straight alpha pixels of the rect.
+         */
+        void compose(const Sml::Rectangle<int32_t>& rect, Sml::Color* pixels, size_t level = 0);
+
+        /**
+         * @brief Updates and recomposes only the parts of the canvas covered by the layers'
+         *        dirty regions.
+         */
         void applyLayersToCanvas();
 
-        void addLayer(Layer* layer);
-        void removeLayer(Layer* layer);
+        /**
+         * @brief Whether the layers changed since the last update().
+         */
+        bool isDirty() const;
+
+        /**
+         * @brief Incremented every time update() picks up changes.
+         */
+        uint64_t getRevision() const;
+        const DirtyRegion& getLastChanges() const; ///< Region changed by the latest revision
+
+        /**
+         * @brief Takes ownership of the layer and puts it on top of the parent group's layers
+         *        (or of the whole document if the parent is invalid).
+         */
+        LayerHandle addLayer(Layer* layer, LayerHandle parent = LayerHandle());
+        LayerHandle addGroup(LayerHandle parent = LayerHandle());
+
+        /**
+         * @brief Like addLayer(), but puts the layer right above the sibling.
+         */
+        LayerHandle addLayerAbove(Layer* layer, LayerHandle sibling);
+
+        /**
+         * @brief Deletes the layer, or the group with all its layers. History::forgetLayer()
+         *        must be called for them beforehand. If the active layer is deleted, the
+         *        nearest layer below it becomes active.
+         */
+        void removeLayer(LayerHandle layer);
 
+        /**
+         * @param position Among the parent's other children, 0 is the bottom.
+         */
+        void moveLayer(LayerHandle layer, LayerHandle parent, size_t position);
+        LayerHandle duplicateLayer(LayerHandle layer);
+
+        /**
+         * @brief See LayerStack::mergeDown(). The history forgets the merged layer's own steps
+         *        and records the merge as one step, undoing which restores the layer below and
+         *        puts the merged layer back above it.
+         */
+        bool mergeLayerDown(LayerHandle layer, History* history);
+
+        /**
+         * @brief Properties of layers and groups can be changed through it, but the order
+         *        only through the document, so that the canvas is updated.
+         */
+        const LayerStack& getLayers() const;
+
+        /**
+         * @return nullptr if the document has no layers.
+         */
         Layer* getActiveLayer();
-        void setActiveLayer(Layer* layer);
+        LayerHandle getActiveLayerHandle() const;
+        void setActiveLayer(LayerHandle layer);
 
     private:
-        std::string       m_Name;
-        Sml::Texture*     m_Canvas      = nullptr;
-        Layer*            m_ActiveLayer = nullptr;
-        std::list<Layer*> m_Layers;
+        std::string   m_Name;
+        size_t        m_Width    = 0;
+        size_t        m_Height   = 0;
+        Sml::Texture* m_Canvas   = nullptr;
+        DirtyRegion   m_CanvasRegion; ///< Changes not composed into the canvas yet
+        LayerStack    m_Layers;
+        LayerHandle   m_ActiveLayer;
+        DirtyRegion   m_DirtyRegion; ///< Changes not caused by drawing (e.g. layer added or removed)
+        uint64_t      m_Revision = 0;
+        DirtyRegion   m_LastChanges;
+
+        Compositor              m_Compositor;
+        std::vector<Sml::Color> m_ComposeBuffer;
+
+        std::shared_ptr<const DocumentFile> m_File;
+
+        void markDirty();
+        void loadFile(const std::shared_ptr<const DocumentFile>& file);
+
+        /**
+         * @brief Picks a new active layer if the previous one was removed.
+         *
+         * @param index Where the removed layer was.
+         */
+        void updateActiveLayer(size_t index);
     };
 };
\ No newline at end of file
@@ -0,0 +1,155 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file document_file.h
+ * @date 2021-12-25
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "tiled_image.h"
+#include "blend.h"
+
+namespace Paint
+{
+    class Layer;
+
+    struct TileLocation
+    {
+        uint64_t offset = 0;
+        uint32_t size   = 0; ///< Zero for transparent tiles, which aren't stored
+
+        bool isEmpty() const { return size == 0; }
+    };
+
+    struct LayerProperties
+    {
+        bool      visible   = true;
+        uint8_t   opacity   = 255;
+        BlendMode blendMode = BlendMode::NORMAL;
+    };
+
+    /**
+     * @brief Read-only memory mapping of a native document file.
+     *
+     * The file starts with a fixed header that points to the index. The index stores the
+     * document's size, the active layer and, for every layer, its properties and the location
+     * of each of its individually compressed tiles. Tiles are only decompressed when asked for, so opening
+     * costs time proportional to the size of the index.
+     *
+     * Saving appends changed tiles and a new index to the end of the file and only then
+     * repoints the header, so an interrupted save leaves the previous version intact. Once
+     * most of the file is garbage it's rewritten from scratch.
+     */
+    class DocumentFile
+    {
+    public:
+        static const char     MAGIC[8];
+        static const uint32_t VERSION;
+        static const uint32_t MIN_VERSION; ///< Oldest version that can still be opened
+        static const uint32_t MAX_SIZE;    ///< Largest width and height of a document that can be opened
+        static const char*    EXTENSION;
+
+    public:
+        /**
+         * @return nullptr if the file isn't a valid native document.
+         */
+        static std::shared_ptr<const DocumentFile> open(const char* filename);
+
+        ~DocumentFile();
+
+        DocumentFile(const DocumentFile& other) = delete;
+        DocumentFile& operator=(const DocumentFile& other) = delete;
+
+        const std::string& getFilename() const;
+
+        size_t getWidth() const;
+        size_t getHeight() const;
+        size_t getLayerCount() const;
+        size_t getActiveLayer() const;
+
+        const std::vector<TileLocation>& getTileLocations(size_t layer) const;
+        const LayerProperties& getLayerProperties(size_t layer) const;
+
+        /**
+         * @return nullptr for empty locations or corrupted data.
+         */
+        TilePtr loadTile(const TileLocation& location) const;
+        const uint8_t* getTileData(const TileLocation& location) const; ///< Compressed bytes
+
+        uint64_t getFileSize() const;
+        uint64_t getLiveSize() const; ///< Bytes referenced by the current index
+
+    private:
+        std::string                            m_Filename;
+        uint8_t*                               m_Data        = nullptr;
+        uint64_t                               m_Size        = 0;
+        uint64_t                               m_LiveSize    = 0;
+
+        size_t                                 m_Width       = 0;
+        size_t                                 m_Height      = 0;
+        size_t                                 m_ActiveLayer = 0;
+        std::vector<std::vector<TileLocation>> m_Layers;
+        std::vector<LayerProperties>           m_LayerProperties;
+
+        DocumentFile() = default;
+
+        bool parseIndex(uint32_t version, uint64_t indexOffset, uint64_t indexSize);
+    };
+
+    /**
+     * @brief State of a tile in the document's file as of the last save.
+     */
+    struct SavedTile
+    {
+        TilePtr      tile;             ///< Held, so that copy-on-write gives modified tiles a new pointer
+        TileLocation location;
+        uint64_t     sourceOffset = 0; ///< Offset in the source file of a tile saved without loading it
+    };
+
+    /**
+     * @brief Copy-on-write copy of everything needed to save a document, which can then be
+     *        written without touching the document itself.
+     */
+    struct DocumentSnapshot
+    {
+        struct LayerSnapshot
+        {
+            const Layer*                        layer = nullptr;
+            TiledImage                          tiles;
+            LayerProperties                     properties;
+
+            std::vector<bool>                   unloaded;        ///< Tiles that are still only in the source file
+            std::shared_ptr<const DocumentFile> source;
+            std::vector<TileLocation>           sourceLocations;
+
+            std::vector<SavedTile>              saved;           ///< State of the tiles in the file being written
+            std::shared_ptr<const DocumentFile> savedSource;     ///< Source the saved tiles' sourceOffset refer to
+        };
+
+        size_t                              width       = 0;
+        size_t                              height      = 0;
+        size_t                              activeLayer = 0;
+        std::vector<LayerSnapshot>          layers;
+        std::shared_ptr<const DocumentFile> file;     ///< Last version of the document on disk, may be nullptr
+    };
+
+    /**
+     * @brief Writes the snapshot, incrementally if the snapshot's file is the same file.
+     *
+     * @return The new version of the file or nullptr on failure.
+     */
+    std::shared_ptr<const DocumentFile> writeDocument(const DocumentSnapshot& snapshot, const char* filename);
+
+    /**
+     * @brief Brings the saved state of the layer up to date after a successful write.
+     *
+     * @param locations Locations of the layer's tiles in the written file.
+     */
+    void updateSavedTiles(const DocumentSnapshot::LayerSnapshot& layer, const std::vector<TileLocation>& locations,
+                          std::vector<SavedTile>* saved);
+};
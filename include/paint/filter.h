@@ -11,6 +11,8 @@
 #include "sml/sml_math.h"
 #include "sml/sml_graphics_wrapper.h"
 #include "sgl/containers.h"
+#include "document.h"
+#include "filter_engine.h"
 
 namespace Paint
 {
@@ -23,7 +25,16 @@ namespace Paint
 
         virtual Sgl::Container* getPreferencesPanel() { return nullptr; }
 
-        virtual void init(Sml::Texture* texture) {}
+        virtual void init(Layer* layer) {}
         virtual void apply() = 0;
+
+        /**
+         * @brief Immutable snapshot of the current settings that can be run in background.
+         *
+         * @param scale Downscaling of the image the kernel is going to be run on.
+         *
+         * @return nullptr if the filter can only be applied synchronously.
+         */
+        virtual std::shared_ptr<const TileKernel> createKernel(float scale) const { return nullptr; }
     };
 }
\ No newline at end of file
@@ -0,0 +1,75 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file filter_engine.h
+ * @date 2021-12-22
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <functional>
+#include "tiled_image.h"
+#include "thread_pool.h"
+
+namespace Paint
+{
+    /**
+     * @brief Horizontal strip of the image handed to a TileKernel.
+     *
+     * Bands always span the whole width of the image, so the halo is only added above
+     * and below. srcRect is clipped to the image, kernels handle the edges themselves.
+     */
+    struct FilterBand
+    {
+        Sml::Rectangle<int32_t> rect;             ///< Part of the image the band produces
+        Sml::Rectangle<int32_t> srcRect;          ///< rect extended by the halo
+        const Sml::Color*       src = nullptr;    ///< Tightly packed pixels of srcRect
+        Sml::Color*             dst = nullptr;    ///< Tightly packed pixels of rect
+    };
+
+    /**
+     * @brief Filter body that can be run on independent parts of the image concurrently.
+     */
+    class TileKernel
+    {
+    public:
+        virtual ~TileKernel() = default;
+
+        /**
+         * @brief How far (in pixels) from an output pixel the kernel reads source pixels.
+         */
+        virtual int32_t getHalo() const = 0;
+
+        /**
+         * @brief Called from worker threads for different bands at the same time.
+         */
+        virtual void processBand(const FilterBand& band) const = 0;
+    };
+
+    class FilterEngine
+    {
+    public:
+        static const int32_t MIN_BAND_HEIGHT;
+        static const size_t  BANDS_PER_THREAD;
+
+    public:
+        explicit FilterEngine(ThreadPool& pool = ThreadPool::getInstance());
+
+        /**
+         * @brief Runs the kernel over the whole image.
+         *
+         * @param dst        Tightly packed buffer of src.getWidth() * src.getHeight() pixels.
+         * @param isCanceled Checked before every band, bands that haven't started yet are skipped.
+         *
+         * @return false if the run was canceled and dst is only partially filled.
+         */
+        bool run(const TiledImage& src, const TileKernel& kernel, Sml::Color* dst,
+                 const std::function<bool()>& isCanceled = nullptr) const;
+
+        int32_t getBandHeight(int32_t imageHeight, int32_t halo) const;
+
+    private:
+        ThreadPool& m_Pool;
+    };
+};
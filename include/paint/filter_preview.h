@@ -0,0 +1,116 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file filter_preview.h
+ * @date 2021-12-23
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "document.h"
+#include "history.h"
+#include "filter_engine.h"
+
+namespace Paint
+{
+    /**
+     * @brief Computes filter previews on a background thread.
+     *
+     * Every request first runs on a downscaled copy of the layer and then at full
+     * resolution, each finished pass is uploaded to the layer by update(). A new request
+     * aborts the one in progress between bands. The layer's original state is kept until
+     * the preview is either committed as a history step or discarded.
+     */
+    class FilterPreview
+    {
+    public:
+        static const int32_t DOWNSCALE_FACTOR;
+        static const size_t  MIN_DOWNSCALED_PIXELS; ///< Smaller layers skip the reduced pass
+
+    public:
+        FilterPreview();
+        ~FilterPreview();
+
+        FilterPreview(const FilterPreview& other) = delete;
+        FilterPreview& operator=(const FilterPreview& other) = delete;
+
+        void start(Layer* layer);
+        bool isActive() const;
+        bool isBusy() const; ///< The full resolution result of the last request hasn't been uploaded yet
+        Layer* getLayer();
+        const TiledImage& getOriginal() const;
+
+        /**
+         * @param reducedKernel Kernel for the image downscaled by DOWNSCALE_FACTOR, may be nullptr.
+         */
+        void request(std::shared_ptr<const TileKernel> reducedKernel, std::shared_ptr<const TileKernel> kernel);
+
+        /**
+         * @brief Uploads the latest finished pass, must be called regularly from the UI thread.
+         */
+        void update();
+
+        /**
+         * @brief Waits for the full resolution result of the last request and records it in history.
+         */
+        void commit(History* history);
+
+        /**
+         * @brief Aborts the computation and restores the layer.
+         */
+        void discard();
+
+    private:
+        struct Request
+        {
+            uint64_t                          generation = 0;
+            TiledImage                        original;
+            uint64_t                          originalId = 0;
+            std::shared_ptr<const TileKernel> reducedKernel;
+            std::shared_ptr<const TileKernel> kernel;
+        };
+
+        struct Result
+        {
+            uint64_t                generation = 0;
+            bool                    isFinal    = false;
+            std::vector<Sml::Color> pixels;
+        };
+
+        /* UI thread only */
+        Layer*                  m_Layer          = nullptr;
+        TiledImage              m_Original;
+        uint64_t                m_OriginalId     = 0;
+        bool                    m_HasRequested   = false;
+        bool                    m_FinalUploaded  = false;
+
+        /* Shared with the worker, guarded by m_Mutex */
+        std::mutex              m_Mutex;
+        std::condition_variable m_RequestReady;
+        std::condition_variable m_ResultReady;
+        bool                    m_HasRequest     = false;
+        Request                 m_Request;
+        bool                    m_HasResult      = false;
+        Result                  m_Result;
+        bool                    m_Stopping       = false;
+
+        std::atomic<uint64_t>   m_Generation{0};  ///< Incremented by every request and discard
+
+        /* Worker thread only */
+        uint64_t                m_ReducedId      = 0;
+        TiledImage              m_Reduced;
+
+        std::thread             m_Worker;
+
+        void workerLoop();
+        bool renderReduced(const Request& request, std::vector<Sml::Color>* pixels);
+        void publish(uint64_t generation, bool isFinal, std::vector<Sml::Color>&& pixels);
+        void upload(const Result& result);
+        void reset();
+    };
+};
@@ -0,0 +1,99 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file frame_profiler.h
+ * @date 2021-12-30
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+#define PROFILE_ZONE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_ZONE_CONCAT(a, b) PROFILE_ZONE_CONCAT_IMPL(a, b)
+
+/**
+ * @brief Records the rest of the enclosing block as a zone, the name must outlive the
+ *        profiler (a string literal or FrameProfiler::intern()).
+ */
+#define PROFILE_ZONE(name) Paint::FrameProfiler::Zone PROFILE_ZONE_CONCAT(profileZone, __LINE__)(name)
+
+namespace Paint
+{
+    /**
+     * @brief Keeps the most recent zones (named timed scopes) of all threads, so that the
+     *        last seconds before a stutter can be saved as a Chrome trace on demand.
+     *
+     * A zone is written once, when it ends, into a fixed-size ring shared by all threads.
+     * Writers claim slots with a single fetch_add and never wait, the oldest zones are
+     * overwritten. A slot's sequence number tells the reader whether it was overwritten
+     * while being read.
+     */
+    class FrameProfiler
+    {
+    public:
+        static const size_t CAPACITY; ///< Zones kept, a power of two
+
+        class Zone
+        {
+        public:
+            explicit Zone(const char* name);
+            ~Zone();
+
+            Zone(const Zone& other) = delete;
+            Zone& operator=(const Zone& other) = delete;
+
+        private:
+            const char* m_Name  = nullptr;
+            uint64_t    m_Start = 0;      ///< 0 if the profiler is disabled
+        };
+
+        static FrameProfiler& getInstance();
+
+        static uint64_t getTimeNs(); ///< Monotonic
+
+    public:
+        FrameProfiler();
+
+        FrameProfiler(const FrameProfiler& other) = delete;
+        FrameProfiler& operator=(const FrameProfiler& other) = delete;
+
+        bool isEnabled() const;
+        void setEnabled(bool enabled);
+
+        /**
+         * @brief Stable copy of a dynamic name, e.g. of a filter or a plugin tool.
+         */
+        const char* intern(const std::string& name);
+
+        void record(const char* name, uint64_t start, uint64_t end);
+
+        /**
+         * @brief Writes the zones that ended within the last seconds as a Chrome trace (JSON
+         *        object format), which chrome://tracing and Perfetto open.
+         */
+        bool dump(const char* filename, double seconds) const;
+
+    private:
+        struct Slot
+        {
+            std::atomic<uint64_t>    sequence{0}; ///< Index of the zone + 1, 0 while being written
+            std::atomic<const char*> name{nullptr};
+            std::atomic<uint64_t>    start{0};
+            std::atomic<uint64_t>    end{0};
+            std::atomic<uint32_t>    thread{0};
+        };
+
+        std::atomic<bool>               m_Enabled{true};
+        std::atomic<uint64_t>           m_Head{0};
+        std::unique_ptr<Slot[]>         m_Slots;
+
+        std::mutex                      m_NamesMutex;
+        std::unordered_set<std::string> m_Names;
+    };
+};
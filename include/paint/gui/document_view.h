@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <vector>
 #include "sgl/scene/controls/scroll_pane.h"
 #include "../../inner_window.h"
 #include "../document.h"
@@ -26,6 +27,12 @@ namespace Paint
 
         Document* getDocument();
         InnerWindow* getView();
+        Canvas* getCanvas();
+
+        /**
+         * @return nullptr if the document isn't shown.
+         */
+        static DocumentView* findView(Document* document);
 
     private:
         Document*        m_Document   = nullptr;
@@ -33,25 +40,125 @@ namespace Paint
         Sgl::ScrollPane* m_ScrollPane = nullptr;
         Canvas*          m_Canvas     = nullptr;
         std::string      m_Title;
+
+        static std::vector<DocumentView*>& getViews();
     };
 
+    /**
+     * @brief Shows the document's canvas on a background, zoomed and panned.
+     *
+     * Only the visible part of the document is composed, from the mip level matching the
+     * zoom (see MipPyramid), into a level texture that is then scaled onto the surface.
+     * The level texture covers whole tiles around the visible part, so panning recomposes
+     * only the newly exposed tiles, and a new revision of the document only its changed
+     * region. The surface is reused across frames, so moving or overlapping document
+     * windows costs a single blit.
+     *
+     * Parts of the canvas outside the scene or under the windows stacked above it aren't
+     * composed or redrawn at all until they're uncovered, and a fully hidden canvas isn't
+     * even blitted.
+     */
     class Canvas : public Sgl::Container
     {
     public:
+        static const Sml::Color      BACKGROUND_COLOR;
         static const Sgl::ColorFill  BACKGROUND_FILL;
         static const Sgl::Background BACKGROUND;
 
+        static const float           MIN_ZOOM;
+        static const float           MAX_ZOOM;
+        static const float           ZOOM_STEP;
+        static const int32_t         MAX_PREF_WIDTH;  ///< Larger documents are initially zoomed out
+        static const int32_t         MAX_PREF_HEIGHT;
+
     public:
         Canvas(Document* document);
-        virtual ~Canvas() override = default;
+        virtual ~Canvas() override;
 
         Document* getDocument();
         void setDocument(Document* document);
 
-        Sml::Vec2i getTexturePos() const;
+        float getZoom() const;
+
+        /**
+         * @brief Zooms around the center of the view.
+         */
+        void setZoom(float zoom);
+        void zoomIn();
+        void zoomOut();
+        void fitToView();
+
+        /**
+         * @param delta In the view's pixels.
+         */
+        void pan(const Sml::Vec2i& delta);
+
+        /**
+         * @brief While on, dragging any canvas pans it instead of using the active tool.
+         */
+        static bool isPanMode();
+        static void setPanMode(bool panMode);
+
+        Sml::Vec2i viewToDocument(const Sml::Vec2i& localPos) const;
+        Sml::Vec2i documentToView(const Sml::Vec2i& documentPos) const;
+
+        /**
+         * @brief Parts of the canvas that aren't covered, in local coordinates.
+         */
+        const std::vector<Sml::Rectangle<int32_t>>& getVisibleRects() const;
 
     private:
-        Document* m_Document = nullptr;
+        Document*               m_Document        = nullptr;
+
+        float                   m_Zoom            = 1;
+        float                   m_CenterX         = 0; ///< Document point in the view's center
+        float                   m_CenterY         = 0;
+        int32_t                 m_PrefWidth       = 0;
+        int32_t                 m_PrefHeight      = 0;
+
+        std::vector<Sml::Rectangle<int32_t>> m_VisibleRects;
+        std::vector<Sml::Rectangle<int32_t>> m_ExposedRects; ///< Became visible, but not redrawn yet
+
+        size_t                  m_Level           = 0;
+        Sml::Rectangle<int32_t> m_LevelRect;           ///< Part of the level in the level texture
+        Sml::Texture*           m_LevelTexture    = nullptr;
+        std::vector<Sml::Color> m_LevelPixels;
+        std::vector<bool>       m_ComposedTiles;       ///< Tiles of m_LevelRect that are up to date
+        bool                    m_LevelValid      = false;
+        uint64_t                m_LevelRevision   = 0;
+
+        Sml::Texture*           m_Surface         = nullptr;
+        bool                    m_SurfaceValid    = false;
+        DirtyRegion             m_LevelChanges;        ///< Composed into the level, but not redrawn on the surface
+
+        static bool&            getPanModeFlag();
+
+        /**
+         * @brief Clips the canvas by the scene and subtracts the windows above it.
+         */
+        std::vector<Sml::Rectangle<int32_t>> computeVisibleRects();
+
+        size_t computeLevel() const;
+        Sml::Rectangle<int32_t> computeLevelRect(size_t level) const;
+        Sml::Rectangle<int32_t> mapViewToLevel(const Sml::Rectangle<int32_t>& rect, size_t level) const;
+        Sml::Rectangle<int32_t> mapLevelToView(const Sml::Rectangle<int32_t>& rect) const;
+
+        size_t getLevelTileColumns() const;
+        Sml::Rectangle<int32_t> getLevelTileRect(size_t index) const;
+
+        void updateLevel();
+        void moveLevelRect(const Sml::Rectangle<int32_t>& levelRect);
+        void composeVisibleTiles();
+        void composeLevel(const Sml::Rectangle<int32_t>& rect);
+
+        void updateSurface();
+
+        /**
+         * @brief Redraws the visible part of the rect from the level texture.
+         *
+         * @param rect In local coordinates.
+         */
+        void redrawSurface(const Sml::Rectangle<int32_t>& rect);
 
         virtual void prerenderSelf() override;
 
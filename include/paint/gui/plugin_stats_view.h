@@ -0,0 +1,45 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file plugin_stats_view.h
+ * @date 2021-12-29
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "sgl/scene/containers/box_container.h"
+#include "../plugin/plugin_profiler.h"
+
+namespace Paint
+{
+    /**
+     * @brief Text overlay with PluginProfiler's counters, a line per plugin and call type.
+     */
+    class PluginStatsView
+    {
+    public:
+        static const Sgl::ColorFill  DEFAULT_FILL;
+        static const Sgl::Background DEFAULT_BACKGROUND;
+        static const int32_t         UPDATE_INTERVAL; ///< In milliseconds
+
+    public:
+        PluginStatsView();
+        ~PluginStatsView() = default;
+
+        Sgl::Container* getView();
+
+        /**
+         * @brief Refreshes the text, at most once per UPDATE_INTERVAL.
+         */
+        void update();
+
+    private:
+        Sgl::VBox*                            m_View = nullptr;
+        std::vector<std::string>              m_Lines;
+        std::chrono::steady_clock::time_point m_LastUpdate;
+    };
+}
@@ -0,0 +1,128 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file history.h
+ * @date 2021-12-21
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <deque>
+#include "document.h"
+
+namespace Paint
+{
+    /**
+     * @brief Undo/redo history made of compressed per-tile deltas.
+     *
+     * A step snapshots the layer when it begins and, when it ends, keeps only the tiles
+     * whose pointers differ between the two snapshots. Thanks to copy-on-write tiles
+     * both finding and restoring the changes cost time proportional to the area that
+     * was actually modified. Tiles that are still in the layer's file aren't loaded for
+     * that, they can't have changed.
+     *
+     * Merging a layer down is a step of the layer below that also keeps the merged layer's
+     * compressed tiles and properties, so that undo can put it back above that layer.
+     */
+    class History
+    {
+    public:
+        static const size_t DEFAULT_MEMORY_BUDGET;
+
+    public:
+        History(size_t memoryBudget = DEFAULT_MEMORY_BUDGET);
+
+        void beginStep(Layer* layer);
+        void endStep();
+
+        /**
+         * @brief Like endStep(), for a step that also removed the layer right above the
+         *        recorded one (see Document::mergeLayerDown()). Undo puts that layer back
+         *        with the tiles and properties it had, redo removes it again.
+         */
+        void endStep(Document* document, const TiledImage& removedTiles,
+                     const LayerProperties& removedProperties);
+
+        bool isRecording() const;
+
+        /**
+         * @brief Records a step that has already happened, going from the snapshot to the
+         *        current state of the layer.
+         */
+        void addStep(Layer* layer, const TiledImage& before);
+
+        bool canUndo() const;
+        bool canRedo() const;
+        void undo();
+        void redo();
+
+        /**
+         * @brief Drops all steps that refer to the layer, must be called before deleting it.
+         *        If the layer was put back by undoing a merge, the steps that can be redone
+         *        are dropped too.
+         */
+        void forgetLayer(Layer* layer);
+        void clear();
+
+        size_t getStepCount() const;
+        size_t getMemoryUsage() const;
+
+        size_t getMemoryBudget() const;
+        void setMemoryBudget(size_t memoryBudget);
+
+    private:
+        struct CompressedTile
+        {
+            bool                 isEmpty = true; ///< Transparent tiles aren't stored at all
+            std::vector<uint8_t> data;
+        };
+
+        struct TileDelta
+        {
+            size_t         index;
+            CompressedTile before;
+            CompressedTile after;
+        };
+
+        struct StoredTile
+        {
+            size_t         index;
+            CompressedTile tile;
+        };
+
+        struct RemovedLayer
+        {
+            Document*               document = nullptr; ///< nullptr if the step didn't remove a layer
+            std::vector<StoredTile> tiles;              ///< Only the nonempty ones
+            LayerProperties         properties;
+            Layer*                  restored = nullptr; ///< Put back by undo, until redo removes it
+        };
+
+        struct Step
+        {
+            Layer*                 layer       = nullptr;
+            std::vector<TileDelta> deltas;
+            RemovedLayer           removed;
+            size_t                 memoryUsage = 0;
+        };
+
+        std::deque<Step> m_Steps;
+        size_t           m_AppliedSteps   = 0; ///< Steps before this index can be undone
+        size_t           m_MemoryUsage    = 0;
+        size_t           m_MemoryBudget   = 0;
+
+        Layer*           m_RecordingLayer = nullptr;
+        LazySnapshot     m_RecordingStart;
+
+        Step finishRecording();
+        void pushStep(Step&& step);
+
+        void apply(Step& step, bool undo);
+        void restoreRemovedLayer(Step& step);
+        void enforceMemoryBudget();
+
+        static CompressedTile compressTile(const TilePtr& tile);
+        static TilePtr decompressTile(const CompressedTile& compressed);
+    };
+};
@@ -0,0 +1,26 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file image_loader.h
+ * @date 2021-12-25
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include "tiled_image.h"
+
+namespace Paint
+{
+    /**
+     * @brief Decodes an image file (any format SDL_image supports) straight into tiles.
+     *
+     * SDL_image decodes the whole image at once, but its pixels are then converted into
+     * tiles a row of tiles at a time, without a converted copy of the whole image, and the
+     * decoded image is freed before anything else is made of the tiles. Fully transparent
+     * tiles aren't allocated.
+     *
+     * @return false if the file can't be opened or decoded.
+     */
+    bool loadImage(const char* filename, TiledImage* image);
+};
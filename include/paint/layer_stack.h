@@ -0,0 +1,216 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file layer_stack.h
+ * @date 2022-01-02
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "dirty_region.h"
+#include "blend.h"
+
+namespace Paint
+{
+    class Layer;
+
+    /**
+     * @brief Refers to a layer or a group of a LayerStack, stays valid while the stack
+     *        is being reordered and becomes invalid once the node is removed.
+     */
+    struct LayerHandle
+    {
+        static const uint32_t INVALID_SLOT;
+
+        uint32_t slot       = INVALID_SLOT;
+        uint32_t generation = 0;
+
+        bool isValid() const;
+
+        bool operator==(const LayerHandle& other) const;
+        bool operator!=(const LayerHandle& other) const;
+    };
+
+    /**
+     * @brief Group of layers, which are composed together and then blended as one layer.
+     */
+    class LayerGroup
+    {
+    public:
+        LayerGroup(size_t width, size_t height);
+
+        size_t getWidth() const;
+        size_t getHeight() const;
+
+        bool isVisible() const;
+        void setVisible(bool visible);
+
+        uint8_t getOpacity() const;
+        void setOpacity(uint8_t opacity);
+
+        BlendMode getBlendMode() const;
+        void setBlendMode(BlendMode mode);
+
+        /**
+         * @brief Changes of the group's own properties, its layers have their own regions.
+         */
+        const DirtyRegion& getDirtyRegion() const;
+        void clearDirtyRegion();
+
+    private:
+        size_t      m_Width     = 0;
+        size_t      m_Height    = 0;
+        DirtyRegion m_DirtyRegion;
+        bool        m_Visible   = true;
+        uint8_t     m_Opacity   = 255;
+        BlendMode   m_BlendMode = BlendMode::NORMAL;
+
+        void invalidate();
+    };
+
+    /**
+     * @brief Tree of layers and groups, stored as one array in the order they're composed.
+     *
+     * Nodes are kept bottom to top, a group right before its subtree, and each node knows
+     * its depth in the tree. So a subtree is a contiguous range of the array, and moving
+     * it is moving the range. Indices change with the order, handles don't.
+     */
+    class LayerStack
+    {
+    public:
+        LayerStack();
+        ~LayerStack();
+
+        LayerStack(const LayerStack& other) = delete;
+        LayerStack& operator=(const LayerStack& other) = delete;
+
+        size_t getSize() const;
+        bool isEmpty() const;
+
+        bool contains(LayerHandle handle) const;
+        size_t getIndex(LayerHandle handle) const;
+        LayerHandle getHandle(size_t index) const;
+
+        /**
+         * @return nullptr if the node is a group.
+         */
+        Layer* getLayer(size_t index) const;
+        Layer* getLayer(LayerHandle handle) const;
+
+        /**
+         * @return nullptr if the node is a layer.
+         */
+        LayerGroup* getGroup(size_t index) const;
+        LayerGroup* getGroup(LayerHandle handle) const;
+
+        LayerHandle findLayer(const Layer* layer) const;
+
+        size_t getDepth(size_t index) const;
+
+        /**
+         * @return Index past the last node of the subtree starting at the index.
+         */
+        size_t getSubtreeEnd(size_t index) const;
+
+        /**
+         * @return Invalid handle for top level nodes.
+         */
+        LayerHandle getParent(LayerHandle handle) const;
+
+        /**
+         * @return Invalid handle for the bottom node among its siblings.
+         */
+        LayerHandle getSiblingBelow(LayerHandle handle) const;
+
+        /**
+         * @brief Visible with nonzero opacity, doesn't check the parents.
+         */
+        bool isShown(size_t index) const;
+
+        BlendMode getBlendMode(size_t index) const;
+        uint8_t getOpacity(size_t index) const;
+        const DirtyRegion& getDirtyRegion(size_t index) const;
+        void clearDirtyRegion(size_t index);
+
+        /**
+         * @brief Puts the layer on top of the parent's children (or of the whole stack if the
+         *        parent is invalid) and takes ownership of it.
+         */
+        LayerHandle addLayer(std::unique_ptr<Layer> layer, LayerHandle parent = LayerHandle());
+        LayerHandle addGroup(std::unique_ptr<LayerGroup> group, LayerHandle parent = LayerHandle());
+
+        /**
+         * @brief Puts the layer right above the sibling (and its subtree, if it's a group)
+         *        and takes ownership of it.
+         */
+        LayerHandle addLayerAbove(std::unique_ptr<Layer> layer, LayerHandle sibling);
+
+        /**
+         * @brief Deletes the node, with its whole subtree if it's a group.
+         */
+        void remove(LayerHandle handle);
+
+        /**
+         * @brief Moves the node (with its subtree) to the parent's children.
+         *
+         * @param position Among the parent's other children, 0 is the bottom.
+         */
+        void move(LayerHandle handle, LayerHandle parent, size_t position);
+
+        /**
+         * @brief Puts a copy of the node right above it. Layers share their tiles with the
+         *        originals until either of them is drawn on.
+         */
+        LayerHandle duplicate(LayerHandle handle);
+
+        /**
+         * @brief Blends the layer onto the layer right below it with its blend mode and opacity,
+         *        then removes it. Only the tiles the upper layer isn't transparent in are changed.
+         *
+         * @return false if there's no layer right below it (e.g. it's a group or the bottom).
+         */
+        bool mergeDown(LayerHandle handle);
+
+    private:
+        struct Node
+        {
+            std::unique_ptr<Layer>      layer;
+            std::unique_ptr<LayerGroup> group;
+            uint32_t                    depth = 0;
+            LayerHandle                 handle;
+        };
+
+        struct Slot
+        {
+            uint32_t index      = 0;
+            uint32_t generation = 0;
+            bool     isUsed     = false;
+        };
+
+        std::vector<Node>     m_Nodes;
+        std::vector<Slot>     m_Slots;
+        std::vector<uint32_t> m_FreeSlots;
+
+        /**
+         * @return Handle of the first of the nodes.
+         */
+        LayerHandle insert(size_t index, std::vector<Node>&& nodes);
+        LayerHandle allocateSlot();
+
+        /**
+         * @brief Index the parent's subtree ends at, i.e. where its new top child goes.
+         */
+        size_t getInsertIndex(LayerHandle parent) const;
+
+        /**
+         * @brief Brings the slots up to date after the nodes from the index on moved.
+         */
+        void updateSlots(size_t first);
+
+        LayerHandle findSiblingBelow(size_t index) const;
+        Node duplicateNode(const Node& node) const;
+    };
+};
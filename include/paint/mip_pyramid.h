@@ -0,0 +1,73 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file mip_pyramid.h
+ * @date 2022-01-03
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <vector>
+#include "tiled_image.h"
+
+namespace Paint
+{
+    /**
+     * @brief Downscaled copies of an image, each level half the size of the previous one.
+     *
+     * Level 0 is the image itself and isn't stored here. The other levels are allocated on
+     * first use and their tiles are only recomputed (from the finer level) when they're
+     * requested after the corresponding part of the image changed.
+     */
+    class MipPyramid
+    {
+    public:
+        MipPyramid(size_t width, size_t height);
+
+        static size_t getLevelSize(size_t size, size_t level);
+
+        /**
+         * @brief The smallest rect of the level covering the level 0 rect.
+         */
+        static Sml::Rectangle<int32_t> getLevelRect(const Sml::Rectangle<int32_t>& rect, size_t level);
+
+        /**
+         * @param rect Changed part of level 0.
+         */
+        void markStale(const Sml::Rectangle<int32_t>& rect);
+
+        /**
+         * @brief Clears the stale flags of the level's tiles covering the rect, so they must be
+         *        recomputed with downsample() right away.
+         *
+         * @return Indices of the tiles that were stale.
+         */
+        std::vector<size_t> takeStaleTiles(size_t level, const Sml::Rectangle<int32_t>& rect);
+
+        /**
+         * @brief Part of the finer level the rect of the level is computed from.
+         */
+        Sml::Rectangle<int32_t> getSourceRect(size_t level, const Sml::Rectangle<int32_t>& rect) const;
+
+        /**
+         * @param finer Level - 1, up to date in the source rects of the tiles.
+         */
+        void downsample(size_t level, const std::vector<size_t>& tiles, const TiledImage& finer);
+
+        const TiledImage& getLevel(size_t level) const;
+
+    private:
+        struct Level
+        {
+            TiledImage        pixels;
+            std::vector<bool> staleTiles;
+        };
+
+        size_t             m_Width  = 0;
+        size_t             m_Height = 0;
+        std::vector<Level> m_Levels; ///< Starting from level 1
+
+        Level& allocateLevel(size_t level);
+    };
+};
@@ -11,6 +11,9 @@
 #include <list>
 #include "plugin/plugin_api.h"
 #include "document.h"
+#include "history.h"
+#include "filter_preview.h"
+#include "autosave.h"
 #include "tool.h"
 #include "filter.h"
 
@@ -37,12 +40,53 @@ namespace Paint
 
         void applyFilter(Filter* filter);
 
+        /**
+         * @brief Runs the filter in background on the active layer, see FilterPreview.
+         *
+         * Falls back to applyFilter() for filters that don't provide a kernel.
+         */
+        void previewFilter(Filter* filter);
+        void commitFilterPreview();
+        void cancelFilterPreview();
+        FilterPreview& getFilterPreview();
+
+        /**
+         * @brief Must be called once per frame from the UI thread.
+         */
+        void update();
+
+        /**
+         * @brief Requests a new frame for changes that neither come from events nor
+         *        mark a document dirty.
+         */
+        void invalidate();
+        void validate(); ///< Called after a frame has been rendered
+
+        /**
+         * @brief Whether there were invalidations or changes to documents since the last frame.
+         */
+        bool needsRedraw() const;
+
+        /**
+         * @brief Whether background work is in progress that will need a redraw once finished.
+         */
+        bool hasPendingWork() const;
+
+        History& getHistory();
+        AutosaveService& getAutosave();
+
         Document* getActiveDocument();
         void setActiveDocument(Document* document); ///< The document must be in the documents list!
 
         const std::list<Document*>& getDocuments() const;
         void addDocument(Document* document);
 
+        /**
+         * @brief Forgets everything the editor keeps about the document (its history steps,
+         *        filter preview and autosave), must be called before deleting it.
+         */
+        void removeDocument(Document* document);
+
         // const std::list<plugin::IPlugin*>& getPlugins() const;
         // void addPlugin(plugin::IPlugin* plugin);
 
@@ -60,6 +104,10 @@ namespace Paint
 
         std::list<Filter*>   m_Filters;
 
+        History              m_History;
+        FilterPreview        m_FilterPreview;
+        AutosaveService      m_Autosave;
+
         Document*            m_ActiveDocument = nullptr;
         std::list<Document*> m_Documents;
 
@@ -68,6 +116,8 @@ namespace Paint
         Sml::Color           m_Background = Sml::COLOR_WHITE;
         Sml::Color           m_Foreground = Sml::COLOR_BLACK;
 
+        bool                 m_Invalidated    = true;
+
     private:
         Editor() = default;
     };
@@ -0,0 +1,58 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file pixel_buffer.h
+ * @date 2021-12-23
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <vector>
+#include "dirty_region.h"
+
+namespace Paint
+{
+    /**
+     * @brief CPU copies of regions of a texture, allocated per lock.
+     *
+     * The texture always holds the actual pixels. Locking a region reads it back into a
+     * buffer of its own, unlocking uploads the buffer if it was modified and frees it. So
+     * accessing pixels costs memory and time proportional to the region that is touched
+     * rather than to the size of the texture.
+     */
+    class PixelBuffer
+    {
+    public:
+        PixelBuffer(Sml::Texture* texture);
+
+        int32_t getWidth() const;
+        int32_t getHeight() const;
+
+        /**
+         * @return Pixels of the rect clipped by the texture (stride is the clipped width),
+         *         valid until the rect is unlocked.
+         */
+        Sml::Color* lock(const Sml::Rectangle<int32_t>& rect);
+        void unlock(const Sml::Rectangle<int32_t>& rect, bool modified);
+
+        /**
+         * @brief Replaces the texture's pixels, tightly packed.
+         */
+        void load(const Sml::Color* pixels);
+
+        Sml::Rectangle<int32_t> clip(const Sml::Rectangle<int32_t>& rect) const;
+
+    private:
+        struct Region
+        {
+            Sml::Rectangle<int32_t> rect;
+            std::vector<Sml::Color> pixels;
+        };
+
+        Sml::Texture*       m_Texture = nullptr;
+        int32_t             m_Width   = 0;
+        int32_t             m_Height  = 0;
+        std::vector<Region> m_Locked;
+    };
+};
@@ -0,0 +1,51 @@
+#ifndef _PLUGIN_EXT_HPP_INCLUDED_
+#define _PLUGIN_EXT_HPP_INCLUDED_
+
+#include "plugin_api.h"
+
+/*
+ * Optional extensions of the plugin API. They don't change any of the interfaces in
+ * plugin_api.h, so plugins built without this header keep working.
+ *
+ * The host exports GetTextureExt. A plugin looks it up at runtime and falls back to
+ * the plain ITexture API if it's missing:
+ *
+ *     auto getExt = (plugin::GetTextureExtFunction) dlsym(RTLD_DEFAULT, "GetTextureExt");
+ *     plugin::ITextureExt* ext = getExt ? getExt(canvas, plugin::kTextureExtVersion) : nullptr;
+ */
+
+namespace plugin {
+
+const uint32_t kTextureExtVersion = 1;
+
+struct BufferRegion {
+    color_t* pixels;   // points to the region's top-left pixel
+    int32_t  stride;   // distance between rows in pixels
+    int32_t  x;
+    int32_t  y;
+    int32_t  size_x;
+    int32_t  size_y;
+};
+
+class ITextureExt {
+  public:
+    virtual ~ITextureExt() {}
+
+    virtual uint32_t GetExtVersion() = 0;
+
+    // Gives direct access to a copy of the region, clipped to the texture. The copy is
+    // made for this lock and is valid until the region is unlocked.
+    virtual BufferRegion LockBuffer(int32_t x, int32_t y, int32_t size_x, int32_t size_y) = 0;
+
+    // Uploads the region back to the texture if it was modified.
+    virtual void UnlockBuffer(const BufferRegion& region, bool modified) = 0;
+};
+
+// Returns nullptr if the texture doesn't support the requested version.
+typedef ITextureExt* (*GetTextureExtFunction)(ITexture* texture, uint32_t version);
+
+extern "C" ITextureExt* GetTextureExt(ITexture* texture, uint32_t version);
+
+} // namespace plugin
+
+#endif /* _PLUGIN_EXT_HPP_INCLUDED_ */
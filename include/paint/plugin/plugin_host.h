@@ -0,0 +1,214 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file plugin_host.h
+ * @date 2021-12-28
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <atomic>
+#include "../document.h"
+#include "plugin_manager.h"
+
+namespace Paint
+{
+    //------------------------------------------------------------------------------
+    // Memory shared with the host process
+    //------------------------------------------------------------------------------
+    constexpr uint32_t HOST_MAGIC              = 0x53334850; ///< "S3HP"
+    constexpr size_t   HOST_RING_SIZE          = 64;
+    constexpr size_t   HOST_MAX_PATH           = 1024;
+    constexpr size_t   HOST_MAX_TOOLS          = 32;
+    constexpr size_t   HOST_MAX_NAME           = 128;
+    constexpr size_t   HOST_MAX_RESPONSE_RECTS = 16;
+
+    enum class HostRequestType : uint32_t
+    {
+        LOAD,
+        ACTION_BEGIN,
+        ACTION,
+        ACTION_END
+    };
+
+    struct HostRequest
+    {
+        HostRequestType type;
+        int32_t         library;
+        int32_t         tool;
+        int32_t         x;
+        int32_t         y;
+        int32_t         dx;
+        int32_t         dy;
+        int32_t         canvasWidth;  ///< Only set for ACTION_BEGIN
+        int32_t         canvasHeight;
+    };
+
+    struct HostRect
+    {
+        int32_t x;
+        int32_t y;
+        int32_t width;
+        int32_t height;
+    };
+
+    /**
+     * @brief Result of a single request, with all the canvas regions drawn by the event.
+     */
+    struct HostResponse
+    {
+        int32_t  status;    ///< 0 on success
+        uint32_t rectCount;
+        HostRect rects[HOST_MAX_RESPONSE_RECTS];
+    };
+
+    /**
+     * @brief Lock-free single producer single consumer queue in shared memory. Only the
+     *        producer writes head, only the consumer writes tail.
+     */
+    template <typename T>
+    struct HostRing
+    {
+        std::atomic<uint32_t> head;
+        std::atomic<uint32_t> tail;
+        T                     slots[HOST_RING_SIZE];
+
+        bool isEmpty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+        bool isFull() const  { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire) == HOST_RING_SIZE; }
+
+        T& back()    { return slots[head.load(std::memory_order_relaxed) % HOST_RING_SIZE]; }
+        void push()  { head.fetch_add(1, std::memory_order_release); }
+
+        T& front()   { return slots[tail.load(std::memory_order_relaxed) % HOST_RING_SIZE]; }
+        void pop()   { tail.fetch_add(1, std::memory_order_release); }
+    };
+
+    /**
+     * @brief Arguments and results of LOAD, there's only ever one in flight.
+     */
+    struct HostLoadArea
+    {
+        char     path[HOST_MAX_PATH];
+        int32_t  library;
+        uint32_t version;
+        uint32_t toolCount;
+        char     toolNames[HOST_MAX_TOOLS][HOST_MAX_NAME];
+        char     toolIcons[HOST_MAX_TOOLS][HOST_MAX_NAME];
+    };
+
+    /**
+     * @brief Beginning of the shared memory, the canvas (canvasWidth * canvasHeight pixels
+     *        of the latest ACTION_BEGIN) follows at HOST_CANVAS_OFFSET.
+     */
+    struct HostSharedMemory
+    {
+        uint32_t               magic;
+        HostRing<HostRequest>  requests;
+        HostRing<HostResponse> responses;
+        HostLoadArea           load;
+    };
+
+    constexpr size_t HOST_CANVAS_OFFSET = (sizeof(HostSharedMemory) + 4095) / 4096 * 4096;
+
+    //------------------------------------------------------------------------------
+    // Editor side
+    //------------------------------------------------------------------------------
+    /**
+     * @brief Runs plugins in a separate process, so that a crashing plugin doesn't take the
+     *        editor down and a slow one doesn't freeze it.
+     *
+     * The host is the editor's own executable started with SERVER_ARGUMENT. Requests and
+     * responses go through rings in a memfd, with an eventfd per direction for wakeups.
+     * The layer being drawn on is mirrored in the same memfd: tiles that changed since the
+     * previous stroke are copied there when a stroke begins, and the plugin draws on them
+     * in place. Events are posted without waiting, every response lists the regions its
+     * event drew, which update() copies to the layer once per frame.
+     *
+     * A host that crashes or doesn't respond within RESPONSE_TIMEOUT is killed and started
+     * again on the next request, see getGeneration().
+     */
+    class PluginHost
+    {
+    public:
+        static const char* const SERVER_ARGUMENT;
+        static const int32_t     RESPONSE_TIMEOUT; ///< In milliseconds
+
+        /**
+         * @brief Whether the process was started as a host, main() then must return runServer().
+         */
+        static bool isServer(int32_t argc, const char* argv[]);
+        static int runServer(int32_t argc, const char* argv[]);
+
+    public:
+        PluginHost() = default;
+        ~PluginHost();
+
+        PluginHost(const PluginHost& other) = delete;
+        PluginHost& operator=(const PluginHost& other) = delete;
+
+        bool isRunning() const;
+
+        /**
+         * @brief Incremented every time the host is started, library ids are only valid
+         *        within the generation they were loaded in.
+         */
+        uint64_t getGeneration() const;
+
+        /**
+         * @brief Loads the library in the host (once per generation) and creates its plugin.
+         *
+         * @return Whether the plugin was created, version and tools are filled in either way
+         *         if the library could be opened.
+         */
+        bool loadLibrary(const char* filename, int32_t* library, uint32_t* version, std::vector<PluginToolInfo>* tools);
+
+        bool beginAction(Layer* layer, int32_t library, int32_t tool, const Sml::Vec2i& pos);
+        void postAction(const Sml::Vec2i& pos, const Sml::Vec2i& displacement);
+        void endAction(const Sml::Vec2i& pos); ///< Waits for all the events of the stroke
+
+        /**
+         * @brief Copies the regions drawn by the finished events to the layer, UI thread only.
+         */
+        void update();
+
+        /**
+         * @brief Waits for all the posted requests, restarting a host that doesn't respond.
+         */
+        void wait();
+
+        bool isBusy() const; ///< Posted requests haven't finished yet
+
+        uint64_t getTransferredBytes() const; ///< Copied between layers and the canvas so far
+
+    private:
+        pid_t             m_Pid           = -1;
+        uint64_t          m_Generation    = 0;
+        int               m_MemoryFd      = -1;
+        int               m_RequestEvent  = -1;
+        int               m_ResponseEvent = -1;
+        int               m_DeathPipe     = -1; ///< Hangs up when the host exits
+        HostSharedMemory* m_Memory        = nullptr;
+        size_t            m_MappedSize    = 0;
+        size_t            m_Pending       = 0;
+        uint64_t          m_Transferred   = 0;
+
+        Layer*            m_Layer         = nullptr;
+        int32_t           m_Width         = 0;
+        int32_t           m_Height        = 0;
+        TiledImage        m_SharedTiles;              ///< Layer's tiles that the canvas holds
+
+        bool start();
+        void stop();
+
+        bool map(size_t size);
+        Sml::Color* getCanvas();
+        void handOffTiles(Layer* layer);
+
+        bool post(const HostRequest& request);
+        bool waitForResponse(int32_t timeout);
+        bool collect();
+        void upload(const HostResponse& response);
+    };
+};
@@ -0,0 +1,128 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file plugin_manager.h
+ * @date 2021-12-27
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plugin_api.h"
+
+namespace Paint
+{
+    class PluginHost;
+
+    struct PluginToolInfo
+    {
+        std::string name;
+        std::string iconFilename;
+    };
+
+    /**
+     * @brief Shared library of a plugin, opened and instantiated on demand.
+     */
+    class PluginLibrary
+    {
+    public:
+        PluginLibrary(const std::string& filename, plugin::IAPI* api);
+        ~PluginLibrary();
+
+        PluginLibrary(const PluginLibrary& other) = delete;
+        PluginLibrary& operator=(const PluginLibrary& other) = delete;
+
+        const std::string& getFilename() const;
+
+        /**
+         * @brief Loads the library and checks its version, can be called from any thread.
+         *
+         * @return Whether the library is compatible with the plugin API.
+         */
+        bool open();
+
+        uint32_t getVersion() const; ///< 0 if the library couldn't be opened or exports no Version()
+
+        /**
+         * @brief Opens the library and creates the plugin on the first call. Must be called
+         *        from the UI thread, as plugins create textures and widgets.
+         *
+         * @return nullptr if the library is incompatible or failed to create the plugin.
+         */
+        plugin::IPlugin* getPlugin();
+
+    private:
+        std::string          m_Filename;
+        plugin::IAPI*        m_API     = nullptr;
+
+        mutable std::mutex   m_Mutex;
+        void*                m_Handle  = nullptr;
+        bool                 m_Opened  = false;
+        uint32_t             m_Version = 0;
+
+        plugin::IPlugin*     m_Plugin  = nullptr;
+        bool                 m_Created = false;
+    };
+
+    /**
+     * @brief Registers plugin tools in the editor without loading the plugins at startup.
+     *
+     * Names and icons of the tools are read from a manifest in the plugins directory, which
+     * is keyed by the libraries' modification times and sizes. Only libraries missing from
+     * it or changed since are loaded right away, in parallel. The rest are opened in the
+     * background by preload() and instantiated when one of their tools is first used.
+     *
+     * With a PluginHost the plugins are loaded in the host process instead, see RemotePluginTool.
+     */
+    class PluginManager
+    {
+    public:
+        static const char* const MANIFEST_FILENAME;
+        static const char* const LIBRARY_EXTENSION;
+
+    public:
+        /**
+         * @param host If not nullptr, plugins are run in the host process.
+         */
+        PluginManager(const char* directory, plugin::IAPI* api, PluginHost* host = nullptr);
+        ~PluginManager();
+
+        PluginManager(const PluginManager& other) = delete;
+        PluginManager& operator=(const PluginManager& other) = delete;
+
+        void loadTools();
+
+        /**
+         * @brief Opens the libraries that haven't been yet on a background thread, so
+         *        that first use of a tool only has to create the plugin.
+         */
+        void preload();
+
+    private:
+        struct ManifestEntry
+        {
+            std::string                 filename;
+            int64_t                     modified = 0; ///< In nanoseconds
+            int64_t                     size     = 0;
+            uint32_t                    version  = 0;
+            std::vector<PluginToolInfo> tools;
+        };
+
+        std::string                                 m_Directory;
+        plugin::IAPI*                               m_API  = nullptr;
+        PluginHost*                                 m_Host = nullptr;
+        std::vector<std::unique_ptr<PluginLibrary>> m_Libraries;
+        std::thread                                 m_Preloader;
+
+        std::vector<ManifestEntry> readManifest() const;
+        void writeManifest(const std::vector<ManifestEntry>& entries) const;
+
+        void createEntry(PluginLibrary* library, ManifestEntry* entry);
+        void registerTools(PluginLibrary* library, const ManifestEntry& entry);
+    };
+};
@@ -0,0 +1,149 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file plugin_profiler.h
+ * @date 2021-12-29
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Paint
+{
+    enum class PluginCall : uint32_t
+    {
+        ACTION_BEGIN,
+        ACTION,
+        ACTION_END,
+        READ_BUFFER,
+        LOAD_BUFFER,
+        LOCK_BUFFER,
+        UNLOCK_BUFFER,
+        DRAW,          ///< Recording a primitive, they are rasterized by FLUSH
+        COPY_TEXTURE,
+        FLUSH,
+        HOST_TRANSFER, ///< Moving pixels between a layer and the plugin host's canvas
+
+        COUNT
+    };
+
+    /**
+     * @brief Latency and traffic counters of plugin calls, per plugin and per call type.
+     *
+     * Every thread accumulates into its own block of counters, which only it writes to, so
+     * recording a call takes two clock reads and a few relaxed stores. Texture calls are
+     * attributed to the plugin whose tool action is running on the thread, see Scope.
+     */
+    class PluginProfiler
+    {
+    public:
+        static constexpr size_t MAX_PLUGINS       = 64; ///< Plugins registered after that share the last id
+        static constexpr size_t HISTOGRAM_BUCKETS = 16; ///< 0 is < 1us, i is [2^(i-1), 2^i) us, last is the rest
+
+        struct CallStats
+        {
+            uint64_t              calls   = 0;
+            uint64_t              totalNs = 0;
+            uint64_t              maxNs   = 0;
+            uint64_t              bytes   = 0;
+            std::vector<uint64_t> histogram;
+
+            double getAverageUs() const;
+            double getPercentileUs(double percentile) const; ///< Upper bound of the bucket
+        };
+
+        struct PluginStats
+        {
+            std::string            name;
+            std::vector<CallStats> calls; ///< Indexed by PluginCall
+        };
+
+        /**
+         * @brief Times a call and makes the plugin current on the thread for its duration.
+         */
+        class Scope
+        {
+        public:
+            Scope(uint32_t plugin, PluginCall call, uint64_t bytes = 0);
+            explicit Scope(PluginCall call, uint64_t bytes = 0); ///< Of the current plugin
+            ~Scope();
+
+            Scope(const Scope& other) = delete;
+            Scope& operator=(const Scope& other) = delete;
+
+            void addBytes(uint64_t bytes);
+
+        private:
+            uint32_t                              m_Plugin         = 0;
+            uint32_t                              m_PreviousPlugin = 0;
+            PluginCall                            m_Call           = PluginCall::COUNT;
+            uint64_t                              m_Bytes          = 0;
+            bool                                  m_Enabled        = false;
+            std::chrono::steady_clock::time_point m_Start;
+        };
+
+        static const char* getCallName(PluginCall call);
+
+        static PluginProfiler& getInstance();
+
+    public:
+        PluginProfiler();
+
+        PluginProfiler(const PluginProfiler& other) = delete;
+        PluginProfiler& operator=(const PluginProfiler& other) = delete;
+
+        bool isEnabled() const;
+        void setEnabled(bool enabled);
+
+        /**
+         * @brief Thread-safe, the same name always gets the same id. Id 0 is the editor
+         *        itself, for texture calls made outside of any plugin.
+         */
+        uint32_t registerPlugin(const std::string& name);
+
+        /**
+         * @brief Sums the counters of all threads, skipping plugins with no calls.
+         */
+        std::vector<PluginStats> collect() const;
+
+        void reset();
+
+        /**
+         * @brief Writes the counters as JSON lines, one per plugin and call type.
+         */
+        bool dump(const char* filename) const;
+
+    private:
+        struct Counter
+        {
+            std::atomic<uint64_t> calls{0};
+            std::atomic<uint64_t> totalNs{0};
+            std::atomic<uint64_t> maxNs{0};
+            std::atomic<uint64_t> bytes{0};
+            std::atomic<uint64_t> histogram[HISTOGRAM_BUCKETS] = {};
+        };
+
+        struct ThreadBlock
+        {
+            std::atomic<uint64_t>      epoch{0};
+            std::unique_ptr<Counter[]> counters; ///< MAX_PLUGINS * PluginCall::COUNT
+        };
+
+        std::atomic<bool>                         m_Enabled{true};
+        std::atomic<uint64_t>                     m_Epoch{0};   ///< Incremented by reset()
+
+        mutable std::mutex                        m_Mutex;
+        std::vector<std::string>                  m_Names;
+        std::vector<std::unique_ptr<ThreadBlock>> m_Blocks;     ///< Kept after their threads exit
+
+        ThreadBlock* getThreadBlock();
+        void record(uint32_t plugin, PluginCall call, uint64_t ns, uint64_t bytes);
+    };
+};
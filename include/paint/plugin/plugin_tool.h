@@ -8,15 +8,25 @@
 
 #pragma once
 
+#include <string>
 #include "../tool.h"
-#include "plugin_api.h"
+#include "../document.h"
+#include "plugin_manager.h"
+#include "plugin_host.h"
+#include "plugin_profiler.h"
 
 namespace Paint
 {
+    /**
+     * @brief Tool of a plugin that is only created when the tool is first used.
+     */
     class PluginTool : public Paint::Tool
     {
     public:
-        PluginTool(plugin::ITool* tool);
+        /**
+         * @param index Index of the tool in the plugin's GetTools().
+         */
+        PluginTool(PluginLibrary* library, size_t index, const char* name, const char* iconFilename);
 
         virtual ~PluginTool() override;
 
@@ -29,7 +39,52 @@ namespace Paint
         virtual void onActionEnd(const Sml::Vec2i& pos) override;
 
     private:
+        PluginLibrary* m_Library      = nullptr; ///< Reset once the tool has been resolved
+        size_t         m_Index        = 0;
         plugin::ITool* m_PluginTool   = nullptr;
-        char*          m_IconFilename = nullptr;
+        std::string    m_Name;
+        std::string    m_IconFilename;
+        uint32_t       m_ProfilerId   = 0;
+        const char*    m_ZoneName     = nullptr; ///< Of the frame profiler
+
+        plugin::ITool* getPluginTool();
+    };
+
+    /**
+     * @brief Tool of a plugin loaded in the PluginHost process. Events are posted to the
+     *        host without waiting, the drawn regions reach the layer in onUpdate().
+     *
+     * Plugin widgets aren't shown, so the tool has no preferences panel.
+     */
+    class RemotePluginTool : public Paint::Tool
+    {
+    public:
+        RemotePluginTool(PluginHost* host, const std::string& filename, size_t index, const char* name,
+                         const char* iconFilename);
+
+        virtual const char* getName() const override;
+        virtual const char* getIconFilename() const override;
+
+        virtual void onActionStart(const Sml::Vec2i& pos) override;
+        virtual void onAction(const Sml::Vec2i& pos, const Sml::Vec2i& displacement) override;
+        virtual void onActionEnd(const Sml::Vec2i& pos) override;
+
+        virtual void onUpdate() override;
+        virtual bool hasPendingWork() const override;
+
+    private:
+        PluginHost* m_Host         = nullptr;
+        std::string m_Filename;
+        size_t      m_Index        = 0;
+        std::string m_Name;
+        std::string m_IconFilename;
+
+        int32_t     m_Library      = -1; ///< Id in the host's generation m_Generation
+        uint64_t    m_Generation   = 0;
+        bool        m_Active       = false;
+        uint32_t    m_ProfilerId   = 0;
+        const char* m_ZoneName     = nullptr; ///< Of the frame profiler
+
+        bool ensureLoaded();
     };
-}
\ No newline at end of file
+}
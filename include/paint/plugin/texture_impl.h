@@ -9,14 +9,30 @@
 #pragma once
 
 #include "sml/sml_graphics_wrapper.h"
+#include "../document.h"
+#include "../pixel_buffer.h"
 #include "plugin_api.h"
+#include "plugin_api_ext.h"
 
 namespace plugin
 {
-    class TextureImpl : public ITexture
+    /**
+     * @brief Pixel access goes through copies of the locked regions, read from the layer's
+     *        tiles if the texture belongs to a layer and through a PixelBuffer otherwise.
+     *        ReadBuffer() returns a copy of the whole texture, only the ITextureExt lock gives
+     *        plugins direct access to a locked region.
+     *
+     * Drawing primitives are recorded and executed in a single render target bind when
+     * the texture is presented, accessed in any other way or destroyed.
+     */
+    class TextureImpl : public ITexture, public ITextureExt
     {
     public:
-        TextureImpl(Sml::Texture* texture);
+        /**
+         * @param layer If the texture belongs to a document layer, the layer to report
+         *              modified regions to.
+         */
+        TextureImpl(Sml::Texture* texture, Paint::Layer* layer = nullptr);
         virtual ~TextureImpl() override;
 
         virtual int32_t GetSizeX() override;
@@ -36,10 +52,51 @@ namespace plugin
         virtual void CopyTexture(ITexture* source, int32_t x, int32_t y, int32_t size_x, int32_t size_y) override;
         virtual void CopyTexture(ITexture* source, int32_t x, int32_t y) override;
 
+        virtual uint32_t GetExtVersion() override;
+        virtual BufferRegion LockBuffer(int32_t x, int32_t y, int32_t size_x, int32_t size_y) override;
+        virtual void UnlockBuffer(const BufferRegion& region, bool modified) override;
+
         const Sml::Texture* GetTexture() const;
 
     private:
-        Sml::Texture* m_Texture = nullptr;
+        struct DrawCommand
+        {
+            enum class Type
+            {
+                CLEAR,
+                LINE,
+                CIRCLE,
+                RECT
+            };
+
+            Type type;
+
+            union
+            {
+                color_t clearColor;
+                Line    line;
+                Circle  circle;
+                Rect    rect;
+            };
+        };
+
+        Sml::Texture*                       m_Texture     = nullptr;
+        Paint::Layer*                       m_Layer       = nullptr;
+        std::unique_ptr<Paint::PixelBuffer> m_PixelBuffer; ///< Only used if there's no layer
+
+        mutable std::vector<DrawCommand>    m_Commands;
+
+        void flush() const;
+        Sml::Rectangle<int32_t> getCommandBounds(const DrawCommand& command) const;
+
+        void markDirty(const Sml::Rectangle<int32_t>& rect) const;
+        void markDirty() const;
+
+        Sml::Color* lockPixels(const Sml::Rectangle<int32_t>& rect);
+        void unlockPixels(const Sml::Rectangle<int32_t>& rect, bool modified);
+        Paint::PixelBuffer& getPixelBuffer();
+        Sml::Rectangle<int32_t> getBounds() const;
+        uint64_t getBufferSize() const; ///< In bytes, for profiling
     };
 
     class TextureFactoryImpl : public ITextureFactory
@@ -0,0 +1,100 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file stroke_engine.h
+ * @date 2021-12-24
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include "document.h"
+
+namespace Paint
+{
+    /**
+     * @brief Round coverage mask of a dab, opaque up to hardness * radius and smoothly
+     *        fading out towards the edge.
+     */
+    class BrushTip
+    {
+    public:
+        BrushTip() = default;
+        BrushTip(int32_t diameter, float hardness);
+
+        int32_t getDiameter() const;
+        float getHardness() const;
+
+        const uint8_t* getMask() const; ///< diameter * diameter coverage values
+
+    private:
+        int32_t              m_Diameter = 0;
+        float                m_Hardness = 1;
+        std::vector<uint8_t> m_Mask;
+    };
+
+    struct StrokeSettings
+    {
+        int32_t    diameter = 10;
+        float      hardness = 1;
+        float      opacity  = 1;
+        float      spacing  = 0.15f;             ///< Distance between dabs relative to the diameter
+        Sml::Color color    = Sml::COLOR_BLACK;
+        bool       erase    = false;             ///< Reduce the layer's alpha instead of painting
+    };
+
+    /**
+     * @brief Turns pointer positions into evenly spaced dabs along a Catmull-Rom spline.
+     *
+     * Dabs are accumulated into a coverage buffer (taking the maximum, so overlapping
+     * dabs don't build up past the opacity) and applied to the layer by composite(),
+     * which is meant to be called once per frame. So the cost of a stroke depends on its
+     * length and the frame rate, not on how many input events arrive.
+     */
+    class StrokeEngine
+    {
+    public:
+        void begin(Layer* layer, const StrokeSettings& settings);
+        void addPoint(const Sml::Vec2i& pos);
+        void end();
+
+        bool isActive() const;
+
+        /**
+         * @brief Applies the dabs placed since the previous call to the layer.
+         */
+        void composite();
+
+        size_t getDabCount() const; ///< Dabs placed during the current (or the last) stroke
+
+    private:
+        struct Point
+        {
+            float x;
+            float y;
+        };
+
+        Layer*                  m_Layer         = nullptr;
+        StrokeSettings          m_Settings;
+        BrushTip                m_Tip;
+        std::vector<uint8_t>    m_DabMask;       ///< Tip mask scaled by the opacity
+
+        LazySnapshot            m_Original;      ///< Layer before the stroke
+        std::vector<uint8_t>    m_Coverage;
+        int32_t                 m_Width         = 0;
+        int32_t                 m_Height        = 0;
+        Sml::Rectangle<int32_t> m_StrokeBounds  = {0, 0, 0, 0};
+        DirtyRegion             m_PendingRegion;
+
+        Point                   m_Points[4];     ///< Control points of the current spline segment
+        size_t                  m_PointCount    = 0;
+        Point                   m_LastSample    = {0, 0};
+        float                   m_DistanceToDab = 0;
+        size_t                  m_DabCount      = 0;
+
+        void processSegment(const Point& p0, const Point& p1, const Point& p2, const Point& p3);
+        void walkTo(const Point& point);
+        void placeDab(const Point& center);
+        void compositeRect(const Sml::Rectangle<int32_t>& rect);
+    };
+};
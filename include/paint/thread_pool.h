@@ -0,0 +1,83 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file thread_pool.h
+ * @date 2021-12-22
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Paint
+{
+    /**
+     * @brief Fixed set of worker threads, each with its own task queue.
+     *
+     * A worker takes tasks from the back of its own queue and, once it runs out of them,
+     * steals from the front of the others' ones. The thread waiting for a batch of tasks
+     * helps executing them instead of sleeping, so nested parallelFor calls don't deadlock.
+     */
+    class ThreadPool
+    {
+    public:
+        static ThreadPool& getInstance();
+
+        /**
+         * @param threadCount 0 means one thread per hardware thread.
+         */
+        explicit ThreadPool(size_t threadCount = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool& other) = delete;
+        ThreadPool& operator=(const ThreadPool& other) = delete;
+
+        size_t getThreadCount() const;
+
+        /**
+         * @brief Calls body(i) for every i in [0, count) in parallel and waits for all of them.
+         */
+        void parallelFor(size_t count, const std::function<void(size_t)>& body);
+
+    private:
+        struct TaskGroup
+        {
+            std::atomic<size_t>     remaining{0};
+            std::mutex              mutex;
+            std::condition_variable finished;
+        };
+
+        struct Task
+        {
+            const std::function<void(size_t)>* body  = nullptr;
+            size_t                             index = 0;
+            TaskGroup*                         group = nullptr;
+        };
+
+        struct WorkQueue
+        {
+            std::mutex       mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::thread>                m_Threads;
+        std::vector<std::unique_ptr<WorkQueue>> m_Queues;
+
+        std::mutex                              m_WakeMutex;
+        std::condition_variable                 m_Wake;
+        std::atomic<size_t>                     m_QueuedTasks{0};
+        bool                                    m_Stopping = false;
+
+        void workerLoop(size_t queueIndex);
+        bool tryRunTask(size_t queueIndex);
+        void runTask(const Task& task);
+    };
+};
@@ -0,0 +1,88 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file tiled_image.h
+ * @date 2021-12-20
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "sml/sml_graphics_wrapper.h"
+
+namespace Paint
+{
+    struct Tile
+    {
+        static constexpr int32_t SIZE = 256;
+
+        Sml::Color pixels[SIZE * SIZE];
+    };
+
+    using TilePtr = std::shared_ptr<Tile>;
+
+    /**
+     * @brief CPU-side image split into fixed-size tiles that are shared copy-on-write.
+     *
+     * Copying a TiledImage only copies the tile table, a tile is duplicated the first time
+     * it's written to while somebody else still references it. A null tile is fully
+     * transparent and takes no memory. Tiles on the right and bottom edges are only
+     * partially used.
+     */
+    class TiledImage
+    {
+    public:
+        TiledImage() = default;
+        TiledImage(size_t width, size_t height);
+
+        size_t getWidth() const;
+        size_t getHeight() const;
+
+        size_t getTilesX() const;
+        size_t getTilesY() const;
+        size_t getTileCount() const;
+
+        size_t getTileIndex(size_t column, size_t row) const;
+        Sml::Rectangle<int32_t> getTileRect(size_t index) const; ///< Clipped to the image bounds
+
+        /**
+         * @brief Inclusive-exclusive range of tile columns and rows covering the rectangle.
+         */
+        void getTileRange(const Sml::Rectangle<int32_t>& rect,
+                          size_t* firstColumn, size_t* firstRow, size_t* endColumn, size_t* endRow) const;
+
+        const TilePtr& getTile(size_t index) const;
+        void setTile(size_t index, const TilePtr& tile);
+
+        /**
+         * @brief Copies the pixels of the rectangle into a tightly packed buffer.
+         */
+        void readPixels(const Sml::Rectangle<int32_t>& rect, Sml::Color* pixels) const;
+
+        /**
+         * @brief Writes a tightly packed buffer into the rectangle, detaching shared tiles.
+         */
+        void writePixels(const Sml::Rectangle<int32_t>& rect, const Sml::Color* pixels);
+
+        size_t getAllocatedTileCount() const;
+        size_t getMemoryUsage() const;
+
+        static bool isTileTransparent(const Tile& tile);
+
+    private:
+        size_t               m_Width  = 0;
+        size_t               m_Height = 0;
+        size_t               m_TilesX = 0;
+        size_t               m_TilesY = 0;
+        std::vector<TilePtr> m_Tiles;
+
+        /**
+         * @brief Makes the tile exclusively owned by this image, so that it can be written to.
+         *
+         * @param preserveContents If false the caller is going to overwrite the whole tile.
+         */
+        Tile* detachTile(size_t index, bool preserveContents);
+    };
+};
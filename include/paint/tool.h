@@ -23,8 +23,22 @@ namespace Paint
         virtual const char* getIconFilename() const = 0;
         virtual Sgl::Container* getPreferencesPanel() { return nullptr; }
 
+        /**
+         * @brief Actions draw on the active layer's texture, which is the render target. The
+         *        layer may be partly unloaded, see Layer::ensureLoaded().
+         */
         virtual void onActionStart(const Sml::Vec2i& pos) {}
         virtual void onAction(const Sml::Vec2i& pos, const Sml::Vec2i& displacement) {}
         virtual void onActionEnd(const Sml::Vec2i& pos) {}
+
+        /**
+         * @brief Called once per frame while the tool is active.
+         */
+        virtual void onUpdate() {}
+
+        /**
+         * @brief Whether the tool is still drawing in the background, see onUpdate().
+         */
+        virtual bool hasPendingWork() const { return false; }
     };
 };
\ No newline at end of file
@@ -7,7 +7,7 @@
  */
 
 #include <filesystem>
-#include <dlfcn.h>
+#include <SDL.h>
 #include "sml/sml_log.h"
 #include "sgl/scene/containers/tile_pane.h"
 #include "sgl/scene/controls/scroll_bar.h"
@@ -20,6 +20,11 @@
 
 int main(int argc, const char* argv[])
 {
+    if (Paint::PluginHost::isServer(argc, argv))
+    {
+        return Paint::PluginHost::runServer(argc, argv);
+    }
+
     EditorApplication application{argc, argv};
 
     return application.run();
@@ -65,27 +70,15 @@ void EditorApplication::initPlugins()
 {
     LOG_APP_INFO("Plugins initialization started.");
 
-    plugin::APIImpl* api = new plugin::APIImpl();
-
-    for (auto entry : std::filesystem::directory_iterator("res/plugins"))
+    if (m_IsolatePlugins)
     {
-        if (std::filesystem::path(entry.path()).extension().compare(".so") == 0)
-        {
-            LOG_APP_INFO("Plugin '%s' detected.", entry.path().c_str());
-
-            void* handle = dlopen(entry.path().c_str(), RTLD_NOW);
-            plugin::CreateFunction create = reinterpret_cast<plugin::CreateFunction>(dlsym(handle, "Create"));
-
-            plugin::IPlugin* plugin = create(api);
-            plugin::Tools tools = plugin->GetTools();
-
-            for (uint32_t i = 0; i < tools.count; ++i)
-            {
-                Paint::Editor::getInstance().addTool(new Paint::PluginTool(tools.tools[i]));
-            }
-        }
+        m_PluginHost = new Paint::PluginHost();
     }
 
+    m_PluginManager = new Paint::PluginManager(EDITOR_PLUGINS_DIRECTORY, new plugin::APIImpl(), m_PluginHost);
+    m_PluginManager->loadTools();
+    m_PluginManager->preload();
+
     LOG_APP_INFO("Plugins initialization finished.");
 }
 
@@ -105,6 +98,7 @@ void EditorApplication::initView()
 
     initToolPanel();
     initPreferencesPanel();
+    recoverAutosaves();
 
     /* Mouse logger */
     // class MouseMoveListener : public Sml::Listener
@@ -138,6 +132,7 @@ void EditorApplication::initMenuBar()
     Sgl::Menu* editMenu    = m_MenuBar->addMenu("Edit");
     Sgl::Menu* toolsMenu   = m_MenuBar->addMenu("Tools");
     Sgl::Menu* filtersMenu = m_MenuBar->addMenu("Filters");
+    Sgl::Menu* viewMenu    = m_MenuBar->addMenu("View");
 
     /* File->New */
     class FileNewListener : public Sgl::ActionListener<Sgl::MenuItem>
@@ -197,17 +192,73 @@ void EditorApplication::initMenuBar()
     fileOpenImage->setOnAction(new FileOpenImageListener(fileOpenImage, m_EditorPane));
     fileMenu->getContextMenu()->addChild(fileOpenImage);
 
-    fileMenu->getContextMenu()->addChild(new Sgl::MenuItem("File item 3"));
+    /* File->Save */
+    class FileSaveListener : public Sgl::ActionListener<Sgl::MenuItem>
+    {
+    public:
+        FileSaveListener(Sgl::MenuItem* menuItem) : Sgl::ActionListener<Sgl::MenuItem>(menuItem) {}
+
+        virtual void onAction(Sgl::ActionEvent* event) override
+        {
+            Paint::Document* document = Paint::Editor::getInstance().getActiveDocument();
+            if (document == nullptr)
+            {
+                return;
+            }
+
+            /* Imported images are saved next to the original instead of overwriting it */
+            std::string filename = document->getFile() != nullptr
+                                       ? document->getFile()->getFilename()
+                                       : std::filesystem::path(document->getName())
+                                             .replace_extension(Paint::DocumentFile::EXTENSION).string();
+
+            if (document->save(filename.c_str()))
+            {
+                LOG_APP_INFO("Document saved to '%s'.", filename.c_str());
+            }
+        }
+    };
+
+    Sgl::MenuItem* fileSaveItem = new Sgl::MenuItem("Save");
+    fileSaveItem->setOnAction(new FileSaveListener(fileSaveItem));
+    fileMenu->getContextMenu()->addChild(fileSaveItem);
+
     fileMenu->getContextMenu()->addChild(new Sgl::MenuItem("File item 4"));
 
-    editMenu->getContextMenu()->addChild(new Sgl::MenuItem("Edit item 1"));
-    editMenu->getContextMenu()->addChild(new Sgl::MenuItem("Edit item 2"));
-    editMenu->getContextMenu()->addChild(new Sgl::MenuItem("Edit item 3"));
-    editMenu->getContextMenu()->addChild(new Sgl::MenuItem("Edit item 4"));
-    editMenu->getContextMenu()->addChild(new Sgl::MenuItem("Edit item 5"));
-    editMenu->getContextMenu()->addChild(new Sgl::MenuItem("Edit item 6"));
+    /* Edit->Undo */
+    class EditUndoListener : public Sgl::ActionListener<Sgl::MenuItem>
+    {
+    public:
+        EditUndoListener(Sgl::MenuItem* menuItem) : Sgl::ActionListener<Sgl::MenuItem>(menuItem) {}
+
+        virtual void onAction(Sgl::ActionEvent* event) override
+        {
+            Paint::Editor::getInstance().getHistory().undo();
+        }
+    };
+
+    Sgl::MenuItem* editUndoItem = new Sgl::MenuItem("Undo");
+    editUndoItem->setOnAction(new EditUndoListener(editUndoItem));
+    editMenu->getContextMenu()->addChild(editUndoItem);
+
+    /* Edit->Redo */
+    class EditRedoListener : public Sgl::ActionListener<Sgl::MenuItem>
+    {
+    public:
+        EditRedoListener(Sgl::MenuItem* menuItem) : Sgl::ActionListener<Sgl::MenuItem>(menuItem) {}
+
+        virtual void onAction(Sgl::ActionEvent* event) override
+        {
+            Paint::Editor::getInstance().getHistory().redo();
+        }
+    };
+
+    Sgl::MenuItem* editRedoItem = new Sgl::MenuItem("Redo");
+    editRedoItem->setOnAction(new EditRedoListener(editRedoItem));
+    editMenu->getContextMenu()->addChild(editRedoItem);
 
     initToolsFiltersMenus(toolsMenu, filtersMenu);
+    initViewMenu(viewMenu);
 }
 
 void EditorApplication::initToolsFiltersMenus(Sgl::Menu* toolsMenu, Sgl::Menu* filtersMenu)
@@ -248,7 +299,7 @@ void EditorApplication::initToolsFiltersMenus(Sgl::Menu* toolsMenu, Sgl::Menu* f
             // Paint::Editor::getInstance().applyFilter(m_Filter);
             InnerWindow* dialog = new InnerWindow(m_Filter->getName(), m_EditorPane->getScene());
             dialog->addChild(m_Filter->getPreferencesPanel());
-            m_Filter->init(Paint::Editor::getInstance().getActiveDocument()->getActiveLayer()->getTexture());
+            m_Filter->init(Paint::Editor::getInstance().getActiveDocument()->getActiveLayer());
             m_EditorPane->addChild(dialog);
         }
 
@@ -266,6 +317,142 @@ void EditorApplication::initToolsFiltersMenus(Sgl::Menu* toolsMenu, Sgl::Menu* f
     }
 }
 
+void EditorApplication::initViewMenu(Sgl::Menu* viewMenu)
+{
+    m_PluginStatsView   = new Paint::PluginStatsView();
+    m_PluginStatsWindow = new InnerWindow("Plugin stats", m_Scene);
+    m_PluginStatsWindow->addChild(m_PluginStatsView->getView());
+
+    /* View->Plugin stats */
+    class ViewPluginStatsListener : public Sgl::ActionListener<Sgl::MenuItem>
+    {
+    public:
+        ViewPluginStatsListener(Sgl::MenuItem* menuItem, InnerWindow* window, Sgl::AnchorPane* editorPane)
+            : Sgl::ActionListener<Sgl::MenuItem>(menuItem), m_Window(window), m_EditorPane(editorPane) {}
+
+        virtual void onAction(Sgl::ActionEvent* event) override
+        {
+            /* Closing the window only detaches it */
+            if (m_Window->getParent() == nullptr)
+            {
+                m_EditorPane->addChild(m_Window);
+            }
+        }
+
+    private:
+        InnerWindow*     m_Window;
+        Sgl::AnchorPane* m_EditorPane;
+    };
+
+    Sgl::MenuItem* viewPluginStatsItem = new Sgl::MenuItem("Plugin stats");
+    viewPluginStatsItem->setOnAction(new ViewPluginStatsListener(viewPluginStatsItem, m_PluginStatsWindow, m_EditorPane));
+    viewMenu->getContextMenu()->addChild(viewPluginStatsItem);
+
+    /* View->Dump plugin stats */
+    class ViewDumpPluginStatsListener : public Sgl::ActionListener<Sgl::MenuItem>
+    {
+    public:
+        ViewDumpPluginStatsListener(Sgl::MenuItem* menuItem) : Sgl::ActionListener<Sgl::MenuItem>(menuItem) {}
+
+        virtual void onAction(Sgl::ActionEvent* event) override
+        {
+            if (Paint::PluginProfiler::getInstance().dump(EDITOR_PLUGIN_STATS_FILENAME))
+            {
+                LOG_APP_INFO("Plugin stats written to '%s'.", EDITOR_PLUGIN_STATS_FILENAME);
+            }
+        }
+    };
+
+    Sgl::MenuItem* viewDumpPluginStatsItem = new Sgl::MenuItem("Dump plugin stats");
+    viewDumpPluginStatsItem->setOnAction(new ViewDumpPluginStatsListener(viewDumpPluginStatsItem));
+    viewMenu->getContextMenu()->addChild(viewDumpPluginStatsItem);
+
+    /* View->Save frame trace */
+    class ViewSaveTraceListener : public Sgl::ActionListener<Sgl::MenuItem>
+    {
+    public:
+        ViewSaveTraceListener(Sgl::MenuItem* menuItem) : Sgl::ActionListener<Sgl::MenuItem>(menuItem) {}
+
+        virtual void onAction(Sgl::ActionEvent* event) override
+        {
+            if (Paint::FrameProfiler::getInstance().dump(EDITOR_TRACE_FILENAME, EDITOR_TRACE_SECONDS))
+            {
+                LOG_APP_INFO("Frame trace written to '%s'.", EDITOR_TRACE_FILENAME);
+            }
+        }
+    };
+
+    Sgl::MenuItem* viewSaveTraceItem = new Sgl::MenuItem("Save frame trace");
+    viewSaveTraceItem->setOnAction(new ViewSaveTraceListener(viewSaveTraceItem));
+    viewMenu->getContextMenu()->addChild(viewSaveTraceItem);
+
+    /* View->Zoom in, Zoom out, Actual size, Fit to window */
+    enum class ZoomAction
+    {
+        ZOOM_IN,
+        ZOOM_OUT,
+        ACTUAL_SIZE,
+        FIT_TO_WINDOW
+    };
+
+    class ViewZoomListener : public Sgl::ActionListener<Sgl::MenuItem>
+    {
+    public:
+        ViewZoomListener(Sgl::MenuItem* menuItem, ZoomAction action)
+            : Sgl::ActionListener<Sgl::MenuItem>(menuItem), m_Action(action) {}
+
+        virtual void onAction(Sgl::ActionEvent* event) override
+        {
+            Paint::DocumentView* view = Paint::DocumentView::findView(Paint::Editor::getInstance().getActiveDocument());
+
+            if (view == nullptr)
+            {
+                return;
+            }
+
+            switch (m_Action)
+            {
+                case ZoomAction::ZOOM_IN:       { view->getCanvas()->zoomIn();     break; }
+                case ZoomAction::ZOOM_OUT:      { view->getCanvas()->zoomOut();    break; }
+                case ZoomAction::ACTUAL_SIZE:   { view->getCanvas()->setZoom(1);   break; }
+                case ZoomAction::FIT_TO_WINDOW: { view->getCanvas()->fitToView();  break; }
+            }
+        }
+
+    private:
+        ZoomAction m_Action;
+    };
+
+    const std::pair<const char*, ZoomAction> zoomItems[] = {{"Zoom in",       ZoomAction::ZOOM_IN},
+                                                            {"Zoom out",      ZoomAction::ZOOM_OUT},
+                                                            {"Actual size",   ZoomAction::ACTUAL_SIZE},
+                                                            {"Fit to window", ZoomAction::FIT_TO_WINDOW}};
+
+    for (const auto& zoomItem : zoomItems)
+    {
+        Sgl::MenuItem* item = new Sgl::MenuItem(zoomItem.first);
+        item->setOnAction(new ViewZoomListener(item, zoomItem.second));
+        viewMenu->getContextMenu()->addChild(item);
+    }
+
+    /* View->Pan mode */
+    class ViewPanModeListener : public Sgl::ActionListener<Sgl::MenuItem>
+    {
+    public:
+        ViewPanModeListener(Sgl::MenuItem* menuItem) : Sgl::ActionListener<Sgl::MenuItem>(menuItem) {}
+
+        virtual void onAction(Sgl::ActionEvent* event) override
+        {
+            Paint::Canvas::setPanMode(!Paint::Canvas::isPanMode());
+            LOG_APP_INFO("Pan mode %s.", Paint::Canvas::isPanMode() ? "on" : "off");
+        }
+    };
+
+    Sgl::MenuItem* viewPanModeItem = new Sgl::MenuItem("Pan mode");
+    viewPanModeItem->setOnAction(new ViewPanModeListener(viewPanModeItem));
+    viewMenu->getContextMenu()->addChild(viewPanModeItem);
+}
+
 void EditorApplication::initToolPanel()
 {
     m_ToolPanel = new Paint::ToolPanel();
@@ -292,10 +479,62 @@ void EditorApplication::initPreferencesPanel()
     m_EditorPane->setRightAnchor(m_PreferencesPanel->getView(), 0);
 }
 
+void EditorApplication::recoverAutosaves()
+{
+    Paint::Editor& editor = Paint::Editor::getInstance();
+
+    for (const auto& filename : Paint::AutosaveService::findRecoverable(editor.getAutosave().getDirectory().c_str()))
+    {
+        LOG_APP_INFO("Recovering '%s'.", filename.c_str());
+
+        std::shared_ptr<const Paint::DocumentFile> file = Paint::DocumentFile::open(filename.c_str());
+
+        /* Moved aside rather than deleted, but so that it isn't tried on every start again */
+        if (file == nullptr)
+        {
+            std::string brokenFilename = filename + ".broken";
+            LOG_APP_ERROR("Couldn't recover '%s', moving it to '%s'.", filename.c_str(), brokenFilename.c_str());
+
+            std::error_code error;
+            std::filesystem::rename(filename, brokenFilename, error);
+
+            if (error)
+            {
+                editor.getAutosave().adoptFile(filename.c_str());
+            }
+
+            continue;
+        }
+
+        /* Saved under a new name, the autosave is kept until the editor quits normally */
+        Paint::Document* document = new Paint::Document(file);
+        document->setName("recovered-" + std::filesystem::path(filename).stem().string());
+        document->detachFile();
+
+        editor.addDocument(document);
+        editor.setActiveDocument(document);
+
+        Paint::DocumentView* documentView = new Paint::DocumentView(document, m_Scene);
+        m_EditorPane->addChild(documentView->getView());
+
+        editor.getAutosave().adoptFile(filename.c_str());
+    }
+}
+
 int EditorApplication::onQuit()
 {
     LOG_APP_INFO("Application quitting.");
 
+    /* Autosaves are only kept if the editor didn't quit normally */
+    Paint::Editor::getInstance().getAutosave().removeFiles();
+
+    if (m_DumpPluginStats)
+    {
+        Paint::PluginProfiler::getInstance().dump(EDITOR_PLUGIN_STATS_FILENAME);
+    }
+
+    delete m_PluginManager;
+    delete m_PluginHost;
     delete Sgl::DefaultSkins::g_DefaultFont;
 
     LOG_APP_INFO("Application quit.");
@@ -305,31 +544,88 @@ int EditorApplication::onQuit()
 
 void EditorApplication::onUpdate()
 {
-    proccessSystemEvents();
+    Paint::Editor& editor = Paint::Editor::getInstance();
+
+    /* Nothing changed since the last frame, so sleep until something does */
+    if (!editor.needsRedraw())
+    {
+        PROFILE_ZONE("EditorApplication::waitForEvents");
+        waitForEvents();
+    }
+
+    PROFILE_ZONE("frame");
+
+    {
+        PROFILE_ZONE("EditorApplication::proccessSystemEvents");
+        if (proccessSystemEvents())
+        {
+            editor.invalidate();
+        }
+    }
+
+    {
+        PROFILE_ZONE("Editor::update");
+        editor.update();
+    }
 
     m_PreferencesPanel->update();
 
-    m_Scene->update();
-    m_Scene->render(m_Scene->getLayoutRegion());
+    if (m_PluginStatsWindow->getParent() != nullptr)
+    {
+        m_PluginStatsView->update();
+    }
 
-    Sml::Renderer::getInstance().present();
+    if (!editor.needsRedraw())
+    {
+        return;
+    }
+
+    /* All the events and background results that arrived meanwhile end up in a single frame */
+    {
+        PROFILE_ZONE("Scene::update");
+        m_Scene->update();
+    }
+
+    {
+        PROFILE_ZONE("Scene::render");
+        m_Scene->render(m_Scene->getLayoutRegion());
+    }
+
+    {
+        PROFILE_ZONE("Renderer::present");
+        Sml::Renderer::getInstance().present();
+    }
+
+    editor.validate();
 
     updateWindowTitle();
 }
 
-void EditorApplication::proccessSystemEvents()
+void EditorApplication::waitForEvents()
 {
-    Sml::Event* nextEvent = nullptr;
+    int32_t timeout = Paint::Editor::getInstance().hasPendingWork() ? EDITOR_BUSY_WAIT_TIMEOUT
+                                                                    : EDITOR_IDLE_WAIT_TIMEOUT;
+
+    /* Doesn't remove the event from the queue, it's polled as usual afterwards */
+    SDL_WaitEventTimeout(nullptr, timeout);
+}
+
+bool EditorApplication::proccessSystemEvents()
+{
+    Sml::Event* nextEvent    = nullptr;
+    bool        sceneChanged = false;
 
     while ((nextEvent = m_SystemEventManager.pollEvent(false)) != nullptr)
     {
         if (nextEvent->isInCategory(Sml::EVENT_CATEGORY_WINDOW))
         {
             proccessWindowEvent(static_cast<Sml::WindowEvent*>(nextEvent));
+            sceneChanged = true;
         }
         else if (nextEvent->isInCategory(Sml::EVENT_CATEGORY_INPUT))
         {
             proccessInputEvent(nextEvent);
+            sceneChanged = true;
         }
         else
         {
@@ -340,6 +636,8 @@ void EditorApplication::proccessSystemEvents()
 
         delete nextEvent;
     }
+
+    return sceneChanged;
 }
 
 void EditorApplication::proccessWindowEvent(Sml::WindowEvent* event)
@@ -7,6 +7,7 @@
  */
 
 #include "sml/sml_log.h"
+#include "paint/async_logger.h"
 #include "inner_window.h"
 
 class MenuBarListener : public Sgl::ComponentEventListener<Sgl::MenuBar>
@@ -19,7 +20,7 @@ public:
 
     virtual void onEvent(Sml::Event* event) override
     {
-        LOG_APP_INFO("InnerWindow::MenuBarListener on MouseButtonPressedEvent");
+        PAINT_LOG_TRACE("InnerWindow::MenuBarListener on MouseButtonPressedEvent");
 
         getComponent()->requestDrag();
 
@@ -38,7 +39,8 @@ public:
 
     virtual void onDragMove(Sgl::DragMoveEvent* event) override
     {
-        LOG_APP_INFO("WindowDragListener::onDragMove<%d, %d>", event->getDeltaX(), event->getDeltaY());
+        PAINT_LOG_TRACE_EVERY(Paint::AsyncLogger::EVENT_INTERVAL, "WindowDragListener::onDragMove<%d, %d>",
+                              event->getDeltaX(), event->getDeltaY());
 
         m_Window->setLayoutX(m_Window->getLayoutX() + event->getDeltaX());
         m_Window->setLayoutY(m_Window->getLayoutY() + event->getDeltaY());
@@ -0,0 +1,267 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file async_logger.cpp
+ * @date 2021-12-30
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <string>
+#include "paint/async_logger.h"
+
+using namespace Paint;
+
+const size_t   AsyncLogger::CAPACITY       = 1024;
+const size_t   AsyncLogger::MESSAGE_LENGTH = 255;
+const uint32_t AsyncLogger::WRITE_PERIOD   = 10;
+const uint32_t AsyncLogger::EVENT_INTERVAL = 250;
+
+static const char* const LEVEL_NAMES[] = {"TRACE", "INFO", "WARNING", "ERROR"};
+
+static uint64_t getTimeNs()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static void appendLine(std::string& batch, uint64_t timeNs, LogLevel level, const char* message)
+{
+    char prefix[48] = "";
+    snprintf(prefix, sizeof(prefix), "[%10.3f] [%s] ", timeNs / 1e9, LEVEL_NAMES[static_cast<size_t>(level)]);
+
+    batch.append(prefix);
+    batch.append(message);
+    batch.push_back('\n');
+}
+
+//------------------------------------------------------------------------------
+// RateLimit
+//------------------------------------------------------------------------------
+AsyncLogger::RateLimit::RateLimit(uint32_t intervalMs) : m_IntervalNs(static_cast<uint64_t>(intervalMs) * 1000000) {}
+
+bool AsyncLogger::RateLimit::pass(uint64_t* suppressed)
+{
+    assert(suppressed);
+
+    uint64_t now  = getTimeNs();
+    uint64_t next = m_NextNs.load(std::memory_order_relaxed);
+
+    /* Only one of the threads racing for the same interval gets it */
+    if (now < next || !m_NextNs.compare_exchange_strong(next, now + m_IntervalNs, std::memory_order_relaxed))
+    {
+        m_Suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    *suppressed = m_Suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// AsyncLogger
+//------------------------------------------------------------------------------
+AsyncLogger& AsyncLogger::getInstance()
+{
+    static AsyncLogger logger;
+    return logger;
+}
+
+AsyncLogger::AsyncLogger(FILE* output) : m_Output(output), m_Slots(new Slot[CAPACITY]), m_StartNs(getTimeNs())
+{
+    assert(output);
+    assert((CAPACITY & (CAPACITY - 1)) == 0);
+
+    for (size_t i = 0; i < CAPACITY; ++i)
+    {
+        m_Slots[i].sequence.store(i, std::memory_order_relaxed);
+        m_Slots[i].message.reset(new char[MESSAGE_LENGTH + 1]);
+    }
+
+    m_Writer = std::thread(&AsyncLogger::writerLoop, this);
+}
+
+AsyncLogger::~AsyncLogger()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_WakeMutex);
+        m_Stopping = true;
+    }
+
+    m_Wake.notify_all();
+    m_Writer.join();
+}
+
+void AsyncLogger::log(LogLevel level, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    push(level, 0, format, args);
+    va_end(args);
+}
+
+void AsyncLogger::logRateLimited(RateLimit& rateLimit, LogLevel level, const char* format, ...)
+{
+    uint64_t suppressed = 0;
+    if (!rateLimit.pass(&suppressed))
+    {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    push(level, suppressed, format, args);
+    va_end(args);
+}
+
+void AsyncLogger::flush()
+{
+    uint64_t target = m_Head.load(std::memory_order_acquire);
+
+    std::unique_lock<std::mutex> lock(m_WakeMutex);
+    m_FlushRequested = true;
+    m_Wake.notify_all();
+
+    m_Flushed.wait(lock, [&]() { return m_Stopping || m_Written.load(std::memory_order_acquire) >= target; });
+}
+
+void AsyncLogger::push(LogLevel level, uint64_t suppressed, const char* format, va_list args)
+{
+    assert(format);
+
+    /* Claiming a slot, see Vyukov's bounded MPMC queue */
+    uint64_t position = m_Head.load(std::memory_order_relaxed);
+    Slot*    slot     = nullptr;
+
+    while (true)
+    {
+        slot = &m_Slots[position & (CAPACITY - 1)];
+
+        int64_t difference = static_cast<int64_t>(slot->sequence.load(std::memory_order_acquire) - position);
+        if (difference == 0)
+        {
+            if (m_Head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            /* The writer hasn't freed it yet, the ring is full */
+            m_Dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            position = m_Head.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->level  = level;
+    slot->timeNs = getTimeNs() - m_StartNs;
+
+    int length = vsnprintf(slot->message.get(), MESSAGE_LENGTH + 1, format, args);
+    length     = std::min(std::max(length, 0), static_cast<int>(MESSAGE_LENGTH));
+
+    if (suppressed != 0)
+    {
+        snprintf(slot->message.get() + length, MESSAGE_LENGTH + 1 - length, " (%llu similar suppressed)",
+                 static_cast<unsigned long long>(suppressed));
+    }
+
+    slot->sequence.store(position + 1, std::memory_order_release);
+
+    /* Pairs with the fence in writerLoop(), so that either the writer sees the message
+       before going to sleep or the message's thread sees it sleeping */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (m_WriterSleeping.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(m_WakeMutex);
+        m_Wake.notify_all();
+    }
+}
+
+bool AsyncLogger::hasPending() const
+{
+    return m_Slots[m_Tail & (CAPACITY - 1)].sequence.load(std::memory_order_acquire) == m_Tail + 1 ||
+           m_Dropped.load(std::memory_order_relaxed) != 0;
+}
+
+bool AsyncLogger::writePending()
+{
+    std::string batch;
+
+    while (true)
+    {
+        Slot& slot = m_Slots[m_Tail & (CAPACITY - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != m_Tail + 1)
+        {
+            break;
+        }
+
+        appendLine(batch, slot.timeNs, slot.level, slot.message.get());
+
+        slot.sequence.store(m_Tail + CAPACITY, std::memory_order_release);
+        ++m_Tail;
+    }
+
+    uint64_t dropped = m_Dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped != 0)
+    {
+        std::string message = std::to_string(dropped) + " log messages dropped, the ring was full";
+        appendLine(batch, getTimeNs() - m_StartNs, LogLevel::WARNING, message.c_str());
+    }
+
+    if (!batch.empty())
+    {
+        fwrite(batch.data(), 1, batch.size(), m_Output);
+        fflush(m_Output);
+    }
+
+    m_Written.store(m_Tail, std::memory_order_release);
+
+    return !batch.empty();
+}
+
+void AsyncLogger::writerLoop()
+{
+    while (true)
+    {
+        bool stopping = false;
+
+        {
+            std::unique_lock<std::mutex> lock(m_WakeMutex);
+
+            /* Doesn't wake up at all while there's nothing to write */
+            m_WriterSleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            m_Wake.wait(lock, [&]() { return m_Stopping || m_FlushRequested || hasPending(); });
+            m_WriterSleeping.store(false, std::memory_order_relaxed);
+
+            /* Then gives the other messages of the burst a moment to arrive, to write them at once */
+            m_Wake.wait_for(lock, std::chrono::milliseconds(WRITE_PERIOD),
+                            [&]() { return m_Stopping || m_FlushRequested; });
+
+            stopping         = m_Stopping;
+            m_FlushRequested = false;
+        }
+
+        writePending();
+
+        {
+            std::lock_guard<std::mutex> lock(m_WakeMutex);
+            m_Flushed.notify_all();
+        }
+
+        if (stopping)
+        {
+            /* Messages logged while the last batch was being written */
+            while (writePending()) {}
+            return;
+        }
+    }
+}
@@ -0,0 +1,394 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file autosave.cpp
+ * @date 2021-12-26
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <unistd.h>
+#include "sml/sml_log.h"
+#include "paint/autosave.h"
+
+using namespace Paint;
+
+const char* const AutosaveService::DEFAULT_DIRECTORY   = ".autosave";
+const double      AutosaveService::DEFAULT_INTERVAL    = 60;
+const uint64_t    AutosaveService::DEFAULT_DISK_BUDGET = 1024ull * 1024 * 1024;
+
+static const char* const FILENAME_PREFIX = "autosave-";
+
+AutosaveService::AutosaveService()
+    : m_Directory(DEFAULT_DIRECTORY),
+      m_Interval(DEFAULT_INTERVAL),
+      m_DiskBudget(DEFAULT_DISK_BUDGET),
+      m_LastSnapshot(Clock::now()) {}
+
+AutosaveService::~AutosaveService()
+{
+    /* Not flushed, so that exiting doesn't wait for writing every document, see removeFiles() */
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        m_Unfinished -= m_Queue.size();
+        m_Queue.clear();
+        m_Stopping = true;
+    }
+
+    m_JobReady.notify_all();
+
+    if (m_Worker.joinable())
+    {
+        m_Worker.join();
+    }
+}
+
+const std::string& AutosaveService::getDirectory() const { return m_Directory; }
+
+void AutosaveService::setDirectory(const char* directory)
+{
+    assert(directory);
+    m_Directory = directory;
+}
+
+double AutosaveService::getInterval() const { return m_Interval; }
+
+void AutosaveService::setInterval(double seconds)
+{
+    assert(seconds >= 0);
+    m_Interval = seconds;
+}
+
+uint64_t AutosaveService::getDiskBudget() const { return m_DiskBudget; }
+void AutosaveService::setDiskBudget(uint64_t bytes) { m_DiskBudget = bytes; }
+
+void AutosaveService::update(const std::list<Document*>& documents)
+{
+    collect();
+
+    /* Zero interval disables autosaving */
+    if (m_Interval <= 0 || std::chrono::duration<double>(Clock::now() - m_LastSnapshot).count() < m_Interval)
+    {
+        return;
+    }
+
+    snapshot(documents);
+}
+
+void AutosaveService::snapshot(const std::list<Document*>& documents)
+{
+    m_LastSnapshot = Clock::now();
+
+    for (auto document : documents)
+    {
+        DocumentState& state = m_Documents[document];
+
+        /* A document still being written is snapshotted next time, so writes never pile up */
+        if (state.writing || state.revision == document->getRevision())
+        {
+            continue;
+        }
+
+        if (state.filename.empty())
+        {
+            state.filename = m_Directory + "/" + FILENAME_PREFIX + std::to_string(getpid()) + "-" +
+                             std::to_string(m_FileCount++) + DocumentFile::EXTENSION;
+        }
+
+        queue(document, &state);
+    }
+}
+
+void AutosaveService::flush()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_JobDone.wait(lock, [this] { return m_Unfinished == 0; });
+    }
+
+    collect();
+}
+
+void AutosaveService::forget(Document* document)
+{
+    assert(document);
+
+    auto entry = m_Documents.find(document);
+    if (entry == m_Documents.end())
+    {
+        return;
+    }
+
+    /* No job may refer to the document afterwards, another one could be allocated at its address */
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+
+        auto isForgotten = [document](const Job& job) { return job.document == document; };
+        auto queued      = std::remove_if(m_Queue.begin(), m_Queue.end(), isForgotten);
+
+        m_Unfinished -= static_cast<size_t>(m_Queue.end() - queued);
+        m_Queue.erase(queued, m_Queue.end());
+
+        m_JobDone.wait(lock, [this, document] { return m_Writing != document; });
+        m_Finished.erase(std::remove_if(m_Finished.begin(), m_Finished.end(), isForgotten), m_Finished.end());
+    }
+
+    m_JobDone.notify_all();
+
+    if (!entry->second.filename.empty())
+    {
+        std::error_code error;
+        std::filesystem::remove(entry->second.filename, error);
+        std::filesystem::remove(entry->second.filename + ".tmp", error);
+    }
+
+    m_Documents.erase(entry);
+}
+
+void AutosaveService::removeFiles()
+{
+    flush();
+
+    for (auto& entry : m_Documents)
+    {
+        DocumentState& state = entry.second;
+
+        if (!state.filename.empty())
+        {
+            std::error_code error;
+            std::filesystem::remove(state.filename, error);
+            std::filesystem::remove(state.filename + ".tmp", error);
+        }
+
+        state = DocumentState();
+    }
+
+    for (const auto& filename : m_AdoptedFiles)
+    {
+        std::error_code error;
+        std::filesystem::remove(filename, error);
+    }
+
+    m_AdoptedFiles.clear();
+
+    /* Only removed if no other session has files there */
+    std::error_code error;
+    std::filesystem::remove(m_Directory, error);
+}
+
+void AutosaveService::adoptFile(const char* filename)
+{
+    assert(filename);
+    m_AdoptedFiles.push_back(filename);
+}
+
+uint64_t AutosaveService::getDiskUsage() const
+{
+    uint64_t usage = 0;
+
+    for (const auto& entry : m_Documents)
+    {
+        if (entry.second.file != nullptr)
+        {
+            usage += entry.second.file->getFileSize();
+        }
+    }
+
+    return usage;
+}
+
+std::vector<std::string> AutosaveService::findRecoverable(const char* directory)
+{
+    assert(directory);
+
+    std::vector<std::string> filenames;
+
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+    {
+        std::string name = entry.path().filename().string();
+
+        int pid = 0;
+        if (entry.path().extension() != DocumentFile::EXTENSION ||
+            name.compare(0, strlen(FILENAME_PREFIX), FILENAME_PREFIX) != 0 ||
+            sscanf(name.c_str() + strlen(FILENAME_PREFIX), "%d-", &pid) != 1)
+        {
+            continue;
+        }
+
+        /* Files of sessions that are still running aren't theirs to recover */
+        if (pid == getpid() || kill(pid, 0) == 0 || errno == EPERM)
+        {
+            continue;
+        }
+
+        filenames.push_back(entry.path().string());
+    }
+
+    return filenames;
+}
+
+void AutosaveService::queue(Document* document, DocumentState* state)
+{
+    assert(document);
+    assert(state);
+
+    std::shared_ptr<const DocumentFile> file = state->file;
+
+    /* Over the budget the file is compacted first, which only helps if it has dead tiles */
+    if (getDiskUsage() > m_DiskBudget)
+    {
+        if (file == nullptr || file->getLiveSize() >= file->getFileSize())
+        {
+            if (!m_OverBudget)
+            {
+                LOG_APP_ERROR("Autosave disk budget of %llu bytes exceeded, autosaving is paused.",
+                              static_cast<unsigned long long>(m_DiskBudget));
+            }
+
+            m_OverBudget = true;
+            return;
+        }
+
+        file = nullptr;
+    }
+
+    m_OverBudget = false;
+
+    Job job;
+    job.document      = document;
+    job.revision      = document->getRevision();
+    job.filename      = state->filename;
+    job.snapshot      = document->createSnapshot();
+    job.snapshot.file = file;
+
+    /* Tiles are compared with what is in the autosave file, not in the document's own file */
+    for (auto& layer : job.snapshot.layers)
+    {
+        auto layerState = state->layers.find(layer.layer);
+
+        if (layerState != state->layers.end())
+        {
+            layer.saved       = layerState->second.saved;
+            layer.savedSource = layerState->second.source;
+        }
+        else
+        {
+            layer.saved.assign(layer.tiles.getTileCount(), SavedTile());
+            layer.savedSource = nullptr;
+        }
+    }
+
+    state->writing = true;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        m_Queue.push_back(std::move(job));
+        ++m_Unfinished;
+    }
+
+    if (!m_Worker.joinable())
+    {
+        m_Worker = std::thread(&AutosaveService::workerLoop, this);
+    }
+
+    m_JobReady.notify_one();
+}
+
+void AutosaveService::collect()
+{
+    std::deque<Job> finished;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        finished.swap(m_Finished);
+    }
+
+    for (auto& job : finished)
+    {
+        apply(job);
+    }
+}
+
+void AutosaveService::apply(Job& job)
+{
+    auto entry = m_Documents.find(job.document);
+    if (entry == m_Documents.end())
+    {
+        return;
+    }
+
+    DocumentState& state = entry->second;
+    state.writing = false;
+
+    /* The revision stays behind, so the document is tried again next time */
+    if (job.result == nullptr)
+    {
+        LOG_APP_ERROR("Couldn't autosave to '%s'.", job.filename.c_str());
+        return;
+    }
+
+    state.file     = job.result;
+    state.revision = job.revision;
+
+    /* Layers removed from the document meanwhile are dropped */
+    std::unordered_map<const Layer*, LayerState> layers;
+
+    for (size_t i = 0; i < job.snapshot.layers.size(); ++i)
+    {
+        const DocumentSnapshot::LayerSnapshot& snapshot = job.snapshot.layers[i];
+        LayerState&                            layer    = layers[snapshot.layer];
+
+        updateSavedTiles(snapshot, job.result->getTileLocations(i), &layer.saved);
+        layer.source = snapshot.source;
+    }
+
+    state.layers = std::move(layers);
+}
+
+void AutosaveService::workerLoop()
+{
+    while (true)
+    {
+        Job job;
+
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_JobReady.wait(lock, [this] { return m_Stopping || !m_Queue.empty(); });
+
+            if (m_Stopping)
+            {
+                return;
+            }
+
+            job = std::move(m_Queue.front());
+            m_Queue.pop_front();
+
+            m_Writing = job.document;
+        }
+
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(job.filename).parent_path(), error);
+
+        job.result = writeDocument(job.snapshot, job.filename.c_str());
+
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+
+            m_Finished.push_back(std::move(job));
+            --m_Unfinished;
+
+            m_Writing = nullptr;
+        }
+
+        m_JobDone.notify_all();
+    }
+}
@@ -6,14 +6,13 @@
  * @copyright Copyright (c) 2021
  */
 
+#include <cmath>
 #include "sgl/controls.h"
 #include "paint/basic_filters.h"
 #include "paint/paint_editor.h"
 
 using namespace Paint;
 
-SharpenFilter::~SharpenFilter() { delete m_BlurKernel; }
-
 const char* SharpenFilter::getName() const { return "Sharpen"; }
 
 Sgl::Container* SharpenFilter::getPreferencesPanel()
@@ -29,7 +28,7 @@ Sgl::Container* SharpenFilter::getPreferencesPanel()
     vbox->addChild(new Sgl::Text("Blur radius"));
 
     Sgl::SliderWithLabel* sliderBlurRadius = new Sgl::SliderWithLabel(1, 20, "%02.0f");
-    sliderBlurRadius->getSlider()->setValue(m_BlurKernel->getRadius());
+    sliderBlurRadius->getSlider()->setValue(m_BlurRadius);
     vbox->addChild(sliderBlurRadius);
 
     class BlurRadiusSliderHandler : public Sml::PropertyChangeListener<float>
@@ -40,7 +39,7 @@ Sgl::Container* SharpenFilter::getPreferencesPanel()
         virtual void onPropertyChange(Sml::PropertyChangeEvent<float>* event) override
         {
             m_Filter->setBlurRadius(static_cast<int32_t>(event->getNewValue()));
-            Paint::Editor::getInstance().applyFilter(m_Filter);
+            Paint::Editor::getInstance().previewFilter(m_Filter);
         }
 
     private:
@@ -64,7 +63,7 @@ Sgl::Container* SharpenFilter::getPreferencesPanel()
         virtual void onPropertyChange(Sml::PropertyChangeEvent<float>* event) override
         {
             m_Filter->setAmount(event->getNewValue());
-            Paint::Editor::getInstance().applyFilter(m_Filter);
+            Paint::Editor::getInstance().previewFilter(m_Filter);
         }
 
     private:
@@ -83,8 +82,7 @@ Sgl::Container* SharpenFilter::getPreferencesPanel()
         virtual void onAction(Sgl::ActionEvent* event) override
         {
             LOG_APP_INFO("Cancel");
-            m_Filter->setCanceled(true);
-            Paint::Editor::getInstance().applyFilter(m_Filter);
+            Paint::Editor::getInstance().cancelFilterPreview();
         }
 
     private:
@@ -105,8 +103,17 @@ Sgl::Container* SharpenFilter::getPreferencesPanel()
         virtual void onAction(Sgl::ActionEvent* event) override
         {
             LOG_APP_INFO("Apply");
-            m_Filter->setCanceled(false);
-            Paint::Editor::getInstance().applyFilter(m_Filter);
+
+            /* Without any preview the filter hasn't been run yet */
+            Paint::Editor& editor = Paint::Editor::getInstance();
+            if (editor.getFilterPreview().isActive())
+            {
+                editor.commitFilterPreview();
+            }
+            else
+            {
+                editor.applyFilter(m_Filter);
+            }
         }
 
     private:
@@ -120,76 +127,80 @@ Sgl::Container* SharpenFilter::getPreferencesPanel()
     return vbox;
 }
 
-void SharpenFilter::init(Sml::Texture* texture)
+void SharpenFilter::init(Layer* layer)
 {
-    m_OriginalTexture = texture->copy();
+    assert(layer);
+
+    m_Layer    = layer;
+    m_Original = layer->snapshot();
 }
 
 void SharpenFilter::apply()
 {
     Sml::Renderer& renderer = Sml::Renderer::getInstance();
 
-    if (m_Canceled)
-    {
-        m_OriginalTexture->copyTo(renderer.getTarget(), nullptr, nullptr);
-        m_Canceled = false;
-        return;
-    }
-
-    int32_t width  = static_cast<int32_t>(m_OriginalTexture->getWidth());
-    int32_t height = static_cast<int32_t>(m_OriginalTexture->getHeight());
+    int32_t width  = static_cast<int32_t>(m_Original.getWidth());
+    int32_t height = static_cast<int32_t>(m_Original.getHeight());
 
-    Sml::Color* originalImage = m_OriginalTexture->readPixels();
-    Sml::Color* blurredImage  = new Sml::Color[width * height];
+    Sml::Color* sharpenedImage = new Sml::Color[width * height];
 
-    Sml::applyKernel(m_BlurKernel, originalImage, blurredImage, width, height);
+    FilterEngine().run(m_Original, *createKernel(1), sharpenedImage);
+    renderer.getTarget()->updatePixels(sharpenedImage, nullptr);
 
-    for (int32_t y = 0; y < height; ++y)
-    {
-        for (int32_t x = 0; x < width; ++x)
-        {
-            Sml::Color originalColor = originalImage[x + y * width];
-            Sml::Color blurredColor  = blurredImage[x + y * width];
-
-            int32_t colorR = static_cast<int32_t>(Sml::colorGetR(originalColor)) - static_cast<int32_t>(Sml::colorGetR(blurredColor));
-            int32_t colorG = static_cast<int32_t>(Sml::colorGetG(originalColor)) - static_cast<int32_t>(Sml::colorGetG(blurredColor));
-            int32_t colorB = static_cast<int32_t>(Sml::colorGetB(originalColor)) - static_cast<int32_t>(Sml::colorGetB(blurredColor));
-            int32_t colorA = static_cast<int32_t>(Sml::colorGetA(originalColor)) - static_cast<int32_t>(Sml::colorGetA(blurredColor));
-
-            colorR = std::max(static_cast<int32_t>(colorR * m_Amount), 0);
-            colorG = std::max(static_cast<int32_t>(colorG * m_Amount), 0);
-            colorB = std::max(static_cast<int32_t>(colorB * m_Amount), 0);
-            colorA = std::max(static_cast<int32_t>(colorA * m_Amount), 0);
-
-            colorR = std::min(static_cast<int32_t>(Sml::colorGetR(originalColor)) + colorR, 255);
-            colorG = std::min(static_cast<int32_t>(Sml::colorGetG(originalColor)) + colorG, 255);
-            colorB = std::min(static_cast<int32_t>(Sml::colorGetB(originalColor)) + colorB, 255);
-            colorA = std::min(static_cast<int32_t>(Sml::colorGetA(originalColor)) + colorA, 255);
-
-            blurredImage[x + y * width] = Sml::rgbaColor(static_cast<uint8_t>(colorR),
-                                                         static_cast<uint8_t>(colorG),
-                                                         static_cast<uint8_t>(colorB),
-                                                         static_cast<uint8_t>(colorA));
-        }
-    }
-
-    renderer.getTarget()->updatePixels(blurredImage, nullptr);
+    delete[] sharpenedImage;
 }
 
-int32_t SharpenFilter::getBlurRadius() const { return m_BlurKernel->getRadius(); }
-void SharpenFilter::setBlurRadius(int32_t radius)
+std::shared_ptr<const TileKernel> SharpenFilter::createKernel(float scale) const
 {
-    if (radius != getBlurRadius())
-    {
-        delete m_BlurKernel;
-        m_BlurKernel = Sml::createGaussianBlurKernel(radius);
-    }
+    int32_t radius = std::max(static_cast<int32_t>(std::lround(m_BlurRadius * scale)), 1);
+    return std::make_shared<SharpenKernel>(radius, m_Amount);
 }
 
+int32_t SharpenFilter::getBlurRadius() const { return m_BlurRadius; }
+void SharpenFilter::setBlurRadius(int32_t radius) { m_BlurRadius = radius; }
+
 float SharpenFilter::getAmount() const { return m_Amount; }
 void SharpenFilter::setAmount(float amount) { m_Amount = amount; }
 
-Sml::Texture* SharpenFilter::getOriginalTexture() { return m_OriginalTexture; }
+const TiledImage& SharpenFilter::getOriginal() const { return m_Original; }
+
+//------------------------------------------------------------------------------
+// SharpenKernel
+//------------------------------------------------------------------------------
+SharpenKernel::SharpenKernel(int32_t blurRadius, float amount) : m_BlurKernel(blurRadius), m_Amount(amount) {}
 
-bool SharpenFilter::isCanceled() const { return m_Canceled; }
-void SharpenFilter::setCanceled(bool canceled) { m_Canceled = canceled; }
\ No newline at end of file
+int32_t SharpenKernel::getHalo() const { return m_BlurKernel.getRadius(); }
+
+void SharpenKernel::processBand(const FilterBand& band) const
+{
+    int32_t width     = band.rect.width;
+    int32_t radius    = m_BlurKernel.getRadius();
+    int32_t srcHeight = band.srcRect.height;
+    int32_t srcOffset = band.rect.pos.y - band.srcRect.pos.y;
+
+    /* Two 1D passes instead of the 2D kernel, so the cost grows linearly with the radius */
+    std::vector<Sml::Color> horizontal(static_cast<size_t>(width) * srcHeight);
+    BlurScratch             scratch;
+
+    for (int32_t y = 0; y < srcHeight; ++y)
+    {
+        blurRowHorizontally(band.src + y * width, horizontal.data() + y * width, width, m_BlurKernel, &scratch);
+    }
+
+    /* The halo is only clipped at the image edges, so clamping to it repeats the edge rows */
+    scratch.rows.resize(m_BlurKernel.getSize());
+
+    for (int32_t y = 0; y < band.rect.height; ++y)
+    {
+        for (int32_t k = 0; k < m_BlurKernel.getSize(); ++k)
+        {
+            int32_t row = std::min(std::max(srcOffset + y + k - radius, 0), srcHeight - 1);
+            scratch.rows[k] = horizontal.data() + row * width;
+        }
+
+        Sml::Color* dst = band.dst + y * width;
+
+        blurRowVertically(scratch.rows.data(), dst, width, m_BlurKernel);
+        unsharpMaskRow(band.src + (srcOffset + y) * width, dst, dst, width, m_Amount);
+    }
+}
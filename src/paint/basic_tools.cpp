@@ -19,17 +19,43 @@ using namespace Paint;
 const char* Brush::getName() const         { return "Brush"; }
 const char* Brush::getIconFilename() const { return "icons/paintbrush.png"; }
 
+void Brush::onActionStart(const Sml::Vec2i& pos)
+{
+    StrokeSettings settings;
+    settings.diameter = m_Thickness;
+    settings.hardness = m_Hardness;
+    settings.opacity  = m_Opacity;
+    settings.color    = Editor::getInstance().getForeground();
+
+    m_Stroke.begin(Editor::getInstance().getActiveDocument()->getActiveLayer(), settings);
+    m_Stroke.addPoint(pos);
+}
+
 void Brush::onAction(const Sml::Vec2i& pos, const Sml::Vec2i& displacement)
 {
-    Sml::Renderer& renderer = Sml::Renderer::getInstance();
+    m_Stroke.addPoint(pos);
+}
+
+void Brush::onActionEnd(const Sml::Vec2i& pos)
+{
+    m_Stroke.addPoint(pos);
+    m_Stroke.end();
+}
 
-    renderer.setColor(Editor::getInstance().getForeground());
-    Sml::renderLine(pos - displacement, pos, m_Thickness);
+void Brush::onUpdate()
+{
+    m_Stroke.composite();
 }
 
 int32_t Brush::getThickness() const         { return m_Thickness; }
 void Brush::setThickness(int32_t thickness) { assert(thickness > 0); m_Thickness = thickness; }
 
+float Brush::getHardness() const        { return m_Hardness; }
+void Brush::setHardness(float hardness) { assert(hardness >= 0 && hardness <= 1); m_Hardness = hardness; }
+
+float Brush::getOpacity() const       { return m_Opacity; }
+void Brush::setOpacity(float opacity) { assert(opacity >= 0 && opacity <= 1); m_Opacity = opacity; }
+
 Sgl::Container* Brush::getPreferencesPanel()
 {
     Sgl::VBox* vbox = new Sgl::VBox();
@@ -41,9 +67,21 @@ Sgl::Container* Brush::getPreferencesPanel()
 
     vbox->addChild(new Sgl::Text("Thickness"));
 
-    Sgl::SliderWithLabel* sliderWithLabel = new Sgl::SliderWithLabel(1, 100, "%02.0f");
-    sliderWithLabel->getSlider()->setValue(m_Thickness);
-    vbox->addChild(sliderWithLabel);
+    Sgl::SliderWithLabel* thicknessSlider = new Sgl::SliderWithLabel(1, 100, "%02.0f");
+    thicknessSlider->getSlider()->setValue(m_Thickness);
+    vbox->addChild(thicknessSlider);
+
+    vbox->addChild(new Sgl::Text("Hardness"));
+
+    Sgl::SliderWithLabel* hardnessSlider = new Sgl::SliderWithLabel(0, 100, "%02.0f");
+    hardnessSlider->getSlider()->setValue(m_Hardness * 100);
+    vbox->addChild(hardnessSlider);
+
+    vbox->addChild(new Sgl::Text("Opacity"));
+
+    Sgl::SliderWithLabel* opacitySlider = new Sgl::SliderWithLabel(0, 100, "%02.0f");
+    opacitySlider->getSlider()->setValue(m_Opacity * 100);
+    vbox->addChild(opacitySlider);
 
     class ThicknessSliderHandler : public Sml::PropertyChangeListener<float>
     {
@@ -59,7 +97,37 @@ Sgl::Container* Brush::getPreferencesPanel()
         Brush* m_Brush;
     };
 
-    sliderWithLabel->getSlider()->addOnPropertyChange(new ThicknessSliderHandler(this));
+    class HardnessSliderHandler : public Sml::PropertyChangeListener<float>
+    {
+    public:
+        HardnessSliderHandler(Brush* brush) : m_Brush(brush) {}
+
+        virtual void onPropertyChange(Sml::PropertyChangeEvent<float>* event) override
+        {
+            m_Brush->setHardness(event->getNewValue() / 100);
+        }
+
+    private:
+        Brush* m_Brush;
+    };
+
+    class OpacitySliderHandler : public Sml::PropertyChangeListener<float>
+    {
+    public:
+        OpacitySliderHandler(Brush* brush) : m_Brush(brush) {}
+
+        virtual void onPropertyChange(Sml::PropertyChangeEvent<float>* event) override
+        {
+            m_Brush->setOpacity(event->getNewValue() / 100);
+        }
+
+    private:
+        Brush* m_Brush;
+    };
+
+    thicknessSlider->getSlider()->addOnPropertyChange(new ThicknessSliderHandler(this));
+    hardnessSlider->getSlider()->addOnPropertyChange(new HardnessSliderHandler(this));
+    opacitySlider->getSlider()->addOnPropertyChange(new OpacitySliderHandler(this));
 
     return vbox;
 }
@@ -81,9 +149,21 @@ Sgl::Container* Eraser::getPreferencesPanel()
 
     vbox->addChild(new Sgl::Text("Thickness"));
 
-    Sgl::SliderWithLabel* sliderWithLabel = new Sgl::SliderWithLabel(1, 100, "%02.0f");
-    sliderWithLabel->getSlider()->setValue(m_Thickness);
-    vbox->addChild(sliderWithLabel);
+    Sgl::SliderWithLabel* thicknessSlider = new Sgl::SliderWithLabel(1, 100, "%02.0f");
+    thicknessSlider->getSlider()->setValue(m_Thickness);
+    vbox->addChild(thicknessSlider);
+
+    vbox->addChild(new Sgl::Text("Hardness"));
+
+    Sgl::SliderWithLabel* hardnessSlider = new Sgl::SliderWithLabel(0, 100, "%02.0f");
+    hardnessSlider->getSlider()->setValue(m_Hardness * 100);
+    vbox->addChild(hardnessSlider);
+
+    vbox->addChild(new Sgl::Text("Opacity"));
+
+    Sgl::SliderWithLabel* opacitySlider = new Sgl::SliderWithLabel(0, 100, "%02.0f");
+    opacitySlider->getSlider()->setValue(m_Opacity * 100);
+    vbox->addChild(opacitySlider);
 
     class ThicknessSliderHandler : public Sml::PropertyChangeListener<float>
     {
@@ -99,25 +179,77 @@ Sgl::Container* Eraser::getPreferencesPanel()
         Eraser* m_Eraser;
     };
 
-    sliderWithLabel->getSlider()->addOnPropertyChange(new ThicknessSliderHandler(this));
+    class HardnessSliderHandler : public Sml::PropertyChangeListener<float>
+    {
+    public:
+        HardnessSliderHandler(Eraser* eraser) : m_Eraser(eraser) {}
+
+        virtual void onPropertyChange(Sml::PropertyChangeEvent<float>* event) override
+        {
+            m_Eraser->setHardness(event->getNewValue() / 100);
+        }
+
+    private:
+        Eraser* m_Eraser;
+    };
+
+    class OpacitySliderHandler : public Sml::PropertyChangeListener<float>
+    {
+    public:
+        OpacitySliderHandler(Eraser* eraser) : m_Eraser(eraser) {}
+
+        virtual void onPropertyChange(Sml::PropertyChangeEvent<float>* event) override
+        {
+            m_Eraser->setOpacity(event->getNewValue() / 100);
+        }
+
+    private:
+        Eraser* m_Eraser;
+    };
+
+    thicknessSlider->getSlider()->addOnPropertyChange(new ThicknessSliderHandler(this));
+    hardnessSlider->getSlider()->addOnPropertyChange(new HardnessSliderHandler(this));
+    opacitySlider->getSlider()->addOnPropertyChange(new OpacitySliderHandler(this));
 
     return vbox;
 }
 
-void Eraser::onAction(const Sml::Vec2i& pos, const Sml::Vec2i& displacement)
+void Eraser::onActionStart(const Sml::Vec2i& pos)
 {
-    Sml::Renderer& renderer = Sml::Renderer::getInstance();
+    StrokeSettings settings;
+    settings.diameter = m_Thickness;
+    settings.hardness = m_Hardness;
+    settings.opacity  = m_Opacity;
+    settings.erase    = true;
+
+    m_Stroke.begin(Editor::getInstance().getActiveDocument()->getActiveLayer(), settings);
+    m_Stroke.addPoint(pos);
+}
 
-    renderer.setColor(Sml::COLOR_TRANSPARENT);
-    renderer.setBlendMode(Sml::Renderer::BlendMode::NONE);
+void Eraser::onAction(const Sml::Vec2i& pos, const Sml::Vec2i& displacement)
+{
+    m_Stroke.addPoint(pos);
+}
 
-    Sml::renderLine(pos - displacement, pos, m_Thickness);
+void Eraser::onActionEnd(const Sml::Vec2i& pos)
+{
+    m_Stroke.addPoint(pos);
+    m_Stroke.end();
+}
 
-    renderer.setBlendMode(Sml::Renderer::BlendMode::BLEND);
+void Eraser::onUpdate()
+{
+    m_Stroke.composite();
 }
 
-int32_t Eraser::getThickness() const { return m_Thickness; }
-void Eraser::setThickness(int32_t thickness) { m_Thickness = thickness; }
+int32_t Eraser::getThickness() const         { return m_Thickness; }
+void Eraser::setThickness(int32_t thickness) { assert(thickness > 0); m_Thickness = thickness; }
+
+float Eraser::getHardness() const        { return m_Hardness; }
+void Eraser::setHardness(float hardness) { assert(hardness >= 0 && hardness <= 1); m_Hardness = hardness; }
+
+float Eraser::getOpacity() const       { return m_Opacity; }
+void Eraser::setOpacity(float opacity) { assert(opacity >= 0 && opacity <= 1); m_Opacity = opacity; }
 
 //------------------------------------------------------------------------------
 // RectangleTool
@@ -161,34 +293,42 @@ Sgl::Container* RectangleTool::getPreferencesPanel()
 
 void RectangleTool::onActionStart(const Sml::Vec2i& pos)
 {
-    Sml::Renderer& renderer = Sml::Renderer::getInstance();
-
-    m_Origin          = pos;
-    m_OriginalTexture = renderer.getTarget()->copy();
+    m_Origin     = pos;
+    m_Original   = Paint::Editor::getInstance().getActiveDocument()->getActiveLayer()->lazySnapshot();
+    m_LastBounds = Sml::Rectangle<int32_t>(0, 0, 0, 0);
 }
 
 void RectangleTool::onAction(const Sml::Vec2i& pos, const Sml::Vec2i& displacement)
 {
     Sml::Renderer& renderer = Sml::Renderer::getInstance();
+    Layer*         layer    = Paint::Editor::getInstance().getActiveDocument()->getActiveLayer();
 
-    m_OriginalTexture->copyTo(renderer.getTarget(), nullptr, nullptr);
+    layer->restore(m_Original.read(m_LastBounds), m_LastBounds);
 
     Sml::Rectangle<int32_t> rectangle(std::min(pos.x, m_Origin.x),
                                       std::min(pos.y, m_Origin.y),
                                       std::abs(pos.x - m_Origin.x),
                                       std::abs(pos.y - m_Origin.y));
 
+    Sml::Rectangle<int32_t> bounds(rectangle.pos.x - m_Thickness, rectangle.pos.y - m_Thickness,
+                                   rectangle.width + 2 * m_Thickness + 1, rectangle.height + 2 * m_Thickness + 1);
+
+    layer->ensureLoaded(bounds);
+
     renderer.setColor(Paint::Editor::getInstance().getBackground());
     Sml::renderFilledRect(rectangle);
 
     renderer.setColor(Paint::Editor::getInstance().getForeground());
     Sml::renderRect(rectangle, m_Thickness);
+
+    layer->markDirty(bounds);
+    m_LastBounds = bounds;
 }
 
 void RectangleTool::onActionEnd(const Sml::Vec2i& pos)
 {
-    Sml::Renderer& renderer = Sml::Renderer::getInstance();
-
+    /* Drop the references, so that the next strokes don't copy the shared tiles */
+    m_Original = LazySnapshot();
 }
 
 int32_t RectangleTool::getThickness() const { return m_Thickness; }
@@ -0,0 +1,502 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file blend.cpp
+ * @date 2021-12-31
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <cassert>
+#include <algorithm>
+#include "paint/blend.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PAINT_BLEND_X86
+#include <immintrin.h>
+#endif
+
+using namespace Paint;
+
+/**
+ * Colors are 0xRRGGBBAA, so on little-endian machines (all the x86 ones) alpha is the first
+ * byte of a pixel and the first 16-bit lane of it once widened. The scalar code extracts
+ * channels with shifts and doesn't depend on the byte order.
+ */
+using BlendFunction       = void (*)(const Sml::Color* src, Sml::Color* dst, size_t count, uint8_t opacity);
+using PremultiplyFunction = void (*)(const Sml::Color* src, Sml::Color* dst, size_t count);
+
+static const char* const BLEND_MODE_NAMES[] = {"normal", "multiply", "screen", "overlay", "darken", "lighten",
+                                               "add", "difference"};
+
+static_assert(sizeof(BLEND_MODE_NAMES) / sizeof(BLEND_MODE_NAMES[0]) == static_cast<size_t>(BlendMode::COUNT),
+              "Every blend mode must have a name");
+
+//------------------------------------------------------------------------------
+// Scalar
+//------------------------------------------------------------------------------
+/* a * b / 255, rounded, exact for all 8-bit inputs */
+static inline int32_t mul255(int32_t a, int32_t b)
+{
+    int32_t product = a * b + 128;
+    return (product + (product >> 8)) >> 8;
+}
+
+static inline int32_t blendChannel(BlendMode mode, int32_t s, int32_t d, int32_t sa, int32_t da)
+{
+    int32_t base = mul255(s, 255 - da) + mul255(d, 255 - sa);
+
+    switch (mode)
+    {
+        case BlendMode::NORMAL:     return s + mul255(d, 255 - sa);
+        case BlendMode::MULTIPLY:   return mul255(s, d) + base;
+        case BlendMode::SCREEN:     return s + d - mul255(s, d);
+        case BlendMode::DARKEN:     return std::min(mul255(s, da), mul255(d, sa)) + base;
+        case BlendMode::LIGHTEN:    return std::max(mul255(s, da), mul255(d, sa)) + base;
+        case BlendMode::ADD:        return s + d;
+        case BlendMode::DIFFERENCE: return s + d - 2 * std::min(mul255(s, da), mul255(d, sa));
+
+        case BlendMode::OVERLAY:
+        {
+            if (2 * d <= da)
+            {
+                return 2 * mul255(s, d) + base;
+            }
+
+            return std::max(mul255(sa, da) - 2 * mul255(da - d, sa - s), 0) + base;
+        }
+
+        default: { assert(!"Unknown blend mode"); return d; }
+    }
+}
+
+static void blendRowScalar(BlendMode mode, const Sml::Color* src, Sml::Color* dst, size_t count, uint8_t opacity)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (src[i] == 0)
+        {
+            continue;
+        }
+
+        uint32_t s  = src[i];
+        uint32_t d  = dst[i];
+        int32_t  sa = mul255(s & 0xFF, opacity);
+        int32_t  da = d & 0xFF;
+
+        uint32_t result = 0;
+        for (uint32_t shift = 0; shift < 32; shift += 8)
+        {
+            int32_t sc = mul255((s >> shift) & 0xFF, opacity);
+            int32_t dc = (d >> shift) & 0xFF;
+
+            /* Alpha of the difference mode is the usual union of the coverages */
+            int32_t value = shift == 0 && mode == BlendMode::DIFFERENCE ? sc + dc - mul255(sc, dc)
+                                                                        : blendChannel(mode, sc, dc, sa, da);
+
+            result |= static_cast<uint32_t>(std::min(std::max(value, 0), 255)) << shift;
+        }
+
+        dst[i] = result;
+    }
+}
+
+template <BlendMode MODE>
+static void blendRowScalar(const Sml::Color* src, Sml::Color* dst, size_t count, uint8_t opacity)
+{
+    blendRowScalar(MODE, src, dst, count, opacity);
+}
+
+static void premultiplyRowScalar(const Sml::Color* src, Sml::Color* dst, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t color = src[i];
+        int32_t  alpha = color & 0xFF;
+
+        dst[i] = static_cast<uint32_t>(mul255(color >> 24,          alpha)) << 24 |
+                 static_cast<uint32_t>(mul255((color >> 16) & 0xFF, alpha)) << 16 |
+                 static_cast<uint32_t>(mul255((color >> 8)  & 0xFF, alpha)) << 8  |
+                 static_cast<uint32_t>(alpha);
+    }
+}
+
+#ifdef PAINT_BLEND_X86
+//------------------------------------------------------------------------------
+// SSE2
+//------------------------------------------------------------------------------
+/* Works on two pixels widened to 16-bit lanes */
+static inline __m128i mulSse2(__m128i a, __m128i b)
+{
+    __m128i product = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+}
+
+static inline __m128i invertSse2(__m128i a) { return _mm_sub_epi16(_mm_set1_epi16(255), a); }
+
+static inline __m128i alphaSse2(__m128i a)
+{
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, _MM_SHUFFLE(0, 0, 0, 0)), _MM_SHUFFLE(0, 0, 0, 0));
+}
+
+static inline __m128i alphaMaskSse2() { return _mm_set_epi16(0, 0, 0, -1, 0, 0, 0, -1); }
+
+template <BlendMode MODE>
+static inline __m128i blendSse2(__m128i s, __m128i d)
+{
+    __m128i sa   = alphaSse2(s);
+    __m128i da   = alphaSse2(d);
+    __m128i base = _mm_add_epi16(mulSse2(s, invertSse2(da)), mulSse2(d, invertSse2(sa)));
+
+    if constexpr (MODE == BlendMode::NORMAL)
+    {
+        return _mm_add_epi16(s, mulSse2(d, invertSse2(sa)));
+    }
+    else if constexpr (MODE == BlendMode::MULTIPLY)
+    {
+        return _mm_add_epi16(mulSse2(s, d), base);
+    }
+    else if constexpr (MODE == BlendMode::SCREEN)
+    {
+        return _mm_sub_epi16(_mm_add_epi16(s, d), mulSse2(s, d));
+    }
+    else if constexpr (MODE == BlendMode::OVERLAY)
+    {
+        __m128i low  = _mm_slli_epi16(mulSse2(s, d), 1);
+        __m128i high = _mm_subs_epu16(mulSse2(sa, da), _mm_slli_epi16(mulSse2(_mm_sub_epi16(da, d), _mm_sub_epi16(sa, s)), 1));
+        __m128i mask = _mm_cmpgt_epi16(_mm_slli_epi16(d, 1), da);
+
+        return _mm_add_epi16(_mm_or_si128(_mm_and_si128(mask, high), _mm_andnot_si128(mask, low)), base);
+    }
+    else if constexpr (MODE == BlendMode::DARKEN)
+    {
+        return _mm_add_epi16(_mm_min_epi16(mulSse2(s, da), mulSse2(d, sa)), base);
+    }
+    else if constexpr (MODE == BlendMode::LIGHTEN)
+    {
+        return _mm_add_epi16(_mm_max_epi16(mulSse2(s, da), mulSse2(d, sa)), base);
+    }
+    else if constexpr (MODE == BlendMode::ADD)
+    {
+        return _mm_add_epi16(s, d);
+    }
+    else
+    {
+        static_assert(MODE == BlendMode::DIFFERENCE, "Unknown blend mode");
+
+        __m128i color = _mm_sub_epi16(_mm_add_epi16(s, d), _mm_slli_epi16(_mm_min_epi16(mulSse2(s, da), mulSse2(d, sa)), 1));
+        __m128i alpha = _mm_sub_epi16(_mm_add_epi16(s, d), mulSse2(s, d));
+
+        return _mm_or_si128(_mm_and_si128(alphaMaskSse2(), alpha), _mm_andnot_si128(alphaMaskSse2(), color));
+    }
+}
+
+template <BlendMode MODE>
+static void blendRowSse2(const Sml::Color* src, Sml::Color* dst, size_t count, uint8_t opacity)
+{
+    const __m128i zero          = _mm_setzero_si128();
+    const __m128i opacityVector = _mm_set1_epi16(opacity);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+        /* Transparent source pixels leave the destination as is in every mode */
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xFFFF)
+        {
+            continue;
+        }
+
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+
+        __m128i sLow  = _mm_unpacklo_epi8(s, zero);
+        __m128i sHigh = _mm_unpackhi_epi8(s, zero);
+
+        if (opacity != 255)
+        {
+            sLow  = mulSse2(sLow,  opacityVector);
+            sHigh = mulSse2(sHigh, opacityVector);
+        }
+
+        __m128i low  = blendSse2<MODE>(sLow,  _mm_unpacklo_epi8(d, zero));
+        __m128i high = blendSse2<MODE>(sHigh, _mm_unpackhi_epi8(d, zero));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(low, high));
+    }
+
+    blendRowScalar(MODE, src + i, dst + i, count - i, opacity);
+}
+
+static void premultiplyRowSse2(const Sml::Color* src, Sml::Color* dst, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = alphaMaskSse2();
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i color = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i low   = _mm_unpacklo_epi8(color, zero);
+        __m128i high  = _mm_unpackhi_epi8(color, zero);
+
+        low  = _mm_or_si128(_mm_and_si128(mask, low),  _mm_andnot_si128(mask, mulSse2(low,  alphaSse2(low))));
+        high = _mm_or_si128(_mm_and_si128(mask, high), _mm_andnot_si128(mask, mulSse2(high, alphaSse2(high))));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(low, high));
+    }
+
+    premultiplyRowScalar(src + i, dst + i, count - i);
+}
+
+//------------------------------------------------------------------------------
+// AVX2
+//------------------------------------------------------------------------------
+/* Unpacks and packs both work within 128-bit lanes, so the pixel order survives the round trip */
+__attribute__((target("avx2")))
+static inline __m256i mulAvx2(__m256i a, __m256i b)
+{
+    __m256i product = _mm256_add_epi16(_mm256_mullo_epi16(a, b), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(product, _mm256_srli_epi16(product, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i invertAvx2(__m256i a) { return _mm256_sub_epi16(_mm256_set1_epi16(255), a); }
+
+__attribute__((target("avx2")))
+static inline __m256i alphaAvx2(__m256i a)
+{
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(a, _MM_SHUFFLE(0, 0, 0, 0)), _MM_SHUFFLE(0, 0, 0, 0));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i alphaMaskAvx2() { return _mm256_set_epi16(0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1); }
+
+template <BlendMode MODE>
+__attribute__((target("avx2")))
+static inline __m256i blendAvx2(__m256i s, __m256i d)
+{
+    __m256i sa   = alphaAvx2(s);
+    __m256i da   = alphaAvx2(d);
+    __m256i base = _mm256_add_epi16(mulAvx2(s, invertAvx2(da)), mulAvx2(d, invertAvx2(sa)));
+
+    if constexpr (MODE == BlendMode::NORMAL)
+    {
+        return _mm256_add_epi16(s, mulAvx2(d, invertAvx2(sa)));
+    }
+    else if constexpr (MODE == BlendMode::MULTIPLY)
+    {
+        return _mm256_add_epi16(mulAvx2(s, d), base);
+    }
+    else if constexpr (MODE == BlendMode::SCREEN)
+    {
+        return _mm256_sub_epi16(_mm256_add_epi16(s, d), mulAvx2(s, d));
+    }
+    else if constexpr (MODE == BlendMode::OVERLAY)
+    {
+        __m256i low  = _mm256_slli_epi16(mulAvx2(s, d), 1);
+        __m256i high = _mm256_subs_epu16(mulAvx2(sa, da),
+                                         _mm256_slli_epi16(mulAvx2(_mm256_sub_epi16(da, d), _mm256_sub_epi16(sa, s)), 1));
+        __m256i mask = _mm256_cmpgt_epi16(_mm256_slli_epi16(d, 1), da);
+
+        return _mm256_add_epi16(_mm256_blendv_epi8(low, high, mask), base);
+    }
+    else if constexpr (MODE == BlendMode::DARKEN)
+    {
+        return _mm256_add_epi16(_mm256_min_epi16(mulAvx2(s, da), mulAvx2(d, sa)), base);
+    }
+    else if constexpr (MODE == BlendMode::LIGHTEN)
+    {
+        return _mm256_add_epi16(_mm256_max_epi16(mulAvx2(s, da), mulAvx2(d, sa)), base);
+    }
+    else if constexpr (MODE == BlendMode::ADD)
+    {
+        return _mm256_add_epi16(s, d);
+    }
+    else
+    {
+        static_assert(MODE == BlendMode::DIFFERENCE, "Unknown blend mode");
+
+        __m256i color = _mm256_sub_epi16(_mm256_add_epi16(s, d),
+                                         _mm256_slli_epi16(_mm256_min_epi16(mulAvx2(s, da), mulAvx2(d, sa)), 1));
+        __m256i alpha = _mm256_sub_epi16(_mm256_add_epi16(s, d), mulAvx2(s, d));
+
+        return _mm256_blendv_epi8(color, alpha, alphaMaskAvx2());
+    }
+}
+
+template <BlendMode MODE>
+__attribute__((target("avx2")))
+static void blendRowAvx2(const Sml::Color* src, Sml::Color* dst, size_t count, uint8_t opacity)
+{
+    const __m256i zero          = _mm256_setzero_si256();
+    const __m256i opacityVector = _mm256_set1_epi16(opacity);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+
+        if (_mm256_testz_si256(s, s))
+        {
+            continue;
+        }
+
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+
+        __m256i sLow  = _mm256_unpacklo_epi8(s, zero);
+        __m256i sHigh = _mm256_unpackhi_epi8(s, zero);
+
+        if (opacity != 255)
+        {
+            sLow  = mulAvx2(sLow,  opacityVector);
+            sHigh = mulAvx2(sHigh, opacityVector);
+        }
+
+        __m256i low  = blendAvx2<MODE>(sLow,  _mm256_unpacklo_epi8(d, zero));
+        __m256i high = blendAvx2<MODE>(sHigh, _mm256_unpackhi_epi8(d, zero));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_packus_epi16(low, high));
+    }
+
+    blendRowSse2<MODE>(src + i, dst + i, count - i, opacity);
+}
+
+__attribute__((target("avx2")))
+static void premultiplyRowAvx2(const Sml::Color* src, Sml::Color* dst, size_t count)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mask = alphaMaskAvx2();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i color = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i low   = _mm256_unpacklo_epi8(color, zero);
+        __m256i high  = _mm256_unpackhi_epi8(color, zero);
+
+        low  = _mm256_blendv_epi8(mulAvx2(low,  alphaAvx2(low)),  low,  mask);
+        high = _mm256_blendv_epi8(mulAvx2(high, alphaAvx2(high)), high, mask);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_packus_epi16(low, high));
+    }
+
+    premultiplyRowSse2(src + i, dst + i, count - i);
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Runtime dispatch
+//------------------------------------------------------------------------------
+struct BlendImplementation
+{
+    const char*         name;
+    BlendFunction       blend[static_cast<size_t>(BlendMode::COUNT)];
+    PremultiplyFunction premultiply;
+};
+
+#define PAINT_BLEND_FUNCTIONS(function)                                                    \
+    {function<BlendMode::NORMAL>,  function<BlendMode::MULTIPLY>, function<BlendMode::SCREEN>, \
+     function<BlendMode::OVERLAY>, function<BlendMode::DARKEN>,   function<BlendMode::LIGHTEN>, \
+     function<BlendMode::ADD>,     function<BlendMode::DIFFERENCE>}
+
+static BlendImplementation selectImplementation()
+{
+#ifdef PAINT_BLEND_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return {"avx2", PAINT_BLEND_FUNCTIONS(blendRowAvx2), premultiplyRowAvx2};
+    }
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return {"sse2", PAINT_BLEND_FUNCTIONS(blendRowSse2), premultiplyRowSse2};
+    }
+#endif
+
+    return {"scalar", PAINT_BLEND_FUNCTIONS(blendRowScalar), premultiplyRowScalar};
+}
+
+static const BlendImplementation& getImplementation()
+{
+    static const BlendImplementation implementation = selectImplementation();
+    return implementation;
+}
+
+const char* Paint::getBlendImplementationName() { return getImplementation().name; }
+
+const char* Paint::getBlendModeName(BlendMode mode)
+{
+    assert(mode < BlendMode::COUNT);
+    return BLEND_MODE_NAMES[static_cast<size_t>(mode)];
+}
+
+//------------------------------------------------------------------------------
+// Rows
+//------------------------------------------------------------------------------
+void Paint::premultiplyRow(const Sml::Color* src, Sml::Color* dst, size_t count)
+{
+    assert(src);
+    assert(dst);
+
+    getImplementation().premultiply(src, dst, count);
+}
+
+void Paint::unpremultiplyRow(const Sml::Color* src, Sml::Color* dst, size_t count)
+{
+    assert(src);
+    assert(dst);
+
+    /* 255 / alpha in 16.16 fixed point, so that there are no divisions per pixel */
+    static const struct Reciprocals
+    {
+        uint32_t values[256];
+
+        Reciprocals()
+        {
+            values[0] = 0;
+            for (uint32_t alpha = 1; alpha < 256; ++alpha)
+            {
+                values[alpha] = (255u * 65536u + alpha / 2) / alpha;
+            }
+        }
+    } reciprocals;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t color = src[i];
+        uint32_t alpha = color & 0xFF;
+
+        if (alpha == 255 || alpha == 0)
+        {
+            dst[i] = alpha == 0 ? 0 : color;
+            continue;
+        }
+
+        uint32_t reciprocal = reciprocals.values[alpha];
+        uint32_t result     = alpha;
+
+        for (uint32_t shift = 8; shift < 32; shift += 8)
+        {
+            uint32_t channel = (((color >> shift) & 0xFF) * reciprocal + 32768) >> 16;
+            result |= std::min(channel, 255u) << shift;
+        }
+
+        dst[i] = result;
+    }
+}
+
+void Paint::blendRow(BlendMode mode, const Sml::Color* src, Sml::Color* dst, size_t count, uint8_t opacity)
+{
+    assert(mode < BlendMode::COUNT);
+    assert(src);
+    assert(dst);
+
+    if (opacity == 0)
+    {
+        return;
+    }
+
+    getImplementation().blend[static_cast<size_t>(mode)](src, dst, count, opacity);
+}
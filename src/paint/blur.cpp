@@ -0,0 +1,366 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file blur.cpp
+ * @date 2021-12-22
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include "paint/blur.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PAINT_BLUR_X86
+#include <immintrin.h>
+#endif
+
+using namespace Paint;
+
+/**
+ * All the pixel loops treat colors as plain bytes, so they don't depend on the channel order.
+ *
+ * Accumulation computes the bytes [begin, end) of the row, indexing the rows and dst from the
+ * row's start, so that the vector versions hand their tails over without offsetting the rows.
+ */
+using AccumulateFunction = void (*)(const Sml::Color* const* rows, const int16_t* weights, int32_t taps,
+                                    uint8_t* dst, size_t begin, size_t end);
+using UnsharpFunction    = void (*)(const uint8_t* original, const uint8_t* blurred, uint8_t* dst,
+                                    size_t size, uint16_t amount);
+
+static const int32_t AMOUNT_BITS = 4;
+
+//------------------------------------------------------------------------------
+// Scalar
+//------------------------------------------------------------------------------
+static void accumulateScalar(const Sml::Color* const* rows, const int16_t* weights, int32_t taps,
+                             uint8_t* dst, size_t begin, size_t end)
+{
+    const size_t BLOCK_SIZE = 256;
+    int32_t      sums[BLOCK_SIZE];
+
+    for (size_t block = begin; block < end; block += BLOCK_SIZE)
+    {
+        size_t count = std::min(BLOCK_SIZE, end - block);
+        std::fill(sums, sums + count, 1 << (BlurKernel::WEIGHT_BITS - 1));
+
+        for (int32_t k = 0; k < taps; ++k)
+        {
+            const uint8_t* src    = reinterpret_cast<const uint8_t*>(rows[k]) + block;
+            int32_t        weight = weights[k];
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                sums[i] += weight * src[i];
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            dst[block + i] = static_cast<uint8_t>(std::min(sums[i] >> BlurKernel::WEIGHT_BITS, 255));
+        }
+    }
+}
+
+static void unsharpScalar(const uint8_t* original, const uint8_t* blurred, uint8_t* dst, size_t size, uint16_t amount)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        int32_t difference = std::max(static_cast<int32_t>(original[i]) - static_cast<int32_t>(blurred[i]), 0);
+        int32_t sharpened  = std::min((difference * amount) >> AMOUNT_BITS, 255);
+
+        dst[i] = static_cast<uint8_t>(std::min(original[i] + sharpened, 255));
+    }
+}
+
+#ifdef PAINT_BLUR_X86
+//------------------------------------------------------------------------------
+// SSE2
+//------------------------------------------------------------------------------
+/* Pairs of taps are interleaved into 16-bit lanes, so that _mm_madd_epi16 computes w0 * a + w1 * b */
+static void accumulateSse2(const Sml::Color* const* rows, const int16_t* weights, int32_t taps,
+                           uint8_t* dst, size_t begin, size_t end)
+{
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (BlurKernel::WEIGHT_BITS - 1));
+
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16)
+    {
+        __m128i sum0 = round;
+        __m128i sum1 = round;
+        __m128i sum2 = round;
+        __m128i sum3 = round;
+
+        for (int32_t k = 0; k < taps; k += 2)
+        {
+            bool    hasPair = k + 1 < taps;
+            __m128i first   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(reinterpret_cast<const uint8_t*>(rows[k]) + i));
+            __m128i second  = hasPair ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(reinterpret_cast<const uint8_t*>(rows[k + 1]) + i))
+                                      : zero;
+            __m128i weight  = _mm_set1_epi32(static_cast<int32_t>(static_cast<uint16_t>(weights[k]) |
+                                             static_cast<uint32_t>(hasPair ? static_cast<uint16_t>(weights[k + 1]) : 0) << 16));
+
+            __m128i low  = _mm_unpacklo_epi8(first, second);
+            __m128i high = _mm_unpackhi_epi8(first, second);
+
+            sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi8(low,  zero), weight));
+            sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpackhi_epi8(low,  zero), weight));
+            sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpacklo_epi8(high, zero), weight));
+            sum3 = _mm_add_epi32(sum3, _mm_madd_epi16(_mm_unpackhi_epi8(high, zero), weight));
+        }
+
+        sum0 = _mm_srai_epi32(sum0, BlurKernel::WEIGHT_BITS);
+        sum1 = _mm_srai_epi32(sum1, BlurKernel::WEIGHT_BITS);
+        sum2 = _mm_srai_epi32(sum2, BlurKernel::WEIGHT_BITS);
+        sum3 = _mm_srai_epi32(sum3, BlurKernel::WEIGHT_BITS);
+
+        __m128i result = _mm_packus_epi16(_mm_packs_epi32(sum0, sum1), _mm_packs_epi32(sum2, sum3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), result);
+    }
+
+    accumulateScalar(rows, weights, taps, dst, i, end);
+}
+
+static void unsharpSse2(const uint8_t* original, const uint8_t* blurred, uint8_t* dst, size_t size, uint16_t amount)
+{
+    const __m128i zero        = _mm_setzero_si128();
+    const __m128i amountVector = _mm_set1_epi16(static_cast<int16_t>(amount));
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i originalBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(original + i));
+        __m128i blurredBytes  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(blurred  + i));
+        __m128i difference    = _mm_subs_epu8(originalBytes, blurredBytes);
+
+        __m128i low  = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(difference, zero), amountVector), AMOUNT_BITS);
+        __m128i high = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(difference, zero), amountVector), AMOUNT_BITS);
+
+        __m128i result = _mm_adds_epu8(originalBytes, _mm_packus_epi16(low, high));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), result);
+    }
+
+    unsharpScalar(original + i, blurred + i, dst + i, size - i, amount);
+}
+
+//------------------------------------------------------------------------------
+// AVX2
+//------------------------------------------------------------------------------
+/* Unpacks and packs both work within 128-bit lanes, so the byte order survives the round trip */
+__attribute__((target("avx2")))
+static void accumulateAvx2(const Sml::Color* const* rows, const int16_t* weights, int32_t taps,
+                           uint8_t* dst, size_t begin, size_t end)
+{
+    const __m256i zero  = _mm256_setzero_si256();
+    const __m256i round = _mm256_set1_epi32(1 << (BlurKernel::WEIGHT_BITS - 1));
+
+    size_t i = begin;
+    for (; i + 32 <= end; i += 32)
+    {
+        __m256i sum0 = round;
+        __m256i sum1 = round;
+        __m256i sum2 = round;
+        __m256i sum3 = round;
+
+        for (int32_t k = 0; k < taps; k += 2)
+        {
+            bool    hasPair = k + 1 < taps;
+            __m256i first   = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(reinterpret_cast<const uint8_t*>(rows[k]) + i));
+            __m256i second  = hasPair ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(reinterpret_cast<const uint8_t*>(rows[k + 1]) + i))
+                                      : zero;
+            __m256i weight  = _mm256_set1_epi32(static_cast<int32_t>(static_cast<uint16_t>(weights[k]) |
+                                                static_cast<uint32_t>(hasPair ? static_cast<uint16_t>(weights[k + 1]) : 0) << 16));
+
+            __m256i low  = _mm256_unpacklo_epi8(first, second);
+            __m256i high = _mm256_unpackhi_epi8(first, second);
+
+            sum0 = _mm256_add_epi32(sum0, _mm256_madd_epi16(_mm256_unpacklo_epi8(low,  zero), weight));
+            sum1 = _mm256_add_epi32(sum1, _mm256_madd_epi16(_mm256_unpackhi_epi8(low,  zero), weight));
+            sum2 = _mm256_add_epi32(sum2, _mm256_madd_epi16(_mm256_unpacklo_epi8(high, zero), weight));
+            sum3 = _mm256_add_epi32(sum3, _mm256_madd_epi16(_mm256_unpackhi_epi8(high, zero), weight));
+        }
+
+        sum0 = _mm256_srai_epi32(sum0, BlurKernel::WEIGHT_BITS);
+        sum1 = _mm256_srai_epi32(sum1, BlurKernel::WEIGHT_BITS);
+        sum2 = _mm256_srai_epi32(sum2, BlurKernel::WEIGHT_BITS);
+        sum3 = _mm256_srai_epi32(sum3, BlurKernel::WEIGHT_BITS);
+
+        __m256i result = _mm256_packus_epi16(_mm256_packs_epi32(sum0, sum1), _mm256_packs_epi32(sum2, sum3));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), result);
+    }
+
+    accumulateSse2(rows, weights, taps, dst, i, end);
+}
+
+__attribute__((target("avx2")))
+static void unsharpAvx2(const uint8_t* original, const uint8_t* blurred, uint8_t* dst, size_t size, uint16_t amount)
+{
+    const __m256i zero         = _mm256_setzero_si256();
+    const __m256i amountVector = _mm256_set1_epi16(static_cast<int16_t>(amount));
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i originalBytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(original + i));
+        __m256i blurredBytes  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(blurred  + i));
+        __m256i difference    = _mm256_subs_epu8(originalBytes, blurredBytes);
+
+        __m256i low  = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(difference, zero), amountVector), AMOUNT_BITS);
+        __m256i high = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(difference, zero), amountVector), AMOUNT_BITS);
+
+        __m256i result = _mm256_adds_epu8(originalBytes, _mm256_packus_epi16(low, high));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), result);
+    }
+
+    unsharpSse2(original + i, blurred + i, dst + i, size - i, amount);
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Runtime dispatch
+//------------------------------------------------------------------------------
+struct BlurImplementation
+{
+    const char*        name;
+    AccumulateFunction accumulate;
+    UnsharpFunction    unsharp;
+};
+
+static BlurImplementation selectImplementation()
+{
+#ifdef PAINT_BLUR_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return {"avx2", accumulateAvx2, unsharpAvx2};
+    }
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return {"sse2", accumulateSse2, unsharpSse2};
+    }
+#endif
+
+    return {"scalar", accumulateScalar, unsharpScalar};
+}
+
+static const BlurImplementation& getImplementation()
+{
+    static const BlurImplementation implementation = selectImplementation();
+    return implementation;
+}
+
+const char* Paint::getBlurImplementationName() { return getImplementation().name; }
+
+//------------------------------------------------------------------------------
+// BlurKernel
+//------------------------------------------------------------------------------
+BlurKernel::BlurKernel(int32_t radius) : m_Radius(std::max(radius, 0)), m_Weights(2 * m_Radius + 1)
+{
+    float sigma = std::max(m_Radius / 2.0f, 0.5f);
+
+    std::vector<float> gaussian(m_Weights.size());
+    float              total = 0;
+
+    for (int32_t i = -m_Radius; i <= m_Radius; ++i)
+    {
+        gaussian[i + m_Radius] = std::exp(-(i * i) / (2 * sigma * sigma));
+        total += gaussian[i + m_Radius];
+    }
+
+    int32_t quantizedTotal = 0;
+    for (size_t i = 0; i < m_Weights.size(); ++i)
+    {
+        m_Weights[i]    = static_cast<int16_t>(std::lround(gaussian[i] / total * (1 << WEIGHT_BITS)));
+        quantizedTotal += m_Weights[i];
+    }
+
+    /* Rounding errors go to the center, so that flat areas stay exactly the same */
+    m_Weights[m_Radius] = static_cast<int16_t>(m_Weights[m_Radius] + (1 << WEIGHT_BITS) - quantizedTotal);
+}
+
+int32_t BlurKernel::getRadius() const         { return m_Radius;                               }
+int32_t BlurKernel::getSize() const           { return static_cast<int32_t>(m_Weights.size()); }
+const int16_t* BlurKernel::getWeights() const { return m_Weights.data();                       }
+
+//------------------------------------------------------------------------------
+// Passes
+//------------------------------------------------------------------------------
+void Paint::blurRowHorizontally(const Sml::Color* src, Sml::Color* dst, int32_t width,
+                                const BlurKernel& kernel, BlurScratch* scratch)
+{
+    assert(src);
+    assert(dst);
+    assert(scratch);
+
+    int32_t radius = kernel.getRadius();
+
+    scratch->paddedRow.resize(width + 2 * radius);
+    std::fill(scratch->paddedRow.begin(), scratch->paddedRow.begin() + radius, src[0]);
+    std::copy(src, src + width, scratch->paddedRow.begin() + radius);
+    std::fill(scratch->paddedRow.begin() + radius + width, scratch->paddedRow.end(), src[width - 1]);
+
+    /* Shifting the row by one pixel per tap turns the horizontal pass into the vertical one */
+    scratch->rows.resize(kernel.getSize());
+    for (int32_t k = 0; k < kernel.getSize(); ++k)
+    {
+        scratch->rows[k] = scratch->paddedRow.data() + k;
+    }
+
+    getImplementation().accumulate(scratch->rows.data(), kernel.getWeights(), kernel.getSize(),
+                                   reinterpret_cast<uint8_t*>(dst), 0, width * sizeof(Sml::Color));
+}
+
+void Paint::blurRowVertically(const Sml::Color* const* rows, Sml::Color* dst, int32_t width, const BlurKernel& kernel)
+{
+    assert(rows);
+    assert(dst);
+
+    getImplementation().accumulate(rows, kernel.getWeights(), kernel.getSize(),
+                                   reinterpret_cast<uint8_t*>(dst), 0, width * sizeof(Sml::Color));
+}
+
+void Paint::gaussianBlur(const Sml::Color* src, Sml::Color* dst, int32_t width, int32_t height, const BlurKernel& kernel)
+{
+    assert(src);
+    assert(dst);
+
+    std::vector<Sml::Color> horizontal(static_cast<size_t>(width) * height);
+    BlurScratch             scratch;
+
+    for (int32_t y = 0; y < height; ++y)
+    {
+        blurRowHorizontally(src + y * width, horizontal.data() + y * width, width, kernel, &scratch);
+    }
+
+    int32_t radius = kernel.getRadius();
+    scratch.rows.resize(kernel.getSize());
+
+    for (int32_t y = 0; y < height; ++y)
+    {
+        for (int32_t k = 0; k < kernel.getSize(); ++k)
+        {
+            int32_t row = std::min(std::max(y + k - radius, 0), height - 1);
+            scratch.rows[k] = horizontal.data() + row * width;
+        }
+
+        blurRowVertically(scratch.rows.data(), dst + y * width, width, kernel);
+    }
+}
+
+void Paint::unsharpMaskRow(const Sml::Color* original, const Sml::Color* blurred, Sml::Color* dst,
+                           int32_t width, float amount)
+{
+    assert(original);
+    assert(blurred);
+    assert(dst);
+
+    float    scaled      = std::round(amount * (1 << AMOUNT_BITS));
+    uint16_t fixedAmount = static_cast<uint16_t>(std::min(std::max(scaled, 0.0f), 255.0f));
+
+    getImplementation().unsharp(reinterpret_cast<const uint8_t*>(original), reinterpret_cast<const uint8_t*>(blurred),
+                                reinterpret_cast<uint8_t*>(dst), width * sizeof(Sml::Color), fixedAmount);
+}
@@ -0,0 +1,407 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file compositor.cpp
+ * @date 2021-12-31
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <algorithm>
+#include <cassert>
+#include "paint/compositor.h"
+#include "paint/mip_pyramid.h"
+#include "paint/document.h"
+
+using namespace Paint;
+
+const size_t Compositor::MIN_CACHED_RUN = 2;
+
+/**
+ * @brief Blends the rect of the image over dst, which is the rect's pixels with the given stride.
+ *
+ * @param row Scratch for premultiplying a row of a tile, Tile::SIZE pixels.
+ */
+static void blendImage(const TiledImage& image, bool isPremultiplied, BlendMode mode, uint8_t opacity,
+                       const Sml::Rectangle<int32_t>& rect, Sml::Color* dst, int32_t stride, Sml::Color* row)
+{
+    size_t firstColumn, firstRow, endColumn, endRow;
+    image.getTileRange(rect, &firstColumn, &firstRow, &endColumn, &endRow);
+
+    for (size_t tileRow = firstRow; tileRow < endRow; ++tileRow)
+    {
+        for (size_t column = firstColumn; column < endColumn; ++column)
+        {
+            size_t         index = image.getTileIndex(column, tileRow);
+            const TilePtr& tile  = image.getTile(index);
+
+            if (tile == nullptr)
+            {
+                continue;
+            }
+
+            Sml::Rectangle<int32_t> tileRect = image.getTileRect(index);
+            Sml::Rectangle<int32_t> region   = intersectRects(rect, tileRect);
+
+            for (int32_t y = region.pos.y; y < region.pos.y + region.height; ++y)
+            {
+                const Sml::Color* src = tile->pixels + (y - tileRect.pos.y) * Tile::SIZE + (region.pos.x - tileRect.pos.x);
+
+                if (!isPremultiplied)
+                {
+                    premultiplyRow(src, row, region.width);
+                    src = row;
+                }
+
+                blendRow(mode, src, dst + (y - rect.pos.y) * stride + (region.pos.x - rect.pos.x), region.width, opacity);
+            }
+        }
+    }
+}
+
+Compositor::Compositor(ThreadPool& pool) : m_Pool(pool) {}
+
+void Compositor::update(const LayerStack& layers, LayerHandle activeLayer)
+{
+    size_t active = layers.contains(activeLayer) ? layers.getIndex(activeLayer) : layers.getSize();
+
+    /* Caches whose nodes changed order, visibility or blend mode are dropped here */
+    m_UnusedCaches = std::move(m_Caches);
+    m_Caches.clear();
+
+    m_Entries = buildEntries(layers, 0, layers.getSize(), active);
+    m_UnusedCaches.clear();
+}
+
+void Compositor::compose(const Sml::Rectangle<int32_t>& rect, Sml::Color* pixels, size_t level)
+{
+    assert(pixels);
+
+    if (isRectEmpty(rect))
+    {
+        return;
+    }
+
+    /* Tiles drawn to on the GPU are read back here, on the rendering thread */
+    prepareEntries(m_Entries, rect, level);
+
+    /* Bands are aligned to tile rows, so that every band walks each tile once */
+    int32_t firstRow = rect.pos.y / Tile::SIZE;
+    int32_t endRow   = (rect.pos.y + rect.height - 1) / Tile::SIZE + 1;
+
+    m_Pool.parallelFor(static_cast<size_t>(endRow - firstRow), [&](size_t index)
+    {
+        Sml::Rectangle<int32_t> band = intersectRects(rect, Sml::Rectangle<int32_t>(rect.pos.x,
+                                                      (firstRow + static_cast<int32_t>(index)) * Tile::SIZE,
+                                                      rect.width, Tile::SIZE));
+
+        Sml::Color* dst = pixels + static_cast<size_t>(band.pos.y - rect.pos.y) * rect.width;
+        std::fill(dst, dst + static_cast<size_t>(band.height) * rect.width, 0);
+
+        composeEntries(m_Entries, band, dst, rect.width);
+
+        for (int32_t y = 0; y < band.height; ++y)
+        {
+            unpremultiplyRow(dst + y * rect.width, dst + y * rect.width, rect.width);
+        }
+    });
+}
+
+size_t Compositor::getCacheCount() const { return m_Caches.size(); }
+
+std::vector<Compositor::Entry> Compositor::buildEntries(const LayerStack& layers, size_t first, size_t end,
+                                                        size_t activeLayer)
+{
+    std::vector<size_t> children;
+    size_t              activeChild = SIZE_MAX;
+
+    for (size_t child = first; child < end; child = layers.getSubtreeEnd(child))
+    {
+        if (!layers.isShown(child))
+        {
+            continue;
+        }
+
+        if (child <= activeLayer && activeLayer < layers.getSubtreeEnd(child))
+        {
+            activeChild = children.size();
+        }
+
+        children.push_back(child);
+    }
+
+    std::vector<Entry>  entries;
+    std::vector<size_t> pending;
+
+    auto flushPending = [&]()
+    {
+        if (pending.size() < MIN_CACHED_RUN)
+        {
+            for (size_t node : pending)
+            {
+                entries.push_back(buildEntry(layers, node));
+            }
+        }
+        else
+        {
+            entries.emplace_back();
+            entries.back().cache = takeCache(layers, pending);
+        }
+
+        pending.clear();
+    };
+
+    /* Everything below the active layer, whatever the blend modes, as it's composed first */
+    size_t split = std::min(activeChild, children.size());
+
+    pending.assign(children.begin(), children.begin() + split);
+    flushPending();
+
+    for (size_t i = split; i < children.size(); ++i)
+    {
+        size_t node = children[i];
+
+        /* Normal blending is associative, so adjacent normal layers can be composed in advance */
+        if (i != activeChild && layers.getBlendMode(node) == BlendMode::NORMAL)
+        {
+            pending.push_back(node);
+            continue;
+        }
+
+        flushPending();
+
+        if (i == activeChild && layers.getGroup(node) != nullptr)
+        {
+            entries.emplace_back();
+            entries.back().children = buildEntries(layers, node + 1, layers.getSubtreeEnd(node), activeLayer);
+            entries.back().mode     = layers.getBlendMode(node);
+            entries.back().opacity  = layers.getOpacity(node);
+        }
+        else
+        {
+            entries.push_back(buildEntry(layers, node));
+        }
+    }
+
+    flushPending();
+
+    return entries;
+}
+
+Compositor::Entry Compositor::buildEntry(const LayerStack& layers, size_t index)
+{
+    Entry entry;
+    entry.layer   = layers.getLayer(index);
+    entry.mode    = layers.getBlendMode(index);
+    entry.opacity = layers.getOpacity(index);
+
+    if (entry.layer != nullptr)
+    {
+        return entry;
+    }
+
+    std::vector<size_t> children;
+    for (size_t child = index + 1; child < layers.getSubtreeEnd(index); child = layers.getSubtreeEnd(child))
+    {
+        if (layers.isShown(child))
+        {
+            children.push_back(child);
+        }
+    }
+
+    /* An empty group is left with neither a layer nor a cache, so it's skipped */
+    if (!children.empty())
+    {
+        entry.cache = takeCache(layers, children);
+    }
+
+    return entry;
+}
+
+Compositor::Cache* Compositor::takeCache(const LayerStack& layers, const std::vector<size_t>& nodes)
+{
+    assert(!nodes.empty());
+
+    std::vector<std::pair<LayerHandle, size_t>> key;
+    for (size_t node : nodes)
+    {
+        for (size_t i = node; i < layers.getSubtreeEnd(node); ++i)
+        {
+            key.emplace_back(layers.getHandle(i), layers.getDepth(i));
+        }
+    }
+
+    std::unique_ptr<Cache> cache;
+
+    for (auto& unused : m_UnusedCaches)
+    {
+        if (unused != nullptr && unused->key == key)
+        {
+            cache = std::move(unused);
+            break;
+        }
+    }
+
+    if (cache == nullptr)
+    {
+        Layer*      layer = layers.getLayer(nodes.front());
+        LayerGroup* group = layers.getGroup(nodes.front());
+
+        cache         = std::make_unique<Cache>();
+        cache->key    = std::move(key);
+        cache->width  = layer != nullptr ? layer->getWidth()  : group->getWidth();
+        cache->height = layer != nullptr ? layer->getHeight() : group->getHeight();
+    }
+
+    /* Any change inside the nodes' subtrees, including the groups' own properties */
+    for (size_t node : nodes)
+    {
+        for (size_t i = node; i < layers.getSubtreeEnd(node); ++i)
+        {
+            for (const auto& rect : layers.getDirtyRegion(i).getRects())
+            {
+                for (size_t level = 0; level < cache->levels.size(); ++level)
+                {
+                    CacheLevel& cacheLevel = cache->levels[level];
+
+                    size_t firstColumn, firstRow, endColumn, endRow;
+                    cacheLevel.pixels.getTileRange(MipPyramid::getLevelRect(rect, level),
+                                                   &firstColumn, &firstRow, &endColumn, &endRow);
+
+                    for (size_t row = firstRow; row < endRow; ++row)
+                    {
+                        for (size_t column = firstColumn; column < endColumn; ++column)
+                        {
+                            cacheLevel.staleTiles[cacheLevel.pixels.getTileIndex(column, row)] = true;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /* Blend modes and opacities may have changed since the cache was created */
+    cache->items.clear();
+    for (size_t node : nodes)
+    {
+        cache->items.push_back(buildEntry(layers, node));
+    }
+
+    m_Caches.push_back(std::move(cache));
+    return m_Caches.back().get();
+}
+
+void Compositor::prepareEntries(std::vector<Entry>& entries, const Sml::Rectangle<int32_t>& rect, size_t level)
+{
+    for (auto& entry : entries)
+    {
+        if (entry.layer != nullptr)
+        {
+            entry.image = &entry.layer->readLevel(level, rect);
+        }
+        else if (entry.cache != nullptr)
+        {
+            entry.image = &updateCache(entry.cache, rect, level).pixels;
+        }
+        else
+        {
+            prepareEntries(entry.children, rect, level);
+        }
+    }
+}
+
+Compositor::CacheLevel& Compositor::updateCache(Cache* cache, const Sml::Rectangle<int32_t>& rect, size_t level)
+{
+    assert(cache);
+
+    while (cache->levels.size() <= level)
+    {
+        size_t next = cache->levels.size();
+
+        cache->levels.emplace_back();
+        cache->levels.back().pixels = TiledImage(MipPyramid::getLevelSize(cache->width,  next),
+                                                 MipPyramid::getLevelSize(cache->height, next));
+        cache->levels.back().staleTiles.assign(cache->levels.back().pixels.getTileCount(), true);
+    }
+
+    CacheLevel& cacheLevel = cache->levels[level];
+
+    size_t firstColumn, firstRow, endColumn, endRow;
+    cacheLevel.pixels.getTileRange(rect, &firstColumn, &firstRow, &endColumn, &endRow);
+
+    std::vector<size_t> staleTiles;
+
+    for (size_t row = firstRow; row < endRow; ++row)
+    {
+        for (size_t column = firstColumn; column < endColumn; ++column)
+        {
+            size_t index = cacheLevel.pixels.getTileIndex(column, row);
+
+            if (cacheLevel.staleTiles[index])
+            {
+                staleTiles.push_back(index);
+                cacheLevel.staleTiles[index] = false;
+            }
+        }
+    }
+
+    if (staleTiles.empty())
+    {
+        return cacheLevel;
+    }
+
+    for (size_t index : staleTiles)
+    {
+        prepareEntries(cache->items, cacheLevel.pixels.getTileRect(index), level);
+    }
+
+    /* Whole tiles are recomposed, even if only a part of them is needed now */
+    m_Pool.parallelFor(staleTiles.size(), [&](size_t i)
+    {
+        size_t                  index    = staleTiles[i];
+        Sml::Rectangle<int32_t> tileRect = cacheLevel.pixels.getTileRect(index);
+
+        TilePtr tile = std::make_shared<Tile>();
+        std::fill(tile->pixels, tile->pixels + Tile::SIZE * Tile::SIZE, 0);
+
+        composeEntries(cache->items, tileRect, tile->pixels, Tile::SIZE);
+
+        cacheLevel.pixels.setTile(index, TiledImage::isTileTransparent(*tile) ? nullptr : tile);
+    });
+
+    return cacheLevel;
+}
+
+void Compositor::composeEntries(const std::vector<Entry>& entries, const Sml::Rectangle<int32_t>& rect,
+                                Sml::Color* dst, int32_t stride)
+{
+    Sml::Color row[Tile::SIZE];
+
+    for (const auto& entry : entries)
+    {
+        blendEntry(entry, rect, dst, stride, row);
+    }
+}
+
+void Compositor::blendEntry(const Entry& entry, const Sml::Rectangle<int32_t>& rect,
+                            Sml::Color* dst, int32_t stride, Sml::Color* row)
+{
+    if (entry.layer != nullptr)
+    {
+        blendImage(*entry.image, false, entry.mode, entry.opacity, rect, dst, stride, row);
+    }
+    else if (entry.cache != nullptr)
+    {
+        blendImage(*entry.image, true, entry.mode, entry.opacity, rect, dst, stride, row);
+    }
+    else if (!entry.children.empty())
+    {
+        /* Composed on its own first, so that the group's blend mode applies to the result */
+        std::vector<Sml::Color> group(static_cast<size_t>(rect.width) * rect.height, 0);
+        composeEntries(entry.children, rect, group.data(), rect.width);
+
+        for (int32_t y = 0; y < rect.height; ++y)
+        {
+            blendRow(entry.mode, group.data() + y * rect.width, dst + y * stride, rect.width, entry.opacity);
+        }
+    }
+}
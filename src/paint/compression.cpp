@@ -0,0 +1,195 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file compression.cpp
+ * @date 2021-12-21
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <cassert>
+#include <cstring>
+#include "paint/compression.h"
+
+static const size_t   LZ_MIN_MATCH  = 4;
+static const size_t   LZ_MAX_OFFSET = 0xFFFF;
+static const size_t   LZ_HASH_BITS  = 12;
+static const uint32_t LZ_NO_MATCH   = UINT32_MAX;
+
+static inline uint32_t read32(const uint8_t* ptr)
+{
+    uint32_t value = 0;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static inline uint32_t hash32(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void writeLength(std::vector<uint8_t>* dst, size_t length)
+{
+    while (length >= 255)
+    {
+        dst->push_back(255);
+        length -= 255;
+    }
+
+    dst->push_back(static_cast<uint8_t>(length));
+}
+
+static void writeSequence(std::vector<uint8_t>* dst, const uint8_t* literals, size_t literalsCount,
+                          size_t offset, size_t matchLength)
+{
+    size_t  matchCode = matchLength != 0 ? matchLength - LZ_MIN_MATCH : 0;
+    uint8_t token     = static_cast<uint8_t>((literalsCount < 15 ? literalsCount : 15) << 4 |
+                                             (matchCode     < 15 ? matchCode     : 15));
+    dst->push_back(token);
+
+    if (literalsCount >= 15)
+    {
+        writeLength(dst, literalsCount - 15);
+    }
+
+    dst->insert(dst->end(), literals, literals + literalsCount);
+
+    if (matchLength == 0)
+    {
+        return;
+    }
+
+    dst->push_back(static_cast<uint8_t>(offset & 0xFF));
+    dst->push_back(static_cast<uint8_t>(offset >> 8));
+
+    if (matchCode >= 15)
+    {
+        writeLength(dst, matchCode - 15);
+    }
+}
+
+size_t Paint::compress(const uint8_t* src, size_t srcSize, std::vector<uint8_t>* dst)
+{
+    assert(src);
+    assert(dst);
+
+    size_t initialSize = dst->size();
+
+    std::vector<uint32_t> table(1 << LZ_HASH_BITS, LZ_NO_MATCH);
+
+    size_t anchor = 0;
+    size_t pos    = 0;
+
+    while (pos + LZ_MIN_MATCH <= srcSize)
+    {
+        uint32_t sequence  = read32(src + pos);
+        uint32_t hash      = hash32(sequence);
+        uint32_t candidate = table[hash];
+        table[hash] = static_cast<uint32_t>(pos);
+
+        if (candidate == LZ_NO_MATCH || pos - candidate > LZ_MAX_OFFSET || read32(src + candidate) != sequence)
+        {
+            ++pos;
+            continue;
+        }
+
+        size_t matchLength = LZ_MIN_MATCH;
+        while (pos + matchLength < srcSize && src[candidate + matchLength] == src[pos + matchLength])
+        {
+            ++matchLength;
+        }
+
+        writeSequence(dst, src + anchor, pos - anchor, pos - candidate, matchLength);
+
+        pos   += matchLength;
+        anchor = pos;
+    }
+
+    writeSequence(dst, src + anchor, srcSize - anchor, 0, 0);
+
+    return dst->size() - initialSize;
+}
+
+static bool readLength(const uint8_t** src, const uint8_t* srcEnd, size_t* length)
+{
+    uint8_t byte = 255;
+
+    while (byte == 255)
+    {
+        if (*src >= srcEnd)
+        {
+            return false;
+        }
+
+        byte = *(*src)++;
+        *length += byte;
+    }
+
+    return true;
+}
+
+bool Paint::decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+    assert(src);
+    assert(dst);
+
+    const uint8_t* srcEnd = src + srcSize;
+    size_t         pos    = 0;
+
+    while (src < srcEnd)
+    {
+        uint8_t token = *src++;
+
+        size_t literalsCount = token >> 4;
+        if (literalsCount == 15 && !readLength(&src, srcEnd, &literalsCount))
+        {
+            return false;
+        }
+
+        if (literalsCount > static_cast<size_t>(srcEnd - src) || literalsCount > dstSize - pos)
+        {
+            return false;
+        }
+
+        memcpy(dst + pos, src, literalsCount);
+        src += literalsCount;
+        pos += literalsCount;
+
+        /* The last sequence has no match */
+        if (src == srcEnd)
+        {
+            break;
+        }
+
+        if (srcEnd - src < 2)
+        {
+            return false;
+        }
+
+        size_t offset = static_cast<size_t>(src[0]) | static_cast<size_t>(src[1]) << 8;
+        src += 2;
+
+        size_t matchLength = token & 0x0F;
+        if (matchLength == 15 && !readLength(&src, srcEnd, &matchLength))
+        {
+            return false;
+        }
+
+        matchLength += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > pos || matchLength > dstSize - pos)
+        {
+            return false;
+        }
+
+        /* Matches may overlap the bytes they produce, so copy one byte at a time */
+        const uint8_t* match = dst + pos - offset;
+        for (size_t i = 0; i < matchLength; ++i)
+        {
+            dst[pos + i] = match[i];
+        }
+
+        pos += matchLength;
+    }
+
+    return pos == dstSize;
+}
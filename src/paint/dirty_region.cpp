@@ -0,0 +1,170 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file dirty_region.cpp
+ * @date 2021-12-20
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <algorithm>
+#include <cassert>
+#include "paint/dirty_region.h"
+
+using namespace Paint;
+
+bool Paint::isRectEmpty(const Sml::Rectangle<int32_t>& rect)
+{
+    return rect.width <= 0 || rect.height <= 0;
+}
+
+bool Paint::doRectsOverlap(const Sml::Rectangle<int32_t>& first, const Sml::Rectangle<int32_t>& second)
+{
+    return first.pos.x <= second.pos.x + second.width  && second.pos.x <= first.pos.x + first.width &&
+           first.pos.y <= second.pos.y + second.height && second.pos.y <= first.pos.y + first.height;
+}
+
+Sml::Rectangle<int32_t> Paint::intersectRects(const Sml::Rectangle<int32_t>& first, const Sml::Rectangle<int32_t>& second)
+{
+    int32_t left   = std::max(first.pos.x, second.pos.x);
+    int32_t top    = std::max(first.pos.y, second.pos.y);
+    int32_t right  = std::min(first.pos.x + first.width,  second.pos.x + second.width);
+    int32_t bottom = std::min(first.pos.y + first.height, second.pos.y + second.height);
+
+    if (right <= left || bottom <= top)
+    {
+        return Sml::Rectangle<int32_t>(0, 0, 0, 0);
+    }
+
+    return Sml::Rectangle<int32_t>(left, top, right - left, bottom - top);
+}
+
+Sml::Rectangle<int32_t> Paint::uniteRects(const Sml::Rectangle<int32_t>& first, const Sml::Rectangle<int32_t>& second)
+{
+    if (isRectEmpty(first))  { return second; }
+    if (isRectEmpty(second)) { return first;  }
+
+    int32_t left   = std::min(first.pos.x, second.pos.x);
+    int32_t top    = std::min(first.pos.y, second.pos.y);
+    int32_t right  = std::max(first.pos.x + first.width,  second.pos.x + second.width);
+    int32_t bottom = std::max(first.pos.y + first.height, second.pos.y + second.height);
+
+    return Sml::Rectangle<int32_t>(left, top, right - left, bottom - top);
+}
+
+void Paint::subtractRect(const Sml::Rectangle<int32_t>& rect, const Sml::Rectangle<int32_t>& hole,
+                         std::vector<Sml::Rectangle<int32_t>>* pieces)
+{
+    assert(pieces);
+
+    Sml::Rectangle<int32_t> overlap = intersectRects(rect, hole);
+
+    if (isRectEmpty(overlap))
+    {
+        if (!isRectEmpty(rect))
+        {
+            pieces->push_back(rect);
+        }
+
+        return;
+    }
+
+    int32_t right         = rect.pos.x + rect.width;
+    int32_t bottom        = rect.pos.y + rect.height;
+    int32_t overlapRight  = overlap.pos.x + overlap.width;
+    int32_t overlapBottom = overlap.pos.y + overlap.height;
+
+    /* Full width strips above and below the hole, then the parts on its sides */
+    const Sml::Rectangle<int32_t> candidates[] = {
+        Sml::Rectangle<int32_t>(rect.pos.x,   rect.pos.y,    rect.width,                 overlap.pos.y - rect.pos.y),
+        Sml::Rectangle<int32_t>(rect.pos.x,   overlapBottom, rect.width,                 bottom - overlapBottom),
+        Sml::Rectangle<int32_t>(rect.pos.x,   overlap.pos.y, overlap.pos.x - rect.pos.x, overlap.height),
+        Sml::Rectangle<int32_t>(overlapRight, overlap.pos.y, right - overlapRight,       overlap.height)};
+
+    for (const auto& candidate : candidates)
+    {
+        if (!isRectEmpty(candidate))
+        {
+            pieces->push_back(candidate);
+        }
+    }
+}
+
+Sml::Rectangle<int32_t> Paint::computeLineBounds(const Sml::Vec2i& start, const Sml::Vec2i& end, int32_t thickness)
+{
+    int32_t halfThickness = thickness / 2 + 1;
+
+    int32_t left   = std::min(start.x, end.x) - halfThickness;
+    int32_t top    = std::min(start.y, end.y) - halfThickness;
+    int32_t right  = std::max(start.x, end.x) + halfThickness + 1;
+    int32_t bottom = std::max(start.y, end.y) + halfThickness + 1;
+
+    return Sml::Rectangle<int32_t>(left, top, right - left, bottom - top);
+}
+
+//------------------------------------------------------------------------------
+// DirtyRegion
+//------------------------------------------------------------------------------
+const size_t DirtyRegion::MAX_RECTS = 16;
+
+void DirtyRegion::add(const Sml::Rectangle<int32_t>& rect)
+{
+    if (isRectEmpty(rect))
+    {
+        return;
+    }
+
+    Sml::Rectangle<int32_t> merged = rect;
+
+    /* Absorbing a rectangle can make the result overlap the ones checked before it */
+    bool absorbed = true;
+    while (absorbed)
+    {
+        absorbed = false;
+
+        for (auto it = m_Rects.begin(); it != m_Rects.end(); ++it)
+        {
+            if (doRectsOverlap(*it, merged))
+            {
+                merged = uniteRects(*it, merged);
+                m_Rects.erase(it);
+                absorbed = true;
+                break;
+            }
+        }
+    }
+
+    m_Rects.push_back(merged);
+
+    if (m_Rects.size() > MAX_RECTS)
+    {
+        Sml::Rectangle<int32_t> bounds = getBounds();
+        m_Rects.clear();
+        m_Rects.push_back(bounds);
+    }
+}
+
+void DirtyRegion::add(const DirtyRegion& region)
+{
+    for (const auto& rect : region.m_Rects)
+    {
+        add(rect);
+    }
+}
+
+void DirtyRegion::clear() { m_Rects.clear(); }
+
+bool DirtyRegion::isEmpty() const { return m_Rects.empty(); }
+
+Sml::Rectangle<int32_t> DirtyRegion::getBounds() const
+{
+    Sml::Rectangle<int32_t> bounds(0, 0, 0, 0);
+
+    for (const auto& rect : m_Rects)
+    {
+        bounds = uniteRects(bounds, rect);
+    }
+
+    return bounds;
+}
+
+const std::vector<Sml::Rectangle<int32_t>>& DirtyRegion::getRects() const { return m_Rects; }
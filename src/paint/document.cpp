@@ -6,25 +6,172 @@
  * @copyright Copyright (c) 2021
  */
 
+#include <algorithm>
 #include "sml/sml_log.h"
 #include "paint/document.h"
+#include "paint/history.h"
+#include "paint/image_loader.h"
+#include "paint/frame_profiler.h"
 
 using namespace Paint;
 
-Layer::Layer(size_t width, size_t height)
+LazySnapshot::LazySnapshot(const TiledImage& tiles) : m_Tiles(tiles) {}
+
+LazySnapshot::LazySnapshot(const TiledImage& tiles, const std::vector<bool>& unloaded,
+                           const std::shared_ptr<const DocumentFile>& source, std::vector<TileLocation> locations)
+    : m_Tiles(tiles), m_Unloaded(unloaded), m_Source(source), m_Locations(std::move(locations))
+{
+    assert(m_Unloaded.size()  == m_Tiles.getTileCount());
+    assert(m_Locations.size() == m_Tiles.getTileCount());
+    assert(m_Source);
+}
+
+size_t LazySnapshot::getTileCount() const { return m_Tiles.getTileCount(); }
+
+bool LazySnapshot::isUnloaded(size_t index) const
+{
+    return !m_Unloaded.empty() && m_Unloaded[index];
+}
+
+TilePtr LazySnapshot::getTile(size_t index) const
+{
+    return isUnloaded(index) ? m_Source->loadTile(m_Locations[index]) : m_Tiles.getTile(index);
+}
+
+const TiledImage& LazySnapshot::read(const Sml::Rectangle<int32_t>& rect)
+{
+    if (m_Unloaded.empty())
+    {
+        return m_Tiles;
+    }
+
+    size_t firstColumn, firstRow, endColumn, endRow;
+    m_Tiles.getTileRange(rect, &firstColumn, &firstRow, &endColumn, &endRow);
+
+    for (size_t row = firstRow; row < endRow; ++row)
+    {
+        for (size_t column = firstColumn; column < endColumn; ++column)
+        {
+            size_t index = m_Tiles.getTileIndex(column, row);
+
+            if (m_Unloaded[index])
+            {
+                m_Tiles.setTile(index, m_Source->loadTile(m_Locations[index]));
+                m_Unloaded[index] = false;
+            }
+        }
+    }
+
+    return m_Tiles;
+}
+
+Layer::Layer(size_t width, size_t height, Sml::Color color)
+    : m_Tiles(width, height),
+      m_StaleTiles(m_Tiles.getTileCount(), false),
+      m_Mips(width, height),
+      m_UnloadedTiles(m_Tiles.getTileCount(), false),
+      m_SavedTiles(m_Tiles.getTileCount())
 {
     assert(width  > 0);
     assert(height > 0);
 
     m_Texture = new Sml::Texture(width, height);
+    clearTexture(color);
 
-    Sml::Renderer::getInstance().pushTarget();
-    Sml::Renderer::getInstance().setTarget(m_Texture);
+    /* Null tiles are transparent already, and copy-on-write detaches the shared one when drawn on */
+    if (Sml::colorGetA(color) != 0)
+    {
+        TilePtr tile = std::make_shared<Tile>();
+        std::fill(std::begin(tile->pixels), std::end(tile->pixels), color);
 
-    Sml::Renderer::getInstance().setColor(Sml::COLOR_WHITE);
-    Sml::Renderer::getInstance().clear();
+        for (size_t i = 0; i < m_Tiles.getTileCount(); ++i)
+        {
+            m_Tiles.setTile(i, tile);
+        }
+    }
 
-    Sml::Renderer::getInstance().popTarget();
+    /* Not markDirty(), the tiles are up to date */
+    m_DirtyRegion.add(Sml::Rectangle<int32_t>(0, 0, static_cast<int32_t>(width), static_cast<int32_t>(height)));
+}
+
+Layer::Layer(const TiledImage& image)
+    : m_Tiles(image),
+      m_StaleTiles(m_Tiles.getTileCount(), false),
+      m_Mips(image.getWidth(), image.getHeight()),
+      m_UnloadedTiles(m_Tiles.getTileCount(), false),
+      m_SavedTiles(m_Tiles.getTileCount())
+{
+    assert(image.getWidth()  > 0);
+    assert(image.getHeight() > 0);
+
+    int32_t width  = static_cast<int32_t>(image.getWidth());
+    int32_t height = static_cast<int32_t>(image.getHeight());
+
+    m_Texture = new Sml::Texture(image.getWidth(), image.getHeight());
+    clearTexture();
+
+    /* Uploaded by rows of tiles, skipping the ones that are transparent anyway */
+    std::vector<Sml::Color> strip(static_cast<size_t>(width) * Tile::SIZE);
+
+    for (size_t row = 0; row < m_Tiles.getTilesY(); ++row)
+    {
+        bool isEmpty = true;
+
+        for (size_t column = 0; column < m_Tiles.getTilesX(); ++column)
+        {
+            isEmpty = isEmpty && m_Tiles.getTile(m_Tiles.getTileIndex(column, row)) == nullptr;
+        }
+
+        if (isEmpty)
+        {
+            continue;
+        }
+
+        Sml::Rectangle<int32_t> rect(0, static_cast<int32_t>(row) * Tile::SIZE, width, 0);
+        rect.height = std::min(Tile::SIZE, height - rect.pos.y);
+
+        m_Tiles.readPixels(rect, strip.data());
+        m_Texture->updatePixels(strip.data(), &rect);
+    }
+
+    m_DirtyRegion.add(Sml::Rectangle<int32_t>(0, 0, width, height));
+}
+
+Layer::Layer(const std::shared_ptr<const DocumentFile>& file, size_t index)
+    : m_Tiles(file->getWidth(), file->getHeight()),
+      m_StaleTiles(m_Tiles.getTileCount(), false),
+      m_Mips(file->getWidth(), file->getHeight()),
+      m_UnloadedTiles(m_Tiles.getTileCount(), false),
+      m_SavedTiles(m_Tiles.getTileCount())
+{
+    assert(index < file->getLayerCount());
+
+    const LayerProperties& properties = file->getLayerProperties(index);
+
+    m_Visible   = properties.visible;
+    m_Opacity   = properties.opacity;
+    m_BlendMode = properties.blendMode;
+
+    m_Texture = new Sml::Texture(file->getWidth(), file->getHeight());
+    clearTexture();
+
+    const std::vector<TileLocation>& locations = file->getTileLocations(index);
+
+    /* Transparent tiles aren't stored, so there's nothing to load for them */
+    for (size_t i = 0; i < locations.size(); ++i)
+    {
+        m_SavedTiles[i].location = locations[i];
+        m_UnloadedTiles[i]       = !locations[i].isEmpty();
+        m_UnloadedCount         += m_UnloadedTiles[i] ? 1 : 0;
+    }
+
+    if (m_UnloadedCount > 0)
+    {
+        m_Source = file;
+    }
+
+    /* Not markDirty(), the tiles are loaded once the canvas is composed */
+    m_DirtyRegion.add(Sml::Rectangle<int32_t>(0, 0, static_cast<int32_t>(getWidth()), static_cast<int32_t>(getHeight())));
 }
 
 Layer::~Layer()
@@ -37,91 +184,788 @@ Layer::~Layer()
 
 Sml::Texture* Layer::getTexture() { return m_Texture; }
 
+size_t Layer::getWidth() const  { return m_Texture->getWidth();  }
+size_t Layer::getHeight() const { return m_Texture->getHeight(); }
+
+bool Layer::isVisible() const { return m_Visible; }
+
+void Layer::setVisible(bool visible)
+{
+    if (visible != m_Visible)
+    {
+        m_Visible = visible;
+        invalidate();
+    }
+}
+
+uint8_t Layer::getOpacity() const { return m_Opacity; }
+
+void Layer::setOpacity(uint8_t opacity)
+{
+    if (opacity != m_Opacity)
+    {
+        m_Opacity = opacity;
+        invalidate();
+    }
+}
+
+BlendMode Layer::getBlendMode() const { return m_BlendMode; }
+
+void Layer::setBlendMode(BlendMode mode)
+{
+    assert(mode < BlendMode::COUNT);
+
+    if (mode != m_BlendMode)
+    {
+        m_BlendMode = mode;
+        invalidate();
+    }
+}
+
+void Layer::markDirty(const Sml::Rectangle<int32_t>& rect)
+{
+    Sml::Rectangle<int32_t> bounds(0, 0, static_cast<int32_t>(getWidth()), static_cast<int32_t>(getHeight()));
+    Sml::Rectangle<int32_t> clipped = intersectRects(rect, bounds);
+
+    m_DirtyRegion.add(clipped);
+    markStale(clipped);
+}
+
+void Layer::markDirty()
+{
+    markDirty(Sml::Rectangle<int32_t>(0, 0, static_cast<int32_t>(getWidth()), static_cast<int32_t>(getHeight())));
+}
+
+const DirtyRegion& Layer::getDirtyRegion() const { return m_DirtyRegion; }
+void Layer::clearDirtyRegion() { m_DirtyRegion.clear(); }
+
+void Layer::syncTiles()
+{
+    for (size_t i = 0; i < m_StaleTiles.size(); ++i)
+    {
+        if (m_StaleTiles[i])
+        {
+            syncTile(i);
+        }
+    }
+}
+
+void Layer::syncTiles(const Sml::Rectangle<int32_t>& rect)
+{
+    size_t firstColumn, firstRow, endColumn, endRow;
+    m_Tiles.getTileRange(rect, &firstColumn, &firstRow, &endColumn, &endRow);
+
+    for (size_t row = firstRow; row < endRow; ++row)
+    {
+        for (size_t column = firstColumn; column < endColumn; ++column)
+        {
+            size_t index = m_Tiles.getTileIndex(column, row);
+
+            if (m_StaleTiles[index])
+            {
+                syncTile(index);
+            }
+        }
+    }
+}
+
+const TiledImage& Layer::readTiles(const Sml::Rectangle<int32_t>& rect)
+{
+    ensureLoaded(rect);
+    syncTiles(rect);
+
+    return m_Tiles;
+}
+
+const TiledImage& Layer::readLevel(size_t level, const Sml::Rectangle<int32_t>& rect)
+{
+    if (level == 0)
+    {
+        return readTiles(rect);
+    }
+
+    std::vector<size_t> staleTiles = m_Mips.takeStaleTiles(level, rect);
+
+    if (!staleTiles.empty())
+    {
+        for (size_t index : staleTiles)
+        {
+            readLevel(level - 1, m_Mips.getSourceRect(level, m_Mips.getLevel(level).getTileRect(index)));
+        }
+
+        m_Mips.downsample(level, staleTiles, level == 1 ? m_Tiles : m_Mips.getLevel(level - 1));
+    }
+
+    return m_Mips.getLevel(level);
+}
+
+TiledImage Layer::snapshot()
+{
+    ensureLoaded();
+    syncTiles();
+
+    return m_Tiles;
+}
+
+LazySnapshot Layer::lazySnapshot()
+{
+    syncTiles();
+
+    if (m_UnloadedCount == 0)
+    {
+        return LazySnapshot(m_Tiles);
+    }
+
+    std::vector<TileLocation> locations(m_SavedTiles.size());
+    for (size_t i = 0; i < m_SavedTiles.size(); ++i)
+    {
+        locations[i] = m_SavedTiles[i].location;
+    }
+
+    return LazySnapshot(m_Tiles, m_UnloadedTiles, m_Source, std::move(locations));
+}
+
+void Layer::restore(const TiledImage& snapshot)
+{
+    restore(snapshot, Sml::Rectangle<int32_t>(0, 0, static_cast<int32_t>(getWidth()), static_cast<int32_t>(getHeight())));
+}
+
+void Layer::restore(const TiledImage& snapshot, const Sml::Rectangle<int32_t>& rect)
+{
+    assert(snapshot.getWidth()  == getWidth());
+    assert(snapshot.getHeight() == getHeight());
+
+    ensureLoaded(rect);
+
+    size_t firstColumn, firstRow, endColumn, endRow;
+    m_Tiles.getTileRange(rect, &firstColumn, &firstRow, &endColumn, &endRow);
+
+    std::vector<Sml::Color> pixels(Tile::SIZE * Tile::SIZE);
+
+    for (size_t row = firstRow; row < endRow; ++row)
+    {
+        for (size_t column = firstColumn; column < endColumn; ++column)
+        {
+            size_t index = m_Tiles.getTileIndex(column, row);
+
+            if (!m_StaleTiles[index] && m_Tiles.getTile(index) == snapshot.getTile(index))
+            {
+                continue;
+            }
+
+            Sml::Rectangle<int32_t> tileRect = m_Tiles.getTileRect(index);
+            Sml::Rectangle<int32_t> region   = intersectRects(rect, tileRect);
+
+            snapshot.readPixels(region, pixels.data());
+            m_Texture->updatePixels(pixels.data(), &region);
+            m_DirtyRegion.add(region);
+            m_Mips.markStale(region);
+
+            if (region.width == tileRect.width && region.height == tileRect.height)
+            {
+                m_Tiles.setTile(index, snapshot.getTile(index));
+                m_StaleTiles[index] = false;
+            }
+            else
+            {
+                m_StaleTiles[index] = true;
+            }
+        }
+    }
+}
+
+Sml::Color* Layer::lockPixels(const Sml::Rectangle<int32_t>& rect)
+{
+    Sml::Rectangle<int32_t> bounds(0, 0, static_cast<int32_t>(getWidth()), static_cast<int32_t>(getHeight()));
+
+    LockedRegion region;
+    region.rect = intersectRects(rect, bounds);
+
+    if (!isRectEmpty(region.rect))
+    {
+        ensureLoaded(region.rect);
+        syncTiles(region.rect);
+
+        region.pixels.resize(static_cast<size_t>(region.rect.width) * region.rect.height);
+        m_Tiles.readPixels(region.rect, region.pixels.data());
+    }
+
+    m_LockedRegions.push_back(std::move(region));
+    return m_LockedRegions.back().pixels.data();
+}
+
+void Layer::unlockPixels(const Sml::Rectangle<int32_t>& rect, bool modified)
+{
+    Sml::Rectangle<int32_t> bounds(0, 0, static_cast<int32_t>(getWidth()), static_cast<int32_t>(getHeight()));
+    Sml::Rectangle<int32_t> clipped = intersectRects(rect, bounds);
+
+    /* The latest lock of the rect, in case it's locked more than once */
+    size_t index = m_LockedRegions.size();
+    while (index > 0)
+    {
+        const Sml::Rectangle<int32_t>& locked = m_LockedRegions[index - 1].rect;
+
+        if (locked.pos.x == clipped.pos.x && locked.pos.y == clipped.pos.y &&
+            locked.width == clipped.width && locked.height == clipped.height)
+        {
+            break;
+        }
+
+        --index;
+    }
+
+    assert(index > 0 && "Unlocking a rect that isn't locked!");
+    LockedRegion region = std::move(m_LockedRegions[index - 1]);
+    m_LockedRegions.erase(m_LockedRegions.begin() + (index - 1));
+
+    if (!modified || isRectEmpty(clipped))
+    {
+        return;
+    }
+
+    /* Not markDirty(), the tiles get the pixels along with the texture and don't need reading back */
+    m_Tiles.writePixels(clipped, region.pixels.data());
+    m_Texture->updatePixels(region.pixels.data(), &clipped);
+    m_DirtyRegion.add(clipped);
+    m_Mips.markStale(clipped);
+}
+
+void Layer::loadPixels(const Sml::Color* pixels)
+{
+    assert(pixels);
+
+    /* Everything is overwritten, so the tiles still in the file aren't needed anymore */
+    m_UnloadedTiles.assign(m_UnloadedTiles.size(), false);
+    m_UnloadedCount = 0;
+    m_Source.reset();
+
+    Sml::Rectangle<int32_t> bounds(0, 0, static_cast<int32_t>(getWidth()), static_cast<int32_t>(getHeight()));
+
+    m_Tiles.writePixels(bounds, pixels);
+    m_StaleTiles.assign(m_StaleTiles.size(), false);
+
+    for (size_t i = 0; i < m_Tiles.getTileCount(); ++i)
+    {
+        if (TiledImage::isTileTransparent(*m_Tiles.getTile(i)))
+        {
+            m_Tiles.setTile(i, nullptr);
+        }
+    }
+
+    m_Texture->updatePixels(pixels, nullptr);
+    m_DirtyRegion.add(bounds);
+    m_Mips.markStale(bounds);
+}
+
+void Layer::ensureLoaded(const Sml::Rectangle<int32_t>& rect)
+{
+    if (m_UnloadedCount == 0)
+    {
+        return;
+    }
+
+    size_t firstColumn, firstRow, endColumn, endRow;
+    m_Tiles.getTileRange(rect, &firstColumn, &firstRow, &endColumn, &endRow);
+
+    for (size_t row = firstRow; row < endRow; ++row)
+    {
+        for (size_t column = firstColumn; column < endColumn; ++column)
+        {
+            size_t index = m_Tiles.getTileIndex(column, row);
+
+            if (m_UnloadedTiles[index])
+            {
+                loadTile(index);
+            }
+        }
+    }
+
+    if (m_UnloadedCount == 0)
+    {
+        m_Source.reset();
+    }
+}
+
+void Layer::ensureLoaded()
+{
+    ensureLoaded(Sml::Rectangle<int32_t>(0, 0, static_cast<int32_t>(getWidth()), static_cast<int32_t>(getHeight())));
+}
+
+void Layer::fillSnapshot(DocumentSnapshot::LayerSnapshot* snapshot)
+{
+    assert(snapshot);
+
+    syncTiles();
+
+    snapshot->layer       = this;
+    snapshot->tiles       = m_Tiles;
+    snapshot->unloaded    = m_UnloadedTiles;
+    snapshot->source      = m_Source;
+    snapshot->saved       = m_SavedTiles;
+    snapshot->savedSource = m_Source;
+
+    snapshot->properties.visible   = m_Visible;
+    snapshot->properties.opacity   = m_Opacity;
+    snapshot->properties.blendMode = m_BlendMode;
+
+    /* The layer's saved state is the state of its tiles in the source file */
+    snapshot->sourceLocations.resize(m_SavedTiles.size());
+    for (size_t i = 0; i < m_SavedTiles.size(); ++i)
+    {
+        snapshot->sourceLocations[i] = m_SavedTiles[i].location;
+    }
+}
+
+void Layer::onSaved(const DocumentSnapshot::LayerSnapshot& snapshot,
+                    const std::shared_ptr<const DocumentFile>& file, size_t index)
+{
+    assert(snapshot.layer == this);
+    assert(file);
+
+    updateSavedTiles(snapshot, file->getTileLocations(index), &m_SavedTiles);
+
+    /* The tiles that are still unloaded are now read from the new version of the file */
+    if (m_UnloadedCount > 0)
+    {
+        m_Source = file;
+    }
+}
+
+void Layer::invalidate()
+{
+    m_DirtyRegion.add(Sml::Rectangle<int32_t>(0, 0, static_cast<int32_t>(getWidth()), static_cast<int32_t>(getHeight())));
+}
+
+void Layer::markStale(const Sml::Rectangle<int32_t>& rect)
+{
+    size_t firstColumn, firstRow, endColumn, endRow;
+    m_Tiles.getTileRange(rect, &firstColumn, &firstRow, &endColumn, &endRow);
+
+    for (size_t row = firstRow; row < endRow; ++row)
+    {
+        for (size_t column = firstColumn; column < endColumn; ++column)
+        {
+            size_t index = m_Tiles.getTileIndex(column, row);
+
+            assert(!m_UnloadedTiles[index] && "Drawing on a layer's area that hasn't been loaded!");
+            m_StaleTiles[index] = true;
+        }
+    }
+
+    m_Mips.markStale(rect);
+}
+
+void Layer::syncTile(size_t index)
+{
+    Sml::Rectangle<int32_t> rect   = m_Tiles.getTileRect(index);
+    Sml::Color*             pixels = m_Texture->readPixels(&rect);
+
+    m_Tiles.writePixels(rect, pixels);
+    delete[] pixels;
+
+    if (TiledImage::isTileTransparent(*m_Tiles.getTile(index)))
+    {
+        m_Tiles.setTile(index, nullptr);
+    }
+
+    m_StaleTiles[index] = false;
+}
+
+void Layer::loadTile(size_t index)
+{
+    assert(m_Source);
+    assert(m_UnloadedTiles[index]);
+
+    TilePtr                 tile = m_Source->loadTile(m_SavedTiles[index].location);
+    Sml::Rectangle<int32_t> rect = m_Tiles.getTileRect(index);
+
+    m_Tiles.setTile(index, tile);
+    m_SavedTiles[index].tile = tile;
+    m_UnloadedTiles[index]   = false;
+    --m_UnloadedCount;
+
+    /* The texture is transparent there already */
+    if (tile == nullptr)
+    {
+        return;
+    }
+
+    if (rect.width == Tile::SIZE)
+    {
+        m_Texture->updatePixels(tile->pixels, &rect);
+    }
+    else
+    {
+        std::vector<Sml::Color> pixels(static_cast<size_t>(rect.width) * rect.height);
+        m_Tiles.readPixels(rect, pixels.data());
+
+        m_Texture->updatePixels(pixels.data(), &rect);
+    }
+}
+
+void Layer::clearTexture(Sml::Color color)
+{
+    Sml::Renderer::getInstance().pushTarget();
+    Sml::Renderer::getInstance().setTarget(m_Texture);
+
+    Sml::Renderer::getInstance().setColor(color);
+    Sml::Renderer::getInstance().clear();
+
+    Sml::Renderer::getInstance().popTarget();
+}
+
 Document::Document(const char* filename) : m_Name(filename)
 {
     assert(filename);
 
-    Sml::Texture* image = new Sml::Texture();
+    std::shared_ptr<const DocumentFile> file = DocumentFile::open(filename);
 
-    if (!image->loadFromImage(filename))
+    if (file != nullptr)
     {
-        LOG_APP_ERROR("File '%s' couldn't be found!", filename);
-        assert(0);
+        loadFile(file);
+        return;
     }
 
-    m_Canvas = new Sml::Texture(image->getWidth(), image->getHeight());
-
-    Layer* imageLayer = new Layer(m_Canvas->getWidth(), m_Canvas->getHeight());
-    image->copyTo(imageLayer->getTexture(), nullptr, nullptr);
+    /* Decoded straight into the layer's tiles, the texture is then filled from them */
+    TiledImage image;
 
-    Layer* layer = new Layer(m_Canvas->getWidth(), m_Canvas->getHeight());
+    if (!loadImage(filename, &image))
+    {
+        LOG_APP_ERROR("File '%s' couldn't be loaded!", filename);
+        assert(0);
+    }
 
-    addLayer(imageLayer);
-    // addLayer(layer);
+    m_Width  = image.getWidth();
+    m_Height = image.getHeight();
 
-    // setActiveLayer(layer);
-    setActiveLayer(imageLayer);
+    setActiveLayer(addLayer(new Layer(image)));
+}
 
-    delete image;
+Document::Document(const std::shared_ptr<const DocumentFile>& file) : m_Name(file->getFilename())
+{
+    loadFile(file);
 }
 
-Document::Document(size_t width, size_t height, const char* name) : m_Name(name)
+Document::Document(size_t width, size_t height, const char* name) : m_Name(name), m_Width(width), m_Height(height)
 {
     assert(name);
-    m_Canvas = new Sml::Texture(width, height);
     
-    Layer* layer = new Layer(m_Canvas->getWidth(), m_Canvas->getHeight());
-    addLayer(layer);
-    setActiveLayer(layer);
+    setActiveLayer(addLayer(new Layer(width, height, Sml::COLOR_WHITE)));
 }
 
 Document::~Document()
 {
     delete m_Canvas;
+}
+
+void Document::loadFile(const std::shared_ptr<const DocumentFile>& file)
+{
+    assert(file);
+
+    m_File   = file;
+    m_Width  = file->getWidth();
+    m_Height = file->getHeight();
+
+    for (size_t i = 0; i < file->getLayerCount(); ++i)
+    {
+        addLayer(new Layer(file, i));
+    }
 
-    for (auto layer : m_Layers)
+    if (m_Layers.isEmpty())
     {
-        delete layer;
+        addLayer(new Layer(file->getWidth(), file->getHeight(), Sml::COLOR_WHITE));
     }
+
+    setActiveLayer(m_Layers.getHandle(std::min(file->getActiveLayer(), m_Layers.getSize() - 1)));
 }
 
 void Document::setName(const std::string& name) { m_Name = name;   }
 const std::string& Document::getName() const    { return m_Name;   }
+
+bool Document::save(const char* filename)
+{
+    assert(filename);
+
+    DocumentSnapshot                    snapshot = createSnapshot();
+    std::shared_ptr<const DocumentFile> file     = writeDocument(snapshot, filename);
+
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    onSaved(snapshot, file);
+    return true;
+}
+
+DocumentSnapshot Document::createSnapshot()
+{
+    DocumentSnapshot snapshot;
+    snapshot.width  = getWidth();
+    snapshot.height = getHeight();
+    snapshot.file   = m_File;
+
+    /* The file keeps a flat list of layers, groups aren't saved */
+    for (size_t i = 0; i < m_Layers.getSize(); ++i)
+    {
+        Layer* layer = m_Layers.getLayer(i);
+
+        if (layer == nullptr)
+        {
+            continue;
+        }
+
+        if (m_Layers.getHandle(i) == m_ActiveLayer)
+        {
+            snapshot.activeLayer = snapshot.layers.size();
+        }
+
+        snapshot.layers.emplace_back();
+        layer->fillSnapshot(&snapshot.layers.back());
+    }
+
+    return snapshot;
+}
+
+void Document::onSaved(const DocumentSnapshot& snapshot, const std::shared_ptr<const DocumentFile>& file)
+{
+    assert(file);
+    assert(file->getLayerCount() == snapshot.layers.size());
+
+    m_File = file;
+
+    /* Layers could have been removed meanwhile if the snapshot was written in background */
+    for (size_t i = 0; i < snapshot.layers.size(); ++i)
+    {
+        LayerHandle handle = m_Layers.findLayer(snapshot.layers[i].layer);
+
+        if (handle.isValid())
+        {
+            m_Layers.getLayer(handle)->onSaved(snapshot.layers[i], file, i);
+        }
+    }
+}
+
+const std::shared_ptr<const DocumentFile>& Document::getFile() const { return m_File; }
+void Document::detachFile()                                          { m_File = nullptr; }
 Sml::Texture* Document::getCanvas()             { return m_Canvas; }
 
-size_t Document::getWidth() const  { assert(m_Canvas); return m_Canvas->getWidth();  }
-size_t Document::getHeight() const { assert(m_Canvas); return m_Canvas->getHeight(); }
+size_t Document::getWidth() const  { return m_Width;  }
+size_t Document::getHeight() const { return m_Height; }
+
+void Document::update()
+{
+    PROFILE_ZONE("Document::update");
+
+    DirtyRegion region = m_DirtyRegion;
+    m_DirtyRegion.clear();
+
+    m_Compositor.update(m_Layers, m_ActiveLayer);
+
+    for (size_t i = 0; i < m_Layers.getSize(); ++i)
+    {
+        region.add(m_Layers.getDirtyRegion(i));
+        m_Layers.clearDirtyRegion(i);
+    }
+
+    if (region.isEmpty())
+    {
+        return;
+    }
+
+    m_LastChanges = region;
+    ++m_Revision;
+
+    if (m_Canvas != nullptr)
+    {
+        m_CanvasRegion.add(region);
+    }
+}
+
+void Document::compose(const Sml::Rectangle<int32_t>& rect, Sml::Color* pixels, size_t level)
+{
+    m_Compositor.compose(rect, pixels, level);
+}
 
 void Document::applyLayersToCanvas()
 {
-    Sml::Renderer::getInstance().pushTarget();
-    Sml::Renderer::getInstance().setTarget(m_Canvas);
+    PROFILE_ZONE("Document::applyLayersToCanvas");
 
-    Sml::Renderer::getInstance().setColor(Sml::COLOR_TRANSPARENT);
-    Sml::Renderer::getInstance().clear();
+    update();
 
-    Sml::Renderer::getInstance().popTarget();
+    if (m_Canvas == nullptr)
+    {
+        m_Canvas = new Sml::Texture(getWidth(), getHeight());
+        m_CanvasRegion.add(Sml::Rectangle<int32_t>(0, 0, static_cast<int32_t>(getWidth()),
+                                                         static_cast<int32_t>(getHeight())));
+    }
+
+    for (const auto& rect : m_CanvasRegion.getRects())
+    {
+        m_ComposeBuffer.resize(static_cast<size_t>(rect.width) * rect.height);
+
+        m_Compositor.compose(rect, m_ComposeBuffer.data());
+        m_Canvas->updatePixels(m_ComposeBuffer.data(), &rect);
+    }
+
+    m_CanvasRegion.clear();
+}
+
+bool Document::isDirty() const
+{
+    if (!m_DirtyRegion.isEmpty())
+    {
+        return true;
+    }
 
-    for (auto layer : m_Layers)
+    for (size_t i = 0; i < m_Layers.getSize(); ++i)
     {
-        layer->getTexture()->copyTo(m_Canvas, nullptr, nullptr);
+        if (!m_Layers.getDirtyRegion(i).isEmpty())
+        {
+            return true;
+        }
     }
+
+    return false;
 }
 
-void Document::addLayer(Layer* layer)
+uint64_t Document::getRevision() const { return m_Revision; }
+const DirtyRegion& Document::getLastChanges() const { return m_LastChanges; }
+
+LayerHandle Document::addLayer(Layer* layer, LayerHandle parent)
 {
     assert(layer);
     assert(layer->getTexture()->getWidth()  == getWidth());
     assert(layer->getTexture()->getHeight() == getHeight());
 
-    m_Layers.push_back(layer);
+    LayerHandle handle = m_Layers.addLayer(std::unique_ptr<Layer>(layer), parent);
+    markDirty();
+
+    return handle;
+}
+
+LayerHandle Document::addGroup(LayerHandle parent)
+{
+    LayerHandle handle = m_Layers.addGroup(std::make_unique<LayerGroup>(getWidth(), getHeight()), parent);
+    markDirty();
+
+    return handle;
 }
 
-void Document::removeLayer(Layer* layer)
+LayerHandle Document::addLayerAbove(Layer* layer, LayerHandle sibling)
 {
     assert(layer);
+    assert(layer->getTexture()->getWidth()  == getWidth());
+    assert(layer->getTexture()->getHeight() == getHeight());
+
+    LayerHandle handle = m_Layers.addLayerAbove(std::unique_ptr<Layer>(layer), sibling);
+    markDirty();
+
+    return handle;
+}
+
+void Document::removeLayer(LayerHandle layer)
+{
+    size_t index = m_Layers.getIndex(layer);
+
     m_Layers.remove(layer);
+    updateActiveLayer(index);
+    markDirty();
+}
+
+void Document::moveLayer(LayerHandle layer, LayerHandle parent, size_t position)
+{
+    m_Layers.move(layer, parent, position);
+    markDirty();
+}
+
+LayerHandle Document::duplicateLayer(LayerHandle layer)
+{
+    LayerHandle handle = m_Layers.duplicate(layer);
+    markDirty();
+
+    return handle;
 }
 
-Layer* Document::getActiveLayer() { return m_ActiveLayer; }
-void Document::setActiveLayer(Layer* layer) { assert(layer); m_ActiveLayer = layer; }
\ No newline at end of file
+bool Document::mergeLayerDown(LayerHandle layer, History* history)
+{
+    assert(history);
+
+    size_t      index       = m_Layers.getIndex(layer);
+    LayerHandle lowerHandle = m_Layers.getSiblingBelow(layer);
+
+    Layer* upper = m_Layers.getLayer(layer);
+    Layer* lower = lowerHandle.isValid() ? m_Layers.getLayer(lowerHandle) : nullptr;
+
+    if (upper == nullptr || lower == nullptr)
+    {
+        return false;
+    }
+
+    LayerProperties properties;
+    properties.visible   = upper->isVisible();
+    properties.opacity   = upper->getOpacity();
+    properties.blendMode = upper->getBlendMode();
+
+    TiledImage upperTiles = upper->snapshot();
+    history->forgetLayer(upper);
+
+    /* Can't fail anymore, the layer below was just found */
+    history->beginStep(lower);
+    m_Layers.mergeDown(layer);
+    history->endStep(this, upperTiles, properties);
+
+    updateActiveLayer(index);
+    markDirty();
+
+    return true;
+}
+
+const LayerStack& Document::getLayers() const { return m_Layers; }
+
+Layer* Document::getActiveLayer()
+{
+    return m_Layers.contains(m_ActiveLayer) ? m_Layers.getLayer(m_ActiveLayer) : nullptr;
+}
+
+LayerHandle Document::getActiveLayerHandle() const { return m_ActiveLayer; }
+
+void Document::setActiveLayer(LayerHandle layer)
+{
+    assert(m_Layers.getLayer(layer) != nullptr && "Only layers can be active, not groups!");
+    m_ActiveLayer = layer;
+}
+
+void Document::markDirty()
+{
+    m_DirtyRegion.add(Sml::Rectangle<int32_t>(0, 0, static_cast<int32_t>(getWidth()), static_cast<int32_t>(getHeight())));
+}
+
+void Document::updateActiveLayer(size_t index)
+{
+    if (m_Layers.contains(m_ActiveLayer))
+    {
+        return;
+    }
+
+    m_ActiveLayer = LayerHandle();
+
+    /* The nearest layer below, or above if there's none */
+    for (size_t i = std::min(index, m_Layers.getSize()); i-- > 0;)
+    {
+        if (m_Layers.getLayer(i) != nullptr)
+        {
+            m_ActiveLayer = m_Layers.getHandle(i);
+            return;
+        }
+    }
+
+    for (size_t i = index; i < m_Layers.getSize(); ++i)
+    {
+        if (m_Layers.getLayer(i) != nullptr)
+        {
+            m_ActiveLayer = m_Layers.getHandle(i);
+            return;
+        }
+    }
+}
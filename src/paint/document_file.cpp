@@ -0,0 +1,549 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file document_file.cpp
+ * @date 2021-12-25
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include "sml/sml_log.h"
+#include "paint/document_file.h"
+#include "paint/compression.h"
+#include "paint/thread_pool.h"
+
+using namespace Paint;
+
+const char     DocumentFile::MAGIC[8]    = {'S', '3', 'D', 'E', 'D', 'O', 'C', '\0'};
+const uint32_t DocumentFile::VERSION     = 2;
+const uint32_t DocumentFile::MIN_VERSION = 1;
+const uint32_t DocumentFile::MAX_SIZE    = 65536;
+const char*    DocumentFile::EXTENSION   = ".sde";
+
+struct FileHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t indexOffset;
+    uint64_t indexSize;
+};
+
+struct IndexHeader
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t layerCount;
+    uint32_t activeLayer;
+};
+
+struct LayerRecord
+{
+    uint32_t tileCount;
+    uint32_t blendMode;
+    uint8_t  visible;
+    uint8_t  opacity;
+    uint16_t reserved;
+};
+
+/**
+ * @brief Layer record of version 1 files, which had no layer properties.
+ */
+struct LayerRecordV1
+{
+    uint32_t tileCount;
+    uint32_t reserved;
+};
+
+struct TileRecord
+{
+    uint64_t offset;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+static const size_t TILE_BYTES        = sizeof(Tile::pixels);
+static const size_t COMPRESSION_BATCH = 64;              ///< Tiles compressed in parallel at a time
+static const size_t WRITE_BUFFER_SIZE = 4 * 1024 * 1024;
+
+/**
+ * @brief Buffered sequential writer on top of pwrite.
+ */
+class FileWriter
+{
+public:
+    FileWriter(int fd, uint64_t offset) : m_Fd(fd), m_Offset(offset) { m_Buffer.reserve(WRITE_BUFFER_SIZE); }
+
+    uint64_t getOffset() const { return m_Offset + m_Buffer.size(); }
+
+    bool write(const void* data, size_t size)
+    {
+        if (m_Buffer.size() + size > WRITE_BUFFER_SIZE && !flush())
+        {
+            return false;
+        }
+
+        if (size > WRITE_BUFFER_SIZE)
+        {
+            return writeAll(static_cast<const uint8_t*>(data), size);
+        }
+
+        m_Buffer.insert(m_Buffer.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+        return true;
+    }
+
+    bool flush()
+    {
+        bool success = writeAll(m_Buffer.data(), m_Buffer.size());
+        m_Buffer.clear();
+
+        return success;
+    }
+
+private:
+    int                  m_Fd     = -1;
+    uint64_t             m_Offset = 0;
+    std::vector<uint8_t> m_Buffer;
+
+    bool writeAll(const uint8_t* data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t written = pwrite(m_Fd, data, size, static_cast<off_t>(m_Offset));
+            if (written <= 0)
+            {
+                return false;
+            }
+
+            data     += written;
+            size     -= static_cast<size_t>(written);
+            m_Offset += static_cast<uint64_t>(written);
+        }
+
+        return true;
+    }
+};
+
+//------------------------------------------------------------------------------
+// DocumentFile
+//------------------------------------------------------------------------------
+std::shared_ptr<const DocumentFile> DocumentFile::open(const char* filename)
+{
+    assert(filename);
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat info = {};
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(FileHeader))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<DocumentFile> file(new DocumentFile());
+    file->m_Filename = filename;
+    file->m_Data     = static_cast<uint8_t*>(data);
+    file->m_Size     = static_cast<uint64_t>(info.st_size);
+
+    FileHeader header;
+    std::memcpy(&header, file->m_Data, sizeof(header));
+
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        return nullptr;
+    }
+
+    if (header.version < MIN_VERSION || header.version > VERSION)
+    {
+        LOG_APP_ERROR("Document '%s' has unsupported version %" PRIu32 ".", filename, header.version);
+        return nullptr;
+    }
+
+    if (!file->parseIndex(header.version, header.indexOffset, header.indexSize))
+    {
+        LOG_APP_ERROR("Document '%s' is corrupted.", filename);
+        return nullptr;
+    }
+
+    return file;
+}
+
+DocumentFile::~DocumentFile()
+{
+    if (m_Data != nullptr)
+    {
+        munmap(m_Data, m_Size);
+    }
+}
+
+const std::string& DocumentFile::getFilename() const { return m_Filename; }
+
+size_t DocumentFile::getWidth() const       { return m_Width;         }
+size_t DocumentFile::getHeight() const      { return m_Height;        }
+size_t DocumentFile::getLayerCount() const  { return m_Layers.size(); }
+size_t DocumentFile::getActiveLayer() const { return m_ActiveLayer;   }
+
+const std::vector<TileLocation>& DocumentFile::getTileLocations(size_t layer) const
+{
+    assert(layer < m_Layers.size());
+    return m_Layers[layer];
+}
+
+const LayerProperties& DocumentFile::getLayerProperties(size_t layer) const
+{
+    assert(layer < m_LayerProperties.size());
+    return m_LayerProperties[layer];
+}
+
+TilePtr DocumentFile::loadTile(const TileLocation& location) const
+{
+    if (location.isEmpty())
+    {
+        return nullptr;
+    }
+
+    TilePtr tile = std::make_shared<Tile>();
+
+    if (!decompress(getTileData(location), location.size, reinterpret_cast<uint8_t*>(tile->pixels), TILE_BYTES))
+    {
+        LOG_APP_ERROR("Tile at offset %" PRIu64 " of '%s' is corrupted.", location.offset, m_Filename.c_str());
+        return nullptr;
+    }
+
+    return tile;
+}
+
+const uint8_t* DocumentFile::getTileData(const TileLocation& location) const
+{
+    assert(location.offset + location.size <= m_Size);
+    return m_Data + location.offset;
+}
+
+uint64_t DocumentFile::getFileSize() const { return m_Size;     }
+uint64_t DocumentFile::getLiveSize() const { return m_LiveSize; }
+
+bool DocumentFile::parseIndex(uint32_t version, uint64_t indexOffset, uint64_t indexSize)
+{
+    if (indexOffset < sizeof(FileHeader) || indexOffset > m_Size || indexSize > m_Size - indexOffset ||
+        indexSize < sizeof(IndexHeader))
+    {
+        return false;
+    }
+
+    const uint8_t* index    = m_Data + indexOffset;
+    const uint8_t* indexEnd = index + indexSize;
+
+    IndexHeader header;
+    std::memcpy(&header, index, sizeof(header));
+    index += sizeof(header);
+
+    if (header.width == 0 || header.height == 0 || header.width > MAX_SIZE || header.height > MAX_SIZE ||
+        (header.layerCount > 0 && header.activeLayer >= header.layerCount))
+    {
+        return false;
+    }
+
+    /* Every layer lists all of its tiles, so a size they can't fit into the index is corrupted */
+    size_t tileSize  = static_cast<size_t>(Tile::SIZE);
+    size_t tileCount = ((header.width + tileSize - 1) / tileSize) * ((header.height + tileSize - 1) / tileSize);
+
+    if (header.layerCount > 0 && tileCount * sizeof(TileRecord) > indexSize / header.layerCount)
+    {
+        return false;
+    }
+
+    m_Width       = header.width;
+    m_Height      = header.height;
+    m_ActiveLayer = header.activeLayer;
+    m_LiveSize    = sizeof(FileHeader) + indexSize;
+
+    for (uint32_t i = 0; i < header.layerCount; ++i)
+    {
+        LayerRecord layer      = {};
+        size_t      recordSize = version == 1 ? sizeof(LayerRecordV1) : sizeof(LayerRecord);
+
+        if (static_cast<size_t>(indexEnd - index) < recordSize)
+        {
+            return false;
+        }
+
+        if (version == 1)
+        {
+            LayerRecordV1 record;
+            std::memcpy(&record, index, sizeof(record));
+
+            layer.tileCount = record.tileCount;
+            layer.blendMode = static_cast<uint32_t>(BlendMode::NORMAL);
+            layer.visible   = 1;
+            layer.opacity   = 255;
+        }
+        else
+        {
+            std::memcpy(&layer, index, sizeof(layer));
+        }
+
+        index += recordSize;
+
+        if (layer.blendMode >= static_cast<uint32_t>(BlendMode::COUNT) || layer.visible > 1)
+        {
+            return false;
+        }
+
+        if (layer.tileCount != tileCount || static_cast<size_t>(indexEnd - index) < tileCount * sizeof(TileRecord))
+        {
+            return false;
+        }
+
+        std::vector<TileLocation> locations(tileCount);
+
+        for (auto& location : locations)
+        {
+            TileRecord record;
+            std::memcpy(&record, index, sizeof(record));
+            index += sizeof(record);
+
+            if (record.size > 0 && (record.offset < sizeof(FileHeader) || record.offset > m_Size ||
+                                    record.size > m_Size - record.offset))
+            {
+                return false;
+            }
+
+            location.offset = record.offset;
+            location.size   = record.size;
+            m_LiveSize     += record.size;
+        }
+
+        LayerProperties properties;
+        properties.visible   = layer.visible != 0;
+        properties.opacity   = layer.opacity;
+        properties.blendMode = static_cast<BlendMode>(layer.blendMode);
+
+        m_Layers.push_back(std::move(locations));
+        m_LayerProperties.push_back(properties);
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Writing
+//------------------------------------------------------------------------------
+static bool writeLayerTiles(const DocumentSnapshot& snapshot, const DocumentSnapshot::LayerSnapshot& layer,
+                            bool append, FileWriter* writer, std::vector<TileLocation>* locations)
+{
+    size_t tileCount = layer.tiles.getTileCount();
+    locations->assign(tileCount, TileLocation());
+
+    std::vector<size_t> changed;
+
+    for (size_t i = 0; i < tileCount; ++i)
+    {
+        if (layer.unloaded[i])
+        {
+            const TileLocation& from  = layer.sourceLocations[i];
+            const SavedTile&    saved = layer.saved[i];
+
+            /* Either already in the file being appended to, or copied over without decompressing */
+            if (append && layer.source == snapshot.file)
+            {
+                (*locations)[i] = from;
+            }
+            else if (append && layer.savedSource == layer.source && saved.tile == nullptr &&
+                     !saved.location.isEmpty() && saved.sourceOffset == from.offset)
+            {
+                (*locations)[i] = saved.location;
+            }
+            else
+            {
+                (*locations)[i] = {writer->getOffset(), from.size};
+
+                if (!writer->write(layer.source->getTileData(from), from.size))
+                {
+                    return false;
+                }
+            }
+
+            continue;
+        }
+
+        const TilePtr& tile = layer.tiles.getTile(i);
+
+        if (tile == nullptr)
+        {
+            continue;
+        }
+
+        if (append && layer.saved[i].tile == tile)
+        {
+            (*locations)[i] = layer.saved[i].location;
+            continue;
+        }
+
+        changed.push_back(i);
+    }
+
+    std::vector<std::vector<uint8_t>> compressed(COMPRESSION_BATCH);
+
+    for (size_t first = 0; first < changed.size(); first += COMPRESSION_BATCH)
+    {
+        size_t count = std::min(COMPRESSION_BATCH, changed.size() - first);
+
+        ThreadPool::getInstance().parallelFor(count, [&](size_t k)
+        {
+            const Tile* tile = layer.tiles.getTile(changed[first + k]).get();
+
+            compressed[k].clear();
+            compress(reinterpret_cast<const uint8_t*>(tile->pixels), TILE_BYTES, &compressed[k]);
+        });
+
+        for (size_t k = 0; k < count; ++k)
+        {
+            (*locations)[changed[first + k]] = {writer->getOffset(), static_cast<uint32_t>(compressed[k].size())};
+
+            if (!writer->write(compressed[k].data(), compressed[k].size()))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool writeIndex(const DocumentSnapshot& snapshot, const std::vector<std::vector<TileLocation>>& locations,
+                       FileWriter* writer)
+{
+    IndexHeader header = {static_cast<uint32_t>(snapshot.width), static_cast<uint32_t>(snapshot.height),
+                          static_cast<uint32_t>(snapshot.layers.size()), static_cast<uint32_t>(snapshot.activeLayer)};
+
+    if (!writer->write(&header, sizeof(header)))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < locations.size(); ++i)
+    {
+        const LayerProperties& properties  = snapshot.layers[i].properties;
+        LayerRecord            layerRecord = {static_cast<uint32_t>(locations[i].size()),
+                                              static_cast<uint32_t>(properties.blendMode),
+                                              static_cast<uint8_t>(properties.visible ? 1 : 0), properties.opacity, 0};
+
+        if (!writer->write(&layerRecord, sizeof(layerRecord)))
+        {
+            return false;
+        }
+
+        for (const auto& location : locations[i])
+        {
+            TileRecord tileRecord = {location.offset, location.size, 0};
+
+            if (!writer->write(&tileRecord, sizeof(tileRecord)))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+std::shared_ptr<const DocumentFile> Paint::writeDocument(const DocumentSnapshot& snapshot, const char* filename)
+{
+    assert(filename);
+
+    /* Appending to a mostly dead file would only make it grow, it's compacted instead */
+    bool append = snapshot.file != nullptr && snapshot.file->getFilename() == filename &&
+                  snapshot.file->getLiveSize() * 2 >= snapshot.file->getFileSize();
+
+    std::string path = append ? std::string(filename) : std::string(filename) + ".tmp";
+
+    int fd = append ? ::open(path.c_str(), O_WRONLY) : ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        LOG_APP_ERROR("Couldn't open '%s' for writing.", path.c_str());
+        return nullptr;
+    }
+
+    FileWriter writer(fd, append ? snapshot.file->getFileSize() : sizeof(FileHeader));
+
+    std::vector<std::vector<TileLocation>> locations(snapshot.layers.size());
+    bool                                   success = true;
+
+    for (size_t i = 0; i < snapshot.layers.size() && success; ++i)
+    {
+        success = writeLayerTiles(snapshot, snapshot.layers[i], append, &writer, &locations[i]);
+    }
+
+    FileHeader header = {};
+    std::memcpy(header.magic, DocumentFile::MAGIC, sizeof(header.magic));
+    header.version     = DocumentFile::VERSION;
+    header.indexOffset = writer.getOffset();
+
+    success = success && writeIndex(snapshot, locations, &writer) && writer.flush();
+    header.indexSize = writer.getOffset() - header.indexOffset;
+
+    /* The header is only switched to the new index once everything it refers to is on disk */
+    success = success && fdatasync(fd) == 0;
+    success = success && pwrite(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+    success = success && fdatasync(fd) == 0;
+
+    close(fd);
+
+    if (!success)
+    {
+        LOG_APP_ERROR("Couldn't write document '%s'.", path.c_str());
+
+        if (!append)
+        {
+            unlink(path.c_str());
+        }
+
+        return nullptr;
+    }
+
+    if (!append && rename(path.c_str(), filename) != 0)
+    {
+        LOG_APP_ERROR("Couldn't replace '%s'.", filename);
+        unlink(path.c_str());
+
+        return nullptr;
+    }
+
+    return DocumentFile::open(filename);
+}
+
+void Paint::updateSavedTiles(const DocumentSnapshot::LayerSnapshot& layer, const std::vector<TileLocation>& locations,
+                             std::vector<SavedTile>* saved)
+{
+    assert(saved);
+    assert(locations.size() == layer.tiles.getTileCount());
+
+    saved->resize(locations.size());
+
+    for (size_t i = 0; i < locations.size(); ++i)
+    {
+        (*saved)[i].tile         = layer.tiles.getTile(i);
+        (*saved)[i].location     = locations[i];
+        (*saved)[i].sourceOffset = layer.unloaded[i] ? layer.sourceLocations[i].offset : 0;
+    }
+}
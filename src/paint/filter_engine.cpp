@@ -0,0 +1,82 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file filter_engine.cpp
+ * @date 2021-12-22
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <algorithm>
+#include <cassert>
+#include "paint/filter_engine.h"
+#include "paint/dirty_region.h"
+#include "paint/frame_profiler.h"
+
+using namespace Paint;
+
+const int32_t FilterEngine::MIN_BAND_HEIGHT  = 16;
+const size_t  FilterEngine::BANDS_PER_THREAD = 4;
+
+FilterEngine::FilterEngine(ThreadPool& pool) : m_Pool(pool) {}
+
+bool FilterEngine::run(const TiledImage& src, const TileKernel& kernel, Sml::Color* dst,
+                       const std::function<bool()>& isCanceled) const
+{
+    PROFILE_ZONE("FilterEngine::run");
+
+    assert(dst);
+
+    int32_t width  = static_cast<int32_t>(src.getWidth());
+    int32_t height = static_cast<int32_t>(src.getHeight());
+
+    if (width == 0 || height == 0)
+    {
+        return true;
+    }
+
+    int32_t halo       = std::max(kernel.getHalo(), 0);
+    int32_t bandHeight = getBandHeight(height, halo);
+    size_t  bandCount  = static_cast<size_t>((height + bandHeight - 1) / bandHeight);
+
+    Sml::Rectangle<int32_t> imageRect(0, 0, width, height);
+    std::atomic<bool>       canceled(false);
+
+    m_Pool.parallelFor(bandCount, [&](size_t index)
+    {
+        if (canceled || (isCanceled && isCanceled()))
+        {
+            canceled = true;
+            return;
+        }
+
+        FilterBand band;
+        band.rect    = Sml::Rectangle<int32_t>(0, static_cast<int32_t>(index) * bandHeight, width, bandHeight);
+        band.rect    = intersectRects(band.rect, imageRect);
+        band.srcRect = intersectRects(Sml::Rectangle<int32_t>(0, band.rect.pos.y - halo,
+                                                              width, band.rect.height + 2 * halo),
+                                      imageRect);
+
+        /* Each band reads its own source, so no single thread has to unpack the whole image */
+        std::vector<Sml::Color> source(static_cast<size_t>(band.srcRect.width) * band.srcRect.height);
+        src.readPixels(band.srcRect, source.data());
+
+        band.src = source.data();
+        band.dst = dst + band.rect.pos.y * width;
+
+        kernel.processBand(band);
+    });
+
+    return !canceled;
+}
+
+int32_t FilterEngine::getBandHeight(int32_t imageHeight, int32_t halo) const
+{
+    /* Enough bands to balance the load, but not so thin that halos dominate the work */
+    int32_t bandCount  = static_cast<int32_t>(std::max(m_Pool.getThreadCount(), size_t(1)) * BANDS_PER_THREAD);
+    int32_t bandHeight = (imageHeight + bandCount - 1) / bandCount;
+
+    bandHeight = std::max(bandHeight, MIN_BAND_HEIGHT);
+    bandHeight = std::max(bandHeight, 2 * halo);
+
+    return std::min(bandHeight, std::max(imageHeight, 1));
+}
@@ -0,0 +1,326 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file filter_preview.cpp
+ * @date 2021-12-23
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <algorithm>
+#include <cassert>
+#include "paint/filter_preview.h"
+
+using namespace Paint;
+
+const int32_t FilterPreview::DOWNSCALE_FACTOR      = 4;
+const size_t  FilterPreview::MIN_DOWNSCALED_PIXELS = 1024 * 1024;
+
+/**
+ * @brief Box-filter downscaling, the last row and column of blocks may be partial.
+ */
+static TiledImage downscale(const TiledImage& image, int32_t factor)
+{
+    int32_t width         = static_cast<int32_t>(image.getWidth());
+    int32_t height        = static_cast<int32_t>(image.getHeight());
+    int32_t reducedWidth  = (width  + factor - 1) / factor;
+    int32_t reducedHeight = (height + factor - 1) / factor;
+
+    std::vector<Sml::Color> reduced(static_cast<size_t>(reducedWidth) * reducedHeight);
+
+    ThreadPool::getInstance().parallelFor(static_cast<size_t>(reducedHeight), [&](size_t row)
+    {
+        Sml::Rectangle<int32_t> strip(0, static_cast<int32_t>(row) * factor, width, 0);
+        strip.height = std::min(factor, height - strip.pos.y);
+
+        std::vector<Sml::Color> pixels(static_cast<size_t>(strip.width) * strip.height);
+        image.readPixels(strip, pixels.data());
+
+        for (int32_t x = 0; x < reducedWidth; ++x)
+        {
+            int32_t  blockWidth = std::min(factor, width - x * factor);
+            uint32_t sums[4]    = {};
+
+            for (int32_t y = 0; y < strip.height; ++y)
+            {
+                const Sml::Color* src = pixels.data() + y * width + x * factor;
+
+                for (int32_t i = 0; i < blockWidth; ++i)
+                {
+                    for (int32_t channel = 0; channel < 4; ++channel)
+                    {
+                        sums[channel] += (src[i] >> (8 * channel)) & 0xFF;
+                    }
+                }
+            }
+
+            uint32_t   count = static_cast<uint32_t>(blockWidth * strip.height);
+            Sml::Color color = 0;
+
+            for (int32_t channel = 0; channel < 4; ++channel)
+            {
+                color |= ((sums[channel] + count / 2) / count) << (8 * channel);
+            }
+
+            reduced[row * reducedWidth + x] = color;
+        }
+    });
+
+    TiledImage result(reducedWidth, reducedHeight);
+    result.writePixels(Sml::Rectangle<int32_t>(0, 0, reducedWidth, reducedHeight), reduced.data());
+
+    return result;
+}
+
+FilterPreview::FilterPreview() : m_Worker(&FilterPreview::workerLoop, this) {}
+
+FilterPreview::~FilterPreview()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stopping = true;
+    }
+
+    ++m_Generation;
+    m_RequestReady.notify_all();
+    m_Worker.join();
+}
+
+void FilterPreview::start(Layer* layer)
+{
+    assert(layer);
+    assert(!isActive());
+
+    m_Layer    = layer;
+    m_Original = layer->snapshot();
+    ++m_OriginalId;
+}
+
+bool FilterPreview::isActive() const { return m_Layer != nullptr; }
+bool FilterPreview::isBusy() const { return isActive() && m_HasRequested && !m_FinalUploaded; }
+Layer* FilterPreview::getLayer() { return m_Layer; }
+const TiledImage& FilterPreview::getOriginal() const { return m_Original; }
+
+void FilterPreview::request(std::shared_ptr<const TileKernel> reducedKernel, std::shared_ptr<const TileKernel> kernel)
+{
+    assert(isActive());
+    assert(kernel);
+
+    uint64_t generation = ++m_Generation;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        m_Request.generation    = generation;
+        m_Request.original      = m_Original;
+        m_Request.originalId    = m_OriginalId;
+        m_Request.reducedKernel = std::move(reducedKernel);
+        m_Request.kernel        = std::move(kernel);
+        m_HasRequest            = true;
+        m_HasResult             = false;
+    }
+
+    m_RequestReady.notify_one();
+
+    m_HasRequested  = true;
+    m_FinalUploaded = false;
+}
+
+void FilterPreview::update()
+{
+    if (!isActive())
+    {
+        return;
+    }
+
+    Result result;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (!m_HasResult)
+        {
+            return;
+        }
+
+        result      = std::move(m_Result);
+        m_HasResult = false;
+    }
+
+    if (result.generation == m_Generation)
+    {
+        upload(result);
+    }
+}
+
+void FilterPreview::commit(History* history)
+{
+    assert(history);
+
+    if (!isActive())
+    {
+        return;
+    }
+
+    if (m_HasRequested && !m_FinalUploaded)
+    {
+        Result result;
+
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_ResultReady.wait(lock, [this] { return m_HasResult && m_Result.isFinal &&
+                                                     m_Result.generation == m_Generation; });
+
+            result      = std::move(m_Result);
+            m_HasResult = false;
+        }
+
+        upload(result);
+    }
+
+    history->addStep(m_Layer, m_Original);
+    reset();
+}
+
+void FilterPreview::discard()
+{
+    if (!isActive())
+    {
+        return;
+    }
+
+    ++m_Generation;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_HasRequest = false;
+        m_HasResult  = false;
+    }
+
+    m_Layer->restore(m_Original);
+    reset();
+}
+
+void FilterPreview::workerLoop()
+{
+    while (true)
+    {
+        Request request;
+
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_RequestReady.wait(lock, [this] { return m_Stopping || m_HasRequest; });
+
+            if (m_Stopping)
+            {
+                return;
+            }
+
+            request      = std::move(m_Request);
+            m_Request    = Request();
+            m_HasRequest = false;
+        }
+
+        uint64_t generation = request.generation;
+        auto     isCanceled = [this, generation]() { return m_Generation != generation; };
+
+        size_t pixelCount = request.original.getWidth() * request.original.getHeight();
+
+        if (request.reducedKernel != nullptr && pixelCount >= MIN_DOWNSCALED_PIXELS)
+        {
+            std::vector<Sml::Color> pixels;
+            if (renderReduced(request, &pixels))
+            {
+                publish(generation, false, std::move(pixels));
+            }
+        }
+
+        if (isCanceled())
+        {
+            continue;
+        }
+
+        std::vector<Sml::Color> pixels(pixelCount);
+        if (FilterEngine().run(request.original, *request.kernel, pixels.data(), isCanceled))
+        {
+            publish(generation, true, std::move(pixels));
+        }
+    }
+}
+
+bool FilterPreview::renderReduced(const Request& request, std::vector<Sml::Color>* pixels)
+{
+    assert(pixels);
+
+    uint64_t generation = request.generation;
+    auto     isCanceled = [this, generation]() { return m_Generation != generation; };
+
+    /* Slider moves don't change the original, so its reduced copy is reused between requests */
+    if (m_ReducedId != request.originalId)
+    {
+        m_Reduced   = downscale(request.original, DOWNSCALE_FACTOR);
+        m_ReducedId = request.originalId;
+    }
+
+    int32_t width         = static_cast<int32_t>(request.original.getWidth());
+    int32_t height        = static_cast<int32_t>(request.original.getHeight());
+    int32_t reducedWidth  = static_cast<int32_t>(m_Reduced.getWidth());
+
+    std::vector<Sml::Color> reduced(m_Reduced.getWidth() * m_Reduced.getHeight());
+    if (!FilterEngine().run(m_Reduced, *request.reducedKernel, reduced.data(), isCanceled))
+    {
+        return false;
+    }
+
+    pixels->resize(static_cast<size_t>(width) * height);
+
+    ThreadPool::getInstance().parallelFor(static_cast<size_t>(height), [&](size_t y)
+    {
+        const Sml::Color* src = reduced.data() + (y / DOWNSCALE_FACTOR) * reducedWidth;
+        Sml::Color*       dst = pixels->data() + y * width;
+
+        for (int32_t x = 0; x < width; ++x)
+        {
+            dst[x] = src[x / DOWNSCALE_FACTOR];
+        }
+    });
+
+    return !isCanceled();
+}
+
+void FilterPreview::publish(uint64_t generation, bool isFinal, std::vector<Sml::Color>&& pixels)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        /* Results of outdated requests are dropped right away */
+        if (generation != m_Generation)
+        {
+            return;
+        }
+
+        m_Result.generation = generation;
+        m_Result.isFinal    = isFinal;
+        m_Result.pixels     = std::move(pixels);
+        m_HasResult         = true;
+    }
+
+    m_ResultReady.notify_all();
+}
+
+void FilterPreview::upload(const Result& result)
+{
+    m_Layer->getTexture()->updatePixels(result.pixels.data(), nullptr);
+    m_Layer->markDirty();
+
+    if (result.isFinal)
+    {
+        m_FinalUploaded = true;
+    }
+}
+
+void FilterPreview::reset()
+{
+    m_Layer         = nullptr;
+    m_Original      = TiledImage();
+    m_HasRequested  = false;
+    m_FinalUploaded = false;
+}
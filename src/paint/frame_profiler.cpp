@@ -0,0 +1,186 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file frame_profiler.cpp
+ * @date 2021-12-30
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "sml/sml_log.h"
+#include "paint/frame_profiler.h"
+
+using namespace Paint;
+
+const size_t FrameProfiler::CAPACITY = 1 << 17;
+
+/**
+ * @brief Small sequential ids read better in trace viewers than pthread ids.
+ */
+static uint32_t getThreadId()
+{
+    static std::atomic<uint32_t> nextId{1};
+    static thread_local uint32_t id = nextId.fetch_add(1, std::memory_order_relaxed);
+
+    return id;
+}
+
+static void writeEscaped(FILE* file, const char* string)
+{
+    for (; *string != '\0'; ++string)
+    {
+        if (*string == '"' || *string == '\\')
+        {
+            fputc('\\', file);
+        }
+
+        /* Control characters can't appear in JSON strings */
+        fputc(static_cast<unsigned char>(*string) < 0x20 ? ' ' : *string, file);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Zone
+//------------------------------------------------------------------------------
+FrameProfiler::Zone::Zone(const char* name) : m_Name(name)
+{
+    if (FrameProfiler::getInstance().isEnabled())
+    {
+        m_Start = getTimeNs();
+    }
+}
+
+FrameProfiler::Zone::~Zone()
+{
+    if (m_Start != 0)
+    {
+        FrameProfiler::getInstance().record(m_Name, m_Start, getTimeNs());
+    }
+}
+
+//------------------------------------------------------------------------------
+// FrameProfiler
+//------------------------------------------------------------------------------
+FrameProfiler& FrameProfiler::getInstance()
+{
+    static FrameProfiler profiler;
+    return profiler;
+}
+
+uint64_t FrameProfiler::getTimeNs()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+FrameProfiler::FrameProfiler() : m_Slots(new Slot[CAPACITY])
+{
+    assert((CAPACITY & (CAPACITY - 1)) == 0);
+}
+
+bool FrameProfiler::isEnabled() const { return m_Enabled.load(std::memory_order_relaxed); }
+void FrameProfiler::setEnabled(bool enabled) { m_Enabled.store(enabled, std::memory_order_relaxed); }
+
+const char* FrameProfiler::intern(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(m_NamesMutex);
+
+    /* Elements of an unordered_set never move */
+    return m_Names.insert(name).first->c_str();
+}
+
+void FrameProfiler::record(const char* name, uint64_t start, uint64_t end)
+{
+    assert(name);
+
+    uint64_t index = m_Head.fetch_add(1, std::memory_order_relaxed);
+    Slot&    slot  = m_Slots[index & (CAPACITY - 1)];
+
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.end.store(end, std::memory_order_relaxed);
+    slot.thread.store(getThreadId(), std::memory_order_relaxed);
+
+    slot.sequence.store(index + 1, std::memory_order_release);
+}
+
+bool FrameProfiler::dump(const char* filename, double seconds) const
+{
+    assert(filename);
+
+    struct Event
+    {
+        const char* name;
+        uint64_t    start;
+        uint64_t    end;
+        uint32_t    thread;
+    };
+
+    uint64_t now    = getTimeNs();
+    uint64_t cutoff = now - std::min(now, static_cast<uint64_t>(seconds * 1e9));
+    uint64_t head   = m_Head.load(std::memory_order_acquire);
+
+    std::vector<Event> events;
+
+    for (uint64_t index = head - std::min<uint64_t>(head, CAPACITY); index < head; ++index)
+    {
+        const Slot& slot     = m_Slots[index & (CAPACITY - 1)];
+        uint64_t    sequence = slot.sequence.load(std::memory_order_acquire);
+
+        /* Still being written, or already overwritten by a newer zone */
+        if (sequence != index + 1)
+        {
+            continue;
+        }
+
+        Event event = {slot.name.load(std::memory_order_relaxed), slot.start.load(std::memory_order_relaxed),
+                       slot.end.load(std::memory_order_relaxed), slot.thread.load(std::memory_order_relaxed)};
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence || event.end < cutoff)
+        {
+            continue;
+        }
+
+        events.push_back(event);
+    }
+
+    std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.start < b.start; });
+
+    FILE* file = fopen(filename, "w");
+    if (file == nullptr)
+    {
+        LOG_APP_ERROR("Couldn't open '%s' to write the trace.", filename);
+        return false;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        fprintf(file, "{\"name\": \"");
+        writeEscaped(file, events[i].name);
+        fprintf(file, "\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %u}%s\n",
+                events[i].start / 1e3, (events[i].end - events[i].start) / 1e3, static_cast<int>(getpid()),
+                events[i].thread, i + 1 < events.size() ? "," : "");
+    }
+
+    fprintf(file, "]}\n");
+
+    bool written = !ferror(file);
+    if (fclose(file) != 0 || !written)
+    {
+        LOG_APP_ERROR("Couldn't write the trace to '%s'.", filename);
+        return false;
+    }
+
+    return true;
+}
@@ -8,6 +8,7 @@
 
 #include <algorithm>
 #include "sgl/scene/style/default_skins.h"
+#include "paint/async_logger.h"
 #include "paint/gui/color_picker.h"
 
 using namespace Paint;
@@ -41,7 +42,7 @@ public:
 
     virtual void onDragStart(Sgl::DragStartEvent* event)
     {
-        LOG_LIB_INFO("ColorPickerDragListener::onDragStart()");
+        PAINT_LOG_TRACE("ColorPickerDragListener::onDragStart()");
 
         ColorPicker&          colorPicker = *getComponent();
         ColorPickerSkin&      skin        = dynamic_cast<ColorPickerSkin&>(*colorPicker.getSkin());
@@ -64,7 +65,7 @@ public:
 
     virtual void onDragMove(Sgl::DragMoveEvent* event)
     {
-        LOG_LIB_INFO("ColorPickerDragListener::onDragMove()");
+        PAINT_LOG_TRACE_EVERY(AsyncLogger::EVENT_INTERVAL, "ColorPickerDragListener::onDragMove()");
 
         ColorPicker&          colorPicker = *getComponent();
         ColorPickerSkin&      skin        = dynamic_cast<ColorPickerSkin&>(*colorPicker.getSkin());
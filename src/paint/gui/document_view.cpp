@@ -6,8 +6,12 @@
  * @copyright Copyright (c) 2021
  */
 
+#include <algorithm>
+#include <cmath>
 #include "paint/gui/document_view.h"
 #include "paint/paint_editor.h"
+#include "paint/frame_profiler.h"
+#include "paint/async_logger.h"
 
 using namespace Paint;
 
@@ -37,6 +41,8 @@ DocumentView::DocumentView(Document* document, Sgl::Scene* scene)
       m_Canvas(new Canvas(document)),
       m_Title(document->getName())
 {
+    getViews().push_back(this);
+
     m_View->updateTitle(m_Title.c_str());
     // m_ScrollPane->setContent(m_Canvas);
     // m_View->addChild(m_ScrollPane);
@@ -49,12 +55,45 @@ DocumentView::DocumentView(Document* document, Sgl::Scene* scene)
 
 Document* DocumentView::getDocument() { return m_Document; }
 InnerWindow* DocumentView::getView() { return m_View; }
+Canvas* DocumentView::getCanvas() { return m_Canvas; }
+
+DocumentView* DocumentView::findView(Document* document)
+{
+    for (DocumentView* view : getViews())
+    {
+        if (view->getDocument() == document)
+        {
+            return view;
+        }
+    }
+
+    return nullptr;
+}
+
+std::vector<DocumentView*>& DocumentView::getViews()
+{
+    static std::vector<DocumentView*> views;
+    return views;
+}
 
 //------------------------------------------------------------------------------
 // Canvas
 //------------------------------------------------------------------------------
-const Sgl::ColorFill  Canvas::BACKGROUND_FILL = {0xA3'A3'A3'FF};
-const Sgl::Background Canvas::BACKGROUND      = {&BACKGROUND_FILL};
+const Sml::Color      Canvas::BACKGROUND_COLOR = 0xA3'A3'A3'FF;
+const Sgl::ColorFill  Canvas::BACKGROUND_FILL  = {BACKGROUND_COLOR};
+const Sgl::Background Canvas::BACKGROUND       = {&BACKGROUND_FILL};
+
+const float           Canvas::MIN_ZOOM         = 1.0f / 64;
+const float           Canvas::MAX_ZOOM         = 32;
+const float           Canvas::ZOOM_STEP        = 2;
+const int32_t         Canvas::MAX_PREF_WIDTH   = 960;
+const int32_t         Canvas::MAX_PREF_HEIGHT  = 540;
+
+static bool areRectsEqual(const Sml::Rectangle<int32_t>& first, const Sml::Rectangle<int32_t>& second)
+{
+    return first.pos.x == second.pos.x && first.pos.y == second.pos.y &&
+           first.width == second.width && first.height == second.height;
+}
 
 class CanvasMousePressListener : public Sgl::ComponentEventListener<Canvas>
 {
@@ -66,7 +105,7 @@ public:
 
     virtual void onEvent(Sml::Event* event) override
     {
-        LOG_APP_INFO("CanvasMousePressListener");
+        PAINT_LOG_TRACE("CanvasMousePressListener");
 
         getComponent()->requestDrag();
     }
@@ -80,14 +119,32 @@ public:
     virtual void onDragStart(Sgl::DragStartEvent* event)
     {
         Sml::Vec2i localPos = getComponent()->computeSceneToLocalPos({event->getX(), event->getY()});
-        m_CurX = localPos.x - getComponent()->getTexturePos().x;
-        m_CurY = localPos.y - getComponent()->getTexturePos().y;
+        m_ViewX   = localPos.x;
+        m_ViewY   = localPos.y;
+        m_Panning = Canvas::isPanMode();
+
+        if (m_Panning)
+        {
+            return;
+        }
+
+        Sml::Vec2i documentPos = getComponent()->viewToDocument(localPos);
+        m_CurX = documentPos.x;
+        m_CurY = documentPos.y;
      
-        LOG_APP_INFO("CanvasDragListener::onDragStart(canvasPos = {%d, %d})", m_CurX, m_CurY);
+        PAINT_LOG_TRACE("CanvasDragListener::onDragStart(canvasPos = {%d, %d})", m_CurX, m_CurY);
+
+        Layer* layer = getComponent()->getDocument()->getActiveLayer();
+
+        /* Painting over a preview keeps it, its step has to come before the stroke's */
+        Editor::getInstance().commitFilterPreview();
+
+        /* Tools load the tiles they draw on themselves, the rest of the layer may stay in the file */
+        Editor::getInstance().getHistory().beginStep(layer);
 
         Sml::Renderer& renderer = Sml::Renderer::getInstance();
         renderer.pushTarget();
-        renderer.setTarget(getComponent()->getDocument()->getActiveLayer()->getTexture());
+        renderer.setTarget(layer->getTexture());
 
         Editor::getInstance().getActiveTool()->onActionStart(Sml::Vec2i(m_CurX, m_CurY));
 
@@ -96,17 +153,28 @@ public:
 
     virtual void onDragMove(Sgl::DragMoveEvent* event)
     {
-        int32_t newX = m_CurX + event->getDeltaX();
-        int32_t newY = m_CurY + event->getDeltaY();
+        if (m_Panning)
+        {
+            getComponent()->pan(Sml::Vec2i(event->getDeltaX(), event->getDeltaY()));
+            return;
+        }
 
-        LOG_APP_INFO("CanvasDragListener::onDragMove(canvasPos = {%d, %d})", newX, newY);
+        m_ViewX += event->getDeltaX();
+        m_ViewY += event->getDeltaY();
+
+        Sml::Vec2i documentPos = getComponent()->viewToDocument(Sml::Vec2i(m_ViewX, m_ViewY));
+        int32_t    newX        = documentPos.x;
+        int32_t    newY        = documentPos.y;
+
+        PAINT_LOG_TRACE_EVERY(AsyncLogger::EVENT_INTERVAL, "CanvasDragListener::onDragMove(canvasPos = {%d, %d})", newX,
+                              newY);
 
         Sml::Renderer& renderer = Sml::Renderer::getInstance();
         renderer.pushTarget();
         renderer.setTarget(getComponent()->getDocument()->getActiveLayer()->getTexture());
 
         Editor::getInstance().getActiveTool()->onAction(Sml::Vec2i(newX, newY),
-                                                        Sml::Vec2i(event->getDeltaX(), event->getDeltaY()));
+                                                        Sml::Vec2i(newX - m_CurX, newY - m_CurY));
 
         renderer.popTarget();
 
@@ -116,11 +184,17 @@ public:
 
     virtual void onDragEnd(Sgl::DragEndEvent* event)
     {
-        Sml::Vec2i localPos = getComponent()->computeSceneToLocalPos({event->getX(), event->getY()});
-        m_CurX = localPos.x - getComponent()->getTexturePos().x;
-        m_CurY = localPos.y - getComponent()->getTexturePos().y;
+        if (m_Panning)
+        {
+            return;
+        }
 
-        LOG_APP_INFO("CanvasDragListener::onDragEnd(canvasPos = {%d, %d})", m_CurX, m_CurY);
+        Sml::Vec2i localPos    = getComponent()->computeSceneToLocalPos({event->getX(), event->getY()});
+        Sml::Vec2i documentPos = getComponent()->viewToDocument(localPos);
+        m_CurX = documentPos.x;
+        m_CurY = documentPos.y;
+
+        PAINT_LOG_TRACE("CanvasDragListener::onDragEnd(canvasPos = {%d, %d})", m_CurX, m_CurY);
 
         Sml::Renderer& renderer = Sml::Renderer::getInstance();
         renderer.pushTarget();
@@ -129,45 +203,581 @@ public:
         Editor::getInstance().getActiveTool()->onActionEnd(Sml::Vec2i(m_CurX, m_CurY));
 
         renderer.popTarget();
+
+        Editor::getInstance().getHistory().endStep();
     }
 
 private:
-    int32_t m_CurX = 0;
-    int32_t m_CurY = 0;
+    int32_t m_CurX    = 0; ///< In the document's pixels
+    int32_t m_CurY    = 0;
+    int32_t m_ViewX   = 0; ///< In the view's pixels, as the zoom may be fractional
+    int32_t m_ViewY   = 0;
+    bool    m_Panning = false;
 };
 
-Canvas::Canvas(Document* document) : m_Document(document)
+Canvas::Canvas(Document* document)
 {
-    assert(document);
+    setDocument(document);
 
     setBackground(&BACKGROUND);
     getEventDispatcher()->attachHandler(CanvasMousePressListener::EVENT_TYPES, new CanvasMousePressListener(this));
     getEventDispatcher()->attachHandler(CanvasDragListener::EVENT_TYPES, new CanvasDragListener(this));
 }
 
+Canvas::~Canvas()
+{
+    delete m_LevelTexture;
+    delete m_Surface;
+}
+
 Document* Canvas::getDocument() { return m_Document; }
-void Canvas::setDocument(Document* texture) { assert(texture); m_Document = texture; }
+
+void Canvas::setDocument(Document* document)
+{
+    assert(document);
+
+    float width  = static_cast<float>(document->getWidth());
+    float height = static_cast<float>(document->getHeight());
+
+    m_Document = document;
+    m_CenterX  = width  / 2;
+    m_CenterY  = height / 2;
+    m_Zoom     = std::max(MIN_ZOOM, std::min({1.0f, MAX_PREF_WIDTH / width, MAX_PREF_HEIGHT / height}));
+
+    m_PrefWidth  = std::max(1, static_cast<int32_t>(std::lround(width  * m_Zoom)));
+    m_PrefHeight = std::max(1, static_cast<int32_t>(std::lround(height * m_Zoom)));
+
+    m_LevelValid   = false;
+    m_SurfaceValid = false;
+}
+
+float Canvas::getZoom() const { return m_Zoom; }
+
+void Canvas::setZoom(float zoom)
+{
+    zoom = std::max(MIN_ZOOM, std::min(MAX_ZOOM, zoom));
+
+    if (zoom != m_Zoom)
+    {
+        m_Zoom         = zoom;
+        m_SurfaceValid = false;
+
+        Editor::getInstance().invalidate();
+    }
+}
+
+void Canvas::zoomIn()  { setZoom(m_Zoom * ZOOM_STEP); }
+void Canvas::zoomOut() { setZoom(m_Zoom / ZOOM_STEP); }
+
+void Canvas::fitToView()
+{
+    if (getLayoutWidth() <= 0 || getLayoutHeight() <= 0)
+    {
+        return;
+    }
+
+    m_CenterX = static_cast<float>(m_Document->getWidth())  / 2;
+    m_CenterY = static_cast<float>(m_Document->getHeight()) / 2;
+
+    setZoom(std::min(static_cast<float>(getLayoutWidth())  / m_Document->getWidth(),
+                     static_cast<float>(getLayoutHeight()) / m_Document->getHeight()));
+
+    m_SurfaceValid = false;
+    Editor::getInstance().invalidate();
+}
+
+void Canvas::pan(const Sml::Vec2i& delta)
+{
+    /* The center stays inside the document, so that it can't be lost off-screen */
+    m_CenterX = std::max(0.0f, std::min(static_cast<float>(m_Document->getWidth()),  m_CenterX - delta.x / m_Zoom));
+    m_CenterY = std::max(0.0f, std::min(static_cast<float>(m_Document->getHeight()), m_CenterY - delta.y / m_Zoom));
+
+    m_SurfaceValid = false;
+    Editor::getInstance().invalidate();
+}
+
+bool Canvas::isPanMode()                { return getPanModeFlag();     }
+void Canvas::setPanMode(bool panMode)   { getPanModeFlag() = panMode;  }
+
+bool& Canvas::getPanModeFlag()
+{
+    static bool panMode = false;
+    return panMode;
+}
+
+Sml::Vec2i Canvas::viewToDocument(const Sml::Vec2i& localPos) const
+{
+    return Sml::Vec2i(static_cast<int32_t>(std::floor((localPos.x - getLayoutWidth()  / 2.0f) / m_Zoom + m_CenterX)),
+                      static_cast<int32_t>(std::floor((localPos.y - getLayoutHeight() / 2.0f) / m_Zoom + m_CenterY)));
+}
+
+Sml::Vec2i Canvas::documentToView(const Sml::Vec2i& documentPos) const
+{
+    return Sml::Vec2i(static_cast<int32_t>(std::lround((documentPos.x - m_CenterX) * m_Zoom + getLayoutWidth()  / 2.0f)),
+                      static_cast<int32_t>(std::lround((documentPos.y - m_CenterY) * m_Zoom + getLayoutHeight() / 2.0f)));
+}
+
+const std::vector<Sml::Rectangle<int32_t>>& Canvas::getVisibleRects() const { return m_VisibleRects; }
 
 void Canvas::prerenderSelf()
 {
-    Container::prerenderSelf();
+    PROFILE_ZONE("Canvas::prerenderSelf");
+
+    /* Picked up even if hidden, otherwise the document would stay dirty */
+    m_Document->update();
+
+    if (getLayoutWidth() <= 0 || getLayoutHeight() <= 0)
+    {
+        return;
+    }
+
+    std::vector<Sml::Rectangle<int32_t>> visibleRects = computeVisibleRects();
+
+    if (visibleRects.size() != m_VisibleRects.size() ||
+        !std::equal(visibleRects.begin(), visibleRects.end(), m_VisibleRects.begin(), areRectsEqual))
+    {
+        /* Only the newly exposed parts are redrawn, what stays visible is already up to date */
+        std::vector<Sml::Rectangle<int32_t>> exposed = visibleRects;
+
+        for (const auto& previousRect : m_VisibleRects)
+        {
+            std::vector<Sml::Rectangle<int32_t>> pieces;
+            for (const auto& rect : exposed)
+            {
+                subtractRect(rect, previousRect, &pieces);
+            }
+
+            exposed.swap(pieces);
+        }
+
+        m_ExposedRects.insert(m_ExposedRects.end(), exposed.begin(), exposed.end());
+        m_VisibleRects = std::move(visibleRects);
+    }
+
+    /* Brought up to date once shown again, as the revisions in between are skipped */
+    if (m_VisibleRects.empty())
+    {
+        return;
+    }
+
+    updateLevel();
+    updateSurface();
 
-    m_Document->applyLayersToCanvas();
-    Sml::renderTexture(*m_Document->getCanvas(), getTexturePos());
+    Sml::renderTexture(*m_Surface, Sml::Vec2i(0, 0));
 }
 
-int32_t Canvas::computeCustomPrefWidth(int32_t height) const
+std::vector<Sml::Rectangle<int32_t>> Canvas::computeVisibleRects()
 {
-    return m_Document->getWidth();
+    std::vector<Sml::Rectangle<int32_t>> rects;
+
+    Sml::Vec2i              origin = computeSceneToLocalPos(Sml::Vec2i(0, 0));
+    Sml::Rectangle<int32_t> bounds(-origin.x, -origin.y, getLayoutWidth(), getLayoutHeight());
+
+    if (getScene() != nullptr)
+    {
+        bounds = intersectRects(bounds, Sml::Rectangle<int32_t>(0, 0, getScene()->getWidth(), getScene()->getHeight()));
+    }
+
+    if (isRectEmpty(bounds))
+    {
+        return rects;
+    }
+
+    rects.push_back(bounds);
+
+    /* Windows are opaque and drawn in the order of their parent's children */
+    Sgl::Component* child = this;
+
+    for (Sgl::Parent* parent = getModifiableParent(); parent != nullptr && !rects.empty();
+         child = parent, parent = parent->getModifiableParent())
+    {
+        bool isAbove = false;
+
+        for (Sgl::Component* sibling : parent->getChildren())
+        {
+            if (sibling == child)
+            {
+                isAbove = true;
+                continue;
+            }
+
+            if (!isAbove || dynamic_cast<InnerWindow*>(sibling) == nullptr)
+            {
+                continue;
+            }
+
+            Sml::Vec2i              siblingOrigin = sibling->computeSceneToLocalPos(Sml::Vec2i(0, 0));
+            Sml::Rectangle<int32_t> hole(-siblingOrigin.x, -siblingOrigin.y,
+                                         sibling->getLayoutWidth(), sibling->getLayoutHeight());
+
+            std::vector<Sml::Rectangle<int32_t>> pieces;
+            for (const auto& rect : rects)
+            {
+                subtractRect(rect, hole, &pieces);
+            }
+
+            rects.swap(pieces);
+        }
+    }
+
+    for (auto& rect : rects)
+    {
+        rect.pos.x += origin.x;
+        rect.pos.y += origin.y;
+    }
+
+    return rects;
 }
 
-int32_t Canvas::computeCustomPrefHeight(int32_t width) const
+size_t Canvas::computeLevel() const
+{
+    /* The finest level that isn't magnified, so that no detail is lost */
+    size_t level = 0;
+    while (m_Zoom * static_cast<float>(2 << level) <= 1)
+    {
+        ++level;
+    }
+
+    return level;
+}
+
+Sml::Rectangle<int32_t> Canvas::computeLevelRect(size_t level) const
+{
+    Sml::Rectangle<int32_t> visible(0, 0, 0, 0);
+    for (const auto& rect : m_VisibleRects)
+    {
+        visible = uniteRects(visible, rect);
+    }
+
+    Sml::Rectangle<int32_t> rect = mapViewToLevel(visible, level);
+
+    if (isRectEmpty(rect))
+    {
+        return rect;
+    }
+
+    /* Whole tiles, so that the rect only changes once panning crosses a tile */
+    int32_t left   = rect.pos.x / Tile::SIZE * Tile::SIZE;
+    int32_t top    = rect.pos.y / Tile::SIZE * Tile::SIZE;
+    int32_t right  = (rect.pos.x + rect.width  + Tile::SIZE - 1) / Tile::SIZE * Tile::SIZE;
+    int32_t bottom = (rect.pos.y + rect.height + Tile::SIZE - 1) / Tile::SIZE * Tile::SIZE;
+
+    Sml::Rectangle<int32_t> bounds(0, 0, static_cast<int32_t>(MipPyramid::getLevelSize(m_Document->getWidth(),  level)),
+                                         static_cast<int32_t>(MipPyramid::getLevelSize(m_Document->getHeight(), level)));
+
+    return intersectRects(Sml::Rectangle<int32_t>(left, top, right - left, bottom - top), bounds);
+}
+
+Sml::Rectangle<int32_t> Canvas::mapViewToLevel(const Sml::Rectangle<int32_t>& rect, size_t level) const
+{
+    float scale   = m_Zoom * static_cast<float>(1 << level);
+    float originX = getLayoutWidth()  / 2.0f - m_CenterX * m_Zoom;
+    float originY = getLayoutHeight() / 2.0f - m_CenterY * m_Zoom;
+
+    int32_t left   = static_cast<int32_t>(std::floor((rect.pos.x - originX) / scale));
+    int32_t top    = static_cast<int32_t>(std::floor((rect.pos.y - originY) / scale));
+    int32_t right  = static_cast<int32_t>(std::ceil((rect.pos.x + rect.width  - originX) / scale));
+    int32_t bottom = static_cast<int32_t>(std::ceil((rect.pos.y + rect.height - originY) / scale));
+
+    Sml::Rectangle<int32_t> bounds(0, 0, static_cast<int32_t>(MipPyramid::getLevelSize(m_Document->getWidth(),  level)),
+                                         static_cast<int32_t>(MipPyramid::getLevelSize(m_Document->getHeight(), level)));
+
+    return intersectRects(Sml::Rectangle<int32_t>(left, top, right - left, bottom - top), bounds);
+}
+
+Sml::Rectangle<int32_t> Canvas::mapLevelToView(const Sml::Rectangle<int32_t>& rect) const
+{
+    float scale   = m_Zoom * static_cast<float>(1 << m_Level);
+    float originX = getLayoutWidth()  / 2.0f - m_CenterX * m_Zoom;
+    float originY = getLayoutHeight() / 2.0f - m_CenterY * m_Zoom;
+
+    /* Edges are rounded the same way for any rect, so that adjacent rects don't leave seams */
+    int32_t left   = static_cast<int32_t>(std::lround(originX + rect.pos.x * scale));
+    int32_t top    = static_cast<int32_t>(std::lround(originY + rect.pos.y * scale));
+    int32_t right  = static_cast<int32_t>(std::lround(originX + (rect.pos.x + rect.width)  * scale));
+    int32_t bottom = static_cast<int32_t>(std::lround(originY + (rect.pos.y + rect.height) * scale));
+
+    return Sml::Rectangle<int32_t>(left, top, right - left, bottom - top);
+}
+
+size_t Canvas::getLevelTileColumns() const
+{
+    return static_cast<size_t>((m_LevelRect.width + Tile::SIZE - 1) / Tile::SIZE);
+}
+
+Sml::Rectangle<int32_t> Canvas::getLevelTileRect(size_t index) const
+{
+    int32_t column = static_cast<int32_t>(index % getLevelTileColumns());
+    int32_t row    = static_cast<int32_t>(index / getLevelTileColumns());
+
+    return intersectRects(Sml::Rectangle<int32_t>(m_LevelRect.pos.x + column * Tile::SIZE,
+                                                  m_LevelRect.pos.y + row    * Tile::SIZE,
+                                                  Tile::SIZE, Tile::SIZE),
+                          m_LevelRect);
+}
+
+void Canvas::updateLevel()
 {
-    return m_Document->getHeight();
+    size_t                  level     = computeLevel();
+    Sml::Rectangle<int32_t> levelRect = computeLevelRect(level);
+    uint64_t                revision  = m_Document->getRevision();
+
+    if (isRectEmpty(levelRect))
+    {
+        m_SurfaceValid = m_SurfaceValid && !m_LevelValid;
+        m_LevelRect    = levelRect;
+        m_LevelValid   = false;
+        return;
+    }
+
+    if (!m_LevelValid || level != m_Level || revision > m_LevelRevision + 1)
+    {
+        m_Level     = level;
+        m_LevelRect = Sml::Rectangle<int32_t>();
+
+        moveLevelRect(levelRect);
+    }
+    else
+    {
+        if (!areRectsEqual(levelRect, m_LevelRect))
+        {
+            moveLevelRect(levelRect);
+        }
+
+        /* Hidden tiles that were composed before are kept up to date, the others are composed once shown */
+        if (revision == m_LevelRevision + 1)
+        {
+            for (const auto& rect : m_Document->getLastChanges().getRects())
+            {
+                Sml::Rectangle<int32_t> changed = MipPyramid::getLevelRect(rect, m_Level);
+
+                for (size_t i = 0; i < m_ComposedTiles.size(); ++i)
+                {
+                    if (m_ComposedTiles[i])
+                    {
+                        composeLevel(intersectRects(changed, getLevelTileRect(i)));
+                    }
+                }
+            }
+        }
+    }
+
+    composeVisibleTiles();
+
+    m_LevelValid    = true;
+    m_LevelRevision = revision;
 }
 
-Sml::Vec2i Canvas::getTexturePos() const
+void Canvas::moveLevelRect(const Sml::Rectangle<int32_t>& levelRect)
 {
-    return Sml::Vec2i((getLayoutWidth()  - m_Document->getWidth())  / 2,
-                      (getLayoutHeight() - m_Document->getHeight()) / 2);
-}
\ No newline at end of file
+    PROFILE_ZONE("Canvas::moveLevelRect");
+
+    Sml::Rectangle<int32_t> overlap = intersectRects(levelRect, m_LevelRect);
+    std::vector<Sml::Color> pixels(static_cast<size_t>(levelRect.width) * levelRect.height);
+
+    /* What's still in the rect is kept, only the newly exposed tiles are composed */
+    for (int32_t y = overlap.pos.y; y < overlap.pos.y + overlap.height; ++y)
+    {
+        const Sml::Color* src = m_LevelPixels.data() + static_cast<size_t>(y - m_LevelRect.pos.y) * m_LevelRect.width +
+                                (overlap.pos.x - m_LevelRect.pos.x);
+
+        std::copy(src, src + overlap.width, pixels.data() + static_cast<size_t>(y - levelRect.pos.y) * levelRect.width +
+                                            (overlap.pos.x - levelRect.pos.x));
+    }
+
+    Sml::Rectangle<int32_t> previousRect  = m_LevelRect;
+    std::vector<bool>       previousTiles = std::move(m_ComposedTiles);
+    size_t                  previousCols  = getLevelTileColumns();
+
+    m_LevelPixels.swap(pixels);
+    m_LevelRect = levelRect;
+
+    size_t columns = getLevelTileColumns();
+    size_t rows    = static_cast<size_t>((levelRect.height + Tile::SIZE - 1) / Tile::SIZE);
+
+    m_ComposedTiles.assign(columns * rows, false);
+
+    /* Both rects are aligned to the tiles of the level, so tiles are either kept or exposed */
+    for (size_t i = 0; i < m_ComposedTiles.size() && !isRectEmpty(overlap); ++i)
+    {
+        Sml::Rectangle<int32_t> tileRect = getLevelTileRect(i);
+
+        if (!areRectsEqual(intersectRects(tileRect, previousRect), tileRect))
+        {
+            continue;
+        }
+
+        size_t previousColumn = static_cast<size_t>((tileRect.pos.x - previousRect.pos.x) / Tile::SIZE);
+        size_t previousRow    = static_cast<size_t>((tileRect.pos.y - previousRect.pos.y) / Tile::SIZE);
+
+        m_ComposedTiles[i] = previousTiles[previousRow * previousCols + previousColumn];
+    }
+
+    if (m_LevelTexture == nullptr || m_LevelTexture->getWidth()  != static_cast<size_t>(levelRect.width) ||
+                                     m_LevelTexture->getHeight() != static_cast<size_t>(levelRect.height))
+    {
+        delete m_LevelTexture;
+        m_LevelTexture = new Sml::Texture(levelRect.width, levelRect.height);
+    }
+
+    /* The kept tiles moved inside the texture (or it's a new one) */
+    if (!isRectEmpty(overlap))
+    {
+        Sml::Rectangle<int32_t> textureRect(0, 0, levelRect.width, levelRect.height);
+        m_LevelTexture->updatePixels(m_LevelPixels.data(), &textureRect);
+    }
+
+    m_SurfaceValid = false;
+}
+
+void Canvas::composeVisibleTiles()
+{
+    for (const auto& visibleRect : m_VisibleRects)
+    {
+        Sml::Rectangle<int32_t> rect = intersectRects(mapViewToLevel(visibleRect, m_Level), m_LevelRect);
+
+        if (isRectEmpty(rect))
+        {
+            continue;
+        }
+
+        size_t firstColumn = static_cast<size_t>((rect.pos.x - m_LevelRect.pos.x) / Tile::SIZE);
+        size_t firstRow    = static_cast<size_t>((rect.pos.y - m_LevelRect.pos.y) / Tile::SIZE);
+        size_t endColumn   = static_cast<size_t>((rect.pos.x + rect.width  - m_LevelRect.pos.x - 1) / Tile::SIZE + 1);
+        size_t endRow      = static_cast<size_t>((rect.pos.y + rect.height - m_LevelRect.pos.y - 1) / Tile::SIZE + 1);
+
+        for (size_t row = firstRow; row < endRow; ++row)
+        {
+            for (size_t column = firstColumn; column < endColumn; ++column)
+            {
+                size_t index = row * getLevelTileColumns() + column;
+
+                if (!m_ComposedTiles[index])
+                {
+                    composeLevel(getLevelTileRect(index));
+                    m_ComposedTiles[index] = true;
+                }
+            }
+        }
+    }
+}
+
+void Canvas::composeLevel(const Sml::Rectangle<int32_t>& rect)
+{
+    if (isRectEmpty(rect))
+    {
+        return;
+    }
+
+    std::vector<Sml::Color> pixels(static_cast<size_t>(rect.width) * rect.height);
+    m_Document->compose(rect, pixels.data(), m_Level);
+
+    for (int32_t y = 0; y < rect.height; ++y)
+    {
+        std::copy(pixels.data() + static_cast<size_t>(y) * rect.width, pixels.data() + static_cast<size_t>(y + 1) * rect.width,
+                  m_LevelPixels.data() + static_cast<size_t>(rect.pos.y - m_LevelRect.pos.y + y) * m_LevelRect.width +
+                  (rect.pos.x - m_LevelRect.pos.x));
+    }
+
+    Sml::Rectangle<int32_t> textureRect(rect.pos.x - m_LevelRect.pos.x, rect.pos.y - m_LevelRect.pos.y,
+                                        rect.width, rect.height);
+    m_LevelTexture->updatePixels(pixels.data(), &textureRect);
+
+    m_LevelChanges.add(rect);
+}
+
+void Canvas::updateSurface()
+{
+    size_t width  = static_cast<size_t>(getLayoutWidth());
+    size_t height = static_cast<size_t>(getLayoutHeight());
+
+    if (m_Surface == nullptr || m_Surface->getWidth() != width || m_Surface->getHeight() != height)
+    {
+        delete m_Surface;
+
+        m_Surface      = new Sml::Texture(width, height);
+        m_SurfaceValid = false;
+    }
+
+    if (!m_SurfaceValid)
+    {
+        redrawSurface(Sml::Rectangle<int32_t>(0, 0, getLayoutWidth(), getLayoutHeight()));
+    }
+    else
+    {
+        /* Only the parts of the level composed since the previous frame changed */
+        for (const auto& rect : m_LevelChanges.getRects())
+        {
+            redrawSurface(mapLevelToView(rect));
+        }
+
+        for (const auto& rect : m_ExposedRects)
+        {
+            redrawSurface(rect);
+        }
+    }
+
+    m_LevelChanges.clear();
+    m_ExposedRects.clear();
+    m_SurfaceValid = true;
+}
+
+void Canvas::redrawSurface(const Sml::Rectangle<int32_t>& rect)
+{
+    PROFILE_ZONE("Canvas::redrawSurface");
+
+    Sml::Renderer& renderer = Sml::Renderer::getInstance();
+
+    /* The covered parts are left as they are, they're redrawn once exposed */
+    for (const auto& visibleRect : m_VisibleRects)
+    {
+        Sml::Rectangle<int32_t> area = intersectRects(rect, visibleRect);
+
+        if (isRectEmpty(area))
+        {
+            continue;
+        }
+
+        /* Less than 2x down when zoomed out, as the level is picked to match the zoom */
+        Sml::Rectangle<int32_t> levelRect   = m_LevelValid ? intersectRects(mapViewToLevel(area, m_Level), m_LevelRect)
+                                                           : Sml::Rectangle<int32_t>();
+        Sml::Rectangle<int32_t> surfaceRect = mapLevelToView(levelRect);
+
+        /* The level's pixels may cover a bit more than the area, they're blended over the
+           background again there rather than over what was drawn before */
+        renderer.pushSetTarget(m_Surface);
+
+        renderer.setColor(BACKGROUND_COLOR);
+        renderer.setBlendMode(Sml::Renderer::BlendMode::NONE);
+        Sml::renderFilledRect(area);
+
+        if (!isRectEmpty(levelRect))
+        {
+            Sml::renderFilledRect(surfaceRect);
+        }
+
+        renderer.setBlendMode(Sml::Renderer::BlendMode::BLEND);
+
+        renderer.popTarget();
+
+        if (isRectEmpty(levelRect))
+        {
+            continue;
+        }
+
+        Sml::Rectangle<int32_t> textureRect(levelRect.pos.x - m_LevelRect.pos.x, levelRect.pos.y - m_LevelRect.pos.y,
+                                            levelRect.width, levelRect.height);
+
+        m_LevelTexture->copyTo(m_Surface, &surfaceRect, &textureRect);
+    }
+}
+
+int32_t Canvas::computeCustomPrefWidth(int32_t height) const
+{
+    return m_PrefWidth;
+}
+
+int32_t Canvas::computeCustomPrefHeight(int32_t width) const
+{
+    return m_PrefHeight;
+}
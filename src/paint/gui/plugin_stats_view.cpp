@@ -0,0 +1,78 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file plugin_stats_view.cpp
+ * @date 2021-12-29
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <cstdio>
+#include "paint/gui/plugin_stats_view.h"
+#include "paint/paint_editor.h"
+
+using namespace Paint;
+
+const Sgl::ColorFill  PluginStatsView::DEFAULT_FILL       = Sgl::ColorFill(0xED'E9'EC'FF);
+const Sgl::Background PluginStatsView::DEFAULT_BACKGROUND = Sgl::Background(&DEFAULT_FILL);
+const int32_t         PluginStatsView::UPDATE_INTERVAL    = 500;
+
+PluginStatsView::PluginStatsView() : m_View(new Sgl::VBox())
+{
+    m_View->setBackground(&DEFAULT_BACKGROUND);
+    m_View->addChild(new Sgl::Text("No plugin calls yet"));
+}
+
+Sgl::Container* PluginStatsView::getView() { return m_View; }
+
+void PluginStatsView::update()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now - m_LastUpdate < std::chrono::milliseconds(UPDATE_INTERVAL))
+    {
+        return;
+    }
+
+    m_LastUpdate = now;
+
+    std::vector<std::string> lines;
+    for (const auto& plugin : PluginProfiler::getInstance().collect())
+    {
+        for (size_t i = 0; i < plugin.calls.size(); ++i)
+        {
+            const PluginProfiler::CallStats& call = plugin.calls[i];
+            if (call.calls == 0)
+            {
+                continue;
+            }
+
+            char line[256] = "";
+            snprintf(line, sizeof(line), "%s %s: %llu calls, avg %.1f us, p99 %.0f us, max %.0f us, %.1f MB",
+                     plugin.name.c_str(), PluginProfiler::getCallName(static_cast<PluginCall>(i)),
+                     static_cast<unsigned long long>(call.calls), call.getAverageUs(), call.getPercentileUs(0.99),
+                     call.maxNs / 1e3, call.bytes / 1e6);
+
+            lines.push_back(line);
+        }
+    }
+
+    /* Rebuilding the text is only worth a redraw if anything changed */
+    if (lines.empty() || lines == m_Lines)
+    {
+        return;
+    }
+
+    for (auto child : m_View->getChildren())
+    {
+        delete child;
+    }
+
+    m_View->removeChildren();
+
+    for (const auto& line : lines)
+    {
+        m_View->addChild(new Sgl::Text(line.c_str()));
+    }
+
+    m_Lines = lines;
+    Editor::getInstance().invalidate();
+}
@@ -0,0 +1,311 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file history.cpp
+ * @date 2021-12-21
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <cstring>
+#include "sml/sml_log.h"
+#include "paint/history.h"
+#include "paint/compression.h"
+
+using namespace Paint;
+
+const size_t History::DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+
+History::History(size_t memoryBudget) : m_MemoryBudget(memoryBudget) {}
+
+void History::beginStep(Layer* layer)
+{
+    assert(layer);
+    assert(!isRecording());
+
+    m_RecordingLayer = layer;
+    m_RecordingStart = layer->lazySnapshot();
+}
+
+void History::endStep()
+{
+    assert(isRecording());
+
+    Step step = finishRecording();
+
+    if (step.deltas.empty())
+    {
+        return;
+    }
+
+    pushStep(std::move(step));
+}
+
+void History::endStep(Document* document, const TiledImage& removedTiles,
+                      const LayerProperties& removedProperties)
+{
+    assert(isRecording());
+    assert(document);
+    assert(removedTiles.getWidth()  == m_RecordingLayer->getWidth());
+    assert(removedTiles.getHeight() == m_RecordingLayer->getHeight());
+
+    Step step = finishRecording();
+
+    step.removed.document   = document;
+    step.removed.properties = removedProperties;
+
+    for (size_t i = 0; i < removedTiles.getTileCount(); ++i)
+    {
+        if (removedTiles.getTile(i) == nullptr)
+        {
+            continue;
+        }
+
+        StoredTile stored = {i, compressTile(removedTiles.getTile(i))};
+        step.memoryUsage += stored.tile.data.size() + sizeof(StoredTile);
+        step.removed.tiles.push_back(std::move(stored));
+    }
+
+    /* Recorded even without deltas, the layer is removed anyway */
+    pushStep(std::move(step));
+}
+
+void History::addStep(Layer* layer, const TiledImage& before)
+{
+    assert(layer);
+    assert(!isRecording());
+    assert(before.getWidth() == layer->getWidth() && before.getHeight() == layer->getHeight());
+
+    m_RecordingLayer = layer;
+    m_RecordingStart = LazySnapshot(before);
+
+    endStep();
+}
+
+bool History::isRecording() const { return m_RecordingLayer != nullptr; }
+
+bool History::canUndo() const { return !isRecording() && m_AppliedSteps > 0;              }
+bool History::canRedo() const { return !isRecording() && m_AppliedSteps < m_Steps.size(); }
+
+void History::undo()
+{
+    if (!canUndo())
+    {
+        return;
+    }
+
+    apply(m_Steps[--m_AppliedSteps], true);
+}
+
+void History::redo()
+{
+    if (!canRedo())
+    {
+        return;
+    }
+
+    apply(m_Steps[m_AppliedSteps++], false);
+}
+
+void History::forgetLayer(Layer* layer)
+{
+    assert(layer);
+    assert(m_RecordingLayer != layer);
+
+    /* Redoing the merge that removed the layer would need it, and the steps after need the merge */
+    for (size_t i = m_AppliedSteps; i < m_Steps.size(); ++i)
+    {
+        if (m_Steps[i].removed.restored == layer)
+        {
+            while (m_Steps.size() > i)
+            {
+                m_MemoryUsage -= m_Steps.back().memoryUsage;
+                m_Steps.pop_back();
+            }
+
+            break;
+        }
+    }
+
+    for (size_t i = m_Steps.size(); i > 0; --i)
+    {
+        if (m_Steps[i - 1].layer != layer)
+        {
+            continue;
+        }
+
+        m_MemoryUsage -= m_Steps[i - 1].memoryUsage;
+        m_Steps.erase(m_Steps.begin() + (i - 1));
+
+        if (i - 1 < m_AppliedSteps)
+        {
+            --m_AppliedSteps;
+        }
+    }
+}
+
+void History::clear()
+{
+    m_Steps.clear();
+    m_AppliedSteps = 0;
+    m_MemoryUsage  = 0;
+}
+
+size_t History::getStepCount() const   { return m_Steps.size(); }
+size_t History::getMemoryUsage() const { return m_MemoryUsage;  }
+
+size_t History::getMemoryBudget() const { return m_MemoryBudget; }
+void History::setMemoryBudget(size_t memoryBudget)
+{
+    m_MemoryBudget = memoryBudget;
+    enforceMemoryBudget();
+}
+
+History::Step History::finishRecording()
+{
+    LazySnapshot finish = m_RecordingLayer->lazySnapshot();
+
+    Step step;
+    step.layer = m_RecordingLayer;
+
+    for (size_t i = 0; i < finish.getTileCount(); ++i)
+    {
+        /* Tiles are only loaded before being drawn on, so the ones still in the file didn't change */
+        if (finish.isUnloaded(i))
+        {
+            continue;
+        }
+
+        TilePtr before = m_RecordingStart.getTile(i);
+        TilePtr after  = finish.getTile(i);
+
+        if (before == after)
+        {
+            continue;
+        }
+
+        /* Reading back a tile that was marked dirty but not really changed produces a new pointer */
+        if (before != nullptr && after != nullptr && memcmp(before->pixels, after->pixels, sizeof(before->pixels)) == 0)
+        {
+            continue;
+        }
+
+        TileDelta delta = {i, compressTile(before), compressTile(after)};
+        step.memoryUsage += delta.before.data.size() + delta.after.data.size() + sizeof(TileDelta);
+        step.deltas.push_back(std::move(delta));
+    }
+
+    m_RecordingLayer = nullptr;
+    m_RecordingStart = LazySnapshot();
+
+    return step;
+}
+
+void History::pushStep(Step&& step)
+{
+    /* A new step makes everything that was undone unreachable */
+    while (m_Steps.size() > m_AppliedSteps)
+    {
+        m_MemoryUsage -= m_Steps.back().memoryUsage;
+        m_Steps.pop_back();
+    }
+
+    m_MemoryUsage += step.memoryUsage;
+    m_Steps.push_back(std::move(step));
+    m_AppliedSteps = m_Steps.size();
+
+    enforceMemoryBudget();
+}
+
+void History::apply(Step& step, bool undo)
+{
+    Document* document = step.removed.document;
+
+    if (document != nullptr && !undo)
+    {
+        LayerHandle handle = document->getLayers().findLayer(step.removed.restored);
+        assert(handle.isValid());
+
+        document->removeLayer(handle);
+        step.removed.restored = nullptr;
+    }
+
+    /* Restored tile by tile, so that only the changed tiles have to be loaded */
+    TiledImage target(step.layer->getWidth(), step.layer->getHeight());
+
+    for (const auto& delta : step.deltas)
+    {
+        target.setTile(delta.index, decompressTile(undo ? delta.before : delta.after));
+        step.layer->restore(target, target.getTileRect(delta.index));
+    }
+
+    if (document != nullptr && undo)
+    {
+        restoreRemovedLayer(step);
+    }
+}
+
+void History::restoreRemovedLayer(Step& step)
+{
+    TiledImage tiles(step.layer->getWidth(), step.layer->getHeight());
+
+    for (const auto& stored : step.removed.tiles)
+    {
+        tiles.setTile(stored.index, decompressTile(stored.tile));
+    }
+
+    Layer* layer = new Layer(tiles);
+    layer->setVisible(step.removed.properties.visible);
+    layer->setOpacity(step.removed.properties.opacity);
+    layer->setBlendMode(step.removed.properties.blendMode);
+
+    Document*   document = step.removed.document;
+    LayerHandle below    = document->getLayers().findLayer(step.layer);
+    assert(below.isValid());
+
+    document->addLayerAbove(layer, below);
+    step.removed.restored = layer;
+}
+
+void History::enforceMemoryBudget()
+{
+    /* The latest step is always kept, so that it can be undone no matter how big it is */
+    while (m_MemoryUsage > m_MemoryBudget && m_Steps.size() > 1 && m_AppliedSteps > 1)
+    {
+        m_MemoryUsage -= m_Steps.front().memoryUsage;
+        m_Steps.pop_front();
+        --m_AppliedSteps;
+    }
+}
+
+History::CompressedTile History::compressTile(const TilePtr& tile)
+{
+    CompressedTile compressed;
+
+    if (tile != nullptr)
+    {
+        compressed.isEmpty = false;
+        compress(reinterpret_cast<const uint8_t*>(tile->pixels), sizeof(tile->pixels), &compressed.data);
+        compressed.data.shrink_to_fit();
+    }
+
+    return compressed;
+}
+
+TilePtr History::decompressTile(const CompressedTile& compressed)
+{
+    if (compressed.isEmpty)
+    {
+        return nullptr;
+    }
+
+    TilePtr tile = std::make_shared<Tile>();
+
+    if (!decompress(compressed.data.data(), compressed.data.size(),
+                    reinterpret_cast<uint8_t*>(tile->pixels), sizeof(tile->pixels)))
+    {
+        LOG_APP_ERROR("History tile is corrupted!");
+        assert(0);
+    }
+
+    return tile;
+}
@@ -0,0 +1,139 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file image_loader.cpp
+ * @date 2021-12-25
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+#include <SDL.h>
+#include <SDL_image.h>
+#include "sml/sml_log.h"
+#include "paint/image_loader.h"
+
+using namespace Paint;
+
+static SDL_Surface* decode(const char* filename)
+{
+    SDL_RWops* stream = SDL_RWFromFile(filename, "rb");
+    if (stream == nullptr)
+    {
+        LOG_APP_ERROR("Couldn't open file '%s': %s", filename, SDL_GetError());
+        return nullptr;
+    }
+
+    /* Frees the stream */
+    SDL_Surface* surface = IMG_Load_RW(stream, 1);
+    if (surface == nullptr)
+    {
+        LOG_APP_ERROR("Couldn't decode '%s': %s", filename, IMG_GetError());
+        return nullptr;
+    }
+
+    return surface;
+}
+
+/**
+ * @brief Converts rows of the surface into tightly packed RGBA8888 pixels.
+ *
+ * SDL_ConvertPixels() can't read palettes (palette PNGs, GIFs, 8-bit grayscale), so indexed
+ * rows are blitted instead, through a surface that only wraps them. This way no converted
+ * copy of the whole image is made.
+ */
+static bool convertRows(SDL_Surface* surface, int32_t y, int32_t height, Sml::Color* pixels)
+{
+    int32_t        width = surface->w;
+    int32_t        pitch = width * static_cast<int32_t>(sizeof(Sml::Color));
+    const uint8_t* src   = static_cast<const uint8_t*>(surface->pixels) + y * surface->pitch;
+
+    if (!SDL_ISPIXELFORMAT_INDEXED(surface->format->format))
+    {
+        return SDL_ConvertPixels(width, height, surface->format->format, src, surface->pitch,
+                                 SDL_PIXELFORMAT_RGBA8888, pixels, pitch) == 0;
+    }
+
+    SDL_Surface* rows = SDL_CreateRGBSurfaceWithFormatFrom(const_cast<uint8_t*>(src), width, height,
+                                                           surface->format->BitsPerPixel, surface->pitch,
+                                                           surface->format->format);
+    SDL_Surface* dst  = SDL_CreateRGBSurfaceWithFormatFrom(pixels, width, height, 32, pitch,
+                                                           SDL_PIXELFORMAT_RGBA8888);
+    bool         success = rows != nullptr && dst != nullptr;
+
+    if (success)
+    {
+        SDL_SetSurfacePalette(rows, surface->format->palette);
+        SDL_SetSurfaceBlendMode(rows, SDL_BLENDMODE_NONE);
+
+        /* Color keyed pixels are skipped by the blit, so they stay transparent */
+        uint32_t colorKey = 0;
+        if (SDL_GetColorKey(surface, &colorKey) == 0)
+        {
+            SDL_SetColorKey(rows, SDL_TRUE, colorKey);
+        }
+
+        memset(pixels, 0, static_cast<size_t>(height) * static_cast<size_t>(pitch));
+        success = SDL_BlitSurface(rows, nullptr, dst, nullptr) == 0;
+    }
+
+    SDL_FreeSurface(rows);
+    SDL_FreeSurface(dst);
+
+    return success;
+}
+
+bool Paint::loadImage(const char* filename, TiledImage* image)
+{
+    assert(filename);
+    assert(image);
+
+    SDL_Surface* surface = decode(filename);
+    if (surface == nullptr)
+    {
+        return false;
+    }
+
+    int32_t width  = surface->w;
+    int32_t height = surface->h;
+
+    *image = TiledImage(static_cast<size_t>(width), static_cast<size_t>(height));
+
+    /* One row of tiles worth of pixels in Sml::Color's format */
+    std::vector<Sml::Color> strip(static_cast<size_t>(width) * Tile::SIZE);
+    bool                    success = true;
+
+    SDL_LockSurface(surface);
+
+    for (size_t row = 0; row < image->getTilesY(); ++row)
+    {
+        Sml::Rectangle<int32_t> rect(0, static_cast<int32_t>(row) * Tile::SIZE, width, 0);
+        rect.height = std::min(Tile::SIZE, height - rect.pos.y);
+
+        if (!convertRows(surface, rect.pos.y, rect.height, strip.data()))
+        {
+            LOG_APP_ERROR("Couldn't convert pixels of '%s': %s", filename, SDL_GetError());
+            success = false;
+            break;
+        }
+
+        image->writePixels(rect, strip.data());
+
+        for (size_t column = 0; column < image->getTilesX(); ++column)
+        {
+            size_t index = image->getTileIndex(column, row);
+
+            if (TiledImage::isTileTransparent(*image->getTile(index)))
+            {
+                image->setTile(index, nullptr);
+            }
+        }
+    }
+
+    SDL_UnlockSurface(surface);
+    SDL_FreeSurface(surface);
+
+    return success;
+}
@@ -0,0 +1,500 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file layer_stack.cpp
+ * @date 2022-01-02
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iterator>
+#include "paint/layer_stack.h"
+#include "paint/document.h"
+#include "paint/thread_pool.h"
+
+using namespace Paint;
+
+//------------------------------------------------------------------------------
+// LayerHandle
+//------------------------------------------------------------------------------
+const uint32_t LayerHandle::INVALID_SLOT = UINT32_MAX;
+
+bool LayerHandle::isValid() const { return slot != INVALID_SLOT; }
+
+bool LayerHandle::operator==(const LayerHandle& other) const
+{
+    return slot == other.slot && generation == other.generation;
+}
+
+bool LayerHandle::operator!=(const LayerHandle& other) const { return !(*this == other); }
+
+//------------------------------------------------------------------------------
+// LayerGroup
+//------------------------------------------------------------------------------
+LayerGroup::LayerGroup(size_t width, size_t height) : m_Width(width), m_Height(height)
+{
+    assert(width  > 0);
+    assert(height > 0);
+}
+
+size_t LayerGroup::getWidth() const  { return m_Width;  }
+size_t LayerGroup::getHeight() const { return m_Height; }
+
+bool LayerGroup::isVisible() const { return m_Visible; }
+
+void LayerGroup::setVisible(bool visible)
+{
+    if (visible != m_Visible)
+    {
+        m_Visible = visible;
+        invalidate();
+    }
+}
+
+uint8_t LayerGroup::getOpacity() const { return m_Opacity; }
+
+void LayerGroup::setOpacity(uint8_t opacity)
+{
+    if (opacity != m_Opacity)
+    {
+        m_Opacity = opacity;
+        invalidate();
+    }
+}
+
+BlendMode LayerGroup::getBlendMode() const { return m_BlendMode; }
+
+void LayerGroup::setBlendMode(BlendMode mode)
+{
+    assert(mode < BlendMode::COUNT);
+
+    if (mode != m_BlendMode)
+    {
+        m_BlendMode = mode;
+        invalidate();
+    }
+}
+
+const DirtyRegion& LayerGroup::getDirtyRegion() const { return m_DirtyRegion; }
+void LayerGroup::clearDirtyRegion() { m_DirtyRegion.clear(); }
+
+void LayerGroup::invalidate()
+{
+    m_DirtyRegion.add(Sml::Rectangle<int32_t>(0, 0, static_cast<int32_t>(m_Width), static_cast<int32_t>(m_Height)));
+}
+
+//------------------------------------------------------------------------------
+// LayerStack
+//------------------------------------------------------------------------------
+LayerStack::LayerStack() {}
+LayerStack::~LayerStack() {}
+
+size_t LayerStack::getSize() const { return m_Nodes.size();  }
+bool LayerStack::isEmpty() const   { return m_Nodes.empty(); }
+
+bool LayerStack::contains(LayerHandle handle) const
+{
+    return handle.slot < m_Slots.size() && m_Slots[handle.slot].isUsed &&
+           m_Slots[handle.slot].generation == handle.generation;
+}
+
+size_t LayerStack::getIndex(LayerHandle handle) const
+{
+    assert(contains(handle));
+    return m_Slots[handle.slot].index;
+}
+
+LayerHandle LayerStack::getHandle(size_t index) const
+{
+    assert(index < m_Nodes.size());
+    return m_Nodes[index].handle;
+}
+
+Layer* LayerStack::getLayer(size_t index) const
+{
+    assert(index < m_Nodes.size());
+    return m_Nodes[index].layer.get();
+}
+
+Layer* LayerStack::getLayer(LayerHandle handle) const { return getLayer(getIndex(handle)); }
+
+LayerGroup* LayerStack::getGroup(size_t index) const
+{
+    assert(index < m_Nodes.size());
+    return m_Nodes[index].group.get();
+}
+
+LayerGroup* LayerStack::getGroup(LayerHandle handle) const { return getGroup(getIndex(handle)); }
+
+LayerHandle LayerStack::findLayer(const Layer* layer) const
+{
+    for (const auto& node : m_Nodes)
+    {
+        if (node.layer.get() == layer)
+        {
+            return node.handle;
+        }
+    }
+
+    return LayerHandle();
+}
+
+size_t LayerStack::getDepth(size_t index) const
+{
+    assert(index < m_Nodes.size());
+    return m_Nodes[index].depth;
+}
+
+size_t LayerStack::getSubtreeEnd(size_t index) const
+{
+    assert(index < m_Nodes.size());
+
+    size_t end = index + 1;
+    while (end < m_Nodes.size() && m_Nodes[end].depth > m_Nodes[index].depth)
+    {
+        ++end;
+    }
+
+    return end;
+}
+
+LayerHandle LayerStack::getParent(LayerHandle handle) const
+{
+    size_t   index = getIndex(handle);
+    uint32_t depth = m_Nodes[index].depth;
+
+    while (index-- > 0)
+    {
+        if (m_Nodes[index].depth < depth)
+        {
+            return m_Nodes[index].handle;
+        }
+    }
+
+    return LayerHandle();
+}
+
+LayerHandle LayerStack::getSiblingBelow(LayerHandle handle) const
+{
+    return findSiblingBelow(getIndex(handle));
+}
+
+bool LayerStack::isShown(size_t index) const
+{
+    assert(index < m_Nodes.size());
+
+    const Node& node = m_Nodes[index];
+    return node.layer != nullptr ? node.layer->isVisible() && node.layer->getOpacity() != 0
+                                 : node.group->isVisible() && node.group->getOpacity() != 0;
+}
+
+BlendMode LayerStack::getBlendMode(size_t index) const
+{
+    assert(index < m_Nodes.size());
+
+    const Node& node = m_Nodes[index];
+    return node.layer != nullptr ? node.layer->getBlendMode() : node.group->getBlendMode();
+}
+
+uint8_t LayerStack::getOpacity(size_t index) const
+{
+    assert(index < m_Nodes.size());
+
+    const Node& node = m_Nodes[index];
+    return node.layer != nullptr ? node.layer->getOpacity() : node.group->getOpacity();
+}
+
+const DirtyRegion& LayerStack::getDirtyRegion(size_t index) const
+{
+    assert(index < m_Nodes.size());
+
+    const Node& node = m_Nodes[index];
+    return node.layer != nullptr ? node.layer->getDirtyRegion() : node.group->getDirtyRegion();
+}
+
+void LayerStack::clearDirtyRegion(size_t index)
+{
+    assert(index < m_Nodes.size());
+
+    Node& node = m_Nodes[index];
+    if (node.layer != nullptr)
+    {
+        node.layer->clearDirtyRegion();
+    }
+    else
+    {
+        node.group->clearDirtyRegion();
+    }
+}
+
+LayerHandle LayerStack::addLayer(std::unique_ptr<Layer> layer, LayerHandle parent)
+{
+    assert(layer);
+
+    std::vector<Node> nodes(1);
+    nodes[0].layer = std::move(layer);
+    nodes[0].depth = parent.isValid() ? m_Nodes[getIndex(parent)].depth + 1 : 0;
+
+    return insert(getInsertIndex(parent), std::move(nodes));
+}
+
+LayerHandle LayerStack::addGroup(std::unique_ptr<LayerGroup> group, LayerHandle parent)
+{
+    assert(group);
+
+    std::vector<Node> nodes(1);
+    nodes[0].group = std::move(group);
+    nodes[0].depth = parent.isValid() ? m_Nodes[getIndex(parent)].depth + 1 : 0;
+
+    return insert(getInsertIndex(parent), std::move(nodes));
+}
+
+LayerHandle LayerStack::addLayerAbove(std::unique_ptr<Layer> layer, LayerHandle sibling)
+{
+    assert(layer);
+
+    size_t index = getIndex(sibling);
+
+    std::vector<Node> nodes(1);
+    nodes[0].layer = std::move(layer);
+    nodes[0].depth = m_Nodes[index].depth;
+
+    return insert(getSubtreeEnd(index), std::move(nodes));
+}
+
+void LayerStack::remove(LayerHandle handle)
+{
+    size_t first = getIndex(handle);
+    size_t end   = getSubtreeEnd(first);
+
+    for (size_t i = first; i < end; ++i)
+    {
+        Slot& slot = m_Slots[m_Nodes[i].handle.slot];
+
+        slot.isUsed = false;
+        ++slot.generation;
+
+        m_FreeSlots.push_back(m_Nodes[i].handle.slot);
+    }
+
+    m_Nodes.erase(m_Nodes.begin() + first, m_Nodes.begin() + end);
+    updateSlots(first);
+}
+
+void LayerStack::move(LayerHandle handle, LayerHandle parent, size_t position)
+{
+    size_t first = getIndex(handle);
+    size_t end   = getSubtreeEnd(first);
+
+    assert(!parent.isValid() || getGroup(parent) != nullptr);
+    assert((!parent.isValid() || getIndex(parent) < first || getIndex(parent) >= end) &&
+           "Moving a group into itself!");
+
+    uint32_t depth = parent.isValid() ? m_Nodes[getIndex(parent)].depth + 1 : 0;
+    uint32_t shift = m_Nodes[first].depth;
+
+    std::vector<Node> subtree(std::make_move_iterator(m_Nodes.begin() + first),
+                              std::make_move_iterator(m_Nodes.begin() + end));
+    m_Nodes.erase(m_Nodes.begin() + first, m_Nodes.begin() + end);
+
+    for (auto& node : subtree)
+    {
+        node.depth = node.depth - shift + depth;
+    }
+
+    updateSlots(first);
+
+    /* Skipping the parent's children below the position */
+    size_t index       = parent.isValid() ? getIndex(parent) + 1 : 0;
+    size_t childrenEnd = parent.isValid() ? getSubtreeEnd(getIndex(parent)) : m_Nodes.size();
+
+    for (size_t child = 0; child < position && index < childrenEnd; ++child)
+    {
+        index = getSubtreeEnd(index);
+    }
+
+    m_Nodes.insert(m_Nodes.begin() + index, std::make_move_iterator(subtree.begin()),
+                   std::make_move_iterator(subtree.end()));
+    updateSlots(std::min(first, index));
+}
+
+LayerHandle LayerStack::duplicate(LayerHandle handle)
+{
+    size_t first = getIndex(handle);
+    size_t end   = getSubtreeEnd(first);
+
+    std::vector<Node> subtree;
+    for (size_t i = first; i < end; ++i)
+    {
+        subtree.push_back(duplicateNode(m_Nodes[i]));
+    }
+
+    return insert(end, std::move(subtree));
+}
+
+bool LayerStack::mergeDown(LayerHandle handle)
+{
+    size_t      index       = getIndex(handle);
+    LayerHandle lowerHandle = findSiblingBelow(index);
+
+    Layer* upper = getLayer(index);
+    Layer* lower = lowerHandle.isValid() ? getLayer(lowerHandle) : nullptr;
+
+    if (upper == nullptr || lower == nullptr)
+    {
+        return false;
+    }
+
+    TiledImage upperTiles = upper->snapshot();
+    TiledImage merged     = lower->snapshot();
+
+    std::vector<size_t> tiles;
+    if (isShown(index))
+    {
+        for (size_t i = 0; i < upperTiles.getTileCount(); ++i)
+        {
+            if (upperTiles.getTile(i) != nullptr)
+            {
+                tiles.push_back(i);
+            }
+        }
+    }
+
+    /* The other tiles stay shared with the lower layer's snapshot, so restore() skips them */
+    std::vector<TilePtr> results(tiles.size());
+
+    ThreadPool::getInstance().parallelFor(tiles.size(), [&](size_t i)
+    {
+        Sml::Rectangle<int32_t> rect  = merged.getTileRect(tiles[i]);
+        size_t                  count = static_cast<size_t>(rect.width) * rect.height;
+
+        std::vector<Sml::Color> src(count);
+        std::vector<Sml::Color> dst(count);
+
+        upperTiles.readPixels(rect, src.data());
+        merged.readPixels(rect, dst.data());
+
+        premultiplyRow(src.data(), src.data(), count);
+        premultiplyRow(dst.data(), dst.data(), count);
+        blendRow(upper->getBlendMode(), src.data(), dst.data(), count, upper->getOpacity());
+        unpremultiplyRow(dst.data(), dst.data(), count);
+
+        TilePtr tile = std::make_shared<Tile>();
+        std::memset(tile->pixels, 0, sizeof(tile->pixels));
+
+        for (int32_t y = 0; y < rect.height; ++y)
+        {
+            std::memcpy(tile->pixels + y * Tile::SIZE, dst.data() + y * rect.width, rect.width * sizeof(Sml::Color));
+        }
+
+        results[i] = TiledImage::isTileTransparent(*tile) ? nullptr : tile;
+    });
+
+    for (size_t i = 0; i < tiles.size(); ++i)
+    {
+        merged.setTile(tiles[i], results[i]);
+    }
+
+    lower->restore(merged);
+    remove(handle);
+
+    return true;
+}
+
+LayerHandle LayerStack::insert(size_t index, std::vector<Node>&& nodes)
+{
+    assert(index <= m_Nodes.size());
+    assert(!nodes.empty());
+
+    for (auto& node : nodes)
+    {
+        node.handle = allocateSlot();
+    }
+
+    LayerHandle handle = nodes.front().handle;
+
+    m_Nodes.insert(m_Nodes.begin() + index, std::make_move_iterator(nodes.begin()),
+                   std::make_move_iterator(nodes.end()));
+    updateSlots(index);
+
+    return handle;
+}
+
+LayerHandle LayerStack::allocateSlot()
+{
+    if (m_FreeSlots.empty())
+    {
+        m_FreeSlots.push_back(static_cast<uint32_t>(m_Slots.size()));
+        m_Slots.emplace_back();
+    }
+
+    uint32_t slot = m_FreeSlots.back();
+    m_FreeSlots.pop_back();
+
+    m_Slots[slot].isUsed = true;
+
+    LayerHandle handle;
+    handle.slot       = slot;
+    handle.generation = m_Slots[slot].generation;
+
+    return handle;
+}
+
+size_t LayerStack::getInsertIndex(LayerHandle parent) const
+{
+    if (!parent.isValid())
+    {
+        return m_Nodes.size();
+    }
+
+    assert(getGroup(parent) != nullptr);
+    return getSubtreeEnd(getIndex(parent));
+}
+
+void LayerStack::updateSlots(size_t first)
+{
+    for (size_t i = first; i < m_Nodes.size(); ++i)
+    {
+        m_Slots[m_Nodes[i].handle.slot].index = static_cast<uint32_t>(i);
+    }
+}
+
+LayerHandle LayerStack::findSiblingBelow(size_t index) const
+{
+    uint32_t depth = m_Nodes[index].depth;
+
+    while (index-- > 0)
+    {
+        if (m_Nodes[index].depth <= depth)
+        {
+            return m_Nodes[index].depth == depth ? m_Nodes[index].handle : LayerHandle();
+        }
+    }
+
+    return LayerHandle();
+}
+
+LayerStack::Node LayerStack::duplicateNode(const Node& node) const
+{
+    Node copy;
+    copy.depth = node.depth;
+
+    if (node.layer != nullptr)
+    {
+        copy.layer = std::make_unique<Layer>(node.layer->snapshot());
+        copy.layer->setVisible(node.layer->isVisible());
+        copy.layer->setOpacity(node.layer->getOpacity());
+        copy.layer->setBlendMode(node.layer->getBlendMode());
+    }
+    else
+    {
+        copy.group = std::make_unique<LayerGroup>(node.group->getWidth(), node.group->getHeight());
+        copy.group->setVisible(node.group->isVisible());
+        copy.group->setOpacity(node.group->getOpacity());
+        copy.group->setBlendMode(node.group->getBlendMode());
+    }
+
+    return copy;
+}
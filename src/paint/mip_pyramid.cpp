@@ -0,0 +1,186 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file mip_pyramid.cpp
+ * @date 2022-01-03
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <algorithm>
+#include <cassert>
+#include "paint/mip_pyramid.h"
+#include "paint/dirty_region.h"
+#include "paint/thread_pool.h"
+
+using namespace Paint;
+
+/**
+ * @brief Averages 2x2 blocks of straight alpha pixels, weighting the colors by alpha so that
+ *        transparent pixels don't darken the edges.
+ *
+ * @param src The finer pixels of the source rect, tightly packed.
+ */
+static void downsampleRect(const Sml::Color* src, const Sml::Rectangle<int32_t>& srcRect,
+                           const Sml::Rectangle<int32_t>& rect, Sml::Color* dst, int32_t stride)
+{
+    for (int32_t y = 0; y < rect.height; ++y)
+    {
+        int32_t top    = 2 * (rect.pos.y + y) - srcRect.pos.y;
+        int32_t bottom = std::min(top + 1, srcRect.height - 1);
+
+        for (int32_t x = 0; x < rect.width; ++x)
+        {
+            int32_t left  = 2 * (rect.pos.x + x) - srcRect.pos.x;
+            int32_t right = std::min(left + 1, srcRect.width - 1);
+
+            const Sml::Color samples[] = {src[top    * srcRect.width + left], src[top    * srcRect.width + right],
+                                          src[bottom * srcRect.width + left], src[bottom * srcRect.width + right]};
+
+            uint32_t alpha = 0;
+            uint32_t red   = 0;
+            uint32_t green = 0;
+            uint32_t blue  = 0;
+
+            for (Sml::Color sample : samples)
+            {
+                uint32_t sampleAlpha = sample & 0xFF;
+
+                alpha += sampleAlpha;
+                red   += (sample >> 24)         * sampleAlpha;
+                green += ((sample >> 16) & 0xFF) * sampleAlpha;
+                blue  += ((sample >> 8)  & 0xFF) * sampleAlpha;
+            }
+
+            if (alpha == 0)
+            {
+                dst[y * stride + x] = 0;
+                continue;
+            }
+
+            dst[y * stride + x] = (((red   + alpha / 2) / alpha) << 24) |
+                                  (((green + alpha / 2) / alpha) << 16) |
+                                  (((blue  + alpha / 2) / alpha) << 8)  |
+                                  ((alpha + 2) / 4);
+        }
+    }
+}
+
+MipPyramid::MipPyramid(size_t width, size_t height) : m_Width(width), m_Height(height) {}
+
+size_t MipPyramid::getLevelSize(size_t size, size_t level)
+{
+    return std::max<size_t>(1, (size + (static_cast<size_t>(1) << level) - 1) >> level);
+}
+
+Sml::Rectangle<int32_t> MipPyramid::getLevelRect(const Sml::Rectangle<int32_t>& rect, size_t level)
+{
+    int32_t scale = 1 << level;
+
+    int32_t left   = std::max(rect.pos.x, 0) / scale;
+    int32_t top    = std::max(rect.pos.y, 0) / scale;
+    int32_t right  = std::max((rect.pos.x + rect.width  + scale - 1) / scale, left);
+    int32_t bottom = std::max((rect.pos.y + rect.height + scale - 1) / scale, top);
+
+    return Sml::Rectangle<int32_t>(left, top, right - left, bottom - top);
+}
+
+void MipPyramid::markStale(const Sml::Rectangle<int32_t>& rect)
+{
+    for (size_t i = 0; i < m_Levels.size(); ++i)
+    {
+        Level& level = m_Levels[i];
+
+        size_t firstColumn, firstRow, endColumn, endRow;
+        level.pixels.getTileRange(getLevelRect(rect, i + 1), &firstColumn, &firstRow, &endColumn, &endRow);
+
+        for (size_t row = firstRow; row < endRow; ++row)
+        {
+            for (size_t column = firstColumn; column < endColumn; ++column)
+            {
+                level.staleTiles[level.pixels.getTileIndex(column, row)] = true;
+            }
+        }
+    }
+}
+
+std::vector<size_t> MipPyramid::takeStaleTiles(size_t level, const Sml::Rectangle<int32_t>& rect)
+{
+    assert(level > 0);
+
+    Level& mip = allocateLevel(level);
+
+    size_t firstColumn, firstRow, endColumn, endRow;
+    mip.pixels.getTileRange(rect, &firstColumn, &firstRow, &endColumn, &endRow);
+
+    std::vector<size_t> staleTiles;
+
+    for (size_t row = firstRow; row < endRow; ++row)
+    {
+        for (size_t column = firstColumn; column < endColumn; ++column)
+        {
+            size_t index = mip.pixels.getTileIndex(column, row);
+
+            if (mip.staleTiles[index])
+            {
+                staleTiles.push_back(index);
+                mip.staleTiles[index] = false;
+            }
+        }
+    }
+
+    return staleTiles;
+}
+
+Sml::Rectangle<int32_t> MipPyramid::getSourceRect(size_t level, const Sml::Rectangle<int32_t>& rect) const
+{
+    assert(level > 0);
+
+    Sml::Rectangle<int32_t> bounds(0, 0, static_cast<int32_t>(getLevelSize(m_Width,  level - 1)),
+                                         static_cast<int32_t>(getLevelSize(m_Height, level - 1)));
+
+    return intersectRects(Sml::Rectangle<int32_t>(2 * rect.pos.x, 2 * rect.pos.y, 2 * rect.width, 2 * rect.height),
+                          bounds);
+}
+
+void MipPyramid::downsample(size_t level, const std::vector<size_t>& tiles, const TiledImage& finer)
+{
+    assert(level > 0 && level <= m_Levels.size());
+
+    Level& mip = m_Levels[level - 1];
+
+    ThreadPool::getInstance().parallelFor(tiles.size(), [&](size_t i)
+    {
+        Sml::Rectangle<int32_t> rect    = mip.pixels.getTileRect(tiles[i]);
+        Sml::Rectangle<int32_t> srcRect = getSourceRect(level, rect);
+
+        std::vector<Sml::Color> src(static_cast<size_t>(srcRect.width) * srcRect.height);
+        finer.readPixels(srcRect, src.data());
+
+        TilePtr tile = std::make_shared<Tile>();
+        std::fill(tile->pixels, tile->pixels + Tile::SIZE * Tile::SIZE, 0);
+
+        downsampleRect(src.data(), srcRect, rect, tile->pixels, Tile::SIZE);
+
+        mip.pixels.setTile(tiles[i], TiledImage::isTileTransparent(*tile) ? nullptr : tile);
+    });
+}
+
+const TiledImage& MipPyramid::getLevel(size_t level) const
+{
+    assert(level > 0 && level <= m_Levels.size());
+    return m_Levels[level - 1].pixels;
+}
+
+MipPyramid::Level& MipPyramid::allocateLevel(size_t level)
+{
+    while (m_Levels.size() < level)
+    {
+        size_t next = m_Levels.size() + 1;
+
+        m_Levels.emplace_back();
+        m_Levels.back().pixels = TiledImage(getLevelSize(m_Width, next), getLevelSize(m_Height, next));
+        m_Levels.back().staleTiles.assign(m_Levels.back().pixels.getTileCount(), true);
+    }
+
+    return m_Levels[level - 1];
+}
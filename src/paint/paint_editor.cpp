@@ -7,6 +7,8 @@
  */
 
 #include "paint/paint_editor.h"
+#include "paint/frame_profiler.h"
+#include "paint/async_logger.h"
 
 using namespace Paint;
 
@@ -43,6 +45,7 @@ Tool* Editor::getActiveTool()
 void Editor::setActiveTool(Tool* tool)
 {
     m_ActiveTool = tool;
+    invalidate();
 }
 
 const std::list<Tool*>& Editor::getTools() const
@@ -73,14 +76,117 @@ void Editor::applyFilter(Filter* filter)
 
     if (getActiveDocument() != nullptr)
     {
-        LOG_APP_INFO("Applying '%s' filter.", filter->getName());
+        PROFILE_ZONE(FrameProfiler::getInstance().intern(std::string("filter: ") + filter->getName()));
 
-        Sml::Renderer::getInstance().pushSetTarget(getActiveDocument()->getActiveLayer()->getTexture());
+        PAINT_LOG_INFO("Applying '%s' filter.", filter->getName());
+
+        Layer* layer = getActiveDocument()->getActiveLayer();
+
+        /* The preview's original would otherwise restore the layer over this step */
+        m_FilterPreview.commit(&m_History);
+        m_History.beginStep(layer);
+        Sml::Renderer::getInstance().pushSetTarget(layer->getTexture());
 
         filter->apply();
 
         Sml::Renderer::getInstance().popTarget();
+
+        layer->markDirty();
+        m_History.endStep();
+    }
+}
+
+void Editor::previewFilter(Filter* filter)
+{
+    assert(filter);
+
+    if (getActiveDocument() == nullptr)
+    {
+        return;
+    }
+
+    std::shared_ptr<const TileKernel> kernel = filter->createKernel(1);
+    if (kernel == nullptr)
+    {
+        applyFilter(filter);
+        return;
+    }
+
+    Layer* layer = getActiveDocument()->getActiveLayer();
+
+    if (m_FilterPreview.isActive() && m_FilterPreview.getLayer() != layer)
+    {
+        m_FilterPreview.commit(&m_History);
+    }
+
+    if (!m_FilterPreview.isActive())
+    {
+        m_FilterPreview.start(layer);
+    }
+
+    m_FilterPreview.request(filter->createKernel(1.0f / FilterPreview::DOWNSCALE_FACTOR), kernel);
+}
+
+void Editor::commitFilterPreview()
+{
+    m_FilterPreview.commit(&m_History);
+}
+
+void Editor::cancelFilterPreview()
+{
+    m_FilterPreview.discard();
+}
+
+FilterPreview& Editor::getFilterPreview()
+{
+    return m_FilterPreview;
+}
+
+void Editor::update()
+{
+    m_FilterPreview.update();
+    m_Autosave.update(m_Documents);
+
+    if (m_ActiveTool != nullptr)
+    {
+        m_ActiveTool->onUpdate();
+    }
+}
+
+void Editor::invalidate() { m_Invalidated = true;  }
+void Editor::validate()   { m_Invalidated = false; }
+
+bool Editor::needsRedraw() const
+{
+    if (m_Invalidated)
+    {
+        return true;
+    }
+
+    for (auto document : m_Documents)
+    {
+        if (document->isDirty())
+        {
+            return true;
+        }
     }
+
+    return false;
+}
+
+bool Editor::hasPendingWork() const
+{
+    return m_FilterPreview.isBusy() || (m_ActiveTool != nullptr && m_ActiveTool->hasPendingWork());
+}
+
+History& Editor::getHistory()
+{
+    return m_History;
+}
+
+AutosaveService& Editor::getAutosave()
+{
+    return m_Autosave;
 }
 
 Document* Editor::getActiveDocument()
@@ -92,6 +198,7 @@ void Editor::setActiveDocument(Document* document)
 {
     assert(document);
     m_ActiveDocument = document;
+    invalidate();
 }
 
 const std::list<Document*>& Editor::getDocuments() const
@@ -105,6 +212,38 @@ void Editor::addDocument(Document* document)
     m_Documents.push_back(document);
 }
 
+void Editor::removeDocument(Document* document)
+{
+    assert(document);
+
+    for (size_t i = 0; i < document->getLayers().getSize(); ++i)
+    {
+        Layer* layer = document->getLayers().getLayer(i);
+
+        if (layer == nullptr)
+        {
+            continue;
+        }
+
+        if (m_FilterPreview.isActive() && m_FilterPreview.getLayer() == layer)
+        {
+            m_FilterPreview.discard();
+        }
+
+        m_History.forgetLayer(layer);
+    }
+
+    m_Autosave.forget(document);
+    m_Documents.remove(document);
+
+    if (m_ActiveDocument == document)
+    {
+        m_ActiveDocument = m_Documents.empty() ? nullptr : m_Documents.back();
+    }
+
+    invalidate();
+}
+
 // const std::list<plugin::IPlugin*>& Editor::getPlugins() const
 // {
 //     return m_Plugins;
@@ -117,7 +256,7 @@ void Editor::addDocument(Document* document)
 // }
 
 Sml::Color Editor::getBackground() const { return m_Background; }
-void Editor::setBackground(Sml::Color background) { m_Background = background; }
+void Editor::setBackground(Sml::Color background) { m_Background = background; invalidate(); }
 
 Sml::Color Editor::getForeground() const { return m_Foreground; }
-void Editor::setForeground(Sml::Color foreground) { m_Foreground = foreground; }
\ No newline at end of file
+void Editor::setForeground(Sml::Color foreground) { m_Foreground = foreground; invalidate(); }
\ No newline at end of file
@@ -0,0 +1,77 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file pixel_buffer.cpp
+ * @date 2021-12-23
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <cassert>
+#include "paint/pixel_buffer.h"
+
+using namespace Paint;
+
+PixelBuffer::PixelBuffer(Sml::Texture* texture)
+    : m_Texture(texture),
+      m_Width(static_cast<int32_t>(texture->getWidth())),
+      m_Height(static_cast<int32_t>(texture->getHeight()))
+{
+    assert(texture);
+}
+
+int32_t PixelBuffer::getWidth() const  { return m_Width;  }
+int32_t PixelBuffer::getHeight() const { return m_Height; }
+
+Sml::Color* PixelBuffer::lock(const Sml::Rectangle<int32_t>& rect)
+{
+    Region region;
+    region.rect = clip(rect);
+
+    if (!isRectEmpty(region.rect))
+    {
+        Sml::Color* pixels = m_Texture->readPixels(&region.rect);
+        region.pixels.assign(pixels, pixels + static_cast<size_t>(region.rect.width) * region.rect.height);
+        delete[] pixels;
+    }
+
+    m_Locked.push_back(std::move(region));
+    return m_Locked.back().pixels.data();
+}
+
+void PixelBuffer::unlock(const Sml::Rectangle<int32_t>& rect, bool modified)
+{
+    Sml::Rectangle<int32_t> clipped = clip(rect);
+
+    /* The latest lock of the rect, in case it's locked more than once */
+    for (size_t i = m_Locked.size(); i > 0; --i)
+    {
+        const Region& region = m_Locked[i - 1];
+
+        if (region.rect.pos.x != clipped.pos.x || region.rect.pos.y != clipped.pos.y ||
+            region.rect.width != clipped.width || region.rect.height != clipped.height)
+        {
+            continue;
+        }
+
+        if (modified && !isRectEmpty(clipped))
+        {
+            m_Texture->updatePixels(region.pixels.data(), &clipped);
+        }
+
+        m_Locked.erase(m_Locked.begin() + (i - 1));
+        return;
+    }
+
+    assert(0 && "Unlocking a rect that isn't locked!");
+}
+
+void PixelBuffer::load(const Sml::Color* pixels)
+{
+    assert(pixels);
+    m_Texture->updatePixels(pixels, nullptr);
+}
+
+Sml::Rectangle<int32_t> PixelBuffer::clip(const Sml::Rectangle<int32_t>& rect) const
+{
+    return intersectRects(rect, Sml::Rectangle<int32_t>(0, 0, m_Width, m_Height));
+}
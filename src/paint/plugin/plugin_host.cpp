@@ -0,0 +1,513 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file plugin_host.cpp
+ * @date 2021-12-28
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <new>
+#include <string>
+#include "sml/sml_log.h"
+#include "paint/plugin/plugin_host.h"
+
+using namespace Paint;
+
+const char* const PluginHost::SERVER_ARGUMENT  = "--plugin-host";
+const int32_t     PluginHost::RESPONSE_TIMEOUT = 2000;
+
+bool PluginHost::isServer(int32_t argc, const char* argv[])
+{
+    return argc > 1 && strcmp(argv[1], SERVER_ARGUMENT) == 0;
+}
+
+PluginHost::~PluginHost()
+{
+    stop();
+}
+
+bool PluginHost::isRunning() const { return m_Pid > 0; }
+uint64_t PluginHost::getGeneration() const { return m_Generation; }
+
+bool PluginHost::loadLibrary(const char* filename, int32_t* library, uint32_t* version,
+                             std::vector<PluginToolInfo>* tools)
+{
+    assert(filename);
+    assert(library);
+    assert(version);
+    assert(tools);
+
+    *library = -1;
+    *version = 0;
+    tools->clear();
+
+    wait();
+
+    if ((!isRunning() && !start()) || strlen(filename) >= HOST_MAX_PATH)
+    {
+        return false;
+    }
+
+    strcpy(m_Memory->load.path, filename);
+
+    HostRequest request = {};
+    request.type = HostRequestType::LOAD;
+
+    if (!post(request))
+    {
+        return false;
+    }
+
+    wait();
+
+    /* Crashed while loading */
+    if (!isRunning())
+    {
+        LOG_APP_ERROR("Plugin '%s' couldn't be loaded in the plugin host.", filename);
+        return false;
+    }
+
+    const HostLoadArea& load = m_Memory->load;
+
+    *library = load.library;
+    *version = load.version;
+
+    for (uint32_t i = 0; i < load.toolCount; ++i)
+    {
+        tools->push_back({load.toolNames[i], load.toolIcons[i]});
+    }
+
+    return load.library >= 0;
+}
+
+bool PluginHost::beginAction(Layer* layer, int32_t library, int32_t tool, const Sml::Vec2i& pos)
+{
+    assert(layer);
+
+    wait();
+
+    if (!isRunning())
+    {
+        return false;
+    }
+
+    int32_t width  = static_cast<int32_t>(layer->getWidth());
+    int32_t height = static_cast<int32_t>(layer->getHeight());
+
+    if (!map(HOST_CANVAS_OFFSET + static_cast<size_t>(width) * height * sizeof(Sml::Color)))
+    {
+        stop();
+        return false;
+    }
+
+    if (width != m_Width || height != m_Height)
+    {
+        m_Width       = width;
+        m_Height      = height;
+        m_SharedTiles = TiledImage();
+    }
+
+    handOffTiles(layer);
+    m_Layer = layer;
+
+    HostRequest request  = {};
+    request.type         = HostRequestType::ACTION_BEGIN;
+    request.library      = library;
+    request.tool         = tool;
+    request.x            = pos.x;
+    request.y            = pos.y;
+    request.canvasWidth  = width;
+    request.canvasHeight = height;
+
+    return post(request);
+}
+
+void PluginHost::postAction(const Sml::Vec2i& pos, const Sml::Vec2i& displacement)
+{
+    if (m_Layer == nullptr)
+    {
+        return;
+    }
+
+    HostRequest request = {};
+    request.type        = HostRequestType::ACTION;
+    request.x           = pos.x;
+    request.y           = pos.y;
+    request.dx          = displacement.x;
+    request.dy          = displacement.y;
+
+    post(request);
+}
+
+void PluginHost::endAction(const Sml::Vec2i& pos)
+{
+    if (m_Layer == nullptr)
+    {
+        return;
+    }
+
+    HostRequest request = {};
+    request.type        = HostRequestType::ACTION_END;
+    request.x           = pos.x;
+    request.y           = pos.y;
+
+    post(request);
+    wait();
+
+    /* The canvas now holds exactly what the layer does, so next stroke only hands off other changes */
+    if (isRunning() && m_Layer != nullptr)
+    {
+        m_SharedTiles = m_Layer->snapshot();
+    }
+
+    m_Layer = nullptr;
+}
+
+void PluginHost::update()
+{
+    if (!isRunning())
+    {
+        return;
+    }
+
+    collect();
+
+    /* Nobody is waiting for the responses that a crashed host won't send */
+    if (m_Pending > 0)
+    {
+        pollfd death = {m_DeathPipe, POLLIN, 0};
+
+        if (poll(&death, 1, 0) > 0)
+        {
+            collect();
+
+            LOG_APP_ERROR("Plugin host crashed, it will be restarted on next use.");
+            stop();
+        }
+    }
+}
+
+void PluginHost::wait()
+{
+    while (m_Pending > 0 && isRunning())
+    {
+        waitForResponse(RESPONSE_TIMEOUT);
+    }
+}
+
+bool PluginHost::isBusy() const { return m_Pending > 0; }
+uint64_t PluginHost::getTransferredBytes() const { return m_Transferred; }
+
+bool PluginHost::start()
+{
+    assert(!isRunning());
+
+    int deathPipe[2] = {-1, -1};
+
+    m_MemoryFd      = memfd_create("plugin-host", 0);
+    m_RequestEvent  = eventfd(0, 0);
+    m_ResponseEvent = eventfd(0, 0);
+
+    if (m_MemoryFd < 0 || m_RequestEvent < 0 || m_ResponseEvent < 0 || pipe(deathPipe) != 0 ||
+        !map(HOST_CANVAS_OFFSET))
+    {
+        LOG_APP_ERROR("Couldn't set up the plugin host: %s", strerror(errno));
+
+        close(deathPipe[1]);
+        m_DeathPipe = deathPipe[0];
+        stop();
+
+        return false;
+    }
+
+    new (m_Memory) HostSharedMemory();
+    m_Memory->magic = HOST_MAGIC;
+
+    /* Everything the child needs is prepared before fork(), it only calls exec */
+    std::string memoryFd      = std::to_string(m_MemoryFd);
+    std::string requestEvent  = std::to_string(m_RequestEvent);
+    std::string responseEvent = std::to_string(m_ResponseEvent);
+
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        close(deathPipe[0]);
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+        execl("/proc/self/exe", "plugin-host", SERVER_ARGUMENT, memoryFd.c_str(), requestEvent.c_str(),
+              responseEvent.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+
+    /* Only the host holds the write end, so the pipe hangs up once it exits */
+    close(deathPipe[1]);
+    m_DeathPipe = deathPipe[0];
+
+    if (pid < 0)
+    {
+        LOG_APP_ERROR("Couldn't start the plugin host: %s", strerror(errno));
+        stop();
+
+        return false;
+    }
+
+    m_Pid         = pid;
+    m_SharedTiles = TiledImage();
+    ++m_Generation;
+
+    LOG_APP_INFO("Plugin host started (pid %d).", static_cast<int>(m_Pid));
+
+    return true;
+}
+
+void PluginHost::stop()
+{
+    if (m_Pid > 0)
+    {
+        kill(m_Pid, SIGKILL);
+        waitpid(m_Pid, nullptr, 0);
+    }
+
+    if (m_Memory != nullptr)
+    {
+        munmap(m_Memory, m_MappedSize);
+    }
+
+    for (int fd : {m_MemoryFd, m_RequestEvent, m_ResponseEvent, m_DeathPipe})
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    m_Pid           = -1;
+    m_MemoryFd      = -1;
+    m_RequestEvent  = -1;
+    m_ResponseEvent = -1;
+    m_DeathPipe     = -1;
+    m_Memory        = nullptr;
+    m_MappedSize    = 0;
+    m_Pending       = 0;
+    m_Layer         = nullptr;
+    m_SharedTiles   = TiledImage();
+}
+
+bool PluginHost::map(size_t size)
+{
+    if (size <= m_MappedSize)
+    {
+        return true;
+    }
+
+    /* The file only grows, the host maps the new part when it sees a larger canvas */
+    if (ftruncate(m_MemoryFd, static_cast<off_t>(size)) != 0)
+    {
+        return false;
+    }
+
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_MemoryFd, 0);
+    if (memory == MAP_FAILED)
+    {
+        return false;
+    }
+
+    if (m_Memory != nullptr)
+    {
+        munmap(m_Memory, m_MappedSize);
+    }
+
+    m_Memory     = static_cast<HostSharedMemory*>(memory);
+    m_MappedSize = size;
+
+    return true;
+}
+
+Sml::Color* PluginHost::getCanvas()
+{
+    return reinterpret_cast<Sml::Color*>(reinterpret_cast<uint8_t*>(m_Memory) + HOST_CANVAS_OFFSET);
+}
+
+void PluginHost::handOffTiles(Layer* layer)
+{
+    TiledImage  tiles  = layer->snapshot();
+    Sml::Color* canvas = getCanvas();
+
+    bool all = m_SharedTiles.getTileCount() != tiles.getTileCount();
+
+    /* Held tiles are never freed, so equal pointers always mean equal pixels, whatever the layer */
+    for (size_t i = 0; i < tiles.getTileCount(); ++i)
+    {
+        const TilePtr& tile = tiles.getTile(i);
+
+        if (!all && tile == m_SharedTiles.getTile(i))
+        {
+            continue;
+        }
+
+        Sml::Rectangle<int32_t> rect = tiles.getTileRect(i);
+
+        for (int32_t y = 0; y < rect.height; ++y)
+        {
+            Sml::Color* row = canvas + (rect.pos.y + y) * m_Width + rect.pos.x;
+
+            if (tile != nullptr)
+            {
+                memcpy(row, tile->pixels + y * Tile::SIZE, rect.width * sizeof(Sml::Color));
+            }
+            else
+            {
+                memset(row, 0, rect.width * sizeof(Sml::Color));
+            }
+        }
+
+        m_Transferred += static_cast<uint64_t>(rect.width) * rect.height * sizeof(Sml::Color);
+    }
+
+    m_SharedTiles = tiles;
+}
+
+bool PluginHost::post(const HostRequest& request)
+{
+    if (!isRunning())
+    {
+        return false;
+    }
+
+    collect();
+
+    /* The host is behind by a whole ring of events */
+    while (m_Memory->requests.isFull())
+    {
+        if (!waitForResponse(RESPONSE_TIMEOUT))
+        {
+            return false;
+        }
+    }
+
+    m_Memory->requests.back() = request;
+    m_Memory->requests.push();
+    ++m_Pending;
+
+    uint64_t one = 1;
+    if (write(m_RequestEvent, &one, sizeof(one)) != sizeof(one))
+    {
+        LOG_APP_ERROR("Couldn't signal the plugin host: %s", strerror(errno));
+    }
+
+    return true;
+}
+
+bool PluginHost::waitForResponse(int32_t timeout)
+{
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout);
+    bool              crashed  = false;
+
+    /* Responses collected without waiting leave the eventfd signaled, so a wakeup may be stale */
+    while (!collect())
+    {
+        int32_t remaining = static_cast<int32_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count());
+
+        if (remaining <= 0 || crashed)
+        {
+            if (crashed)
+            {
+                LOG_APP_ERROR("Plugin host crashed, it will be restarted on next use.");
+            }
+            else
+            {
+                LOG_APP_ERROR("Plugin host didn't respond in %d ms, it will be restarted on next use.", timeout);
+            }
+
+            stop();
+            return false;
+        }
+
+        pollfd fds[2] = {{m_ResponseEvent, POLLIN, 0}, {m_DeathPipe, POLLIN, 0}};
+
+        if (poll(fds, 2, remaining) > 0)
+        {
+            uint64_t count = 0;
+            if ((fds[0].revents & POLLIN) && read(m_ResponseEvent, &count, sizeof(count)) != sizeof(count))
+            {
+                LOG_APP_ERROR("Couldn't read the plugin host's signal: %s", strerror(errno));
+            }
+
+            /* Responses sent right before the crash are still collected once more */
+            crashed = fds[1].revents != 0;
+        }
+    }
+
+    return true;
+}
+
+bool PluginHost::collect()
+{
+    bool collected = false;
+
+    while (!m_Memory->responses.isEmpty())
+    {
+        const HostResponse& response = m_Memory->responses.front();
+
+        if (response.status != 0)
+        {
+            LOG_APP_ERROR("Plugin host failed to handle a request (status %d).", response.status);
+        }
+
+        upload(response);
+
+        m_Memory->responses.pop();
+        --m_Pending;
+
+        collected = true;
+    }
+
+    return collected;
+}
+
+void PluginHost::upload(const HostResponse& response)
+{
+    if (m_Layer == nullptr)
+    {
+        return;
+    }
+
+    const Sml::Color* canvas = getCanvas();
+
+    for (uint32_t i = 0; i < response.rectCount && i < HOST_MAX_RESPONSE_RECTS; ++i)
+    {
+        const HostRect&         drawn = response.rects[i];
+        Sml::Rectangle<int32_t> rect  = intersectRects({drawn.x, drawn.y, drawn.width, drawn.height},
+                                                       {0, 0, m_Width, m_Height});
+        if (isRectEmpty(rect))
+        {
+            continue;
+        }
+
+        Sml::Color* pixels = m_Layer->lockPixels(rect);
+
+        for (int32_t y = rect.pos.y; y < rect.pos.y + rect.height; ++y)
+        {
+            memcpy(pixels + (y - rect.pos.y) * rect.width, canvas + y * m_Width + rect.pos.x,
+                   rect.width * sizeof(Sml::Color));
+        }
+
+        m_Layer->unlockPixels(rect, true);
+        m_Transferred += static_cast<uint64_t>(rect.width) * rect.height * sizeof(Sml::Color);
+    }
+}
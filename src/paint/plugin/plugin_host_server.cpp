@@ -0,0 +1,700 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file plugin_host_server.cpp
+ * @date 2021-12-28
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * Host side of PluginHost. The host never opens a window or a renderer, so everything
+ * plugins draw is rasterized on the CPU, right into the canvas in shared memory.
+ */
+
+#include <sys/mman.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "sml/sml_log.h"
+#include "paint/plugin/plugin_host.h"
+#include "paint/plugin/plugin_api_ext.h"
+#include "paint/dirty_region.h"
+#include "paint/image_loader.h"
+
+using namespace Paint;
+
+namespace
+{
+    //------------------------------------------------------------------------------
+    // Textures
+    //------------------------------------------------------------------------------
+    Sml::Color blendPixel(Sml::Color dst, Sml::Color src)
+    {
+        uint32_t srcA = src & 0xFF;
+
+        if (srcA == 0xFF)
+        {
+            return src;
+        }
+
+        if (srcA == 0)
+        {
+            return dst;
+        }
+
+        /* Same as SDL's blend mode: rgb = src * a + dst * (1 - a), a = srcA + dstA * (1 - srcA) */
+        uint32_t result = 0;
+        for (uint32_t shift = 8; shift < 32; shift += 8)
+        {
+            uint32_t srcChannel = (src >> shift) & 0xFF;
+            uint32_t dstChannel = (dst >> shift) & 0xFF;
+
+            result |= ((srcChannel * srcA + dstChannel * (0xFF - srcA)) / 0xFF) << shift;
+        }
+
+        return result | (srcA + (dst & 0xFF) * (0xFF - srcA) / 0xFF);
+    }
+
+    /**
+     * @brief CPU raster over either the shared canvas or its own pixels. Tracks the
+     *        regions drawn since the last takeDrawn().
+     */
+    class HostTexture : public plugin::ITexture, public plugin::ITextureExt
+    {
+    public:
+        HostTexture(int32_t width, int32_t height)
+            : m_Owned(static_cast<size_t>(width) * height, 0), m_Pixels(m_Owned.data()),
+              m_Width(width), m_Height(height) {}
+
+        HostTexture(Sml::Color* pixels, int32_t width, int32_t height)
+            : m_Pixels(pixels), m_Width(width), m_Height(height) {}
+
+        virtual int32_t GetSizeX() override { return m_Width; }
+        virtual int32_t GetSizeY() override { return m_Height; }
+
+        /* A copy like in the editor, changes only count once loaded, see LockBuffer() for direct access */
+        virtual plugin::Buffer ReadBuffer() override
+        {
+            size_t      count = static_cast<size_t>(m_Width) * m_Height;
+            Sml::Color* copy  = new Sml::Color[count];
+
+            std::copy(m_Pixels, m_Pixels + count, copy);
+            return {copy, this};
+        }
+
+        virtual void ReleaseBuffer(plugin::Buffer buffer) override
+        {
+            assert(buffer.texture == this);
+            delete[] buffer.pixels;
+        }
+
+        virtual void LoadBuffer(plugin::Buffer buffer) override
+        {
+            if (buffer.pixels != m_Pixels)
+            {
+                memcpy(m_Pixels, buffer.pixels, static_cast<size_t>(m_Width) * m_Height * sizeof(Sml::Color));
+            }
+
+            m_Drawn.add(getBounds());
+        }
+
+        virtual void Clear(plugin::color_t color) override
+        {
+            std::fill(m_Pixels, m_Pixels + static_cast<size_t>(m_Width) * m_Height, color);
+            m_Drawn.add(getBounds());
+        }
+
+        virtual void Present() override {}
+
+        virtual void DrawLine(const plugin::Line& line) override
+        {
+            Sml::Rectangle<int32_t> bounds = intersectRects(computeLineBounds({line.x0, line.y0}, {line.x1, line.y1},
+                                                                              line.thickness), getBounds());
+            if (isRectEmpty(bounds))
+            {
+                return;
+            }
+
+            float radius = std::max(line.thickness, 1) / 2.0f;
+            float dx     = static_cast<float>(line.x1 - line.x0);
+            float dy     = static_cast<float>(line.y1 - line.y0);
+            float length = dx * dx + dy * dy;
+
+            /* Pixels within half the thickness from the segment */
+            for (int32_t y = bounds.pos.y; y < bounds.pos.y + bounds.height; ++y)
+            {
+                for (int32_t x = bounds.pos.x; x < bounds.pos.x + bounds.width; ++x)
+                {
+                    float px = static_cast<float>(x - line.x0);
+                    float py = static_cast<float>(y - line.y0);
+                    float t  = length > 0 ? std::min(std::max((px * dx + py * dy) / length, 0.0f), 1.0f) : 0;
+
+                    float distanceX = px - t * dx;
+                    float distanceY = py - t * dy;
+
+                    if (distanceX * distanceX + distanceY * distanceY <= radius * radius)
+                    {
+                        blend(x, y, line.color);
+                    }
+                }
+            }
+
+            m_Drawn.add(bounds);
+        }
+
+        virtual void DrawCircle(const plugin::Circle& circle) override
+        {
+            Sml::Rectangle<int32_t> bounds = intersectRects({circle.x - circle.radius, circle.y - circle.radius,
+                                                             2 * circle.radius + 1, 2 * circle.radius + 1}, getBounds());
+            if (isRectEmpty(bounds))
+            {
+                return;
+            }
+
+            int32_t inner      = std::max(circle.radius - circle.outline_thickness, 0);
+            bool    opaqueFill = Sml::colorGetA(circle.fill_color) == 0xFF;
+
+            for (int32_t y = bounds.pos.y; y < bounds.pos.y + bounds.height; ++y)
+            {
+                for (int32_t x = bounds.pos.x; x < bounds.pos.x + bounds.width; ++x)
+                {
+                    int32_t distance = (x - circle.x) * (x - circle.x) + (y - circle.y) * (y - circle.y);
+                    if (distance > circle.radius * circle.radius)
+                    {
+                        continue;
+                    }
+
+                    /* As in the editor, an opaque fill doesn't show through the outline */
+                    bool outline = circle.outline_thickness > 0 && distance > inner * inner;
+
+                    if (!outline || !opaqueFill)
+                    {
+                        blend(x, y, circle.fill_color);
+                    }
+
+                    if (outline)
+                    {
+                        blend(x, y, circle.outline_color);
+                    }
+                }
+            }
+
+            m_Drawn.add(bounds);
+        }
+
+        virtual void DrawRect(const plugin::Rect& rect) override
+        {
+            int32_t thickness = rect.outline_thickness;
+
+            fill({rect.x, rect.y, rect.size_x, rect.size_y}, rect.fill_color);
+
+            if (thickness > 0)
+            {
+                fill({rect.x - thickness,   rect.y - thickness,   rect.size_x + 2 * thickness, thickness}, rect.outline_color);
+                fill({rect.x - thickness,   rect.y + rect.size_y, rect.size_x + 2 * thickness, thickness}, rect.outline_color);
+                fill({rect.x - thickness,   rect.y,               thickness,                   rect.size_y}, rect.outline_color);
+                fill({rect.x + rect.size_x, rect.y,               thickness,                   rect.size_y}, rect.outline_color);
+            }
+        }
+
+        virtual void CopyTexture(plugin::ITexture* source, int32_t x, int32_t y, int32_t size_x, int32_t size_y) override
+        {
+            HostTexture* sourceTexture = dynamic_cast<HostTexture*>(source);
+            assert(sourceTexture);
+
+            Sml::Rectangle<int32_t> bounds = intersectRects({x, y, size_x, size_y}, getBounds());
+            if (isRectEmpty(bounds) || sourceTexture->m_Width == 0 || sourceTexture->m_Height == 0)
+            {
+                return;
+            }
+
+            /* Nearest neighbour, the same as the renderer's default scaling */
+            for (int32_t dstY = bounds.pos.y; dstY < bounds.pos.y + bounds.height; ++dstY)
+            {
+                int32_t srcY = (dstY - y) * sourceTexture->m_Height / size_y;
+
+                for (int32_t dstX = bounds.pos.x; dstX < bounds.pos.x + bounds.width; ++dstX)
+                {
+                    int32_t srcX = (dstX - x) * sourceTexture->m_Width / size_x;
+                    blend(dstX, dstY, sourceTexture->m_Pixels[srcY * sourceTexture->m_Width + srcX]);
+                }
+            }
+
+            m_Drawn.add(bounds);
+        }
+
+        virtual void CopyTexture(plugin::ITexture* source, int32_t x, int32_t y) override
+        {
+            CopyTexture(source, x, y, source->GetSizeX(), source->GetSizeY());
+        }
+
+        virtual uint32_t GetExtVersion() override { return plugin::kTextureExtVersion; }
+
+        virtual plugin::BufferRegion LockBuffer(int32_t x, int32_t y, int32_t size_x, int32_t size_y) override
+        {
+            Sml::Rectangle<int32_t> rect = intersectRects({x, y, size_x, size_y}, getBounds());
+
+            return {m_Pixels + rect.pos.y * m_Width + rect.pos.x, m_Width, rect.pos.x, rect.pos.y, rect.width, rect.height};
+        }
+
+        virtual void UnlockBuffer(const plugin::BufferRegion& region, bool modified) override
+        {
+            if (modified)
+            {
+                m_Drawn.add({region.x, region.y, region.size_x, region.size_y});
+            }
+        }
+
+        DirtyRegion takeDrawn()
+        {
+            DirtyRegion drawn = m_Drawn;
+            m_Drawn.clear();
+
+            return drawn;
+        }
+
+    private:
+        std::vector<Sml::Color> m_Owned;
+        Sml::Color*             m_Pixels = nullptr;
+        int32_t                 m_Width  = 0;
+        int32_t                 m_Height = 0;
+        DirtyRegion             m_Drawn;
+
+        Sml::Rectangle<int32_t> getBounds() const { return {0, 0, m_Width, m_Height}; }
+
+        void blend(int32_t x, int32_t y, Sml::Color color)
+        {
+            Sml::Color& pixel = m_Pixels[y * m_Width + x];
+            pixel = blendPixel(pixel, color);
+        }
+
+        void fill(const Sml::Rectangle<int32_t>& rect, Sml::Color color)
+        {
+            Sml::Rectangle<int32_t> clipped = intersectRects(rect, getBounds());
+            if (isRectEmpty(clipped))
+            {
+                return;
+            }
+
+            for (int32_t y = clipped.pos.y; y < clipped.pos.y + clipped.height; ++y)
+            {
+                for (int32_t x = clipped.pos.x; x < clipped.pos.x + clipped.width; ++x)
+                {
+                    blend(x, y, color);
+                }
+            }
+
+            m_Drawn.add(clipped);
+        }
+    };
+
+    class HostTextureFactory : public plugin::ITextureFactory
+    {
+    public:
+        virtual plugin::ITexture* CreateTexture(const char* filename) override
+        {
+            TiledImage image;
+            if (!loadImage((std::string("res/plugins/") + filename).c_str(), &image))
+            {
+                return nullptr;
+            }
+
+            int32_t      width   = static_cast<int32_t>(image.getWidth());
+            int32_t      height  = static_cast<int32_t>(image.getHeight());
+            HostTexture* texture = new HostTexture(width, height);
+
+            plugin::BufferRegion region = texture->LockBuffer(0, 0, width, height);
+            image.readPixels({0, 0, width, height}, region.pixels);
+            texture->UnlockBuffer(region, true);
+
+            return texture;
+        }
+
+        virtual plugin::ITexture* CreateTexture(int32_t size_x, int32_t size_y) override
+        {
+            return new HostTexture(size_x, size_y);
+        }
+    };
+
+    //------------------------------------------------------------------------------
+    // Widgets
+    //------------------------------------------------------------------------------
+    /* Preferences panels aren't shown for plugins in the host, widgets only keep their state */
+    template <typename Interface>
+    class HostWidget : public Interface
+    {
+    public:
+        HostWidget(int32_t width = 0, int32_t height = 0) : m_Width(width), m_Height(height) {}
+
+        virtual int32_t GetSizeX() override { return m_Width; }
+        virtual int32_t GetSizeY() override { return m_Height; }
+
+    private:
+        int32_t m_Width  = 0;
+        int32_t m_Height = 0;
+    };
+
+    class HostButton : public HostWidget<plugin::IButton>
+    {
+    public:
+        using HostWidget::HostWidget;
+        virtual void SetClickCallback(plugin::IClickCallback*) override {}
+    };
+
+    class HostSlider : public HostWidget<plugin::ISlider>
+    {
+    public:
+        HostSlider(float min, float max, int32_t width = 0, int32_t height = 0)
+            : HostWidget(width, height), m_Value(min) { (void) max; }
+
+        virtual void SetSliderCallback(plugin::ISliderCallback*) override {}
+        virtual float GetValue() override { return m_Value; }
+        virtual void SetValue(float value) override { m_Value = value; }
+
+    private:
+        float m_Value = 0;
+    };
+
+    class HostLabel : public HostWidget<plugin::ILabel>
+    {
+    public:
+        using HostWidget::HostWidget;
+        virtual void SetText(const char*) override {}
+    };
+
+    class HostIcon : public HostWidget<plugin::IIcon>
+    {
+    public:
+        using HostWidget::HostWidget;
+        virtual void SetIcon(const plugin::ITexture*) override {}
+    };
+
+    class HostPalette : public HostWidget<plugin::IPalette>
+    {
+    public:
+        virtual void SetPaletteCallback(plugin::IPaletteCallback*) override {}
+    };
+
+    class HostPreferencesPanel : public HostWidget<plugin::IPreferencesPanel>
+    {
+    public:
+        virtual void Attach(plugin::IButton*,  int32_t, int32_t) override {}
+        virtual void Attach(plugin::ILabel*,   int32_t, int32_t) override {}
+        virtual void Attach(plugin::ISlider*,  int32_t, int32_t) override {}
+        virtual void Attach(plugin::IIcon*,    int32_t, int32_t) override {}
+        virtual void Attach(plugin::IPalette*, int32_t, int32_t) override {}
+    };
+
+    class HostWidgetFactory : public plugin::IWidgetFactory
+    {
+    public:
+        virtual plugin::IButton* CreateDefaultButtonWithIcon(const char*) override { return new HostButton(); }
+        virtual plugin::IButton* CreateDefaultButtonWithText(const char*) override { return new HostButton(); }
+
+        virtual plugin::IButton* CreateButtonWithIcon(int32_t size_x, int32_t size_y, const char*) override
+        {
+            return new HostButton(size_x, size_y);
+        }
+
+        virtual plugin::IButton* CreateButtonWithText(int32_t size_x, int32_t size_y, const char*, int32_t) override
+        {
+            return new HostButton(size_x, size_y);
+        }
+
+        virtual plugin::ISlider* CreateDefaultSlider(float range_min, float range_max) override
+        {
+            return new HostSlider(range_min, range_max);
+        }
+
+        virtual plugin::ISlider* CreateSlider(int32_t size_x, int32_t size_y, float range_min, float range_max) override
+        {
+            return new HostSlider(range_min, range_max, size_x, size_y);
+        }
+
+        virtual plugin::ILabel* CreateDefaultLabel(const char*) override { return new HostLabel(); }
+
+        virtual plugin::ILabel* CreateLabel(int32_t size_x, int32_t size_y, const char*, int32_t) override
+        {
+            return new HostLabel(size_x, size_y);
+        }
+
+        virtual plugin::IIcon* CreateIcon(int32_t size_x, int32_t size_y) override { return new HostIcon(size_x, size_y); }
+        virtual plugin::IPalette* CreatePalette() override { return new HostPalette(); }
+        virtual plugin::IPreferencesPanel* CreatePreferencesPanel() override { return new HostPreferencesPanel(); }
+    };
+
+    class HostAPI : public plugin::IAPI
+    {
+    public:
+        virtual plugin::IWidgetFactory*  GetWidgetFactory () override { return &m_WidgetFactory;  }
+        virtual plugin::ITextureFactory* GetTextureFactory() override { return &m_TextureFactory; }
+
+    private:
+        HostWidgetFactory  m_WidgetFactory;
+        HostTextureFactory m_TextureFactory;
+    };
+
+    //------------------------------------------------------------------------------
+    // Server
+    //------------------------------------------------------------------------------
+    class HostServer
+    {
+    public:
+        HostServer(int memoryFd, int requestEvent, int responseEvent)
+            : m_MemoryFd(memoryFd), m_RequestEvent(requestEvent), m_ResponseEvent(responseEvent) {}
+
+        int run()
+        {
+            if (!map(HOST_CANVAS_OFFSET) || m_Memory->magic != HOST_MAGIC)
+            {
+                LOG_APP_ERROR("Plugin host couldn't map the shared memory.");
+                return EXIT_FAILURE;
+            }
+
+            /* The editor kills the host, there's no request to quit */
+            while (true)
+            {
+                uint64_t count = 0;
+                if (read(m_RequestEvent, &count, sizeof(count)) != sizeof(count))
+                {
+                    return EXIT_FAILURE;
+                }
+
+                while (!m_Memory->requests.isEmpty())
+                {
+                    HostRequest request = m_Memory->requests.front();
+                    m_Memory->requests.pop();
+
+                    HostResponse response = process(request);
+
+                    while (m_Memory->responses.isFull())
+                    {
+                        usleep(100);
+                    }
+
+                    m_Memory->responses.back() = response;
+                    m_Memory->responses.push();
+
+                    uint64_t one = 1;
+                    if (write(m_ResponseEvent, &one, sizeof(one)) != sizeof(one))
+                    {
+                        return EXIT_FAILURE;
+                    }
+                }
+            }
+        }
+
+    private:
+        struct Library
+        {
+            std::string      path;
+            void*            handle  = nullptr;
+            uint32_t         version = 0;
+            plugin::IPlugin* plugin  = nullptr;
+        };
+
+        int                          m_MemoryFd      = -1;
+        int                          m_RequestEvent  = -1;
+        int                          m_ResponseEvent = -1;
+        HostSharedMemory*            m_Memory        = nullptr;
+        size_t                       m_MappedSize    = 0;
+
+        HostAPI                      m_API;
+        std::vector<Library>         m_Libraries;
+
+        std::unique_ptr<HostTexture> m_Canvas;
+        plugin::ITool*               m_Tool          = nullptr;
+
+        bool map(size_t size)
+        {
+            if (size <= m_MappedSize)
+            {
+                return true;
+            }
+
+            void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_MemoryFd, 0);
+            if (memory == MAP_FAILED)
+            {
+                return false;
+            }
+
+            if (m_Memory != nullptr)
+            {
+                munmap(m_Memory, m_MappedSize);
+            }
+
+            m_Memory     = static_cast<HostSharedMemory*>(memory);
+            m_MappedSize = size;
+
+            return true;
+        }
+
+        HostResponse process(const HostRequest& request)
+        {
+            HostResponse response = {};
+
+            switch (request.type)
+            {
+                case HostRequestType::LOAD:
+                {
+                    load();
+                    return response;
+                }
+
+                case HostRequestType::ACTION_BEGIN:
+                {
+                    size_t canvasSize = static_cast<size_t>(request.canvasWidth) * request.canvasHeight;
+                    m_Tool = findTool(request.library, request.tool);
+
+                    if (m_Tool == nullptr || !map(HOST_CANVAS_OFFSET + canvasSize * sizeof(Sml::Color)))
+                    {
+                        m_Tool = nullptr;
+                        response.status = -1;
+                        return response;
+                    }
+
+                    Sml::Color* canvas = reinterpret_cast<Sml::Color*>(reinterpret_cast<uint8_t*>(m_Memory) + HOST_CANVAS_OFFSET);
+                    m_Canvas.reset(new HostTexture(canvas, request.canvasWidth, request.canvasHeight));
+
+                    m_Tool->ActionBegin(m_Canvas.get(), request.x, request.y);
+                    break;
+                }
+
+                case HostRequestType::ACTION:
+                {
+                    if (m_Tool == nullptr)
+                    {
+                        response.status = -1;
+                        return response;
+                    }
+
+                    m_Tool->Action(m_Canvas.get(), request.x, request.y, request.dx, request.dy);
+                    break;
+                }
+
+                case HostRequestType::ACTION_END:
+                {
+                    if (m_Tool == nullptr)
+                    {
+                        response.status = -1;
+                        return response;
+                    }
+
+                    m_Tool->ActionEnd(m_Canvas.get(), request.x, request.y);
+                    m_Tool = nullptr;
+                    break;
+                }
+            }
+
+            DirtyRegion drawn = m_Canvas->takeDrawn();
+
+            /* Can't happen with DirtyRegion::MAX_RECTS rects at most, but the rings are fixed size */
+            if (drawn.getRects().size() > HOST_MAX_RESPONSE_RECTS)
+            {
+                Sml::Rectangle<int32_t> bounds = drawn.getBounds();
+
+                drawn.clear();
+                drawn.add(bounds);
+            }
+
+            for (const auto& rect : drawn.getRects())
+            {
+                response.rects[response.rectCount++] = {rect.pos.x, rect.pos.y, rect.width, rect.height};
+            }
+
+            return response;
+        }
+
+        plugin::ITool* findTool(int32_t library, int32_t tool)
+        {
+            if (library < 0 || static_cast<size_t>(library) >= m_Libraries.size() || m_Libraries[library].plugin == nullptr)
+            {
+                return nullptr;
+            }
+
+            plugin::Tools tools = m_Libraries[library].plugin->GetTools();
+
+            return tool >= 0 && static_cast<uint32_t>(tool) < tools.count ? tools.tools[tool] : nullptr;
+        }
+
+        void load()
+        {
+            HostLoadArea& area = m_Memory->load;
+            area.path[HOST_MAX_PATH - 1] = '\0';
+
+            size_t index = 0;
+            while (index < m_Libraries.size() && m_Libraries[index].path != area.path)
+            {
+                ++index;
+            }
+
+            if (index == m_Libraries.size())
+            {
+                m_Libraries.push_back(open(area.path));
+            }
+
+            const Library& library = m_Libraries[index];
+
+            area.library   = library.plugin != nullptr ? static_cast<int32_t>(index) : -1;
+            area.version   = library.version;
+            area.toolCount = 0;
+
+            if (library.plugin == nullptr)
+            {
+                return;
+            }
+
+            plugin::Tools tools = library.plugin->GetTools();
+
+            for (uint32_t i = 0; i < tools.count && i < HOST_MAX_TOOLS; ++i)
+            {
+                snprintf(area.toolNames[i], HOST_MAX_NAME, "%s", tools.tools[i]->GetName());
+                snprintf(area.toolIcons[i], HOST_MAX_NAME, "%s", tools.tools[i]->GetIconFileName());
+            }
+
+            area.toolCount = std::min(tools.count, static_cast<uint32_t>(HOST_MAX_TOOLS));
+        }
+
+        Library open(const char* path)
+        {
+            Library library;
+            library.path   = path;
+            library.handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+            if (library.handle == nullptr)
+            {
+                LOG_APP_ERROR("Couldn't load plugin '%s': %s", path, dlerror());
+                return library;
+            }
+
+            plugin::VersionFunction version = reinterpret_cast<plugin::VersionFunction>(dlsym(library.handle, "Version"));
+            plugin::CreateFunction  create  = reinterpret_cast<plugin::CreateFunction>(dlsym(library.handle, "Create"));
+
+            library.version = version != nullptr ? version() : 0;
+
+            if (library.version == plugin::kVersion && create != nullptr)
+            {
+                library.plugin = create(&m_API);
+            }
+
+            return library;
+        }
+    };
+}
+
+int PluginHost::runServer(int32_t argc, const char* argv[])
+{
+    if (argc != 5)
+    {
+        return EXIT_FAILURE;
+    }
+
+    HostServer server(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+
+    return server.run();
+}
@@ -0,0 +1,360 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file plugin_manager.cpp
+ * @date 2021-12-27
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <sys/stat.h>
+#include <dlfcn.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include "sml/sml_log.h"
+#include "paint/plugin/plugin_manager.h"
+#include "paint/plugin/plugin_tool.h"
+#include "paint/paint_editor.h"
+#include "paint/thread_pool.h"
+
+using namespace Paint;
+
+const char* const PluginManager::MANIFEST_FILENAME = "plugins.manifest";
+const char* const PluginManager::LIBRARY_EXTENSION = ".so";
+
+//------------------------------------------------------------------------------
+// PluginLibrary
+//------------------------------------------------------------------------------
+PluginLibrary::PluginLibrary(const std::string& filename, plugin::IAPI* api) : m_Filename(filename), m_API(api)
+{
+    assert(api);
+}
+
+PluginLibrary::~PluginLibrary()
+{
+    /* Tools of a created plugin are owned by the editor and may outlive the manager */
+    if (m_Handle != nullptr && m_Plugin == nullptr)
+    {
+        dlclose(m_Handle);
+    }
+}
+
+const std::string& PluginLibrary::getFilename() const { return m_Filename; }
+
+bool PluginLibrary::open()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (!m_Opened)
+    {
+        m_Opened = true;
+        m_Handle = dlopen(m_Filename.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+        if (m_Handle == nullptr)
+        {
+            LOG_APP_ERROR("Couldn't load plugin '%s': %s", m_Filename.c_str(), dlerror());
+        }
+        else
+        {
+            plugin::VersionFunction version = reinterpret_cast<plugin::VersionFunction>(dlsym(m_Handle, "Version"));
+            m_Version = version != nullptr ? version() : 0;
+        }
+    }
+
+    return m_Version == plugin::kVersion;
+}
+
+uint32_t PluginLibrary::getVersion() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Version;
+}
+
+plugin::IPlugin* PluginLibrary::getPlugin()
+{
+    if (m_Created)
+    {
+        return m_Plugin;
+    }
+
+    m_Created = true;
+
+    if (!open())
+    {
+        LOG_APP_ERROR("Plugin '%s' has version %u, %u is required.", m_Filename.c_str(), getVersion(), plugin::kVersion);
+        return nullptr;
+    }
+
+    plugin::CreateFunction create = reinterpret_cast<plugin::CreateFunction>(dlsym(m_Handle, "Create"));
+    if (create == nullptr)
+    {
+        LOG_APP_ERROR("Plugin '%s' doesn't export Create().", m_Filename.c_str());
+        return nullptr;
+    }
+
+    m_Plugin = create(m_API);
+    if (m_Plugin == nullptr)
+    {
+        LOG_APP_ERROR("Plugin '%s' failed to create.", m_Filename.c_str());
+    }
+
+    return m_Plugin;
+}
+
+//------------------------------------------------------------------------------
+// PluginManager
+//------------------------------------------------------------------------------
+PluginManager::PluginManager(const char* directory, plugin::IAPI* api, PluginHost* host)
+    : m_Directory(directory), m_API(api), m_Host(host)
+{
+    assert(directory);
+    assert(api);
+}
+
+PluginManager::~PluginManager()
+{
+    if (m_Preloader.joinable())
+    {
+        m_Preloader.join();
+    }
+}
+
+void PluginManager::loadTools()
+{
+    std::vector<ManifestEntry> cached = readManifest();
+
+    std::vector<std::string> filenames;
+
+    std::error_code error;
+    for (const auto& file : std::filesystem::directory_iterator(m_Directory, error))
+    {
+        if (file.path().extension() == LIBRARY_EXTENSION)
+        {
+            filenames.push_back(file.path().string());
+        }
+    }
+
+    /* Same tool order on every start, regardless of the directory order */
+    std::sort(filenames.begin(), filenames.end());
+
+    std::vector<ManifestEntry> entries;
+    std::vector<size_t>        uncached;
+
+    for (const auto& filename : filenames)
+    {
+        struct stat info = {};
+        if (stat(filename.c_str(), &info) != 0)
+        {
+            continue;
+        }
+
+        ManifestEntry entry;
+        entry.filename = filename;
+        entry.modified = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+        entry.size     = static_cast<int64_t>(info.st_size);
+
+        auto match = std::find_if(cached.begin(), cached.end(), [&entry](const ManifestEntry& other)
+        {
+            return other.filename == entry.filename && other.modified == entry.modified && other.size == entry.size;
+        });
+
+        if (match != cached.end())
+        {
+            entry = *match;
+        }
+        else
+        {
+            uncached.push_back(entries.size());
+        }
+
+        entries.push_back(entry);
+        m_Libraries.emplace_back(new PluginLibrary(filename, m_API));
+    }
+
+    /* The loader serializes most of dlopen, but reading the libraries from disk still overlaps */
+    if (m_Host == nullptr)
+    {
+        ThreadPool::getInstance().parallelFor(uncached.size(), [&](size_t i)
+        {
+            m_Libraries[uncached[i]]->open();
+        });
+    }
+
+    for (size_t i : uncached)
+    {
+        createEntry(m_Libraries[i].get(), &entries[i]);
+    }
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i].version != plugin::kVersion)
+        {
+            LOG_APP_ERROR("Plugin '%s' skipped, its version is %u instead of %u.",
+                          entries[i].filename.c_str(), entries[i].version, plugin::kVersion);
+            continue;
+        }
+
+        registerTools(m_Libraries[i].get(), entries[i]);
+    }
+
+    if (!uncached.empty() || entries.size() != cached.size())
+    {
+        writeManifest(entries);
+    }
+}
+
+void PluginManager::preload()
+{
+    if (m_Preloader.joinable() || m_Host != nullptr)
+    {
+        return;
+    }
+
+    std::vector<PluginLibrary*> libraries;
+    for (const auto& library : m_Libraries)
+    {
+        libraries.push_back(library.get());
+    }
+
+    m_Preloader = std::thread([libraries]()
+    {
+        for (auto library : libraries)
+        {
+            library->open();
+        }
+    });
+}
+
+/**
+ * Manifest is a text file of tab separated records, a library's record is followed by
+ * the records of its tools:
+ *     library <filename> <modified> <size> <version> <tool count>
+ *     tool    <name>     <icon filename>
+ */
+std::vector<PluginManager::ManifestEntry> PluginManager::readManifest() const
+{
+    std::vector<ManifestEntry> entries;
+
+    std::ifstream file(m_Directory + "/" + MANIFEST_FILENAME);
+    std::string   line;
+
+    while (std::getline(file, line))
+    {
+        std::vector<std::string> fields;
+
+        std::istringstream stream(line);
+        std::string        field;
+        while (std::getline(stream, field, '\t'))
+        {
+            fields.push_back(field);
+        }
+
+        if (fields.size() == 6 && fields[0] == "library")
+        {
+            ManifestEntry entry;
+            entry.filename = fields[1];
+            entry.modified = strtoll(fields[2].c_str(), nullptr, 10);
+            entry.size     = strtoll(fields[3].c_str(), nullptr, 10);
+            entry.version  = static_cast<uint32_t>(strtoul(fields[4].c_str(), nullptr, 10));
+
+            entries.push_back(entry);
+        }
+        else if ((fields.size() == 2 || fields.size() == 3) && fields[0] == "tool" && !entries.empty())
+        {
+            /* Trailing empty field (no icon) isn't split off */
+            entries.back().tools.push_back({fields[1], fields.size() == 3 ? fields[2] : ""});
+        }
+        else
+        {
+            LOG_APP_ERROR("Plugin manifest is corrupted, plugins will be reloaded.");
+            return {};
+        }
+    }
+
+    return entries;
+}
+
+void PluginManager::writeManifest(const std::vector<ManifestEntry>& entries) const
+{
+    std::string filename = m_Directory + "/" + MANIFEST_FILENAME;
+
+    {
+        std::ofstream file(filename + ".tmp");
+
+        for (const auto& entry : entries)
+        {
+            file << "library\t" << entry.filename << '\t' << entry.modified << '\t' << entry.size << '\t'
+                 << entry.version << '\t' << entry.tools.size() << '\n';
+
+            for (const auto& tool : entry.tools)
+            {
+                file << "tool\t" << tool.name << '\t' << tool.iconFilename << '\n';
+            }
+        }
+
+        if (!file)
+        {
+            LOG_APP_ERROR("Couldn't write the plugin manifest '%s'.", filename.c_str());
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(filename + ".tmp", filename, error);
+}
+
+void PluginManager::createEntry(PluginLibrary* library, ManifestEntry* entry)
+{
+    assert(library);
+    assert(entry);
+
+    LOG_APP_INFO("Plugin '%s' detected.", library->getFilename().c_str());
+
+    /* Even a plugin crashing on creation can't take the editor down this way */
+    if (m_Host != nullptr)
+    {
+        int32_t id = 0;
+        m_Host->loadLibrary(library->getFilename().c_str(), &id, &entry->version, &entry->tools);
+        return;
+    }
+
+    entry->version = library->getVersion();
+    entry->tools.clear();
+
+    /* Tools' metadata is only available from the plugin itself */
+    plugin::IPlugin* plugin = entry->version == plugin::kVersion ? library->getPlugin() : nullptr;
+    if (plugin == nullptr)
+    {
+        return;
+    }
+
+    plugin::Tools tools = plugin->GetTools();
+
+    for (uint32_t i = 0; i < tools.count; ++i)
+    {
+        entry->tools.push_back({tools.tools[i]->GetName(), tools.tools[i]->GetIconFileName()});
+    }
+}
+
+void PluginManager::registerTools(PluginLibrary* library, const ManifestEntry& entry)
+{
+    assert(library);
+
+    for (size_t i = 0; i < entry.tools.size(); ++i)
+    {
+        const char* name = entry.tools[i].name.c_str();
+        const char* icon = entry.tools[i].iconFilename.c_str();
+
+        if (m_Host != nullptr)
+        {
+            Editor::getInstance().addTool(new RemotePluginTool(m_Host, library->getFilename(), i, name, icon));
+        }
+        else
+        {
+            Editor::getInstance().addTool(new PluginTool(library, i, name, icon));
+        }
+    }
+}
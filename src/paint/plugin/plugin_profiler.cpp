@@ -0,0 +1,290 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file plugin_profiler.cpp
+ * @date 2021-12-29
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include "sml/sml_log.h"
+#include "paint/plugin/plugin_profiler.h"
+
+using namespace Paint;
+
+static const char* const CALL_NAMES[] = {"action_begin", "action", "action_end", "read_buffer", "load_buffer",
+                                         "lock_buffer", "unlock_buffer", "draw", "copy_texture", "flush",
+                                         "host_transfer"};
+
+static_assert(sizeof(CALL_NAMES) / sizeof(CALL_NAMES[0]) == static_cast<size_t>(PluginCall::COUNT),
+              "Every call type must have a name");
+
+static thread_local uint32_t s_CurrentPlugin = 0;
+
+//------------------------------------------------------------------------------
+// CallStats
+//------------------------------------------------------------------------------
+double PluginProfiler::CallStats::getAverageUs() const
+{
+    return calls != 0 ? static_cast<double>(totalNs) / calls / 1e3 : 0;
+}
+
+double PluginProfiler::CallStats::getPercentileUs(double percentile) const
+{
+    uint64_t target     = static_cast<uint64_t>(std::ceil(calls * percentile));
+    uint64_t cumulative = 0;
+
+    for (size_t i = 0; i + 1 < histogram.size(); ++i)
+    {
+        cumulative += histogram[i];
+
+        if (cumulative >= target)
+        {
+            return static_cast<double>(1ull << i);
+        }
+    }
+
+    return static_cast<double>(maxNs) / 1e3;
+}
+
+//------------------------------------------------------------------------------
+// Scope
+//------------------------------------------------------------------------------
+PluginProfiler::Scope::Scope(uint32_t plugin, PluginCall call, uint64_t bytes)
+    : m_Plugin(plugin), m_PreviousPlugin(s_CurrentPlugin), m_Call(call), m_Bytes(bytes),
+      m_Enabled(PluginProfiler::getInstance().isEnabled())
+{
+    s_CurrentPlugin = plugin;
+
+    if (m_Enabled)
+    {
+        m_Start = std::chrono::steady_clock::now();
+    }
+}
+
+PluginProfiler::Scope::Scope(PluginCall call, uint64_t bytes) : Scope(s_CurrentPlugin, call, bytes) {}
+
+PluginProfiler::Scope::~Scope()
+{
+    if (m_Enabled)
+    {
+        uint64_t ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                std::chrono::steady_clock::now() - m_Start).count());
+
+        PluginProfiler::getInstance().record(m_Plugin, m_Call, ns, m_Bytes);
+    }
+
+    s_CurrentPlugin = m_PreviousPlugin;
+}
+
+void PluginProfiler::Scope::addBytes(uint64_t bytes) { m_Bytes += bytes; }
+
+//------------------------------------------------------------------------------
+// PluginProfiler
+//------------------------------------------------------------------------------
+const char* PluginProfiler::getCallName(PluginCall call)
+{
+    assert(call < PluginCall::COUNT);
+    return CALL_NAMES[static_cast<size_t>(call)];
+}
+
+PluginProfiler& PluginProfiler::getInstance()
+{
+    static PluginProfiler profiler;
+    return profiler;
+}
+
+PluginProfiler::PluginProfiler() : m_Names{"editor"} {}
+
+bool PluginProfiler::isEnabled() const { return m_Enabled.load(std::memory_order_relaxed); }
+void PluginProfiler::setEnabled(bool enabled) { m_Enabled.store(enabled, std::memory_order_relaxed); }
+
+uint32_t PluginProfiler::registerPlugin(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    auto found = std::find(m_Names.begin(), m_Names.end(), name);
+    if (found != m_Names.end())
+    {
+        return static_cast<uint32_t>(found - m_Names.begin());
+    }
+
+    if (m_Names.size() == MAX_PLUGINS)
+    {
+        LOG_APP_ERROR("Too many plugins to profile, '%s' is counted as '%s'.", name.c_str(), m_Names.back().c_str());
+        return static_cast<uint32_t>(MAX_PLUGINS - 1);
+    }
+
+    m_Names.push_back(name);
+    return static_cast<uint32_t>(m_Names.size() - 1);
+}
+
+std::vector<PluginProfiler::PluginStats> PluginProfiler::collect() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    std::vector<PluginStats> stats(m_Names.size());
+    for (size_t plugin = 0; plugin < stats.size(); ++plugin)
+    {
+        stats[plugin].name = m_Names[plugin];
+        stats[plugin].calls.resize(static_cast<size_t>(PluginCall::COUNT));
+
+        for (auto& call : stats[plugin].calls)
+        {
+            call.histogram.resize(HISTOGRAM_BUCKETS);
+        }
+    }
+
+    uint64_t epoch = m_Epoch.load(std::memory_order_acquire);
+
+    for (const auto& block : m_Blocks)
+    {
+        /* Its thread hasn't cleared it since the last reset() */
+        if (block->epoch.load(std::memory_order_acquire) != epoch)
+        {
+            continue;
+        }
+
+        for (size_t plugin = 0; plugin < stats.size(); ++plugin)
+        {
+            for (size_t call = 0; call < static_cast<size_t>(PluginCall::COUNT); ++call)
+            {
+                const Counter& counter = block->counters[plugin * static_cast<size_t>(PluginCall::COUNT) + call];
+                CallStats&     result  = stats[plugin].calls[call];
+
+                result.calls   += counter.calls.load(std::memory_order_relaxed);
+                result.totalNs += counter.totalNs.load(std::memory_order_relaxed);
+                result.bytes   += counter.bytes.load(std::memory_order_relaxed);
+                result.maxNs    = std::max(result.maxNs, counter.maxNs.load(std::memory_order_relaxed));
+
+                for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+                {
+                    result.histogram[bucket] += counter.histogram[bucket].load(std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    stats.erase(std::remove_if(stats.begin(), stats.end(), [](const PluginStats& plugin)
+    {
+        return std::all_of(plugin.calls.begin(), plugin.calls.end(), [](const CallStats& call) { return call.calls == 0; });
+    }), stats.end());
+
+    return stats;
+}
+
+void PluginProfiler::reset()
+{
+    /* Blocks are cleared by their own threads, the only writers of them */
+    m_Epoch.fetch_add(1, std::memory_order_acq_rel);
+}
+
+bool PluginProfiler::dump(const char* filename) const
+{
+    assert(filename);
+
+    std::ofstream file(filename);
+
+    for (const auto& plugin : collect())
+    {
+        for (size_t i = 0; i < plugin.calls.size(); ++i)
+        {
+            const CallStats& call = plugin.calls[i];
+            if (call.calls == 0)
+            {
+                continue;
+            }
+
+            file << "{\"plugin\": \"" << plugin.name << "\", \"call\": \"" << CALL_NAMES[i] << "\""
+                 << ", \"calls\": "  << call.calls
+                 << ", \"avg_us\": " << call.getAverageUs()
+                 << ", \"p50_us\": " << call.getPercentileUs(0.5)
+                 << ", \"p99_us\": " << call.getPercentileUs(0.99)
+                 << ", \"max_us\": " << call.maxNs / 1e3
+                 << ", \"bytes\": "  << call.bytes
+                 << ", \"histogram\": [";
+
+            for (size_t bucket = 0; bucket < call.histogram.size(); ++bucket)
+            {
+                file << (bucket != 0 ? ", " : "") << call.histogram[bucket];
+            }
+
+            file << "]}\n";
+        }
+    }
+
+    if (!file)
+    {
+        LOG_APP_ERROR("Couldn't write plugin stats to '%s'.", filename);
+        return false;
+    }
+
+    return true;
+}
+
+PluginProfiler::ThreadBlock* PluginProfiler::getThreadBlock()
+{
+    static thread_local ThreadBlock* block = nullptr;
+
+    if (block == nullptr)
+    {
+        std::unique_ptr<ThreadBlock> created(new ThreadBlock());
+        created->counters.reset(new Counter[MAX_PLUGINS * static_cast<size_t>(PluginCall::COUNT)]);
+        created->epoch.store(m_Epoch.load(std::memory_order_acquire), std::memory_order_release);
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        block = created.get();
+        m_Blocks.push_back(std::move(created));
+    }
+
+    return block;
+}
+
+void PluginProfiler::record(uint32_t plugin, PluginCall call, uint64_t ns, uint64_t bytes)
+{
+    ThreadBlock* block = getThreadBlock();
+
+    uint64_t epoch = m_Epoch.load(std::memory_order_acquire);
+    if (block->epoch.load(std::memory_order_relaxed) != epoch)
+    {
+        for (size_t i = 0; i < MAX_PLUGINS * static_cast<size_t>(PluginCall::COUNT); ++i)
+        {
+            Counter& counter = block->counters[i];
+
+            counter.calls.store(0, std::memory_order_relaxed);
+            counter.totalNs.store(0, std::memory_order_relaxed);
+            counter.maxNs.store(0, std::memory_order_relaxed);
+            counter.bytes.store(0, std::memory_order_relaxed);
+
+            for (auto& bucket : counter.histogram)
+            {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        block->epoch.store(epoch, std::memory_order_release);
+    }
+
+    size_t   index   = std::min(static_cast<size_t>(plugin), MAX_PLUGINS - 1) * static_cast<size_t>(PluginCall::COUNT) +
+                       static_cast<size_t>(call);
+    Counter& counter = block->counters[index];
+
+    /* Only this thread writes the block, so plain load and store is enough */
+    uint64_t us     = ns / 1000;
+    size_t   bucket = us == 0 ? 0 : std::min(static_cast<size_t>(64 - __builtin_clzll(us)), HISTOGRAM_BUCKETS - 1);
+
+    counter.calls.store(counter.calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    counter.totalNs.store(counter.totalNs.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    counter.bytes.store(counter.bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+    counter.histogram[bucket].store(counter.histogram[bucket].load(std::memory_order_relaxed) + 1,
+                                    std::memory_order_relaxed);
+
+    if (ns > counter.maxNs.load(std::memory_order_relaxed))
+    {
+        counter.maxNs.store(ns, std::memory_order_relaxed);
+    }
+}
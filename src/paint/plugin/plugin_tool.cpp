@@ -6,46 +6,239 @@
  * @copyright Copyright (c) 2021
  */
 
+#include <cassert>
+#include <filesystem>
 #include "paint/plugin/plugin_tool.h"
 #include "paint/plugin/api_impl.h"
 #include "paint/paint_editor.h"
+#include "paint/frame_profiler.h"
 
 using namespace Paint;
 
-PluginTool::PluginTool(plugin::ITool* tool) : m_PluginTool(tool)
+static Layer* getTargetLayer()
 {
-    m_IconFilename = new char[512];
-    snprintf(m_IconFilename, 512, "plugins/%s", m_PluginTool->GetIconFileName());
+    Document* document = Editor::getInstance().getActiveDocument();
+    return document != nullptr ? document->getActiveLayer() : nullptr;
 }
 
-PluginTool::~PluginTool() { delete m_PluginTool; delete m_IconFilename; }
+static uint32_t registerInProfiler(const std::string& filename)
+{
+    return PluginProfiler::getInstance().registerPlugin(std::filesystem::path(filename).filename().string());
+}
+
+//------------------------------------------------------------------------------
+// PluginTool
+//------------------------------------------------------------------------------
+PluginTool::PluginTool(PluginLibrary* library, size_t index, const char* name, const char* iconFilename)
+    : m_Library(library), m_Index(index), m_Name(name), m_IconFilename(std::string("plugins/") + iconFilename)
+{
+    assert(library);
+
+    m_ProfilerId = registerInProfiler(library->getFilename());
+    m_ZoneName   = FrameProfiler::getInstance().intern(std::string("plugin: ") + name);
+}
+
+PluginTool::~PluginTool() { delete m_PluginTool; }
+
+plugin::ITool* PluginTool::getPluginTool()
+{
+    if (m_Library == nullptr)
+    {
+        return m_PluginTool;
+    }
 
-const char* PluginTool::getName() const { return m_PluginTool->GetName(); }
+    plugin::IPlugin* plugin = m_Library->getPlugin();
+    m_Library = nullptr;
+
+    if (plugin != nullptr)
+    {
+        plugin::Tools tools = plugin->GetTools();
+
+        if (m_Index < tools.count)
+        {
+            m_PluginTool = tools.tools[m_Index];
+        }
+    }
+
+    if (m_PluginTool == nullptr)
+    {
+        LOG_APP_ERROR("Plugin tool '%s' is unavailable.", m_Name.c_str());
+    }
+
+    return m_PluginTool;
+}
+
+const char* PluginTool::getName() const { return m_Name.c_str(); }
 
 const char* PluginTool::getIconFilename() const
 {
-    return m_IconFilename;
+    return m_IconFilename.c_str();
 }
 
 Sgl::Container* PluginTool::getPreferencesPanel()
 {
+    if (getPluginTool() == nullptr)
+    {
+        return nullptr;
+    }
+
     return dynamic_cast<plugin::PreferencesPanelImpl*>(m_PluginTool->GetPreferencesPanel())->GetComponent();
 }
 
 void PluginTool::onActionStart(const Sml::Vec2i& pos)
 {
-    plugin::TextureImpl texture(Sml::Renderer::getInstance().getTarget());
+    if (getPluginTool() == nullptr)
+    {
+        return;
+    }
+
+    PROFILE_ZONE(m_ZoneName);
+    PluginProfiler::Scope scope(m_ProfilerId, PluginCall::ACTION_BEGIN);
+
+    plugin::TextureImpl texture(Sml::Renderer::getInstance().getTarget(), getTargetLayer());
     m_PluginTool->ActionBegin(&texture, pos.x, pos.y);
 }
 
 void PluginTool::onAction(const Sml::Vec2i& pos, const Sml::Vec2i& displacement)
 {
-    plugin::TextureImpl texture(Sml::Renderer::getInstance().getTarget());
+    if (getPluginTool() == nullptr)
+    {
+        return;
+    }
+
+    PROFILE_ZONE(m_ZoneName);
+    PluginProfiler::Scope scope(m_ProfilerId, PluginCall::ACTION);
+
+    plugin::TextureImpl texture(Sml::Renderer::getInstance().getTarget(), getTargetLayer());
     m_PluginTool->Action(&texture, pos.x, pos.y, displacement.x, displacement.y);
 }
 
 void PluginTool::onActionEnd(const Sml::Vec2i& pos)
 {
-    plugin::TextureImpl texture(Sml::Renderer::getInstance().getTarget());
+    if (getPluginTool() == nullptr)
+    {
+        return;
+    }
+
+    PROFILE_ZONE(m_ZoneName);
+    PluginProfiler::Scope scope(m_ProfilerId, PluginCall::ACTION_END);
+
+    plugin::TextureImpl texture(Sml::Renderer::getInstance().getTarget(), getTargetLayer());
     m_PluginTool->ActionEnd(&texture, pos.x, pos.y);
-}
\ No newline at end of file
+}
+
+//------------------------------------------------------------------------------
+// RemotePluginTool
+//------------------------------------------------------------------------------
+RemotePluginTool::RemotePluginTool(PluginHost* host, const std::string& filename, size_t index, const char* name,
+                                   const char* iconFilename)
+    : m_Host(host), m_Filename(filename), m_Index(index), m_Name(name),
+      m_IconFilename(std::string("plugins/") + iconFilename)
+{
+    assert(host);
+
+    m_ProfilerId = registerInProfiler(filename);
+    m_ZoneName   = FrameProfiler::getInstance().intern(std::string("plugin: ") + name);
+}
+
+const char* RemotePluginTool::getName() const { return m_Name.c_str(); }
+
+const char* RemotePluginTool::getIconFilename() const
+{
+    return m_IconFilename.c_str();
+}
+
+bool RemotePluginTool::ensureLoaded()
+{
+    /* A restarted host has lost the libraries loaded before */
+    if (m_Library >= 0 && m_Host->isRunning() && m_Generation == m_Host->getGeneration())
+    {
+        return true;
+    }
+
+    uint32_t                    version = 0;
+    std::vector<PluginToolInfo> tools;
+
+    bool loaded  = m_Host->loadLibrary(m_Filename.c_str(), &m_Library, &version, &tools);
+    m_Generation = m_Host->getGeneration();
+
+    if (!loaded || m_Index >= tools.size())
+    {
+        LOG_APP_ERROR("Plugin tool '%s' is unavailable.", m_Name.c_str());
+
+        m_Library = -1;
+        return false;
+    }
+
+    return true;
+}
+
+void RemotePluginTool::onActionStart(const Sml::Vec2i& pos)
+{
+    Layer* layer = getTargetLayer();
+
+    if (layer == nullptr || !ensureLoaded())
+    {
+        return;
+    }
+
+    PROFILE_ZONE(m_ZoneName);
+    PluginProfiler::Scope scope(m_ProfilerId, PluginCall::ACTION_BEGIN);
+    uint64_t              transferred = m_Host->getTransferredBytes();
+
+    m_Active = m_Host->beginAction(layer, m_Library, static_cast<int32_t>(m_Index), pos);
+
+    scope.addBytes(m_Host->getTransferredBytes() - transferred);
+}
+
+void RemotePluginTool::onAction(const Sml::Vec2i& pos, const Sml::Vec2i& displacement)
+{
+    if (!m_Active)
+    {
+        return;
+    }
+
+    /* Only the time to post the event, unless the host is a whole ring of events behind */
+    PROFILE_ZONE(m_ZoneName);
+    PluginProfiler::Scope scope(m_ProfilerId, PluginCall::ACTION);
+    uint64_t              transferred = m_Host->getTransferredBytes();
+
+    m_Host->postAction(pos, displacement);
+
+    scope.addBytes(m_Host->getTransferredBytes() - transferred);
+}
+
+void RemotePluginTool::onActionEnd(const Sml::Vec2i& pos)
+{
+    if (!m_Active)
+    {
+        return;
+    }
+
+    PROFILE_ZONE(m_ZoneName);
+    PluginProfiler::Scope scope(m_ProfilerId, PluginCall::ACTION_END);
+    uint64_t              transferred = m_Host->getTransferredBytes();
+
+    m_Host->endAction(pos);
+    m_Active = false;
+
+    scope.addBytes(m_Host->getTransferredBytes() - transferred);
+}
+
+void RemotePluginTool::onUpdate()
+{
+    if (!m_Host->isBusy())
+    {
+        return;
+    }
+
+    PROFILE_ZONE(m_ZoneName);
+    PluginProfiler::Scope scope(m_ProfilerId, PluginCall::HOST_TRANSFER);
+    uint64_t              transferred = m_Host->getTransferredBytes();
+
+    m_Host->update();
+
+    scope.addBytes(m_Host->getTransferredBytes() - transferred);
+}
+
+bool RemotePluginTool::hasPendingWork() const { return m_Host->isBusy(); }
@@ -6,14 +6,20 @@
  * @copyright Copyright (c) 2021
  */
 
+#include <algorithm>
 #include "paint/plugin/texture_impl.h"
+#include "paint/plugin/plugin_profiler.h"
 
 using namespace plugin;
 
-TextureImpl::TextureImpl(Sml::Texture* texture) { assert(texture); m_Texture = texture; }
+TextureImpl::TextureImpl(Sml::Texture* texture, Paint::Layer* layer) : m_Texture(texture), m_Layer(layer)
+{
+    assert(texture);
+}
 
 TextureImpl::~TextureImpl()
 {
+    flush();
     // delete m_Texture; FIXME: WTF?
 }
 
@@ -23,92 +29,368 @@ int32_t TextureImpl::GetSizeY() { return m_Texture->getHeight(); }
 Buffer TextureImpl::ReadBuffer()
 {
     assert(m_Texture);
-    return {m_Texture->readPixels(nullptr), this};
+
+    Paint::PluginProfiler::Scope scope(Paint::PluginCall::READ_BUFFER, getBufferSize());
+
+    flush();
+
+    /* A copy, plugins may modify it and release it without loading, see LockBuffer() for direct access */
+    size_t      count  = static_cast<size_t>(GetSizeX()) * GetSizeY();
+    Sml::Color* pixels = lockPixels(getBounds());
+    Sml::Color* copy   = new Sml::Color[count];
+
+    std::copy(pixels, pixels + count, copy);
+    unlockPixels(getBounds(), false);
+
+    return {copy, this};
 }
 
 void TextureImpl::ReleaseBuffer(Buffer buffer)
 {
-    delete buffer.pixels;
+    assert(this == buffer.texture);
+    delete[] buffer.pixels;
 }
 
 void TextureImpl::LoadBuffer(Buffer buffer)
 {
     assert(this == buffer.texture);
-    m_Texture->updatePixels(buffer.pixels);
+
+    Paint::PluginProfiler::Scope scope(Paint::PluginCall::LOAD_BUFFER, getBufferSize());
+
+    /* Everything recorded so far would be overwritten anyway */
+    m_Commands.clear();
+
+    if (m_Layer != nullptr)
+    {
+        m_Layer->loadPixels(buffer.pixels);
+    }
+    else
+    {
+        getPixelBuffer().load(buffer.pixels);
+    }
 }
 
 void TextureImpl::Clear(color_t color)
 {
-    Sml::Renderer& renderer = Sml::Renderer::getInstance();
-    renderer.pushSetTarget(m_Texture);
+    Paint::PluginProfiler::Scope scope(Paint::PluginCall::DRAW);
 
-    renderer.setColor(color);
-    renderer.clear();
+    m_Commands.clear();
 
-    renderer.popTarget();
+    DrawCommand command;
+    command.type       = DrawCommand::Type::CLEAR;
+    command.clearColor = color;
+    m_Commands.push_back(command);
 }
 
-void TextureImpl::Present() {}
+void TextureImpl::Present() { flush(); }
 
 void TextureImpl::DrawLine(const Line& line)
 {
-    Sml::Renderer& renderer = Sml::Renderer::getInstance();
-    renderer.pushSetTarget(m_Texture);
+    Paint::PluginProfiler::Scope scope(Paint::PluginCall::DRAW);
 
-    renderer.setColor(line.color);
-    Sml::renderLine({line.x0, line.y0}, {line.x1, line.y1}, line.thickness);
-
-    renderer.popTarget();
+    DrawCommand command;
+    command.type = DrawCommand::Type::LINE;
+    command.line = line;
+    m_Commands.push_back(command);
 }
 
 void TextureImpl::DrawCircle(const Circle& circle)
 {
-    Sml::Renderer& renderer = Sml::Renderer::getInstance();
-    renderer.pushSetTarget(m_Texture);
+    Paint::PluginProfiler::Scope scope(Paint::PluginCall::DRAW);
 
-    renderer.setColor(circle.fill_color);
-    Sml::renderFilledCircle({{circle.x, circle.y}, circle.radius});
-
-    renderer.setColor(circle.outline_color);
-    for (int32_t i = 0; i < circle.outline_thickness; ++i)
-    {
-        Sml::renderCircle({{circle.x, circle.y}, circle.radius - i});
-    }
-
-    renderer.popTarget();
+    DrawCommand command;
+    command.type   = DrawCommand::Type::CIRCLE;
+    command.circle = circle;
+    m_Commands.push_back(command);
 }
 
 void TextureImpl::DrawRect(const Rect& rect)
 {
-    Sml::Renderer& renderer = Sml::Renderer::getInstance();
-    renderer.pushSetTarget(m_Texture);
-
-    renderer.setColor(rect.fill_color);
-    Sml::renderFilledRect({rect.x, rect.y, rect.size_x, rect.size_y});
+    Paint::PluginProfiler::Scope scope(Paint::PluginCall::DRAW);
 
-    renderer.setColor(rect.outline_color);
-    Sml::renderRect({rect.x, rect.y, rect.size_x, rect.size_y}, static_cast<uint8_t>(rect.outline_thickness));
-
-    renderer.popTarget();
+    DrawCommand command;
+    command.type = DrawCommand::Type::RECT;
+    command.rect = rect;
+    m_Commands.push_back(command);
 }
 
 void TextureImpl::CopyTexture(ITexture* source, int32_t x, int32_t y, int32_t size_x, int32_t size_y)
 {
+    Paint::PluginProfiler::Scope scope(Paint::PluginCall::COPY_TEXTURE,
+                                       static_cast<uint64_t>(size_x) * size_y * sizeof(Sml::Color));
+
     TextureImpl* sourceTexture = dynamic_cast<TextureImpl*>(source);
 
+    flush();
+    sourceTexture->flush();
+
     Sml::Rectangle<int32_t> dstRect = {x, y, size_x, size_y};
+    if (m_Layer != nullptr)
+    {
+        m_Layer->ensureLoaded(dstRect);
+    }
+
     sourceTexture->m_Texture->copyTo(m_Texture, &dstRect, nullptr);
+
+    markDirty(dstRect);
 }
 
 void TextureImpl::CopyTexture(ITexture* source, int32_t x, int32_t y)
 {
+    Paint::PluginProfiler::Scope scope(Paint::PluginCall::COPY_TEXTURE,
+                                       static_cast<uint64_t>(source->GetSizeX()) * source->GetSizeY() * sizeof(Sml::Color));
+
     TextureImpl* sourceTexture = dynamic_cast<TextureImpl*>(source);
 
+    flush();
+    sourceTexture->flush();
+
     Sml::Rectangle<int32_t> dstRect = {x, y, sourceTexture->GetSizeX(), sourceTexture->GetSizeY()};
+    if (m_Layer != nullptr)
+    {
+        m_Layer->ensureLoaded(dstRect);
+    }
+
     sourceTexture->m_Texture->copyTo(m_Texture, &dstRect, nullptr);
+
+    markDirty(dstRect);
 }
 
-const Sml::Texture* TextureImpl::GetTexture() const { return m_Texture; }
+uint32_t TextureImpl::GetExtVersion() { return kTextureExtVersion; }
+
+BufferRegion TextureImpl::LockBuffer(int32_t x, int32_t y, int32_t size_x, int32_t size_y)
+{
+    Paint::PluginProfiler::Scope scope(Paint::PluginCall::LOCK_BUFFER);
+
+    flush();
+
+    Sml::Rectangle<int32_t> rect = Paint::intersectRects({x, y, size_x, size_y}, getBounds());
+    scope.addBytes(static_cast<uint64_t>(rect.width) * rect.height * sizeof(Sml::Color));
+    Sml::Color*             base = lockPixels(rect);
+
+    return {base, rect.width, rect.pos.x, rect.pos.y, rect.width, rect.height};
+}
+
+void TextureImpl::UnlockBuffer(const BufferRegion& region, bool modified)
+{
+    Paint::PluginProfiler::Scope scope(Paint::PluginCall::UNLOCK_BUFFER,
+                                       modified ? static_cast<uint64_t>(region.size_x) * region.size_y * sizeof(Sml::Color) : 0);
+
+    unlockPixels({region.x, region.y, region.size_x, region.size_y}, modified);
+}
+
+const Sml::Texture* TextureImpl::GetTexture() const
+{
+    flush();
+    return m_Texture;
+}
+
+void TextureImpl::flush() const
+{
+    if (m_Commands.empty())
+    {
+        return;
+    }
+
+    Paint::PluginProfiler::Scope scope(Paint::PluginCall::FLUSH);
+
+    /* Only the tiles the commands draw on are loaded */
+    if (m_Layer != nullptr)
+    {
+        for (const auto& command : m_Commands)
+        {
+            m_Layer->ensureLoaded(getCommandBounds(command));
+        }
+    }
+
+    Sml::Renderer& renderer = Sml::Renderer::getInstance();
+    renderer.pushSetTarget(m_Texture);
+
+    Paint::DirtyRegion dirtyRegion;
+    color_t            currentColor = 0;
+    bool               hasColor     = false;
+
+    /* Consecutive primitives of the same color are drawn without touching the renderer state */
+    auto setColor = [&](color_t color)
+    {
+        if (!hasColor || color != currentColor)
+        {
+            renderer.setColor(color);
+            currentColor = color;
+            hasColor     = true;
+        }
+    };
+
+    for (const auto& command : m_Commands)
+    {
+        switch (command.type)
+        {
+            case DrawCommand::Type::CLEAR:
+            {
+                setColor(command.clearColor);
+                renderer.clear();
+                break;
+            }
+
+            case DrawCommand::Type::LINE:
+            {
+                const Line& line = command.line;
+
+                setColor(line.color);
+                Sml::renderLine({line.x0, line.y0}, {line.x1, line.y1}, line.thickness);
+                break;
+            }
+
+            case DrawCommand::Type::CIRCLE:
+            {
+                const Circle& circle = command.circle;
+
+                /* With both colors opaque the outline is a disc under the fill rather than a ring per
+                   pixel. The rings blend a translucent outline over the fill, not over the layer, and
+                   an outline reaching the center would leave the fill no radius */
+                if (circle.outline_thickness > 0 && circle.outline_thickness < circle.radius &&
+                    Sml::colorGetA(circle.fill_color) == 0xFF && Sml::colorGetA(circle.outline_color) == 0xFF)
+                {
+                    setColor(circle.outline_color);
+                    Sml::renderFilledCircle({{circle.x, circle.y}, circle.radius});
+
+                    setColor(circle.fill_color);
+                    Sml::renderFilledCircle({{circle.x, circle.y}, circle.radius - circle.outline_thickness});
+                }
+                else
+                {
+                    setColor(circle.fill_color);
+                    Sml::renderFilledCircle({{circle.x, circle.y}, circle.radius});
+
+                    setColor(circle.outline_color);
+                    for (int32_t i = 0; i < circle.outline_thickness; ++i)
+                    {
+                        Sml::renderCircle({{circle.x, circle.y}, circle.radius - i});
+                    }
+                }
+                break;
+            }
+
+            case DrawCommand::Type::RECT:
+            {
+                const Rect& rect = command.rect;
+
+                setColor(rect.fill_color);
+                Sml::renderFilledRect({rect.x, rect.y, rect.size_x, rect.size_y});
+
+                setColor(rect.outline_color);
+                Sml::renderRect({rect.x, rect.y, rect.size_x, rect.size_y}, static_cast<uint8_t>(rect.outline_thickness));
+                break;
+            }
+        }
+
+        dirtyRegion.add(getCommandBounds(command));
+    }
+
+    renderer.popTarget();
+    m_Commands.clear();
+
+    /* Reported once per flush, the region merges overlapping primitives */
+    for (const auto& rect : dirtyRegion.getRects())
+    {
+        markDirty(rect);
+    }
+}
+
+Sml::Rectangle<int32_t> TextureImpl::getCommandBounds(const DrawCommand& command) const
+{
+    switch (command.type)
+    {
+        case DrawCommand::Type::LINE:
+        {
+            const Line& line = command.line;
+            return Paint::computeLineBounds({line.x0, line.y0}, {line.x1, line.y1}, line.thickness);
+        }
+
+        case DrawCommand::Type::CIRCLE:
+        {
+            const Circle& circle = command.circle;
+            return {circle.x - circle.radius - 1, circle.y - circle.radius - 1, 2 * circle.radius + 3, 2 * circle.radius + 3};
+        }
+
+        case DrawCommand::Type::RECT:
+        {
+            const Rect& rect = command.rect;
+            return {rect.x - rect.outline_thickness, rect.y - rect.outline_thickness,
+                    rect.size_x + 2 * rect.outline_thickness + 1, rect.size_y + 2 * rect.outline_thickness + 1};
+        }
+
+        case DrawCommand::Type::CLEAR:
+        {
+            break;
+        }
+    }
+
+    return getBounds();
+}
+
+void TextureImpl::markDirty(const Sml::Rectangle<int32_t>& rect) const
+{
+    if (m_Layer != nullptr)
+    {
+        m_Layer->markDirty(rect);
+    }
+}
+
+void TextureImpl::markDirty() const
+{
+    markDirty(getBounds());
+}
+
+Sml::Color* TextureImpl::lockPixels(const Sml::Rectangle<int32_t>& rect)
+{
+    return m_Layer != nullptr ? m_Layer->lockPixels(rect) : getPixelBuffer().lock(rect);
+}
+
+void TextureImpl::unlockPixels(const Sml::Rectangle<int32_t>& rect, bool modified)
+{
+    if (m_Layer != nullptr)
+    {
+        m_Layer->unlockPixels(rect, modified);
+    }
+    else
+    {
+        getPixelBuffer().unlock(rect, modified);
+    }
+}
+
+Paint::PixelBuffer& TextureImpl::getPixelBuffer()
+{
+    if (m_PixelBuffer == nullptr)
+    {
+        m_PixelBuffer = std::make_unique<Paint::PixelBuffer>(m_Texture);
+    }
+
+    return *m_PixelBuffer;
+}
+
+Sml::Rectangle<int32_t> TextureImpl::getBounds() const
+{
+    return {0, 0, static_cast<int32_t>(m_Texture->getWidth()), static_cast<int32_t>(m_Texture->getHeight())};
+}
+
+uint64_t TextureImpl::getBufferSize() const
+{
+    return static_cast<uint64_t>(m_Texture->getWidth()) * m_Texture->getHeight() * sizeof(Sml::Color);
+}
+
+ITextureExt* plugin::GetTextureExt(ITexture* texture, uint32_t version)
+{
+    /* Not only TextureImpl, textures of the plugin host support the extension too */
+    ITextureExt* ext = dynamic_cast<ITextureExt*>(texture);
+
+    if (ext == nullptr || version == 0 || version > ext->GetExtVersion())
+    {
+        return nullptr;
+    }
+
+    return ext;
+}
 
 ITexture* TextureFactoryImpl::CreateTexture(const char* filename)
 {
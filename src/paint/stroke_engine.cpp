@@ -0,0 +1,312 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file stroke_engine.cpp
+ * @date 2021-12-24
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include "paint/stroke_engine.h"
+
+using namespace Paint;
+
+//------------------------------------------------------------------------------
+// BrushTip
+//------------------------------------------------------------------------------
+BrushTip::BrushTip(int32_t diameter, float hardness)
+    : m_Diameter(std::max(diameter, 1)),
+      m_Hardness(std::min(std::max(hardness, 0.0f), 1.0f)),
+      m_Mask(static_cast<size_t>(m_Diameter) * m_Diameter)
+{
+    float radius = m_Diameter / 2.0f;
+
+    for (int32_t y = 0; y < m_Diameter; ++y)
+    {
+        for (int32_t x = 0; x < m_Diameter; ++x)
+        {
+            float dx       = x + 0.5f - radius;
+            float dy       = y + 0.5f - radius;
+            float distance = std::sqrt(dx * dx + dy * dy) / radius;
+            float coverage = 0;
+
+            if (distance <= m_Hardness)
+            {
+                coverage = 1;
+            }
+            else if (distance < 1)
+            {
+                float t  = (distance - m_Hardness) / (1 - m_Hardness);
+                coverage = 1 - t * t * (3 - 2 * t);
+            }
+
+            m_Mask[y * m_Diameter + x] = static_cast<uint8_t>(std::lround(coverage * 255));
+        }
+    }
+}
+
+int32_t BrushTip::getDiameter() const { return m_Diameter; }
+float BrushTip::getHardness() const { return m_Hardness; }
+const uint8_t* BrushTip::getMask() const { return m_Mask.data(); }
+
+//------------------------------------------------------------------------------
+// StrokeEngine
+//------------------------------------------------------------------------------
+void StrokeEngine::begin(Layer* layer, const StrokeSettings& settings)
+{
+    assert(layer);
+    assert(!isActive());
+
+    m_Layer    = layer;
+    m_Settings = settings;
+
+    /* The tip is only rebuilt when its shape changes */
+    if (m_Tip.getDiameter() != settings.diameter || m_Tip.getHardness() != settings.hardness)
+    {
+        m_Tip = BrushTip(settings.diameter, settings.hardness);
+    }
+
+    uint32_t opacity = static_cast<uint32_t>(std::lround(std::min(std::max(settings.opacity, 0.0f), 1.0f) * 255));
+    size_t   maskSize = static_cast<size_t>(m_Tip.getDiameter()) * m_Tip.getDiameter();
+
+    m_DabMask.resize(maskSize);
+    for (size_t i = 0; i < maskSize; ++i)
+    {
+        m_DabMask[i] = static_cast<uint8_t>((m_Tip.getMask()[i] * opacity + 127) / 255);
+    }
+
+    m_Original = layer->lazySnapshot();
+    m_Width    = static_cast<int32_t>(layer->getWidth());
+    m_Height   = static_cast<int32_t>(layer->getHeight());
+
+    if (m_Coverage.size() != static_cast<size_t>(m_Width) * m_Height)
+    {
+        m_Coverage.assign(static_cast<size_t>(m_Width) * m_Height, 0);
+    }
+
+    m_StrokeBounds  = Sml::Rectangle<int32_t>(0, 0, 0, 0);
+    m_PendingRegion.clear();
+    m_PointCount    = 0;
+    m_DabCount      = 0;
+}
+
+void StrokeEngine::addPoint(const Sml::Vec2i& pos)
+{
+    assert(isActive());
+
+    Point point = {static_cast<float>(pos.x), static_cast<float>(pos.y)};
+
+    if (m_PointCount == 0)
+    {
+        /* The first segment starts at the first point, so it serves as its own predecessor */
+        m_Points[0]  = point;
+        m_Points[1]  = point;
+        m_PointCount = 2;
+
+        m_LastSample    = point;
+        m_DistanceToDab = std::max(m_Tip.getDiameter() * m_Settings.spacing, 1.0f);
+        placeDab(point);
+
+        return;
+    }
+
+    const Point& last = m_Points[m_PointCount - 1];
+    if (last.x == point.x && last.y == point.y)
+    {
+        return;
+    }
+
+    m_Points[m_PointCount++] = point;
+
+    /* A segment is only drawn once the point after it is known, hence one event of latency */
+    if (m_PointCount == 4)
+    {
+        processSegment(m_Points[0], m_Points[1], m_Points[2], m_Points[3]);
+
+        m_Points[0]  = m_Points[1];
+        m_Points[1]  = m_Points[2];
+        m_Points[2]  = m_Points[3];
+        m_PointCount = 3;
+    }
+}
+
+void StrokeEngine::end()
+{
+    if (!isActive())
+    {
+        return;
+    }
+
+    if (m_PointCount == 3)
+    {
+        processSegment(m_Points[0], m_Points[1], m_Points[2], m_Points[2]);
+    }
+
+    composite();
+
+    /* Only the part of the coverage buffer the stroke touched has to be cleared */
+    for (int32_t y = 0; y < m_StrokeBounds.height; ++y)
+    {
+        std::memset(m_Coverage.data() + (m_StrokeBounds.pos.y + y) * m_Width + m_StrokeBounds.pos.x, 0,
+                    m_StrokeBounds.width);
+    }
+
+    m_Layer      = nullptr;
+    m_Original   = LazySnapshot();
+    m_PointCount = 0;
+}
+
+bool StrokeEngine::isActive() const { return m_Layer != nullptr; }
+
+void StrokeEngine::composite()
+{
+    if (!isActive() || m_PendingRegion.isEmpty())
+    {
+        return;
+    }
+
+    for (const auto& rect : m_PendingRegion.getRects())
+    {
+        compositeRect(rect);
+    }
+
+    m_PendingRegion.clear();
+}
+
+size_t StrokeEngine::getDabCount() const { return m_DabCount; }
+
+void StrokeEngine::processSegment(const Point& p0, const Point& p1, const Point& p2, const Point& p3)
+{
+    /* Uniform Catmull-Rom between p1 and p2, flattened into pieces of about two pixels */
+    float chord = std::hypot(p2.x - p1.x, p2.y - p1.y);
+    int32_t steps = std::max(static_cast<int32_t>(std::ceil(chord / 2)), 1);
+
+    for (int32_t i = 1; i <= steps; ++i)
+    {
+        float t  = static_cast<float>(i) / steps;
+        float t2 = t * t;
+        float t3 = t2 * t;
+
+        Point point;
+        point.x = 0.5f * (2 * p1.x + (p2.x - p0.x) * t + (2 * p0.x - 5 * p1.x + 4 * p2.x - p3.x) * t2 +
+                          (3 * p1.x - p0.x - 3 * p2.x + p3.x) * t3);
+        point.y = 0.5f * (2 * p1.y + (p2.y - p0.y) * t + (2 * p0.y - 5 * p1.y + 4 * p2.y - p3.y) * t2 +
+                          (3 * p1.y - p0.y - 3 * p2.y + p3.y) * t3);
+
+        walkTo(point);
+    }
+}
+
+void StrokeEngine::walkTo(const Point& point)
+{
+    float dx     = point.x - m_LastSample.x;
+    float dy     = point.y - m_LastSample.y;
+    float length = std::hypot(dx, dy);
+
+    float spacing  = std::max(m_Tip.getDiameter() * m_Settings.spacing, 1.0f);
+    float traveled = 0;
+
+    while (length - traveled >= m_DistanceToDab)
+    {
+        traveled += m_DistanceToDab;
+        placeDab({m_LastSample.x + dx * traveled / length, m_LastSample.y + dy * traveled / length});
+
+        m_DistanceToDab = spacing;
+    }
+
+    m_DistanceToDab -= length - traveled;
+    m_LastSample     = point;
+}
+
+void StrokeEngine::placeDab(const Point& center)
+{
+    int32_t diameter = m_Tip.getDiameter();
+
+    Sml::Rectangle<int32_t> dab(static_cast<int32_t>(std::lround(center.x - diameter / 2.0f)),
+                                static_cast<int32_t>(std::lround(center.y - diameter / 2.0f)),
+                                diameter, diameter);
+
+    Sml::Rectangle<int32_t> clipped = intersectRects(dab, Sml::Rectangle<int32_t>(0, 0, m_Width, m_Height));
+    if (isRectEmpty(clipped))
+    {
+        return;
+    }
+
+    for (int32_t y = 0; y < clipped.height; ++y)
+    {
+        const uint8_t* mask     = m_DabMask.data() + (clipped.pos.y - dab.pos.y + y) * diameter + (clipped.pos.x - dab.pos.x);
+        uint8_t*       coverage = m_Coverage.data() + (clipped.pos.y + y) * m_Width + clipped.pos.x;
+
+        for (int32_t x = 0; x < clipped.width; ++x)
+        {
+            coverage[x] = std::max(coverage[x], mask[x]);
+        }
+    }
+
+    m_PendingRegion.add(clipped);
+    m_StrokeBounds = uniteRects(m_StrokeBounds, clipped);
+    ++m_DabCount;
+}
+
+void StrokeEngine::compositeRect(const Sml::Rectangle<int32_t>& rect)
+{
+    /* Only the tiles the stroke reaches are loaded */
+    m_Layer->ensureLoaded(rect);
+
+    std::vector<Sml::Color> pixels(static_cast<size_t>(rect.width) * rect.height);
+    m_Original.read(rect).readPixels(rect, pixels.data());
+
+    uint32_t colorR = Sml::colorGetR(m_Settings.color);
+    uint32_t colorG = Sml::colorGetG(m_Settings.color);
+    uint32_t colorB = Sml::colorGetB(m_Settings.color);
+    uint32_t colorA = Sml::colorGetA(m_Settings.color);
+
+    for (int32_t y = 0; y < rect.height; ++y)
+    {
+        const uint8_t* coverage = m_Coverage.data() + (rect.pos.y + y) * m_Width + rect.pos.x;
+        Sml::Color*    row      = pixels.data() + y * rect.width;
+
+        for (int32_t x = 0; x < rect.width; ++x)
+        {
+            if (coverage[x] == 0)
+            {
+                continue;
+            }
+
+            uint32_t dstR = Sml::colorGetR(row[x]);
+            uint32_t dstG = Sml::colorGetG(row[x]);
+            uint32_t dstB = Sml::colorGetB(row[x]);
+            uint32_t dstA = Sml::colorGetA(row[x]);
+
+            if (m_Settings.erase)
+            {
+                dstA = dstA * (255 - coverage[x]) / 255;
+                row[x] = Sml::rgbaColor(dstR, dstG, dstB, dstA);
+                continue;
+            }
+
+            /* Non-premultiplied source-over */
+            uint32_t srcA = colorA * coverage[x] / 255;
+            uint32_t outA = srcA + dstA * (255 - srcA) / 255;
+
+            if (outA == 0)
+            {
+                row[x] = Sml::COLOR_TRANSPARENT;
+                continue;
+            }
+
+            uint32_t dstWeight = dstA * (255 - srcA) / 255;
+
+            row[x] = Sml::rgbaColor((colorR * srcA + dstR * dstWeight) / outA,
+                                    (colorG * srcA + dstG * dstWeight) / outA,
+                                    (colorB * srcA + dstB * dstWeight) / outA,
+                                    outA);
+        }
+    }
+
+    m_Layer->getTexture()->updatePixels(pixels.data(), &rect);
+    m_Layer->markDirty(rect);
+}
@@ -0,0 +1,168 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file thread_pool.cpp
+ * @date 2021-12-22
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <algorithm>
+#include <cassert>
+#include "paint/thread_pool.h"
+
+using namespace Paint;
+
+ThreadPool& ThreadPool::getInstance()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    for (size_t i = 0; i < threadCount; ++i)
+    {
+        m_Queues.push_back(std::make_unique<WorkQueue>());
+    }
+
+    for (size_t i = 0; i < threadCount; ++i)
+    {
+        m_Threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_WakeMutex);
+        m_Stopping = true;
+    }
+
+    m_Wake.notify_all();
+
+    for (auto& thread : m_Threads)
+    {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::getThreadCount() const { return m_Threads.size(); }
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& body)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    if (count == 1 || m_Threads.empty())
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            body(i);
+        }
+
+        return;
+    }
+
+    TaskGroup group;
+    group.remaining = count;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        WorkQueue& queue = *m_Queues[i % m_Queues.size()];
+
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back({&body, i, &group});
+        ++m_QueuedTasks;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_WakeMutex);
+    }
+
+    m_Wake.notify_all();
+
+    while (tryRunTask(0)) {}
+
+    /* Taking the mutex also guarantees that the last task is done touching the group */
+    std::unique_lock<std::mutex> lock(group.mutex);
+    group.finished.wait(lock, [&group] { return group.remaining == 0; });
+}
+
+void ThreadPool::workerLoop(size_t queueIndex)
+{
+    while (true)
+    {
+        if (tryRunTask(queueIndex))
+        {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_WakeMutex);
+        m_Wake.wait(lock, [this] { return m_Stopping || m_QueuedTasks > 0; });
+
+        if (m_Stopping && m_QueuedTasks == 0)
+        {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::tryRunTask(size_t queueIndex)
+{
+    Task task;
+    bool found = false;
+
+    for (size_t offset = 0; offset < m_Queues.size() && !found; ++offset)
+    {
+        WorkQueue& queue = *m_Queues[(queueIndex + offset) % m_Queues.size()];
+
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+        {
+            continue;
+        }
+
+        /* Own tasks are taken LIFO while still hot in cache, stolen ones FIFO */
+        if (offset == 0)
+        {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+
+        --m_QueuedTasks;
+        found = true;
+    }
+
+    if (found)
+    {
+        runTask(task);
+    }
+
+    return found;
+}
+
+void ThreadPool::runTask(const Task& task)
+{
+    assert(task.body);
+    assert(task.group);
+
+    (*task.body)(task.index);
+
+    std::lock_guard<std::mutex> lock(task.group->mutex);
+    if (--task.group->remaining == 0)
+    {
+        task.group->finished.notify_all();
+    }
+}
@@ -0,0 +1,200 @@
+/**
+ * @author Nikita Mochalov (github.com/tralf-strues)
+ * @file tiled_image.cpp
+ * @date 2021-12-20
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#include <cstring>
+#include <algorithm>
+#include "paint/tiled_image.h"
+#include "paint/dirty_region.h"
+
+using namespace Paint;
+
+TiledImage::TiledImage(size_t width, size_t height)
+    : m_Width(width),
+      m_Height(height),
+      m_TilesX((width  + Tile::SIZE - 1) / Tile::SIZE),
+      m_TilesY((height + Tile::SIZE - 1) / Tile::SIZE),
+      m_Tiles(m_TilesX * m_TilesY) {}
+
+size_t TiledImage::getWidth() const     { return m_Width;          }
+size_t TiledImage::getHeight() const    { return m_Height;         }
+size_t TiledImage::getTilesX() const    { return m_TilesX;         }
+size_t TiledImage::getTilesY() const    { return m_TilesY;         }
+size_t TiledImage::getTileCount() const { return m_Tiles.size();   }
+
+size_t TiledImage::getTileIndex(size_t column, size_t row) const
+{
+    assert(column < m_TilesX);
+    assert(row    < m_TilesY);
+
+    return row * m_TilesX + column;
+}
+
+Sml::Rectangle<int32_t> TiledImage::getTileRect(size_t index) const
+{
+    assert(index < m_Tiles.size());
+
+    int32_t x = static_cast<int32_t>(index % m_TilesX) * Tile::SIZE;
+    int32_t y = static_cast<int32_t>(index / m_TilesX) * Tile::SIZE;
+
+    return Sml::Rectangle<int32_t>(x, y,
+                                   std::min(Tile::SIZE, static_cast<int32_t>(m_Width)  - x),
+                                   std::min(Tile::SIZE, static_cast<int32_t>(m_Height) - y));
+}
+
+void TiledImage::getTileRange(const Sml::Rectangle<int32_t>& rect,
+                              size_t* firstColumn, size_t* firstRow, size_t* endColumn, size_t* endRow) const
+{
+    assert(firstColumn);
+    assert(firstRow);
+    assert(endColumn);
+    assert(endRow);
+
+    Sml::Rectangle<int32_t> clipped = intersectRects(rect, Sml::Rectangle<int32_t>(0, 0,
+                                                                                   static_cast<int32_t>(m_Width),
+                                                                                   static_cast<int32_t>(m_Height)));
+    if (isRectEmpty(clipped))
+    {
+        *firstColumn = *endColumn = 0;
+        *firstRow    = *endRow    = 0;
+        return;
+    }
+
+    *firstColumn = static_cast<size_t>(clipped.pos.x / Tile::SIZE);
+    *firstRow    = static_cast<size_t>(clipped.pos.y / Tile::SIZE);
+    *endColumn   = static_cast<size_t>((clipped.pos.x + clipped.width  - 1) / Tile::SIZE) + 1;
+    *endRow      = static_cast<size_t>((clipped.pos.y + clipped.height - 1) / Tile::SIZE) + 1;
+}
+
+const TilePtr& TiledImage::getTile(size_t index) const
+{
+    assert(index < m_Tiles.size());
+    return m_Tiles[index];
+}
+
+void TiledImage::setTile(size_t index, const TilePtr& tile)
+{
+    assert(index < m_Tiles.size());
+    m_Tiles[index] = tile;
+}
+
+void TiledImage::readPixels(const Sml::Rectangle<int32_t>& rect, Sml::Color* pixels) const
+{
+    assert(pixels);
+
+    size_t firstColumn, firstRow, endColumn, endRow;
+    getTileRange(rect, &firstColumn, &firstRow, &endColumn, &endRow);
+
+    /* Pixels outside of the image are transparent */
+    Sml::Rectangle<int32_t> clipped = intersectRects(rect, Sml::Rectangle<int32_t>(0, 0,
+                                                                                   static_cast<int32_t>(m_Width),
+                                                                                   static_cast<int32_t>(m_Height)));
+    if (clipped.width != rect.width || clipped.height != rect.height)
+    {
+        std::fill(pixels, pixels + rect.width * rect.height, Sml::COLOR_TRANSPARENT);
+    }
+
+    for (size_t row = firstRow; row < endRow; ++row)
+    {
+        for (size_t column = firstColumn; column < endColumn; ++column)
+        {
+            size_t                  index   = getTileIndex(column, row);
+            Sml::Rectangle<int32_t> overlap = intersectRects(rect, getTileRect(index));
+            const Tile*             tile    = m_Tiles[index].get();
+
+            int32_t tileX = overlap.pos.x % Tile::SIZE;
+            int32_t tileY = overlap.pos.y % Tile::SIZE;
+
+            for (int32_t y = 0; y < overlap.height; ++y)
+            {
+                Sml::Color* dst = pixels + (overlap.pos.y - rect.pos.y + y) * rect.width + (overlap.pos.x - rect.pos.x);
+
+                if (tile == nullptr)
+                {
+                    std::fill(dst, dst + overlap.width, Sml::COLOR_TRANSPARENT);
+                }
+                else
+                {
+                    std::memcpy(dst, tile->pixels + (tileY + y) * Tile::SIZE + tileX, overlap.width * sizeof(Sml::Color));
+                }
+            }
+        }
+    }
+}
+
+void TiledImage::writePixels(const Sml::Rectangle<int32_t>& rect, const Sml::Color* pixels)
+{
+    assert(pixels);
+
+    size_t firstColumn, firstRow, endColumn, endRow;
+    getTileRange(rect, &firstColumn, &firstRow, &endColumn, &endRow);
+
+    for (size_t row = firstRow; row < endRow; ++row)
+    {
+        for (size_t column = firstColumn; column < endColumn; ++column)
+        {
+            size_t                  index   = getTileIndex(column, row);
+            Sml::Rectangle<int32_t> overlap = intersectRects(rect, getTileRect(index));
+            bool                    whole   = overlap.width == Tile::SIZE && overlap.height == Tile::SIZE;
+            Tile*                   tile    = detachTile(index, !whole);
+
+            int32_t tileX = overlap.pos.x % Tile::SIZE;
+            int32_t tileY = overlap.pos.y % Tile::SIZE;
+
+            for (int32_t y = 0; y < overlap.height; ++y)
+            {
+                const Sml::Color* src = pixels + (overlap.pos.y - rect.pos.y + y) * rect.width + (overlap.pos.x - rect.pos.x);
+                std::memcpy(tile->pixels + (tileY + y) * Tile::SIZE + tileX, src, overlap.width * sizeof(Sml::Color));
+            }
+        }
+    }
+}
+
+size_t TiledImage::getAllocatedTileCount() const
+{
+    return static_cast<size_t>(std::count_if(m_Tiles.begin(), m_Tiles.end(),
+                                             [](const TilePtr& tile) { return tile != nullptr; }));
+}
+
+size_t TiledImage::getMemoryUsage() const
+{
+    return getAllocatedTileCount() * sizeof(Tile) + m_Tiles.size() * sizeof(TilePtr);
+}
+
+bool TiledImage::isTileTransparent(const Tile& tile)
+{
+    for (int32_t i = 0; i < Tile::SIZE * Tile::SIZE; ++i)
+    {
+        if (Sml::colorGetA(tile.pixels[i]) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+Tile* TiledImage::detachTile(size_t index, bool preserveContents)
+{
+    TilePtr& tile = m_Tiles[index];
+
+    if (tile == nullptr || (tile.use_count() > 1 && !preserveContents))
+    {
+        tile = std::make_shared<Tile>();
+
+        if (preserveContents)
+        {
+            std::fill(tile->pixels, tile->pixels + Tile::SIZE * Tile::SIZE, Sml::COLOR_TRANSPARENT);
+        }
+    }
+    else if (tile.use_count() > 1)
+    {
+        tile = std::make_shared<Tile>(*tile);
+    }
+
+    return tile.get();
+}